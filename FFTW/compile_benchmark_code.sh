@@ -5,6 +5,50 @@ FFTW_LIB=$1
 # For linking to FFTW3 libraries + ImageMagick
 export LD_LIBRARY_PATH=${FFTW_LIB}/double/.libs:${FFTW_LIB}/double/threads/.libs:/usr/local/lib
 
+# FFTW configure flags (set in the Dockerfiles). These are compiled into the benchmarks to key the wisdom files
+FFTW_BUILD_FLAGS_DEFINE="-DFFTW_BUILD_FLAGS=\"${FFTW_BUILD_FLAGS:-unknown}\""
+
+# Commit the benchmarks are built from, recorded with every result
+GIT_SHA_DEFINE="-DGIT_SHA=\"$(git -C "$(dirname "${BASH_SOURCE[0]}")" rev-parse --short=12 HEAD 2>/dev/null || echo unknown)\""
+
+# FFTW 3.3.9 and later let the benchmarks run FFTW's parallel loops on their own thread backend (src/thread_backend.c)
+THREADS_CALLBACK_DEFINE=""
+if grep -q "threads_set_callback" "${FFTW_LIB}/api/fftw3.h" 2>/dev/null; then
+    THREADS_CALLBACK_DEFINE="-DHAVE_FFTW_THREADS_CALLBACK"
+fi
+
+# Precision variants of the blur and cosine engines (src/precision_engine.c), built for every other precision FFTW
+# was built in: ${FFTW_LIB}/single (fftwf_), ${FFTW_LIB}/long or long-double (fftwl_) and ${FFTW_LIB}/quad (fftwq_)
+PRECISION_SOURCES=""
+PRECISION_LIBS=""
+add_precision() {
+    local dir=$1 source=$2 define=$3 libs=$4
+    if [ -d "${FFTW_LIB}/${dir}/.libs" ]; then
+        PRECISION_SOURCES="${PRECISION_SOURCES} src/${source} -D${define}"
+        PRECISION_LIBS="${PRECISION_LIBS} -L${FFTW_LIB}/${dir}/.libs -L${FFTW_LIB}/${dir}/threads/.libs ${libs}"
+        export LD_LIBRARY_PATH=${LD_LIBRARY_PATH}:${FFTW_LIB}/${dir}/.libs:${FFTW_LIB}/${dir}/threads/.libs
+    fi
+}
+add_precision single precision_single.c HAVE_FFTW_SINGLE "-lfftw3f -lfftw3f_threads"
+if [ -d "${FFTW_LIB}/long/.libs" ]; then
+    add_precision long precision_long_double.c HAVE_FFTW_LONG_DOUBLE "-lfftw3l -lfftw3l_threads"
+else
+    add_precision long-double precision_long_double.c HAVE_FFTW_LONG_DOUBLE "-lfftw3l -lfftw3l_threads"
+fi
+add_precision quad precision_quad.c HAVE_FFTW_QUAD "-lfftw3q -lfftw3q_threads -lquadmath"
+
+# Distributed-memory mode of nd_cosine_ffts (--mpi, src/mpi_cosine.c): built with mpicc when FFTW was configured with
+# --enable-mpi (${FFTW_LIB}/mpi/.libs), otherwise --mpi reports that it isn't available
+ND_CC=gcc
+MPI_DEFINE=""
+MPI_LIBS=""
+if [ -d "${FFTW_LIB}/mpi/.libs" ] && command -v mpicc > /dev/null 2>&1; then
+    ND_CC=mpicc
+    MPI_DEFINE="-DHAVE_FFTW_MPI -I${FFTW_LIB}/mpi"
+    MPI_LIBS="-L${FFTW_LIB}/mpi/.libs -lfftw3_mpi"
+    export LD_LIBRARY_PATH=${LD_LIBRARY_PATH}:${FFTW_LIB}/mpi/.libs
+fi
+
 # Compile
-gcc -O  src/guru_real_2D_dft_fftw_malloc.c -std=c11 -Wall -o 2d_fft -I/usr/include -I${FFTW_LIB}/api -L${FFTW_LIB}/double/.libs -L${FFTW_LIB}/double/threads/.libs -lfftw3 -lfftw3_threads -lm -lpthread -I/usr/local/include/ImageMagick-7 -I/usr/local/include/ImageMagick-7/MagickWand -L/usr/local/lib -lMagickCore-7.Q16HDRI -lMagickWand-7.Q16HDRI -DMAGICKCORE_QUANTUM_DEPTH=16 -DMAGICKCORE_HDRI_ENABLE=0
-gcc -O  src/multidimensional_cosine_dft.c -std=c11 -Wall -o nd_cosine_ffts -I/usr/include -I${FFTW_LIB}/api -L${FFTW_LIB}/double/.libs -L${FFTW_LIB}/double/threads/.libs -lfftw3 -lfftw3_threads -lm -lpthread -I/usr/local/include/ImageMagick-7 -I/usr/local/include/ImageMagick-7/MagickWand -L/usr/local/lib -lMagickCore-7.Q16HDRI -lMagickWand-7.Q16HDRI -DMAGICKCORE_QUANTUM_DEPTH=16 -DMAGICKCORE_HDRI_ENABLE=0
+gcc -O  src/guru_real_2D_dft_fftw_malloc.c src/plan_cache.c src/wisdom.c src/kernel_cache.c src/spectral_multiply.c src/simd.c src/image_io.c src/pipeline.c src/ring_buffer.c src/worker_pool.c src/fft_size.c src/tiled.c src/convolution.c src/timing.c src/perf_counters.c src/flops.c src/results.c src/thread_backend.c src/numa_alloc.c src/precision.c src/precision_double.c ${PRECISION_SOURCES} "${FFTW_BUILD_FLAGS_DEFINE}" "${GIT_SHA_DEFINE}" ${THREADS_CALLBACK_DEFINE} -std=c11 -Wall -fopenmp -pthread -o 2d_fft -I/usr/include -I${FFTW_LIB}/api -L${FFTW_LIB}/double/.libs -L${FFTW_LIB}/double/threads/.libs -lfftw3 -lfftw3_threads ${PRECISION_LIBS} -lm -lpthread -I/usr/local/include/ImageMagick-7 -I/usr/local/include/ImageMagick-7/MagickWand -L/usr/local/lib -lMagickCore-7.Q16HDRI -lMagickWand-7.Q16HDRI -DMAGICKCORE_QUANTUM_DEPTH=16 -DMAGICKCORE_HDRI_ENABLE=0
+${ND_CC} -O  src/multidimensional_cosine_dft.c src/mpi_cosine.c src/sweep.c src/wisdom.c src/timing.c src/perf_counters.c src/flops.c src/results.c src/thread_backend.c src/numa_alloc.c src/cache_flush.c src/simd.c src/signal_gen.c src/precision.c src/precision_double.c ${PRECISION_SOURCES} "${FFTW_BUILD_FLAGS_DEFINE}" "${GIT_SHA_DEFINE}" ${THREADS_CALLBACK_DEFINE} ${MPI_DEFINE} -std=c11 -Wall -fopenmp -pthread -o nd_cosine_ffts -I/usr/include -I${FFTW_LIB}/api -L${FFTW_LIB}/double/.libs -L${FFTW_LIB}/double/threads/.libs ${MPI_LIBS} -lfftw3 -lfftw3_threads ${PRECISION_LIBS} -lm -lpthread -I/usr/local/include/ImageMagick-7 -I/usr/local/include/ImageMagick-7/MagickWand -L/usr/local/lib -lMagickCore-7.Q16HDRI -lMagickWand-7.Q16HDRI -DMAGICKCORE_QUANTUM_DEPTH=16 -DMAGICKCORE_HDRI_ENABLE=0
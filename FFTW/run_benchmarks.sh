@@ -1,7 +1,7 @@
 #!/bin/bash
 
 usage() {
-    echo "Usage: $0 [-i iterations] [-e executable] [-j json_filename] [-r rank] [-d dimensions] [-f sampling_frequency] [-p] [-t] [-l log_filename] [-v thread_values] [-n] [-h]"
+    echo "Usage: $0 [-i iterations] [-e executable] [-j json_filename] [-r rank] [-d dimensions] [-f sampling_frequency] [-p] [-s sweep_config] [-m process_counts] [-o] [-t] [-l log_filename] [-v thread_values] [-n] [-h]"
     echo "  REQUIRED:"
     echo "  -i  Number of iterations. For 2d_fft, use this value to emulate the number of images processed. For nd_cosine_ffts, use this value to emulate the number of cosine matrices to perform fourier transforms on."
     echo "  -e  Path to executable."
@@ -14,6 +14,9 @@ usage() {
     echo ""
     echo "  OPTIONAL FOR nd_cosine_ffts:"
     echo "  -p  Use this flag if you wish to plot the results of the cosine FFT program"
+    echo "  -s  Sweep config file. Runs every configuration it lists (sizes, ranks, threads, plan efforts, precisions, batch sizes and layouts) in a single nd_cosine_ffts process. -i, -r, -d, -f and -v are not needed (the config has them)."
+    echo "  -m  MPI process counts. For example, \"1 2 4\" runs one distributed transform (nd_cosine_ffts --mpi) under mpirun -np 1, 2 and 4, one thread per process. Needs a rank of at least 2 and a build with FFTW's MPI library. Set MPIRUN to change the launcher (e.g. MPIRUN=\"mpirun --oversubscribe\")."
+    echo "  -o  With -m, leave the distributed spectrum transposed (--transposed-out), which saves one all-to-all per transform."
     echo ""
     echo "  OPTIONAL:"
     echo "  -t  Max number of threads to use. Omit this option if you want to use the max number of (real) cores on your system."
@@ -34,8 +37,11 @@ rank=-2222
 fs=-2222
 plot=0
 json_doc="NULL"
+sweep_config="NULL"
+mpi_processes="NULL"
+transposed_out=""
 
-options=":hpi:f:e:t:d:l:v:r:j:n"
+options=":hpi:f:e:t:d:l:v:r:j:ns:m:o"
 while getopts "$options" x
 do
     case "$x" in
@@ -75,6 +81,15 @@ do
       j)
           json_doc=${OPTARG}
           ;;
+      s)
+          sweep_config=${OPTARG}
+          ;;
+      m)
+          mpi_processes=${OPTARG}
+          ;;
+      o)
+          transposed_out="--transposed-out"
+          ;;
       *)  
           usage
           ;;
@@ -103,6 +118,29 @@ if [ ! -x $executable ]; then
     exit
 fi
 
+# A sweep runs its whole config in one process
+if [ "$sweep_config" != "NULL" ]; then
+    if [ "$executable" != "nd_cosine_ffts" ]; then
+        echo "Sweeps (-s) are run by nd_cosine_ffts. Please use -e nd_cosine_ffts."
+        exit
+    fi
+    if [ ! -f "$sweep_config" ]; then
+        echo "The sweep config $sweep_config does not exist!"
+        exit
+    fi
+    if [[ "$json_doc" == "NULL" ]]; then
+        echo "No JSON document name was passed. Please supply a value for -j"
+        usage
+    fi
+    echo "Executing ./nd_cosine_ffts --sweep=$sweep_config $json_doc"
+    if [ $use_numactl == 1 ]; then
+        numactl -C 0-$((max_threads-1)) -i 0,1 ./nd_cosine_ffts --sweep="$sweep_config" $json_doc >> $run_log
+    else
+        ./nd_cosine_ffts --sweep="$sweep_config" $json_doc >> $run_log
+    fi
+    exit
+fi
+
 # Check if the number of iterations was passed in
 if (( $num_executions == -2222 )); then
     echo "Missing argument for number of iterations. Please pass in the number of iterations with the -i flag."
@@ -132,13 +170,12 @@ if [ "$executable" == "2d_fft" ]; then
                 ./2d_fft $k $num_executions $json_doc >> $run_log
             fi
         done
-        if [ $max_threads > $k ]; then
-            echo "Executing ./2d_fft $max_threads $num_executions"
-            if [ $use_numactl == 1 ]; then
-                numactl -C 0-$((k-1)) -i 0,1 ./2d_fft $max_threads $num_executions $json_doc >> $run_log
-            else
-                ./2d_fft $k $num_executions $json_doc >> $run_log
-            fi
+        # The loop stops below max_threads, so finish with max_threads itself
+        echo "Executing ./2d_fft $max_threads $num_executions"
+        if [ $use_numactl == 1 ]; then
+            numactl -C 0-$((max_threads-1)) -i 0,1 ./2d_fft $max_threads $num_executions $json_doc >> $run_log
+        else
+            ./2d_fft $max_threads $num_executions $json_doc >> $run_log
         fi
     # Else, use the thread values the user specified
     else
@@ -201,6 +238,20 @@ elif [ "$executable" == "nd_cosine_ffts" ]; then
         should_plot="noplot"
     fi
 
+    # MPI mode: one distributed transform per process count, on the same dims (strong scaling). For weak scaling, run
+    # again with dims that grow with the process count
+    if [ "$mpi_processes" != "NULL" ]; then
+        if [ $plot == 1 ] || (( $rank < 2 )); then
+            echo "With -m, please leave out -p and use a rank of at least 2."
+            exit
+        fi
+        for np in $mpi_processes; do
+            echo "Executing ${MPIRUN:-mpirun} -np $np ./nd_cosine_ffts --mpi $transposed_out noplot json=$json_doc nthreads=1 num_executions=$num_executions fs=$fs rank=$rank dims=\"$dimensions\""
+            ${MPIRUN:-mpirun} -np $np ./nd_cosine_ffts --mpi $transposed_out noplot $json_doc 1 $num_executions $fs $rank $dimensions >> $run_log
+        done
+        exit
+    fi
+
     # If no thread values were supplied, then iterate in powers of two
     if [ "$thread_values" == -1 ]; then
         echo "Using default thread values."
@@ -213,13 +264,12 @@ elif [ "$executable" == "nd_cosine_ffts" ]; then
                 ./nd_cosine_ffts $should_plot $json_doc $k $num_executions $fs $rank $dimensions >> $run_log
             fi
         done
-        if [ $max_threads > $k ]; then
-            echo "Executing ./nd_cosine_ffts $should_plot json=$json_doc nthreads=$max_threads num_executions=$num_executions fs=$fs rank=$rank dims=\"$dimensions\""
-            if [ $use_numactl == 1 ]; then
-                numactl -C 0-$((max_threads-1)) -i 0,1 ./nd_cosine_ffts $should_plot $json_doc $max_threads $num_executions $fs $rank $dimensions >> $run_log
-            else
-                ./nd_cosine_ffts $should_plot $json_doc $max_threads $num_executions $fs $rank $dimensions >> $run_log
-            fi
+        # The loop stops below max_threads, so finish with max_threads itself
+        echo "Executing ./nd_cosine_ffts $should_plot json=$json_doc nthreads=$max_threads num_executions=$num_executions fs=$fs rank=$rank dims=\"$dimensions\""
+        if [ $use_numactl == 1 ]; then
+            numactl -C 0-$((max_threads-1)) -i 0,1 ./nd_cosine_ffts $should_plot $json_doc $max_threads $num_executions $fs $rank $dimensions >> $run_log
+        else
+            ./nd_cosine_ffts $should_plot $json_doc $max_threads $num_executions $fs $rank $dimensions >> $run_log
         fi
     # Else, use the thread values the user specified
     else
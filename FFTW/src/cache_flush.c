@@ -0,0 +1,90 @@
+/* Cold-cache runs
+ *
+ * A transform that is executed over and over finds its input, output and twiddle factors in the cache from the second
+ * execution on, so back-to-back iterations measure the warm case only. To measure the cold case, every line of a
+ * buffer twice the size of the last level cache is read and written between two iterations, which evicts (and writes
+ * back) whatever the transform left in the caches. The sweep runs on the calling thread, outside the timed phases,
+ * and its cost is reported separately.
+ *
+ * The last level cache is the largest data cache sysconf() or /sys/devices/system/cpu/cpu0/cache reports (see
+ * detect_cache_size() in tiled.c, which sizes the tiles the same way).
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "cache_flush.h"
+#include "timing.h"
+
+#define DEFAULT_LLC_BYTES (32UL * 1024 * 1024) //when the host doesn't say
+#define CACHE_LINE_DOUBLES 8                   //64 byte lines
+
+size_t detect_llc_size(void){
+/* Size of the last level cache, in bytes */
+    long size = 0;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size <= 0)
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    if (size <= 0){
+        char path[256];
+        int index;
+        for (index=0; index<16; index++){
+            unsigned long index_size;
+            char unit = 'B';
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+            FILE *f = fopen(path, "r");
+            if (!f)
+                break;
+            if (fscanf(f, "%lu%c", &index_size, &unit) < 1)
+                index_size = 0;
+            fclose(f);
+            if (unit == 'K')
+                index_size *= 1024;
+            else if (unit == 'M')
+                index_size *= 1024 * 1024;
+            if ((long)index_size > size)
+                size = (long)index_size;
+        }
+    }
+    return (size > 0) ? (size_t)size : DEFAULT_LLC_BYTES;
+}
+
+bool cache_flusher_init(cache_flusher *flusher, bool enabled){
+/* Allocates (and touches) the eviction buffer if 'enabled'. Returns false if it can't be allocated */
+    memset(flusher, 0, sizeof(cache_flusher));
+    flusher->enabled = enabled;
+    if (!enabled)
+        return true;
+    flusher->llc_bytes = detect_llc_size();
+    flusher->bytes = 2 * flusher->llc_bytes;
+    flusher->buffer = malloc(flusher->bytes);
+    if (!flusher->buffer)
+        return false;
+    memset(flusher->buffer, 0, flusher->bytes);
+    return true;
+}
+
+void cache_flusher_flush(cache_flusher *flusher){
+/* Reads and writes one double per cache line of the eviction buffer (does nothing unless enabled) */
+    size_t i, count;
+    double sum = 0.0;
+    if (!flusher->enabled)
+        return;
+    uint64_t start = timing_now();
+    count = flusher->bytes / sizeof(double);
+    for (i=0; i<count; i+=CACHE_LINE_DOUBLES){
+        sum += flusher->buffer[i];
+        flusher->buffer[i] = sum;
+    }
+    flusher->sink += sum;
+    flusher->flush_time += timing_elapsed(start, timing_now());
+    flusher->flushes++;
+}
+
+void cache_flusher_destroy(cache_flusher *flusher){
+    free(flusher->buffer);
+    flusher->buffer = NULL;
+}
@@ -0,0 +1,24 @@
+/* Cold-cache runs: evicts the last level cache between iterations by sweeping a buffer twice its size */
+#ifndef CACHE_FLUSH_H
+#define CACHE_FLUSH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    bool enabled;
+    size_t llc_bytes;        //last level cache size, from sysconf or sysfs
+    size_t bytes;            //size of the eviction buffer (twice the last level cache)
+    double *buffer;
+    unsigned long flushes;
+    double flush_time;       //seconds spent flushing, kept out of the timed phases
+    double sink;             //what the sweeps read, so that they can't be optimized away
+} cache_flusher;
+
+size_t detect_llc_size(void);
+
+bool cache_flusher_init(cache_flusher *flusher, bool enabled);
+void cache_flusher_flush(cache_flusher *flusher);
+void cache_flusher_destroy(cache_flusher *flusher);
+
+#endif
@@ -0,0 +1,527 @@
+/* Convolution backends for the image blurring benchmark
+ *
+ * A gaussian blur can be computed three ways, and which one is fastest depends on the image and the filter:
+ *
+ *   - direct:    every output pixel is a filter_size x filter_size weighted sum, filter_size^2 multiply-adds
+ *   - separable: the gaussian is the outer product of a 1D gaussian with itself, so the blur is a horizontal 1D
+ *                pass followed by a vertical one, 2 * filter_size multiply-adds per pixel
+ *   - FFT:       zero-pad to an FFT-friendly size, forward transform, spectral multiply, backward transform. The
+ *                cost per pixel grows with log(image size) but not with the filter size
+ *
+ * All three compute the same linear convolution (the filter anchored at its top left corner, zero outside the
+ * image), so they are interchangeable. Both spatial engines are built from one kernel, y += a * x over a row, which
+ * is vectorized with AVX2 or AVX-512 (see simd.c), and rows are split across OpenMP threads.
+ *
+ * CONV_AUTO routes each request to the engine that was measured to be fastest for its (height, width, filter size).
+ * A shape is calibrated the first time it comes along, by timing all three engines on it, and the timings are kept
+ * in a small table next to the wisdom file, so each shape is only calibrated once per host and FFTW build. The
+ * engines' relative costs change with the thread count, the planner flags and the vector kernels, so a timing is
+ * only reused for the same ones.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "convolution.h"
+#include "fft_size.h"
+#include "spectral_multiply.h"
+#include "timing.h"
+
+#define CALIBRATION_REPS 3 //timed runs per engine (after one untimed run)
+#define CALIBRATION_SLOW 4 //an engine whose first run is this many times slower than the best so far is not repeated
+#define CONV_TABLE_HEADER "# height width filter_size nthreads flags simd direct_seconds separable_seconds fft_seconds (one RGB image)\n"
+
+bool parse_conv_engine(const char *name, conv_engine *engine){
+    if (strcmp(name, "direct") == 0)
+        *engine = CONV_DIRECT;
+    else if (strcmp(name, "separable") == 0)
+        *engine = CONV_SEPARABLE;
+    else if (strcmp(name, "fft") == 0)
+        *engine = CONV_FFT;
+    else if (strcmp(name, "auto") == 0)
+        *engine = CONV_AUTO;
+    else
+        return false;
+    return true;
+}
+
+const char *conv_engine_name(conv_engine engine){
+    switch (engine){
+        case CONV_DIRECT: return "direct";
+        case CONV_SEPARABLE: return "separable";
+        case CONV_FFT: return "fft";
+        default: return "auto";
+    }
+}
+
+/*
+ * Row kernels: y[i] += a * x[i] for i in [0, n)
+ */
+
+static void axpy_generic(double a, const double *x, double *y, int n){
+    int i;
+    for (i=0; i<n; i++)
+        y[i] += a * x[i];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static void axpy_avx2(double a, const double *x, double *y, int n){
+    __m256d va = _mm256_set1_pd(a);
+    int i;
+    for (i=0; i+4<=n; i+=4)
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    axpy_generic(a, x + i, y + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void axpy_avx512(double a, const double *x, double *y, int n){
+    __m512d va = _mm512_set1_pd(a);
+    int i;
+    for (i=0; i+8<=n; i+=8)
+        _mm512_storeu_pd(y + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i)));
+    axpy_generic(a, x + i, y + i, n - i);
+}
+#endif
+
+typedef void (*axpy_kernel)(double, const double*, double*, int);
+
+static axpy_kernel select_axpy(simd_level level){
+#if defined(__x86_64__) || defined(__i386__)
+    if (level == SIMD_AVX512)
+        return axpy_avx512;
+    if (level == SIMD_AVX2)
+        return axpy_avx2;
+#endif
+    return axpy_generic;
+}
+
+static bool grow_scratch(conv_backend *backend, size_t bytes){
+    if (bytes <= backend->scratch_bytes)
+        return true;
+    fftw_free(backend->scratch);
+    backend->scratch = (double*)fftw_malloc(bytes);
+    backend->scratch_bytes = backend->scratch ? bytes : 0;
+    return backend->scratch != NULL;
+}
+
+/*
+ * Engines. Each one blurs the R, G and B planes in[c] -> out[c] (height x width, out must not alias in)
+ */
+
+static bool blur_direct(conv_backend *backend, int height, int width, double **in, double **out){
+/* out[y][x] = sum over (i, j) of filter[i][j] * in[y-i][x-j]. Each output row is built from filter_size^2 shifted
+ * input rows, and stays in cache while it is */
+    axpy_kernel axpy = select_axpy(backend->simd);
+    int F = backend->filter_size;
+    int row;
+
+#pragma omp parallel for num_threads(backend->nthreads) schedule(static)
+    for (row=0; row<3*height; row++){
+        int c = row / height, y = row % height;
+        double *out_row = out[c] + (size_t)y*width;
+        int i, j;
+
+        memset(out_row, 0, width * sizeof(double));
+        for (i=0; i<F && i<=y; i++){
+            const double *in_row = in[c] + (size_t)(y - i)*width;
+            for (j=0; j<F && j<width; j++)
+                axpy(backend->filter[i*F + j], in_row, out_row + j, width - j);
+        }
+    }
+    return true;
+}
+
+static bool blur_separable(conv_backend *backend, int height, int width, double **in, double **out){
+/* Horizontal pass into the scratch image, then a vertical pass into 'out' */
+    axpy_kernel axpy = select_axpy(backend->simd);
+    size_t plane_size = (size_t)height * width;
+    int F = backend->filter_size;
+    int row;
+
+    if (!grow_scratch(backend, 3 * plane_size * sizeof(double)))
+        return false;
+    double *tmp = backend->scratch;
+
+#pragma omp parallel for num_threads(backend->nthreads) schedule(static)
+    for (row=0; row<3*height; row++){
+        int c = row / height, y = row % height;
+        double *tmp_row = tmp + c*plane_size + (size_t)y*width;
+        const double *in_row = in[c] + (size_t)y*width;
+        int j;
+
+        memset(tmp_row, 0, width * sizeof(double));
+        for (j=0; j<F && j<width; j++)
+            axpy(backend->taps[j], in_row, tmp_row + j, width - j);
+    }
+
+#pragma omp parallel for num_threads(backend->nthreads) schedule(static)
+    for (row=0; row<3*height; row++){
+        int c = row / height, y = row % height;
+        double *out_row = out[c] + (size_t)y*width;
+        int i;
+
+        memset(out_row, 0, width * sizeof(double));
+        for (i=0; i<F && i<=y; i++)
+            axpy(backend->taps[i], tmp + c*plane_size + (size_t)(y - i)*width, out_row, width);
+    }
+    return true;
+}
+
+static bool blur_fft(conv_backend *backend, int height, int width, double **in, double **out){
+/* Same as the streaming blur stage: the three planes are zero-padded into one in-place buffer and transformed with a
+ * single howmany = 3 plan pair, and the top left height x width corner of the result is kept */
+    size_choice size;
+    choose_fft_size(PAD_SMOOTH, NULL, height, width, backend->filter_size, backend->nthreads, &size);
+    int padded_height = size.height, padded_width = size.width;
+    size_t real_row_width = 2*(padded_width/2+1);
+    size_t plane_size = (size_t)padded_height * real_row_width;
+    int n[2] = {padded_height, padded_width};
+    size_t x, y;
+    int c;
+
+    if (!grow_scratch(backend, 3 * plane_size * sizeof(double)))
+        return false;
+    double *buffer = backend->scratch;
+    fftw_complex *spectrum = (fftw_complex*)buffer;
+
+    fftw_complex *filter = kernel_cache_gaussian(backend->kernels, backend->plans, padded_height, padded_width, backend->sigma, backend->filter_size, backend->analytic_filter, backend->nthreads, backend->flags);
+    fftw_plan forward_plan = plan_cache_r2c(backend->plans, 2, n, 3, buffer, 1, (int)plane_size, spectrum, 1, (int)(plane_size/2), backend->nthreads, backend->flags);
+    fftw_plan backward_plan = plan_cache_c2r(backend->plans, 2, n, 3, spectrum, 1, (int)(plane_size/2), buffer, 1, (int)plane_size, backend->nthreads, backend->flags);
+    if (!filter || !forward_plan || !backward_plan)
+        return false;
+
+    // Fill the buffer (after planning, which may overwrite it), zeroing the padding
+    for (c=0; c<3; c++){
+        for (y=0; y<height; y++){
+            memcpy(buffer + c*plane_size + y*real_row_width, in[c] + y*width, width * sizeof(double));
+            memset(buffer + c*plane_size + y*real_row_width + width, 0, (padded_width - width) * sizeof(double));
+        }
+        for (y=height; y<padded_height; y++)
+            memset(buffer + c*plane_size + y*real_row_width, 0, padded_width * sizeof(double));
+    }
+
+    fftw_complex *planes[3] = {spectrum, spectrum + plane_size/2, spectrum + plane_size};
+    fftw_execute_dft_r2c(forward_plan, buffer, spectrum);
+    spectral_multiply(backend->simd, filter, padded_height, padded_width/2+1, planes, planes, 3, 1, backend->nthreads);
+    fftw_execute_dft_c2r(backward_plan, spectrum, buffer);
+
+    // Copy back, undoing FFTW's scaling by the transform size
+    double scale = 1.0 / ((double)padded_height * padded_width);
+    for (c=0; c<3; c++){
+        for (y=0; y<height; y++){
+            for (x=0; x<width; x++)
+                out[c][y*width + x] = buffer[c*plane_size + y*real_row_width + x] * scale;
+        }
+    }
+    return true;
+}
+
+static bool run_engine(conv_backend *backend, conv_engine engine, int height, int width, double **in, double **out){
+    switch (engine){
+        case CONV_DIRECT: return blur_direct(backend, height, width, in, out);
+        case CONV_SEPARABLE: return blur_separable(backend, height, width, in, out);
+        default: return blur_fft(backend, height, width, in, out);
+    }
+}
+
+/*
+ * Calibration table: measured time of every engine per (height, width, filter size)
+ */
+
+void conv_table_init(conv_table *table, const char *wisdom_path){
+/* The table lives next to the wisdom file, and is keyed the same way (by host CPU and FFTW build) */
+    const char *suffix = strrchr(wisdom_path, '.');
+    int stem = suffix ? (int)(suffix - wisdom_path) : (int)strlen(wisdom_path);
+    snprintf(table->path, sizeof(table->path), "%.*s_conv.txt", stem, wisdom_path);
+    table->entries = NULL;
+    table->num_entries = 0;
+    table->capacity = 0;
+    table->loaded = false;
+    table->measured = 0;
+    table->measure_time = 0.0;
+}
+
+static conv_timing *add_timing(conv_table *table, const conv_timing *timing){
+    if (table->num_entries == table->capacity){
+        int new_capacity = (table->capacity == 0) ? 16 : 2 * table->capacity;
+        conv_timing *grown = realloc(table->entries, new_capacity * sizeof(conv_timing));
+        if (!grown)
+            return NULL;
+        table->entries = grown;
+        table->capacity = new_capacity;
+    }
+    table->entries[table->num_entries] = *timing;
+    return &table->entries[table->num_entries++];
+}
+
+bool conv_table_load(conv_table *table){
+/* Reads "height width filter_size nthreads flags simd direct separable fft" lines (lines starting with '#' are
+ * comments). Tables written before the threads, flags and SIMD level were recorded start with another header and are
+ * ignored (and replaced by the next save) */
+    FILE *f = fopen(table->path, "r");
+    char line[256], simd[16];
+    conv_timing timing;
+
+    if (!f)
+        return false;
+    if (!fgets(line, sizeof(line), f) || strcmp(line, CONV_TABLE_HEADER) != 0){
+        fclose(f);
+        return false;
+    }
+    while (fgets(line, sizeof(line), f)){
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%d %d %d %d %u %15s %lf %lf %lf", &timing.height, &timing.width, &timing.filter_size, &timing.nthreads, &timing.flags, simd, &timing.seconds[CONV_DIRECT], &timing.seconds[CONV_SEPARABLE], &timing.seconds[CONV_FFT]) == 9 && parse_simd_level(simd, &timing.simd))
+            add_timing(table, &timing);
+    }
+    fclose(f);
+
+    table->loaded = (table->num_entries > 0);
+    return table->loaded;
+}
+
+bool conv_table_save(conv_table *table){
+/* Writes the table back if anything was calibrated during this run */
+    FILE *f;
+    char directory[CONV_TABLE_PATH_SIZE];
+    char *slash;
+    int i;
+
+    if (table->measured == 0)
+        return true;
+
+    snprintf(directory, sizeof(directory), "%s", table->path);
+    slash = strrchr(directory, '/');
+    if (slash){
+        *slash = '\0';
+        mkdir(directory, 0755); //fails harmlessly if it already exists
+    }
+
+    f = fopen(table->path, "w");
+    if (!f){
+        printf("  WARNING: Could not save convolution timings to %s\n", table->path);
+        return false;
+    }
+    fprintf(f, CONV_TABLE_HEADER);
+    for (i=0; i<table->num_entries; i++){
+        conv_timing *t = &table->entries[i];
+        fprintf(f, "%d %d %d %d %u %s %0.9e %0.9e %0.9e\n", t->height, t->width, t->filter_size, t->nthreads, t->flags, simd_level_name(t->simd), t->seconds[CONV_DIRECT], t->seconds[CONV_SEPARABLE], t->seconds[CONV_FFT]);
+    }
+    fclose(f);
+
+    return true;
+}
+
+void conv_table_destroy(conv_table *table){
+    free(table->entries);
+    table->entries = NULL;
+    table->num_entries = table->capacity = 0;
+}
+
+/*
+ * Backend
+ */
+
+bool conv_backend_init(conv_backend *backend, plan_cache *plans, kernel_cache *kernels, conv_table *table, double sigma, int filter_size, bool analytic_filter, int nthreads, unsigned flags, simd_level simd){
+/* Sets up the three engines for one filter
+ *
+ * Inputs
+ * ======
+ *   plan_cache *plans, kernel_cache *kernels
+ *       Where the FFT engine's plans and filter spectra come from
+ *
+ *   conv_table *table
+ *       Measured timings that CONV_AUTO routes with (shapes that are missing get calibrated). If NULL, an
+ *       operation-count model picks the engine instead
+ *
+ *   double sigma, int filter_size, bool analytic_filter
+ *       The gaussian (analytic_filter only applies to the FFT engine)
+ *
+ *   int nthreads, unsigned flags, simd_level simd
+ *       Threads for every engine, FFTW planner flags, and the vector kernels to use
+ */
+    int i;
+    memset(backend, 0, sizeof(conv_backend));
+    backend->filter_size = filter_size;
+    backend->sigma = sigma;
+    backend->analytic_filter = analytic_filter;
+    backend->nthreads = nthreads;
+    backend->flags = flags;
+    backend->simd = simd;
+    backend->plans = plans;
+    backend->kernels = kernels;
+    backend->table = table;
+
+    backend->filter = malloc(sizeof(double) * filter_size * filter_size);
+    backend->taps = malloc(sizeof(double) * filter_size);
+    if (!backend->filter || !backend->taps){
+        conv_backend_destroy(backend);
+        return false;
+    }
+
+    // The 2D gaussian is normalized to sum to 1, so its row sums are the normalized 1D gaussian
+    gaussian_filter(backend->filter, sigma, filter_size);
+    for (i=0; i<filter_size; i++){
+        int j;
+        backend->taps[i] = 0.0;
+        for (j=0; j<filter_size; j++)
+            backend->taps[i] += backend->filter[i*filter_size + j];
+    }
+
+    return true;
+}
+
+void conv_backend_destroy(conv_backend *backend){
+    free(backend->filter);
+    free(backend->taps);
+    fftw_free(backend->scratch);
+    backend->filter = backend->taps = backend->scratch = NULL;
+    backend->scratch_bytes = 0;
+}
+
+static double time_engine(conv_backend *backend, conv_engine engine, int height, int width, double **in, double **out, double best_so_far){
+/* Best of CALIBRATION_REPS runs after an untimed one (which also creates any plans). An engine that is already far
+ * behind after its first run is not repeated, so that e.g. a large direct blur doesn't stall the calibration */
+    uint64_t start, stop;
+    double best = -1.0, seconds;
+    int rep;
+
+    for (rep=0; rep<=CALIBRATION_REPS; rep++){
+        start = timing_now(); //start clock
+        if (!run_engine(backend, engine, height, width, in, out))
+            return -1.0;
+        stop = timing_now(); //stop clock
+        seconds = timing_elapsed(start, stop);
+        if (rep > 0 && (best < 0.0 || seconds < best))
+            best = seconds;
+        if (rep == 0 && best_so_far > 0.0 && seconds > CALIBRATION_SLOW * best_so_far)
+            return seconds;
+    }
+    return best;
+}
+
+const conv_timing *conv_table_find(const conv_table *table, const conv_backend *backend, int height, int width){
+/* The table's timing of a height x width image with the backend's filter, threads, planner flags and SIMD level, or
+ * NULL if it hasn't been calibrated */
+    int i;
+    if (!table)
+        return NULL;
+    for (i=0; i<table->num_entries; i++){
+        const conv_timing *t = &table->entries[i];
+        if (t->height == height && t->width == width && t->filter_size == backend->filter_size && t->nthreads == backend->nthreads && t->flags == backend->flags && t->simd == backend->simd)
+            return t;
+    }
+    return NULL;
+}
+
+const conv_timing *conv_calibrate(conv_backend *backend, int height, int width){
+/* Times every engine on a height x width image with the backend's filter, unless the table already has the shape */
+    conv_table *table = backend->table;
+    conv_timing timing;
+    uint64_t start, stop;
+    double *planes;
+    double *in[3], *out[3];
+    double best = -1.0;
+    size_t plane_size = (size_t)height * width, i;
+    int c, e;
+
+    if (!table)
+        return NULL;
+    const conv_timing *found = conv_table_find(table, backend, height, width);
+    if (found)
+        return found;
+
+    start = timing_now(); //start clock
+    planes = (double*)fftw_malloc(6 * plane_size * sizeof(double));
+    if (!planes)
+        return NULL;
+    for (c=0; c<3; c++){
+        in[c] = planes + c*plane_size;
+        out[c] = planes + (3 + c)*plane_size;
+    }
+    for (i=0; i<3*plane_size; i++)
+        planes[i] = (double)(i % 251) / 251.0;
+
+    // The FFT engine's cost doesn't depend on the filter size, so it goes first and bounds the others
+    timing.height = height;
+    timing.width = width;
+    timing.filter_size = backend->filter_size;
+    timing.nthreads = backend->nthreads;
+    timing.flags = backend->flags;
+    timing.simd = backend->simd;
+    conv_engine order[CONV_NUM_ENGINES] = {CONV_FFT, CONV_SEPARABLE, CONV_DIRECT};
+    for (e=0; e<CONV_NUM_ENGINES; e++){
+        double seconds = time_engine(backend, order[e], height, width, in, out, best);
+        timing.seconds[order[e]] = seconds;
+        if (seconds > 0.0 && (best < 0.0 || seconds < best))
+            best = seconds;
+    }
+    fftw_free(planes);
+    stop = timing_now(); //stop clock
+    table->measure_time += timing_elapsed(start, stop);
+    table->measured++;
+
+    return add_timing(table, &timing);
+}
+
+static conv_engine model_select(const conv_backend *backend, int height, int width){
+/* Flops per RGB image: 2 per multiply-add for the spatial engines, and for the FFT engine ~5 n log2(n) per complex
+ * transform (see fft_cost_model) plus 6 per complex multiply */
+    double F = backend->filter_size;
+    double pixels = 3.0 * height * width;
+    size_choice size;
+    choose_fft_size(PAD_SMOOTH, NULL, height, width, backend->filter_size, backend->nthreads, &size);
+    double flops[CONV_NUM_ENGINES];
+    flops[CONV_DIRECT] = 2.0 * F * F * pixels;
+    flops[CONV_SEPARABLE] = 4.0 * F * pixels;
+    flops[CONV_FFT] = 3.0 * (5.0 * size.cost + 6.0 * size.height * (size.width/2+1));
+
+    conv_engine best = CONV_DIRECT;
+    int e;
+    for (e=1; e<CONV_NUM_ENGINES; e++){
+        if (flops[e] < flops[best])
+            best = (conv_engine)e;
+    }
+    return best;
+}
+
+conv_engine conv_select(conv_backend *backend, int height, int width){
+/* Fastest engine for a height x width image, calibrating the shape first if it hasn't been. Engines that failed
+ * during the calibration (seconds < 0) are never picked, and the model decides if all of them did */
+    const conv_timing *timing = conv_calibrate(backend, height, width);
+    if (!timing)
+        return model_select(backend, height, width);
+
+    int best = -1, e;
+    for (e=0; e<CONV_NUM_ENGINES; e++){
+        if (timing->seconds[e] > 0.0 && (best < 0 || timing->seconds[e] < timing->seconds[best]))
+            best = e;
+    }
+    if (best < 0)
+        return model_select(backend, height, width);
+    return (conv_engine)best;
+}
+
+conv_engine conv_blur(conv_backend *backend, conv_engine engine, int height, int width, double **in, double **out){
+/* Blurs in[c] -> out[c] for the R, G and B planes and returns the engine that did it (CONV_AUTO picks one with
+ * conv_select). Returns CONV_AUTO if the engine could not allocate its buffers */
+    uint64_t start, stop;
+
+    if (engine == CONV_AUTO)
+        engine = conv_select(backend, height, width);
+
+    start = timing_now(); //start clock
+    if (!run_engine(backend, engine, height, width, in, out))
+        return CONV_AUTO;
+    stop = timing_now(); //stop clock
+
+    backend->requests[engine]++;
+    backend->busy_time[engine] += timing_elapsed(start, stop);
+    return engine;
+}
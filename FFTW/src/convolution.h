@@ -0,0 +1,75 @@
+/* Convolution backends: direct 2D, separable 1D passes and FFT, with a measured table to route each request */
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <fftw3.h>
+#include "plan_cache.h"
+#include "kernel_cache.h"
+#include "simd.h"
+
+#define CONV_TABLE_PATH_SIZE 4096
+#define CONV_NUM_ENGINES 3
+
+typedef enum {
+    CONV_DIRECT,    //filter_size^2 multiply-adds per pixel
+    CONV_SEPARABLE, //a horizontal and a vertical 1D pass, 2 * filter_size multiply-adds per pixel
+    CONV_FFT,       //zero-padded r2c, spectral multiply, c2r
+    CONV_AUTO       //whichever of the above was measured to be fastest for the request's shape
+} conv_engine;
+
+typedef struct {
+    int height, width, filter_size;
+    int nthreads;                     //what the engines were timed with: threads, FFTW planner flags and vector kernels
+    unsigned flags;
+    simd_level simd;
+    double seconds[CONV_NUM_ENGINES]; //one RGB image, per engine
+} conv_timing;
+
+typedef struct {
+    char path[CONV_TABLE_PATH_SIZE]; //table file, stored next to the wisdom file of this host + FFTW build
+    conv_timing *entries;
+    int num_entries;
+    int capacity;
+    bool loaded;                     //true if timings were found and loaded at startup
+    unsigned long measured;          //shapes calibrated during this run
+    double measure_time;             //seconds spent calibrating
+} conv_table;
+
+typedef struct {
+    int filter_size;
+    double *filter;         //filter_size x filter_size gaussian (direct)
+    double *taps;           //filter_size 1D gaussian, filter = taps x taps (separable)
+    double sigma;
+    bool analytic_filter;
+    int nthreads;
+    unsigned flags;
+    simd_level simd;
+    plan_cache *plans;      //FFT plans and filter spectra
+    kernel_cache *kernels;
+    conv_table *table;      //measured timings for CONV_AUTO (NULL uses the operation-count model)
+    double *scratch;        //separable intermediate image or FFT buffer, grown as needed
+    size_t scratch_bytes;
+
+    unsigned long requests[CONV_NUM_ENGINES]; //images blurred by each engine
+    double busy_time[CONV_NUM_ENGINES];       //seconds spent in each engine
+} conv_backend;
+
+bool parse_conv_engine(const char *name, conv_engine *engine);
+const char *conv_engine_name(conv_engine engine);
+
+void conv_table_init(conv_table *table, const char *wisdom_path);
+bool conv_table_load(conv_table *table);
+bool conv_table_save(conv_table *table);
+void conv_table_destroy(conv_table *table);
+
+bool conv_backend_init(conv_backend *backend, plan_cache *plans, kernel_cache *kernels, conv_table *table, double sigma, int filter_size, bool analytic_filter, int nthreads, unsigned flags, simd_level simd);
+void conv_backend_destroy(conv_backend *backend);
+
+const conv_timing *conv_table_find(const conv_table *table, const conv_backend *backend, int height, int width);
+const conv_timing *conv_calibrate(conv_backend *backend, int height, int width);
+conv_engine conv_select(conv_backend *backend, int height, int width);
+conv_engine conv_blur(conv_backend *backend, conv_engine engine, int height, int width, double **in, double **out);
+
+#endif
@@ -0,0 +1,400 @@
+/* Transform size selection
+ *
+ * Blurring by multiplying spectra is a circular convolution: without padding, the blur wraps around the image's
+ * edges. Padding each dimension to at least image + filter - 1 turns it into a linear convolution, and since the
+ * padded size is free to choose, we might as well choose one FFTW is fast at. FFTW has hand-written codelets for
+ * small radices, so sizes of the form 2^a 3^b 5^c 7^d are fast, while sizes with a large prime factor (541, say)
+ * fall back to much slower generic algorithms.
+ *
+ * The candidates for each dimension are the 7-smooth sizes between the minimum and the next power of two (which is
+ * always a candidate). They are ranked either with a simple operation-count model, or by timing a forward and a
+ * backward transform of each shape. Timings are kept in a small table next to the wisdom file, so each shape is only
+ * timed once per host and FFTW build.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <fftw3.h>
+#include "fft_size.h"
+#include "timing.h"
+
+#define MAX_CANDIDATES 256    //per dimension
+#define MEASURED_CANDIDATES 4 //per dimension, shortlisted by the model before timing
+#define TIMING_REPS 3
+#define SIZE_TABLE_HEADER "# height width nthreads seconds (one forward + one backward 2D r2c/c2r transform)\n"
+
+bool parse_pad_mode(const char *name, pad_mode *mode){
+    if (strcmp(name, "none") == 0)
+        *mode = PAD_NONE;
+    else if (strcmp(name, "pow2") == 0)
+        *mode = PAD_POW2;
+    else if (strcmp(name, "smooth") == 0)
+        *mode = PAD_SMOOTH;
+    else
+        return false;
+    return true;
+}
+
+const char *pad_mode_name(pad_mode mode){
+    switch (mode){
+        case PAD_POW2: return "pow2";
+        case PAD_SMOOTH: return "smooth";
+        default: return "none";
+    }
+}
+
+bool parse_size_cost(const char *name, size_cost_source *source){
+    if (strcmp(name, "model") == 0)
+        *source = SIZE_COST_MODEL;
+    else if (strcmp(name, "measured") == 0)
+        *source = SIZE_COST_MEASURED;
+    else
+        return false;
+    return true;
+}
+
+const char *size_cost_name(size_cost_source source){
+    return (source == SIZE_COST_MEASURED) ? "measured" : "model";
+}
+
+int next_power_of_two(int n){
+/* Smallest power of two greater than or equal to n */
+    int power = 1;
+    while (power < n)
+        power <<= 1;
+    return power;
+}
+
+bool is_smooth_size(int n){
+/* True if n = 2^a 3^b 5^c 7^d */
+    int radices[4] = {2, 3, 5, 7};
+    int i;
+    if (n < 1)
+        return false;
+    for (i=0; i<4; i++){
+        while (n % radices[i] == 0)
+            n /= radices[i];
+    }
+    return n == 1;
+}
+
+static double radix_weight(int p){
+/* Relative cost per log2 of a radix-p pass. FFTW's codelets make 2, 3, 5 and 7 cheap; 11 and 13 have codelets too
+ * but are slower, and larger primes go through Rader's or the generic O(p^2) algorithm */
+    switch (p){
+        case 2: return 1.0;
+        case 3: return 1.15;
+        case 5: return 1.3;
+        case 7: return 1.5;
+        case 11: case 13: return 2.0;
+        default: return 4.0;
+    }
+}
+
+static double cost_1d(int n){
+/* Model cost of a complex 1D transform of size n: n times the weighted number of passes */
+    double passes = 0.0;
+    int m = n, p;
+    for (p=2; p*p<=m; p++){
+        while (m % p == 0){
+            passes += log2((double)p) * radix_weight(p);
+            m /= p;
+        }
+    }
+    if (m > 1)
+        passes += log2((double)m) * radix_weight(m);
+    return n * passes;
+}
+
+double fft_cost_model(int height, int width){
+/* Model cost of a forward plus a backward 2D r2c/c2r transform. A real transform of the rows costs about half of a
+ * complex one, and the columns are transformed on the width/2+1 non-redundant outputs */
+    return 2.0 * (height * 0.5 * cost_1d(width) + (width/2+1) * cost_1d(height));
+}
+
+/*
+ * Size table: measured transform times per shape
+ */
+
+void size_table_init(size_table *table, const char *wisdom_path){
+/* The table lives next to the wisdom file, and is keyed the same way (by host CPU and FFTW build) */
+    const char *suffix = strrchr(wisdom_path, '.');
+    int stem = suffix ? (int)(suffix - wisdom_path) : (int)strlen(wisdom_path);
+    snprintf(table->path, sizeof(table->path), "%.*s_sizes.txt", stem, wisdom_path);
+    table->entries = NULL;
+    table->num_entries = 0;
+    table->capacity = 0;
+    table->loaded = false;
+    table->measured = 0;
+    table->measure_time = 0.0;
+}
+
+static bool add_timing(size_table *table, int height, int width, int nthreads, double seconds){
+    if (table->num_entries == table->capacity){
+        int new_capacity = (table->capacity == 0) ? 16 : 2 * table->capacity;
+        size_timing *grown = realloc(table->entries, new_capacity * sizeof(size_timing));
+        if (!grown)
+            return false;
+        table->entries = grown;
+        table->capacity = new_capacity;
+    }
+    table->entries[table->num_entries].height = height;
+    table->entries[table->num_entries].width = width;
+    table->entries[table->num_entries].nthreads = nthreads;
+    table->entries[table->num_entries].seconds = seconds;
+    table->num_entries++;
+    return true;
+}
+
+bool size_table_load(size_table *table){
+/* Reads "height width nthreads seconds" lines (lines starting with '#' are comments). Tables written before the
+ * thread count was recorded start with another header and are ignored (and replaced by the next save) */
+    FILE *f = fopen(table->path, "r");
+    char line[256];
+    int height, width, nthreads;
+    double seconds;
+
+    if (!f)
+        return false;
+    if (!fgets(line, sizeof(line), f) || strcmp(line, SIZE_TABLE_HEADER) != 0){
+        fclose(f);
+        return false;
+    }
+    while (fgets(line, sizeof(line), f)){
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%d %d %d %lf", &height, &width, &nthreads, &seconds) == 4)
+            add_timing(table, height, width, nthreads, seconds);
+    }
+    fclose(f);
+
+    table->loaded = (table->num_entries > 0);
+    return table->loaded;
+}
+
+bool size_table_save(size_table *table){
+/* Writes the table back if anything was timed during this run */
+    FILE *f;
+    char directory[SIZE_TABLE_PATH_SIZE];
+    char *slash;
+    int i;
+
+    if (table->measured == 0)
+        return true;
+
+    snprintf(directory, sizeof(directory), "%s", table->path);
+    slash = strrchr(directory, '/');
+    if (slash){
+        *slash = '\0';
+        mkdir(directory, 0755); //fails harmlessly if it already exists
+    }
+
+    f = fopen(table->path, "w");
+    if (!f){
+        printf("  WARNING: Could not save transform size timings to %s\n", table->path);
+        return false;
+    }
+    fprintf(f, SIZE_TABLE_HEADER);
+    for (i=0; i<table->num_entries; i++)
+        fprintf(f, "%d %d %d %0.9e\n", table->entries[i].height, table->entries[i].width, table->entries[i].nthreads, table->entries[i].seconds);
+    fclose(f);
+
+    return true;
+}
+
+void size_table_destroy(size_table *table){
+    free(table->entries);
+    table->entries = NULL;
+    table->num_entries = table->capacity = 0;
+}
+
+static double time_transforms(int height, int width, int nthreads){
+/* Best of TIMING_REPS forward + backward transforms of a height x width image. The plans are FFTW_ESTIMATE plans,
+ * so timing a shape doesn't cost a full MEASURE planning run */
+    size_t real_size = (size_t)height * width;
+    size_t complex_size = (size_t)height * (width/2+1);
+    double *real = (double*)fftw_malloc(real_size * sizeof(double));
+    fftw_complex *spectrum = (fftw_complex*)fftw_malloc(complex_size * sizeof(fftw_complex));
+    uint64_t start, stop;
+    double best = -1.0, seconds;
+    size_t i;
+    int rep;
+
+    if (!real || !spectrum){
+        fftw_free(real);
+        fftw_free(spectrum);
+        return -1.0;
+    }
+
+    fftw_plan_with_nthreads(nthreads);
+    fftw_plan forward = fftw_plan_dft_r2c_2d(height, width, real, spectrum, FFTW_ESTIMATE);
+    fftw_plan backward = fftw_plan_dft_c2r_2d(height, width, spectrum, real, FFTW_ESTIMATE);
+    for (i=0; i<real_size; i++)
+        real[i] = (double)(i % 251) / 251.0;
+
+    // One untimed run to warm up the caches, then keep the best run
+    for (rep=0; rep<=TIMING_REPS; rep++){
+        start = timing_now(); //start clock
+        fftw_execute(forward);
+        fftw_execute(backward);
+        stop = timing_now(); //stop clock
+        seconds = timing_elapsed(start, stop);
+        if (rep > 0 && (best < 0.0 || seconds < best))
+            best = seconds;
+    }
+
+    fftw_destroy_plan(forward);
+    fftw_destroy_plan(backward);
+    fftw_free(real);
+    fftw_free(spectrum);
+
+    return best;
+}
+
+double size_table_lookup(size_table *table, int height, int width, int nthreads){
+/* Measured cost of a shape on 'nthreads' threads, timing it (and adding it to the table) if it hasn't been timed on
+ * this host with that many threads before. Returns -1 if the shape could not be timed */
+    uint64_t start, stop;
+    double seconds;
+    int i;
+
+    for (i=0; i<table->num_entries; i++){
+        if (table->entries[i].height == height && table->entries[i].width == width && table->entries[i].nthreads == nthreads)
+            return table->entries[i].seconds;
+    }
+
+    start = timing_now(); //start clock
+    seconds = time_transforms(height, width, nthreads);
+    stop = timing_now(); //stop clock
+    table->measure_time += timing_elapsed(start, stop);
+    if (seconds < 0.0)
+        return -1.0; //could not allocate the test arrays
+    table->measured++;
+    add_timing(table, height, width, nthreads, seconds);
+
+    return seconds;
+}
+
+/*
+ * Size selection
+ */
+
+static int smooth_candidates(int minimum, int *candidates){
+/* 7-smooth sizes from 'minimum' up to the next power of two, in increasing order */
+    int limit = next_power_of_two(minimum);
+    int n, count = 0;
+    for (n=minimum; n<=limit && count<MAX_CANDIDATES; n++){
+        if (is_smooth_size(n))
+            candidates[count++] = n;
+    }
+    if (count == 0 || candidates[count-1] != limit){
+        // Ran out of room before reaching the power of two, which must stay a candidate
+        if (count == MAX_CANDIDATES)
+            count--;
+        candidates[count++] = limit;
+    }
+    return count;
+}
+
+static int shortlist(int *candidates, int count, int keep){
+/* Keeps the 'keep' candidates with the lowest 1D model cost */
+    int i, j;
+    for (i=0; i<count && i<keep; i++){
+        int best = i;
+        for (j=i+1; j<count; j++){
+            if (cost_1d(candidates[j]) < cost_1d(candidates[best]))
+                best = j;
+        }
+        int swap = candidates[i]; candidates[i] = candidates[best]; candidates[best] = swap;
+    }
+    return (count < keep) ? count : keep;
+}
+
+static double shape_cost(size_table *table, int height, int width, int nthreads){
+    return table ? size_table_lookup(table, height, width, nthreads) : fft_cost_model(height, width);
+}
+
+void choose_fft_size(pad_mode mode, size_table *table, int height, int width, int filter_size, int nthreads, size_choice *choice){
+/* Picks the shape to transform a height x width image at
+ *
+ * Inputs
+ * ======
+ *   pad_mode mode
+ *       PAD_NONE keeps the native size. PAD_POW2 and PAD_SMOOTH pad to at least (height + filter_size - 1) x
+ *       (width + filter_size - 1), so that the blur does not wrap around
+ *
+ *   size_table *table
+ *       Measured timings to rank the candidates with (shapes that are missing get timed). If NULL, the cost model
+ *       ranks them
+ *
+ *   size_choice *choice
+ *       Filled in with the chosen shape and its cost relative to the native size
+ *
+ * FFTW's threads must have been initialized if a table is passed. If any shape can't be timed, the costs of
+ * measured and modelled shapes can't be compared, so the model ranks every candidate instead
+ */
+    int row_candidates[MAX_CANDIDATES], col_candidates[MAX_CANDIDATES];
+    int num_rows, num_cols, r, c;
+    double cost;
+
+    choice->native_height = height;
+    choice->native_width = width;
+    choice->min_height = (mode == PAD_NONE) ? height : height + filter_size - 1;
+    choice->min_width = (mode == PAD_NONE) ? width : width + filter_size - 1;
+    choice->native_cost = shape_cost(table, height, width, nthreads);
+    choice->measured = (table != NULL);
+    if (choice->native_cost < 0.0){
+        choose_fft_size(mode, NULL, height, width, filter_size, nthreads, choice);
+        return;
+    }
+
+    if (mode == PAD_NONE){
+        choice->height = height;
+        choice->width = width;
+        choice->candidates = 1;
+    }
+    else if (mode == PAD_POW2){
+        choice->height = next_power_of_two(choice->min_height);
+        choice->width = next_power_of_two(choice->min_width);
+        choice->candidates = 1;
+    }
+    else{
+        num_rows = smooth_candidates(choice->min_height, row_candidates);
+        num_cols = smooth_candidates(choice->min_width, col_candidates);
+
+        // Timing every combination would take too long, so only the model's favourites get timed
+        if (table){
+            num_rows = shortlist(row_candidates, num_rows, MEASURED_CANDIDATES);
+            num_cols = shortlist(col_candidates, num_cols, MEASURED_CANDIDATES);
+        }
+
+        choice->height = row_candidates[0];
+        choice->width = col_candidates[0];
+        choice->cost = -1.0;
+        for (r=0; r<num_rows; r++){
+            for (c=0; c<num_cols; c++){
+                cost = shape_cost(table, row_candidates[r], col_candidates[c], nthreads);
+                if (cost < 0.0){
+                    choose_fft_size(mode, NULL, height, width, filter_size, nthreads, choice);
+                    return;
+                }
+                if (choice->cost < 0.0 || cost < choice->cost){
+                    choice->cost = cost;
+                    choice->height = row_candidates[r];
+                    choice->width = col_candidates[c];
+                }
+            }
+        }
+        choice->candidates = num_rows * num_cols;
+    }
+
+    choice->cost = shape_cost(table, choice->height, choice->width, nthreads);
+    if (choice->cost < 0.0){
+        choose_fft_size(mode, NULL, height, width, filter_size, nthreads, choice);
+        return;
+    }
+    choice->speedup = (choice->cost > 0.0) ? choice->native_cost / choice->cost : 1.0;
+}
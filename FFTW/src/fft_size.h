@@ -0,0 +1,64 @@
+/* Transform size selection: pads images to FFT-friendly (2^a 3^b 5^c 7^d) shapes for a linear convolution */
+#ifndef FFT_SIZE_H
+#define FFT_SIZE_H
+
+#include <stdbool.h>
+
+#define SIZE_TABLE_PATH_SIZE 4096
+
+typedef enum {
+    PAD_NONE,   //transform at the image's own size (circular convolution, the blur wraps around the edges)
+    PAD_POW2,   //next power of two that fits the linear convolution
+    PAD_SMOOTH  //cheapest 2^a 3^b 5^c 7^d shape that fits the linear convolution
+} pad_mode;
+
+typedef enum {
+    SIZE_COST_MODEL,   //rank candidate shapes with an operation-count model
+    SIZE_COST_MEASURED //rank candidate shapes by timing them (timings are kept in a size table)
+} size_cost_source;
+
+typedef struct {
+    int height, width;
+    int nthreads;   //FFTW threads the transforms were timed on
+    double seconds; //one forward + one backward 2D r2c/c2r transform
+} size_timing;
+
+typedef struct {
+    char path[SIZE_TABLE_PATH_SIZE]; //table file, stored next to the wisdom file of this host + FFTW build
+    size_timing *entries;
+    int num_entries;
+    int capacity;
+    bool loaded;                     //true if timings were found and loaded at startup
+    unsigned long measured;          //shapes timed during this run
+    double measure_time;             //seconds spent timing shapes
+} size_table;
+
+typedef struct {
+    int native_height, native_width; //image size
+    int min_height, min_width;       //smallest shape without wraparound (image + filter - 1)
+    int height, width;               //chosen shape
+    int candidates;                  //shapes considered
+    double native_cost;              //cost of transforming at the native size (model units or seconds)
+    double cost;                     //cost of the chosen shape
+    double speedup;                  //native_cost / cost
+    bool measured;                   //costs are measured seconds (false: model units, also when timing failed)
+} size_choice;
+
+bool parse_pad_mode(const char *name, pad_mode *mode);
+const char *pad_mode_name(pad_mode mode);
+bool parse_size_cost(const char *name, size_cost_source *source);
+const char *size_cost_name(size_cost_source source);
+
+int next_power_of_two(int n);
+bool is_smooth_size(int n);
+double fft_cost_model(int height, int width);
+
+void size_table_init(size_table *table, const char *wisdom_path);
+bool size_table_load(size_table *table);
+bool size_table_save(size_table *table);
+void size_table_destroy(size_table *table);
+double size_table_lookup(size_table *table, int height, int width, int nthreads);
+
+void choose_fft_size(pad_mode mode, size_table *table, int height, int width, int filter_size, int nthreads, size_choice *choice);
+
+#endif
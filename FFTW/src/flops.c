@@ -0,0 +1,90 @@
+/* Operation and memory traffic accounting for the benchmarks
+ *
+ * A GFLOP/s figure needs an operation count, and there are two useful ones:
+ *
+ *   - benchFFT's convention counts 5 N log2(N) for a complex transform of N points and half that for a real one,
+ *     whatever algorithm runs. It is really an inverse time scaled by the size, which makes it the figure to
+ *     compare across sizes, hosts and against published benchFFT results, so it is the one reported as GFLOP/s
+ *   - fftw_flops() reports the additions, multiplications and fused multiply-adds the plan actually executes. This
+ *     depends on the algorithm FFTW picked. Note that a SIMD codelet's operation counts once for the whole vector,
+ *     so with SIMD this is a count of arithmetic instructions rather than of scalar flops (it is several times
+ *     lower than the benchFFT count with AVX)
+ *
+ * Bytes are the compulsory traffic of a real transform: N reals in and N/n[rank-1] * (n[rank-1]/2 + 1) complex
+ * values out (or the other way around), so a single precision transform moves half the bytes of a double one.
+ * benchFFT flops per byte is the arithmetic intensity, which together with the GFLOP/s places the run on the host's
+ * roofline. Transforms that don't fit in the cache move more than this, so the GB/s here is a lower bound on the
+ * bandwidth used.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "flops.h"
+
+void flop_count_real_plan(flop_count *count, const fftw_plan plan, int rank, const int *n, int howmany, int executions){
+/* Adds 'executions' runs of a real (r2c or c2r) plan to the count
+ *
+ * Inputs
+ * ======
+ *   int rank, const int *n
+ *       Logical size of one transform, as given to the planner
+ *
+ *   int howmany
+ *       Transforms per execution (1 unless the plan is batched)
+ */
+    double add, mul, fma;
+    fftw_flops(plan, &add, &mul, &fma);
+    flop_count_real_ops(count, add, mul, fma, sizeof(double), rank, n, howmany, executions);
+}
+
+void flop_count_real_ops(flop_count *count, double add, double mul, double fma, size_t real_bytes, int rank, const int *n, int howmany, int executions){
+/* Same, from the operation counts of a plan of any precision (fftwf_flops(), fftwl_flops(), ...) whose reals are
+ * 'real_bytes' wide */
+    double points = 1.0;
+    int d;
+    for (d=0; d<rank; d++)
+        points *= n[d];
+    double complex_points = points / n[rank-1] * (n[rank-1]/2 + 1);
+
+    count->adds += add * executions;
+    count->muls += mul * executions;
+    count->fmas += fma * executions;
+    count->fftw_ops += (add + mul + 2.0 * fma) * executions;
+    count->benchfft_flops += 2.5 * points * log2(points) * howmany * executions;
+    count->bytes += (points * real_bytes + complex_points * 2 * real_bytes) * howmany * executions;
+    count->transforms += (unsigned long)howmany * executions;
+    count->executions += executions;
+}
+
+void flop_count_rates(const flop_count *count, double seconds, flop_rates *rates){
+/* Rates over the 'seconds' the counted executions took */
+    memset(rates, 0, sizeof(flop_rates));
+    if (count->bytes > 0.0)
+        rates->arithmetic_intensity = count->benchfft_flops / count->bytes;
+    if (seconds <= 0.0)
+        return;
+    rates->gflops = count->benchfft_flops / seconds * 1.0e-9;
+    rates->fftw_gops = count->fftw_ops / seconds * 1.0e-9;
+    rates->gbytes_per_second = count->bytes / seconds * 1.0e-9;
+}
+
+void flop_rates_json(FILE *f, const char *indent, const flop_count *count, const flop_rates *rates, bool last){
+/* Writes the accounting fields into an open JSON object, one per line. Per-transform counts are averages */
+    double transforms = (count->transforms > 0) ? (double)count->transforms : 1.0;
+    fprintf(f, "%s\"transforms\": %lu,\n", indent, count->transforms);
+    fprintf(f, "%s\"benchfft_flops_per_transform\": %0.1f,\n", indent, count->benchfft_flops / transforms);
+    fprintf(f, "%s\"fftw_ops_per_transform\": %0.1f,\n", indent, count->fftw_ops / transforms);
+    fprintf(f, "%s\"fftw_adds_per_transform\": %0.1f,\n", indent, count->adds / transforms);
+    fprintf(f, "%s\"fftw_muls_per_transform\": %0.1f,\n", indent, count->muls / transforms);
+    fprintf(f, "%s\"fftw_fmas_per_transform\": %0.1f,\n", indent, count->fmas / transforms);
+    fprintf(f, "%s\"bytes_per_transform\": %0.1f,\n", indent, count->bytes / transforms);
+    fprintf(f, "%s\"average_gflops\": %0.5f,\n", indent, rates->gflops);
+    fprintf(f, "%s\"fftw_gops_per_second\": %0.5f,\n", indent, rates->fftw_gops);
+    fprintf(f, "%s\"gbytes_per_second\": %0.5f,\n", indent, rates->gbytes_per_second);
+    fprintf(f, "%s\"arithmetic_intensity_flops_per_byte\": %0.5f%s\n", indent, rates->arithmetic_intensity, last ? "" : ",");
+}
+
+void flop_rates_print(const char *name, const flop_count *count, const flop_rates *rates){
+    printf("    %s: %0.3f GFLOP/s (benchFFT), %0.3f Gops/s (fftw_flops), %0.3f GB/s, %0.3f flops/byte over %lu transforms\n", name, rates->gflops, rates->fftw_gops, rates->gbytes_per_second, rates->arithmetic_intensity, count->transforms);
+}
@@ -0,0 +1,32 @@
+/* Operation and memory traffic accounting for executed plans: GFLOP/s (benchFFT), FFTW's own op count, GB/s, flops/byte */
+#ifndef FLOPS_H
+#define FLOPS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <fftw3.h>
+
+typedef struct {
+    double fftw_ops;       //counted by FFTW for the executed plans (adds + muls + 2 fmas, a SIMD operation counts once)
+    double adds, muls, fmas;
+    double benchfft_flops; //benchFFT convention: 2.5 N log2(N) per real transform of N points
+    double bytes;          //compulsory traffic: every input read once, every output written once
+    unsigned long transforms;
+    unsigned long executions;
+} flop_count;
+
+typedef struct {
+    double gflops;               //benchFFT convention, comparable across sizes and with published results
+    double fftw_gops;            //from fftw_flops(), the arithmetic operations the plans actually executed
+    double gbytes_per_second;
+    double arithmetic_intensity; //benchFFT flops per byte, the x-axis of a roofline
+} flop_rates;
+
+void flop_count_real_plan(flop_count *count, const fftw_plan plan, int rank, const int *n, int howmany, int executions);
+void flop_count_real_ops(flop_count *count, double add, double mul, double fma, size_t real_bytes, int rank, const int *n, int howmany, int executions);
+void flop_count_rates(const flop_count *count, double seconds, flop_rates *rates);
+
+void flop_rates_json(FILE *f, const char *indent, const flop_count *count, const flop_rates *rates, bool last);
+void flop_rates_print(const char *name, const flop_count *count, const flop_rates *rates);
+
+#endif
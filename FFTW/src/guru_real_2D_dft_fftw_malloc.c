@@ -4,6 +4,7 @@
 #include <stdio.h>
 //#include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <fftw3.h>
 #include <MagickWand.h>
 #include <math.h>
@@ -13,14 +14,32 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
+#include "plan_cache.h"
+#include "wisdom.h"
+#include "kernel_cache.h"
+#include "spectral_multiply.h"
+#include "image_io.h"
+#include "pipeline.h"
+#include "worker_pool.h"
+#include "fft_size.h"
+#include "tiled.h"
+#include "convolution.h"
+#include "timing.h"
+#include "perf_counters.h"
+#include "flops.h"
+#include "results.h"
+#include "thread_backend.h"
+#include "numa_alloc.h"
+#include "precision.h"
 
-#define BUFFSIZE 4096
 #define ALIGNMENT 16   //for aligned allocation --> set to page size, NOT number of bytes in AVX* instructions
 #define NITERS 1000       //number of times we should replicate the image blurring before finding an average
 #define PI 3.14159265359
 #define D0 3             //standard deviation for blurring --> https://en.wikipedia.org/wiki/Gaussian_blur
 #define FILTER_SIZE 16   //gaussian blur filter size
 #define TIMELIMIT 2      //this tells FFTW to spend no more than X seconds on finding an "acceptable" algorithm
+#define LATENCY_PHASES 6 //plan, copy-in, forward DFT, multiply, backward DFT and the whole iteration
 //#define DEBUG            //to print out debug statements
 //#define SAVEIMAGE        //to save the resulting blured image (this is optional)
 #define IMAGE "test_images/cat.jpeg" //image to blur
@@ -30,62 +49,1313 @@
 #endif
 
 
-double G(double x, double y, double sigma){
-    /*
-     * This function computes G(x,y), the gaussian distribution for 2 dimensions
-     */
+enum {PHASE_PLAN, PHASE_COPY_IN, PHASE_FORWARD, PHASE_MULTIPLY, PHASE_BACKWARD, PHASE_ITERATION};
 
-    return (1.0 / (2.0 * PI * sigma * sigma)) * exp( -(x*x + y*y) / (2.0 * sigma * sigma));
-    //return exp( -(x*x + y*y) / (2.0 * sigma * sigma));
+typedef struct {
+    // Where to stage the image
+    double *r, *g, *b;      //separate engine: one input array per channel
+    double *batch;          //batched engine: the batch's input buffer, this image's planes are 3*index .. 3*index+2
+    int index;
+    int istride, idist;
+    size_t real_row_width;
+    int width, height;
+    int padded_width, padded_height; //transform size, the padding around the image is zeroed
+
+    // What to stage: 'channels', or (if decode is true) a fresh decode of 'path'
+    double *channels[3];
+    bool decode;
+    const char *path;
+    simd_level simd;
+    thread_backend *threads; //splits the copy across a thread backend's threads (NULL copies on the calling thread)
+
+    // Results
+    image_status status;
+    double decode_time;     //seconds spent decoding, exporting and converting the image
+    double copy_time;       //seconds spent copying the channels into the input arrays
+} staging_job;
+
+typedef struct {
+    staging_job *job;
+    double **channels;
+} copy_job;
+
+static void copy_rows(void *arg, int begin, int end){
+/* Copies rows [begin, end) of the staged image into the input arrays. Row y of channel c is row c*padded_height + y.
+ * Rows are real_row_width apart, which leaves room for the padding when transforming in place. When the image is
+ * padded to a larger transform size, the padding has to be zeroed every time, since the transforms (and the other
+ * staging set) may have left data there */
+    copy_job *copy = (copy_job*)arg;
+    staging_job *job = copy->job;
+    double *in[3] = {job->r, job->g, job->b};
+    size_t x, y;
+    int c, row;
+
+    for (row=begin; row<end; row++){
+        c = row / job->padded_height;
+        y = row % job->padded_height;
+        if (job->batch){
+            double *plane = job->batch + (size_t)(3*job->index + c)*job->idist;
+            for (x=0; x<job->padded_width; x++)
+                plane[(y*job->real_row_width + x)*job->istride] = (y < job->height && x < job->width) ? copy->channels[c][y*job->width + x] : 0.0;
+        }
+        else if (y < job->height){
+            memcpy(in[c] + y*job->real_row_width, copy->channels[c] + y*job->width, job->width * sizeof(double));
+            memset(in[c] + y*job->real_row_width + job->width, 0, (job->padded_width - job->width) * sizeof(double));
+        }
+        else
+            memset(in[c] + y*job->real_row_width, 0, job->padded_width * sizeof(double));
+    }
+}
+
+static void stage_image(void *arg){
+/* Copies one image's R, G and B channels into the transform input arrays, decoding the image first if asked to.
+ * This runs on the main thread, or (with --staging=async) on a staging worker while the previous batch is being
+ * transformed */
+    staging_job *job = (staging_job*)arg;
+    struct timeval start, stop;
+    planar_image image;
+    copy_job copy = {job, job->channels};
+    double *decoded[3];
+
+    job->status = IMAGE_OK;
+    job->decode_time = 0.0;
+    job->copy_time = 0.0;
+    if (job->decode){
+        gettimeofday(&start, NULL); //start clock
+        job->status = image_load_planar(job->path, &image, job->simd);
+        gettimeofday(&stop, NULL); //stop clock
+        job->decode_time = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) * (1.0e-6);
+        if (job->status != IMAGE_OK)
+            return;
+        decoded[0] = image.red;
+        decoded[1] = image.green;
+        decoded[2] = image.blue;
+        copy.channels = decoded;
+    }
+
+    gettimeofday(&start, NULL); //start clock
+    if (job->threads)
+        thread_backend_parallel_for(job->threads, 3 * job->padded_height, copy_rows, &copy);
+    else
+        copy_rows(&copy, 0, 3 * job->padded_height);
+    gettimeofday(&stop, NULL); //stop clock
+    job->copy_time = (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) * (1.0e-6);
+
+    if (job->decode)
+        image_free_planar(&image);
+}
+
+static void stream_images(const char *input, bool input_is_list, pipeline_config *config, size_cost_source size_cost, const char *filename, bool use_wisdom, char *wisdom_dir, struct timeval program_start){
+/* Streaming mode of the benchmark
+ *
+ * Inputs
+ * ======
+ *   const char *input
+ *       Directory of images, or (if input_is_list is true) a file listing one image path per line
+ *
+ *   pipeline_config *config
+ *       Pipeline settings from the command line. The paths, plan cache, kernel cache and size table are filled
+ *       in here
+ *
+ *   size_cost_source size_cost
+ *       How transform sizes are chosen (SIZE_COST_MEASURED uses, and extends, the timings saved on this host)
+ *
+ *   const char *filename
+ *       JSON document to append the results to
+ */
+    int num_paths = input_is_list ? pipeline_read_file_list(input, &config->paths) : pipeline_list_directory(input, &config->paths);
+    if (num_paths < 0){
+        printf("Could not read %s `%s`. Exiting.\n", input_is_list ? "image list" : "image directory", input);
+        exit(0);
+    }
+    if (num_paths == 0){
+        printf("No images found in `%s`. Exiting.\n", input);
+        exit(0);
+    }
+    config->num_paths = num_paths;
+    if (config->output_dir && access(config->output_dir, W_OK) != 0){
+        printf("Output directory `%s` does not exist or is not writable. Exiting.\n", config->output_dir);
+        exit(0);
+    }
+
+    // Same setup as the single-image mode: FFTW threads, wisdom, and the plan and kernel caches (only the blur
+    // stage plans, so these are never shared between threads)
+    MagickWandGenesis();
+    fftw_set_timelimit(TIMELIMIT);
+    fftw_init_threads();
+    fftw_plan_with_nthreads(config->nthreads);
+
+    wisdom_store wisdom;
+    wisdom_init(&wisdom, wisdom_dir);
+    wisdom.enabled = use_wisdom;
+    wisdom_load(&wisdom);
+
+    plan_cache cache;
+    plan_cache_init(&cache);
+    kernel_cache kernels;
+    kernel_cache_init(&kernels);
+    config->plans = &cache;
+    config->kernels = &kernels;
+
+    // Transform sizes are chosen per image shape, as the shapes come along
+    size_table sizes;
+    size_table_init(&sizes, wisdom.path);
+    if (size_cost == SIZE_COST_MEASURED)
+        size_table_load(&sizes);
+    config->sizes = (size_cost == SIZE_COST_MEASURED) ? &sizes : NULL;
+
+#ifdef DEBUG
+    printf("<< STREAMING %d IMAGES (%d passes) >>\n", num_paths, config->passes);
+#endif
+    pipeline_stats stats;
+    if (!pipeline_run(config, &stats)){
+        printf("Could not set up the streaming pipeline. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_rss_kb = usage.ru_maxrss;
+
+    wisdom_save(&wisdom);
+    size_table_save(&sizes);
+    size_table_destroy(&sizes);
+    struct timeval program_stop;
+    gettimeofday(&program_stop, NULL);
+    double program_time = (program_stop.tv_sec - program_start.tv_sec) + (program_stop.tv_usec - program_start.tv_usec) * (1.0e-6);
+
+    unsigned long plans_created = cache.misses;
+    unsigned long plan_cache_hits = cache.hits;
+    double total_planning_time = cache.total_planning_time;
+    plan_cache_destroy(&cache);
+    unsigned long filter_spectra_created = kernels.misses;
+    double filter_setup_time = kernels.total_setup_time;
+    kernel_cache_destroy(&kernels);
+    fftw_cleanup_threads();
+
+    const char *bottleneck = pipeline_bottleneck(&stats);
+    const char *stage_names[3] = {"decode", "blur", "encode"};
+    pipeline_stage_stats *stages[3] = {&stats.decode, &stats.blur, &stats.encode};
+    const char *queue_names[2] = {"decode_to_blur", "blur_to_encode"};
+    pipeline_queue_stats *queues[2] = {&stats.decoded, &stats.blurred};
+    int s;
+
+    // Save as JSON
+    results_record record;
+    FILE *results_file = results_begin(&record, filename);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"mode\": \"streaming\",\n");
+    fprintf(results_file, "                \"input\": ");
+    results_json_string(results_file, input);
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"num_files\": %d,\n", num_paths);
+    fprintf(results_file, "                \"passes\": %d,\n", config->passes);
+    fprintf(results_file, "                \"threads\": %d,\n", config->nthreads);
+    fprintf(results_file, "                \"decode_threads\": %d,\n", config->decode_threads);
+    fprintf(results_file, "                \"queue_depth\": %d,\n", config->queue_depth);
+    fprintf(results_file, "                \"output_dir\": ");
+    results_json_string(results_file, config->output_dir ? config->output_dir : "");
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"plan_mode\": \"%s\",\n", config->cache_plans ? "cached" : "replan");
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(config->flags));
+    fprintf(results_file, "                \"simd\": \"%s\",\n", simd_level_name(config->simd));
+    fprintf(results_file, "                \"pad\": \"%s\",\n", pad_mode_name(config->pad));
+    fprintf(results_file, "                \"size_cost\": \"%s\"\n", size_cost_name(size_cost));
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"streaming\": {\n");
+    fprintf(results_file, "                \"images\": %lu,\n", stats.images);
+    fprintf(results_file, "                \"failed\": %lu,\n", stats.failed);
+    fprintf(results_file, "                \"wall_time_seconds\": %0.5f,\n", stats.wall_time);
+    fprintf(results_file, "                \"images_per_second\": %0.5f,\n", stats.images_per_second);
+    fprintf(results_file, "                \"bottleneck\": \"%s\",\n", bottleneck);
+    fprintf(results_file, "                \"stages\": {\n");
+    for (s=0; s<3; s++){
+        fprintf(results_file, "                    \"%s\": {\n", stage_names[s]);
+        fprintf(results_file, "                        \"threads\": %d,\n", stages[s]->threads);
+        fprintf(results_file, "                        \"images\": %lu,\n", stages[s]->items);
+        fprintf(results_file, "                        \"busy_time_seconds\": %0.5f,\n", stages[s]->busy_time);
+        fprintf(results_file, "                        \"utilization\": %0.5f\n", stages[s]->utilization);
+        fprintf(results_file, "                    }%s\n", (s < 2) ? "," : "");
+    }
+    fprintf(results_file, "                },\n");
+    fprintf(results_file, "                \"queues\": {\n");
+    for (s=0; s<2; s++){
+        fprintf(results_file, "                    \"%s\": {\n", queue_names[s]);
+        fprintf(results_file, "                        \"capacity\": %zu,\n", queues[s]->capacity);
+        fprintf(results_file, "                        \"average_occupancy\": %0.5f,\n", queues[s]->average_occupancy);
+        fprintf(results_file, "                        \"max_occupancy\": %zu,\n", queues[s]->max_occupancy);
+        fprintf(results_file, "                        \"full_stalls\": %lu,\n", queues[s]->full_stalls);
+        fprintf(results_file, "                        \"empty_stalls\": %lu\n", queues[s]->empty_stalls);
+        fprintf(results_file, "                    }%s\n", (s < 1) ? "," : "");
+    }
+    fprintf(results_file, "                }\n");
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"plan_cache\": {\n");
+    fprintf(results_file, "                \"plans_created\": %lu,\n", plans_created);
+    fprintf(results_file, "                \"cache_hits\": %lu,\n", plan_cache_hits);
+    fprintf(results_file, "                \"planning_time_seconds\": %0.5f\n", total_planning_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"filter\": {\n");
+    fprintf(results_file, "                \"spectrum\": \"%s\",\n", config->analytic_filter ? "analytic" : "fft");
+    fprintf(results_file, "                \"spectra_created\": %lu,\n", filter_spectra_created);
+    fprintf(results_file, "                \"setup_time_seconds\": %0.5f\n", filter_setup_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"transform_sizes\": {\n");
+    fprintf(results_file, "                \"shapes\": [\n");
+    for (s=0; s<stats.num_sizes; s++){
+        size_choice *size = &stats.sizes[s];
+        fprintf(results_file, "                    {\"native_dims\": [%d, %d], \"padded_dims\": [%d, %d], \"candidates\": %d, \"speedup_vs_native\": %0.5f}%s\n", size->native_width, size->native_height, size->width, size->height, size->candidates, size->speedup, (s < stats.num_sizes-1) ? "," : "");
+    }
+    fprintf(results_file, "                ],\n");
+    fprintf(results_file, "                \"shapes_timed\": %lu,\n", sizes.measured);
+    fprintf(results_file, "                \"timing_time_seconds\": %0.5f\n", sizes.measure_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"wisdom\": {\n");
+    fprintf(results_file, "                \"file\": ");
+    results_json_string(results_file, use_wisdom ? wisdom.path : "");
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"imported\": %s\n", wisdom.imported ? "true" : "false");
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"memory\": {\n");
+    fprintf(results_file, "                \"peak_rss_kilobytes\": %ld\n", peak_rss_kb);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"misc\": {\n");
+    fprintf(results_file, "                \"program_time_seconds\": %0.5f\n", program_time);
+    fprintf(results_file, "            }\n");
+    fprintf(results_file, "        }\n");
+    results_end(&record);
+
+    // Print out performance results
+    printf("\nPERFORMANCE RESULTS (STREAMING)\n");
+    printf("===============================\n");
+    printf("Operations:\n");
+    printf("    %lu images blurred (%d files x %d passes), %lu failed\n", stats.images, num_paths, config->passes, stats.failed);
+    printf("    %d FFTW threads, %d decode threads, queue depth %zu\n", config->nthreads, config->decode_threads, stats.decoded.capacity);
+    if (config->output_dir)
+        printf("    Blurred images written to %s\n", config->output_dir);
+    printf("Throughput\n");
+    printf("    %0.3f images/sec (%0.3f sec wall time)\n", stats.images_per_second, stats.wall_time);
+    printf("Stages (busy time / utilization)\n");
+    for (s=0; s<3; s++){
+        if (stages[s]->threads > 0)
+            printf("    %-7s %d thread%s, %lu images, %0.3f sec busy, %5.1f%% utilized\n", stage_names[s], stages[s]->threads, (stages[s]->threads == 1) ? " " : "s", stages[s]->items, stages[s]->busy_time, 100.0 * stages[s]->utilization);
+    }
+    printf("    Bottleneck: %s\n", bottleneck);
+    printf("Queues (occupancy)\n");
+    for (s=0; s<(config->output_dir ? 2 : 1); s++)
+        printf("    %-15s average %0.2f, max %zu of %zu, %lu full stalls, %lu empty stalls\n", queue_names[s], queues[s]->average_occupancy, queues[s]->max_occupancy, queues[s]->capacity, queues[s]->full_stalls, queues[s]->empty_stalls);
+    printf("Plan cache\n");
+    printf("    %lu plans created, %lu cache hits, %0.3f sec spent planning\n", plans_created, plan_cache_hits, total_planning_time);
+    printf("    %lu filter spectra created, %0.5f sec setup\n", filter_spectra_created, filter_setup_time);
+    printf("Transform sizes (%s padding, %s cost)\n", pad_mode_name(config->pad), size_cost_name(size_cost));
+    for (s=0; s<stats.num_sizes; s++)
+        printf("    %dx%d -> %dx%d, %0.2fx vs. native\n", stats.sizes[s].native_width, stats.sizes[s].native_height, stats.sizes[s].width, stats.sizes[s].height, stats.sizes[s].speedup);
+    if (size_cost == SIZE_COST_MEASURED)
+        printf("    %lu shapes timed (%0.3f sec)\n", sizes.measured, sizes.measure_time);
+    printf("Memory\n");
+    printf("    %0.1f MB peak RSS\n\n", peak_rss_kb / 1024.0);
+
+    free(stats.sizes);
+    pipeline_free_paths(config->paths, num_paths);
 }
 
-void complex_multiply(double a_real, double a_complex, double b_real, double b_complex, double *real_result, double *complex_result){
+static void tile_images(planar_image *image, int niters, int nthreads, unsigned flags, bool analytic_filter, simd_level simd, tile_cache_level cache_level, int tile_transform, int warmup, clock_source timer_source, wisdom_store *wisdom, bool use_wisdom, const char *filename, struct timeval program_start){
+/* Tiled mode of the benchmark
+ *
+ * Inputs
+ * ======
+ *   planar_image *image
+ *       The loaded image, blurred 'niters' times
+ *
+ *   tile_cache_level cache_level
+ *       Cache the tiles are sized for
+ *
+ *   int tile_transform
+ *       Transform size per tile side from "--tile" (0 sizes the tiles from the cache)
+ *
+ *   int warmup, clock_source timer_source
+ *       Images left out of the latency percentiles ("--warmup"), and the clock they are timed with ("--clock")
+ *
+ *   wisdom_store *wisdom
+ *       Wisdom loaded by the caller, saved again here
+ *
+ *   const char *filename
+ *       JSON document to append the results to
+ */
+    int height = image->height, width = image->width;
+    int c, k;
+
+    tile_geometry geometry;
+    choose_tile_geometry(height, width, FILTER_SIZE, nthreads, cache_level, tile_transform, &geometry);
+#ifdef DEBUG
+    printf("<< TILING %d x %d IMAGE >>\n", width, height);
+    printf("  %d x %d tiles of %d x %d (transform %d x %d), %zu byte working set\n\n", geometry.tiles_x, geometry.tiles_y, geometry.tile, geometry.tile, geometry.transform, geometry.transform, geometry.working_set_bytes);
+#endif
+
+    // The whole-image engine would transform the image padded to the linear convolution size in one go
+    size_choice whole;
+    choose_fft_size(PAD_SMOOTH, NULL, height, width, FILTER_SIZE, nthreads, &whole);
+    size_t whole_image_bytes = 3 * ((size_t)whole.height * whole.width * sizeof(double) + (size_t)whole.height * (whole.width/2+1) * sizeof(fftw_complex));
+
+    // Single-threaded tile plans from the plan cache, one filter spectrum from the kernel cache
+    plan_cache cache;
+    plan_cache_init(&cache);
+    kernel_cache kernels;
+    kernel_cache_init(&kernels);
+    tiled_engine engine;
+    if (!tiled_engine_init(&engine, &cache, &kernels, height, width, D0, FILTER_SIZE, analytic_filter, &geometry, nthreads, flags, simd)){
+        printf("Could not set up the tiled engine. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double *out[3];
+    for (c=0; c<3; c++){
+        out[c] = (double*)fftw_malloc(sizeof(double) * (size_t)height * width);
+        if (!out[c]){
+            printf("Could not allocate memory for the blurred image. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    double *in[3] = {image->red, image->green, image->blue};
+
+    // Every image is recorded, so that the tail latencies can be reported and not just the totals. The first
+    // 'warmup' images are left out
+    latency_histogram latency;
+    latency_summary image_latency;
+    if (!latency_histogram_init(&latency, warmup)){
+        printf("Could not allocate the latency histogram. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t wall_time_start, wall_time_stop, image_start;
+    struct timeval first_image_stop;
+    wall_time_start = timing_now(); //start clock
+    for (k=0; k<niters; k++){
+        image_start = timing_now(); //start clock
+        tiled_blur(&engine, in, out);
+        latency_histogram_record(&latency, timing_elapsed(image_start, timing_now()));
+        if (k == 0)
+            gettimeofday(&first_image_stop, NULL); //same clock as program_start
+    }
+    wall_time_stop = timing_now(); //stop clock
+    latency_histogram_summarize(&latency, &image_latency);
+    latency_histogram_destroy(&latency);
+    double wall_time = timing_elapsed(wall_time_start, wall_time_stop);
+    double time_to_first_image = (first_image_stop.tv_sec - program_start.tv_sec) + (first_image_stop.tv_usec - program_start.tv_usec) * (1.0e-6);
+    double images_per_sec = (wall_time > 0.0) ? niters / wall_time : 0.0;
+
+#ifdef SAVEIMAGE
+    planar_image blurred = *image;
+    blurred.red = out[0];
+    blurred.green = out[1];
+    blurred.blue = out[2];
+    if (image_save_planar(OUTIMAGE, &blurred) != IMAGE_OK)
+        printf("Could not write `%s`.\n", OUTIMAGE);
+#endif
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_rss_kb = usage.ru_maxrss;
+
+    wisdom_save(wisdom);
+    struct timeval program_stop;
+    gettimeofday(&program_stop, NULL);
+    double program_time = (program_stop.tv_sec - program_start.tv_sec) + (program_stop.tv_usec - program_start.tv_usec) * (1.0e-6);
+
+    size_t tile_buffer_bytes = (size_t)nthreads * engine.buffer_bytes;
+    tiled_engine_destroy(&engine);
+    for (c=0; c<3; c++)
+        fftw_free(out[c]);
+
+    unsigned long plans_created = cache.misses;
+    unsigned long plan_cache_hits = cache.hits;
+    double total_planning_time = cache.total_planning_time;
+    plan_cache_destroy(&cache);
+    unsigned long filter_spectra_created = kernels.misses;
+    double filter_setup_time = kernels.total_setup_time;
+    kernel_cache_destroy(&kernels);
+    fftw_cleanup_threads();
+
+    // Save as JSON
+    results_record record;
+    FILE *results_file = results_begin(&record, filename);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"num_images\": %d,\n", niters);
+    fprintf(results_file, "                \"image_dims\": [%d, %d],\n", width, height);
+    fprintf(results_file, "                \"threads\": %d,\n", nthreads);
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(flags));
+    fprintf(results_file, "                \"engine\": \"tiled\",\n");
+    fprintf(results_file, "                \"simd\": \"%s\"\n", simd_level_name(simd));
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"tiling\": {\n");
+    fprintf(results_file, "                \"method\": \"overlap_save\",\n");
+    fprintf(results_file, "                \"sized_for\": \"%s\",\n", geometry.cache_bytes ? tile_cache_level_name(cache_level) : "manual");
+    fprintf(results_file, "                \"cache_bytes\": %zu,\n", geometry.cache_bytes);
+    fprintf(results_file, "                \"transform_dims\": [%d, %d],\n", geometry.transform, geometry.transform);
+    fprintf(results_file, "                \"tile_dims\": [%d, %d],\n", geometry.tile, geometry.tile);
+    fprintf(results_file, "                \"overlap\": %d,\n", geometry.overlap);
+    fprintf(results_file, "                \"tiles_per_image\": %d,\n", geometry.tiles_x * geometry.tiles_y);
+    fprintf(results_file, "                \"tiles\": %lu,\n", engine.tiles);
+    fprintf(results_file, "                \"working_set_bytes\": %zu,\n", geometry.working_set_bytes);
+    fprintf(results_file, "                \"whole_image_dims\": [%d, %d],\n", whole.width, whole.height);
+    fprintf(results_file, "                \"whole_image_buffer_bytes\": %zu\n", whole_image_bytes);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"phases\": {\n");
+    fprintf(results_file, "                \"copy_time_seconds\": %0.5f,\n", engine.copy_time);
+    fprintf(results_file, "                \"forward_dft_time_seconds\": %0.5f,\n", engine.fft_time);
+    fprintf(results_file, "                \"blur_time_seconds\": %0.5f,\n", engine.multiply_time);
+    fprintf(results_file, "                \"backward_dft_time_seconds\": %0.5f\n", engine.ifft_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"plan_cache\": {\n");
+    fprintf(results_file, "                \"plans_created\": %lu,\n", plans_created);
+    fprintf(results_file, "                \"cache_hits\": %lu,\n", plan_cache_hits);
+    fprintf(results_file, "                \"planning_time_seconds\": %0.5f\n", total_planning_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"filter\": {\n");
+    fprintf(results_file, "                \"spectrum\": \"%s\",\n", analytic_filter ? "analytic" : "fft");
+    fprintf(results_file, "                \"spectra_created\": %lu,\n", filter_spectra_created);
+    fprintf(results_file, "                \"setup_time_seconds\": %0.5f\n", filter_setup_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"wisdom\": {\n");
+    fprintf(results_file, "                \"file\": ");
+    results_json_string(results_file, use_wisdom ? wisdom->path : "");
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"imported\": %s,\n", wisdom->imported ? "true" : "false");
+    fprintf(results_file, "                \"time_to_first_image_seconds\": %0.5f\n", time_to_first_image);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"latency\": {\n");
+    fprintf(results_file, "                \"clock\": \"%s\",\n", clock_source_name(timer_source));
+    fprintf(results_file, "                \"warmup_iterations\": %d,\n", warmup);
+    fprintf(results_file, "                \"phases\": {\n");
+    latency_summary_json(results_file, "                    ", "iteration", &image_latency, true);
+    fprintf(results_file, "                }\n");
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"memory\": {\n");
+    fprintf(results_file, "                \"transform_buffer_bytes\": %zu,\n", tile_buffer_bytes);
+    fprintf(results_file, "                \"peak_rss_kilobytes\": %ld\n", peak_rss_kb);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"misc\": {\n");
+    fprintf(results_file, "                \"wall_time_seconds\": %0.5f,\n", wall_time);
+    fprintf(results_file, "                \"images_per_second\": %0.5f,\n", images_per_sec);
+    fprintf(results_file, "                \"program_time_seconds\": %0.5f\n", program_time);
+    fprintf(results_file, "            }\n");
+    fprintf(results_file, "        }\n");
+    results_end(&record);
+
+    // Print out performance results
+    printf("\nPERFORMANCE RESULTS (TILED)\n");
+    printf("===========================\n");
+    printf("Operations:\n");
+    printf("    %d images of size %dx%d blurred\n", niters, width, height);
+    printf("    %d threads used, plan effort: %s\n", nthreads, plan_effort_name(flags));
+    printf("Tiling (overlap-save)\n");
+    if (geometry.cache_bytes)
+        printf("    Sized for %0.0f KB of %s per thread\n", geometry.cache_bytes / 1024.0, (cache_level == TILE_CACHE_LLC) ? "last level cache" : "L2");
+    else
+        printf("    Tile size set with --tile\n");
+    printf("    %dx%d tiles (%dx%d transforms, %d pixel overlap), %d x %d = %d tiles per image\n", geometry.tile, geometry.tile, geometry.transform, geometry.transform, geometry.overlap, geometry.tiles_x, geometry.tiles_y, geometry.tiles_x * geometry.tiles_y);
+    printf("    %0.1f KB working set per tile vs. %0.1f MB for a %dx%d whole-image transform\n", geometry.working_set_bytes / 1024.0, whole_image_bytes / (1024.0 * 1024.0), whole.width, whole.height);
+    printf("Phases (summed over threads)\n");
+    printf("    %0.3f sec copying, %0.3f sec FFT, %0.3f sec blur (%s kernel), %0.3f sec IFFT\n", engine.copy_time, engine.fft_time, engine.multiply_time, simd_level_name(simd), engine.ifft_time);
+    printf("Plan cache\n");
+    printf("    %lu plans created, %lu cache hits, %0.3f sec spent planning\n", plans_created, plan_cache_hits, total_planning_time);
+    printf("    %lu filter spectra created, %0.5f sec setup\n", filter_spectra_created, filter_setup_time);
+    printf("    Time to first image: %0.3f sec (includes loading the image, wisdom and planning)\n", time_to_first_image);
+    printf("Memory\n");
+    printf("    %0.1f MB of tile buffers, %0.1f MB peak RSS\n", tile_buffer_bytes / (1024.0 * 1024.0), peak_rss_kb / 1024.0);
+    printf("Latency per image (%lu recorded after %d warm-up, %s clock)\n", image_latency.count, warmup, clock_source_name(timer_source));
+    latency_summary_print("iteration", &image_latency);
+    printf("Wall time\n");
+    printf("    Took %0.3f sec to blur %d images\n", wall_time, niters);
+    printf("    %0.3f images/sec\n\n", images_per_sec);
+}
+
+static void convolve_images(planar_image *image, int niters, int nthreads, unsigned flags, bool analytic_filter, simd_level simd, conv_engine engine, bool sweep, int warmup, clock_source timer_source, wisdom_store *wisdom, bool use_wisdom, const char *filename, struct timeval program_start){
+/* Convolution backend mode of the benchmark
+ *
+ * Inputs
+ * ======
+ *   planar_image *image
+ *       The loaded image, blurred 'niters' times (each blur is one request to the backend)
+ *
+ *   conv_engine engine
+ *       Engine from "--convolution". CONV_AUTO routes every request to the engine measured to be fastest for its
+ *       shape
+ *
+ *   bool sweep
+ *       If true, first calibrate a grid of image and filter sizes and report where the FFT starts to win
+ *
+ *   wisdom_store *wisdom, bool use_wisdom
+ *       Wisdom loaded by the caller, saved again here. The calibration table is kept next to it, and like the wisdom
+ *       is neither loaded nor saved with "--no-wisdom"
+ *
+ *   const char *filename
+ *       JSON document to append the results to
+ */
+    int sweep_filters[] = {3, 5, 9, FILTER_SIZE, 31};
+    int sweep_sizes[] = {64, 128, 256, 512, 1024};
+    int num_sweep_filters = sweep ? (int)(sizeof(sweep_filters) / sizeof(int)) : 0;
+    int num_sweep_sizes = (int)(sizeof(sweep_sizes) / sizeof(int));
+    conv_engine sweep_best[sizeof(sweep_filters) / sizeof(int)][sizeof(sweep_sizes) / sizeof(int)];
+    int height = image->height, width = image->width;
+    int c, f, s, k;
+
+    plan_cache cache;
+    plan_cache_init(&cache);
+    kernel_cache kernels;
+    kernel_cache_init(&kernels);
+    conv_table table;
+    conv_table_init(&table, wisdom->path);
+    if (use_wisdom)
+        conv_table_load(&table);
+
+    // Crossover sweep: every engine on square images of each size, for each filter size. A crossover is a size whose
+    // fastest engine differs from the next smaller size's
+    for (f=0; f<num_sweep_filters; f++){
+        conv_backend sweep_backend;
+        if (!conv_backend_init(&sweep_backend, &cache, &kernels, &table, D0, sweep_filters[f], analytic_filter, nthreads, flags, simd)){
+            printf("Could not set up the convolution backend. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+#ifdef DEBUG
+        printf("<< CALIBRATING %dx%d FILTER >>\n", sweep_filters[f], sweep_filters[f]);
+#endif
+        for (s=0; s<num_sweep_sizes; s++)
+            sweep_best[f][s] = conv_select(&sweep_backend, sweep_sizes[s], sweep_sizes[s]);
+        conv_backend_destroy(&sweep_backend);
+    }
+
+    conv_backend backend;
+    if (!conv_backend_init(&backend, &cache, &kernels, &table, D0, FILTER_SIZE, analytic_filter, nthreads, flags, simd)){
+        printf("Could not set up the convolution backend. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double *out[3];
+    for (c=0; c<3; c++){
+        out[c] = (double*)fftw_malloc(sizeof(double) * (size_t)height * width);
+        if (!out[c]){
+            printf("Could not allocate memory for the blurred image. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    double *in[3] = {image->red, image->green, image->blue};
+
+    // Every blur is a request. With --convolution=auto, the image's shape is calibrated first (unless the table
+    // already has it), outside the timed loop (its cost is in calibration_time_seconds), and every request goes to
+    // the fastest engine
+    conv_engine chosen = (engine == CONV_AUTO) ? conv_select(&backend, height, width) : engine;
+
+    // Every request is recorded, so that the tail latencies can be reported and not just the totals. The first
+    // 'warmup' requests are left out
+    latency_histogram latency;
+    latency_summary image_latency;
+    if (!latency_histogram_init(&latency, warmup)){
+        printf("Could not allocate the latency histogram. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t wall_time_start, wall_time_stop, image_start;
+    wall_time_start = timing_now(); //start clock
+    for (k=0; k<niters; k++){
+        image_start = timing_now(); //start clock
+        chosen = conv_blur(&backend, chosen, height, width, in, out);
+        if (chosen == CONV_AUTO){
+            printf("Could not allocate the convolution buffers. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+        latency_histogram_record(&latency, timing_elapsed(image_start, timing_now()));
+    }
+    wall_time_stop = timing_now(); //stop clock
+    latency_histogram_summarize(&latency, &image_latency);
+    latency_histogram_destroy(&latency);
+    double wall_time = timing_elapsed(wall_time_start, wall_time_stop);
+    double images_per_sec = (wall_time > 0.0) ? niters / wall_time : 0.0;
+
+    // Measured timings for this image's shape (only there if it was calibrated, now or by an earlier run)
+    const conv_timing *timing = conv_table_find(&table, &backend, height, width);
+
+#ifdef SAVEIMAGE
+    planar_image blurred = *image;
+    blurred.red = out[0];
+    blurred.green = out[1];
+    blurred.blue = out[2];
+    if (image_save_planar(OUTIMAGE, &blurred) != IMAGE_OK)
+        printf("Could not write `%s`.\n", OUTIMAGE);
+#endif
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_rss_kb = usage.ru_maxrss;
+
+    wisdom_save(wisdom);
+    if (use_wisdom)
+        conv_table_save(&table);
+    struct timeval program_stop;
+    gettimeofday(&program_stop, NULL);
+    double program_time = (program_stop.tv_sec - program_start.tv_sec) + (program_stop.tv_usec - program_start.tv_usec) * (1.0e-6);
+
+    for (c=0; c<3; c++)
+        fftw_free(out[c]);
+    conv_backend_destroy(&backend);
+    unsigned long plans_created = cache.misses;
+    double total_planning_time = cache.total_planning_time;
+    plan_cache_destroy(&cache);
+    kernel_cache_destroy(&kernels);
+    fftw_cleanup_threads();
+
+    const char *engine_names[CONV_NUM_ENGINES] = {"direct", "separable", "fft"};
 
-    *real_result = (a_real * b_real) - (a_complex * b_complex);
-    *complex_result = (a_real * b_complex) + (a_complex * b_real);
+    // Save as JSON
+    results_record record;
+    FILE *results_file = results_begin(&record, filename);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"num_images\": %d,\n", niters);
+    fprintf(results_file, "                \"image_dims\": [%d, %d],\n", width, height);
+    fprintf(results_file, "                \"filter_size\": %d,\n", FILTER_SIZE);
+    fprintf(results_file, "                \"threads\": %d,\n", nthreads);
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(flags));
+    fprintf(results_file, "                \"convolution\": \"%s\",\n", conv_engine_name(engine));
+    fprintf(results_file, "                \"simd\": \"%s\"\n", simd_level_name(simd));
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"convolution\": {\n");
+    fprintf(results_file, "                \"engine\": \"%s\",\n", conv_engine_name(chosen));
+    fprintf(results_file, "                \"calibrated_seconds\": {");
+    for (s=0; s<CONV_NUM_ENGINES; s++)
+        fprintf(results_file, "\"%s\": %0.5e%s", engine_names[s], timing ? timing->seconds[s] : 0.0, (s < CONV_NUM_ENGINES-1) ? ", " : "");
+    fprintf(results_file, "},\n");
+    fprintf(results_file, "                \"engines\": {\n");
+    for (s=0; s<CONV_NUM_ENGINES; s++)
+        fprintf(results_file, "                    \"%s\": {\"images\": %lu, \"time_seconds\": %0.5f}%s\n", engine_names[s], backend.requests[s], backend.busy_time[s], (s < CONV_NUM_ENGINES-1) ? "," : "");
+    fprintf(results_file, "                },\n");
+    fprintf(results_file, "                \"crossover\": [\n");
+    for (f=0; f<num_sweep_filters; f++){
+        fprintf(results_file, "                    {\"filter_size\": %d, \"fastest\": [", sweep_filters[f]);
+        for (s=0; s<num_sweep_sizes; s++)
+            fprintf(results_file, "[%d, \"%s\"]%s", sweep_sizes[s], conv_engine_name(sweep_best[f][s]), (s < num_sweep_sizes-1) ? ", " : "");
+        fprintf(results_file, "], \"crossovers\": [");
+        bool first = true;
+        for (s=1; s<num_sweep_sizes; s++){
+            if (sweep_best[f][s] != sweep_best[f][s-1]){
+                fprintf(results_file, "%s%d", first ? "" : ", ", sweep_sizes[s]);
+                first = false;
+            }
+        }
+        fprintf(results_file, "]}%s\n", (f < num_sweep_filters-1) ? "," : "");
+    }
+    fprintf(results_file, "                ],\n");
+    fprintf(results_file, "                \"table_file\": ");
+    results_json_string(results_file, use_wisdom ? table.path : "");
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"shapes_calibrated\": %lu,\n", table.measured);
+    fprintf(results_file, "                \"calibration_time_seconds\": %0.5f\n", table.measure_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"plan_cache\": {\n");
+    fprintf(results_file, "                \"plans_created\": %lu,\n", plans_created);
+    fprintf(results_file, "                \"planning_time_seconds\": %0.5f\n", total_planning_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"wisdom\": {\n");
+    fprintf(results_file, "                \"file\": ");
+    results_json_string(results_file, use_wisdom ? wisdom->path : "");
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"imported\": %s\n", wisdom->imported ? "true" : "false");
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"latency\": {\n");
+    fprintf(results_file, "                \"clock\": \"%s\",\n", clock_source_name(timer_source));
+    fprintf(results_file, "                \"warmup_iterations\": %d,\n", warmup);
+    fprintf(results_file, "                \"phases\": {\n");
+    latency_summary_json(results_file, "                    ", "iteration", &image_latency, true);
+    fprintf(results_file, "                }\n");
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"memory\": {\n");
+    fprintf(results_file, "                \"peak_rss_kilobytes\": %ld\n", peak_rss_kb);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"misc\": {\n");
+    fprintf(results_file, "                \"wall_time_seconds\": %0.5f,\n", wall_time);
+    fprintf(results_file, "                \"images_per_second\": %0.5f,\n", images_per_sec);
+    fprintf(results_file, "                \"program_time_seconds\": %0.5f\n", program_time);
+    fprintf(results_file, "            }\n");
+    fprintf(results_file, "        }\n");
+    results_end(&record);
+
+    // Print out performance results
+    printf("\nPERFORMANCE RESULTS (CONVOLUTION BACKEND)\n");
+    printf("=========================================\n");
+    printf("Operations:\n");
+    printf("    %d images of size %dx%d blurred with a %dx%d gaussian\n", niters, width, height, FILTER_SIZE, FILTER_SIZE);
+    printf("    %d threads used, %s kernels, plan effort: %s\n", nthreads, simd_level_name(simd), plan_effort_name(flags));
+    printf("Convolution (%s)\n", conv_engine_name(engine));
+    if (engine == CONV_AUTO)
+        printf("    Routed to %s\n", conv_engine_name(chosen));
+    if (timing)
+        printf("    Calibrated: %0.5f sec direct, %0.5f sec separable, %0.5f sec FFT per image\n", timing->seconds[CONV_DIRECT], timing->seconds[CONV_SEPARABLE], timing->seconds[CONV_FFT]);
+    for (s=0; s<CONV_NUM_ENGINES; s++){
+        if (backend.requests[s] > 0)
+            printf("    %-9s %lu images, %0.3f sec\n", engine_names[s], backend.requests[s], backend.busy_time[s]);
+    }
+    if (sweep){
+        printf("Crossover (fastest engine per square image size)\n");
+        printf("    filter ");
+        for (s=0; s<num_sweep_sizes; s++)
+            printf(" %9d", sweep_sizes[s]);
+        printf("   crossovers\n");
+        for (f=0; f<num_sweep_filters; f++){
+            printf("    %2dx%-2d  ", sweep_filters[f], sweep_filters[f]);
+            for (s=0; s<num_sweep_sizes; s++)
+                printf(" %9s", conv_engine_name(sweep_best[f][s]));
+            printf("  ");
+            for (s=1; s<num_sweep_sizes; s++){
+                if (sweep_best[f][s] != sweep_best[f][s-1])
+                    printf(" %d", sweep_sizes[s]);
+            }
+            printf("\n");
+        }
+    }
+    printf("Calibration\n");
+    if (use_wisdom)
+        printf("    %lu shapes calibrated (%0.3f sec), %s %s\n", table.measured, table.measure_time, table.loaded ? "timings loaded from" : "timings saved to", table.path);
+    else
+        printf("    %lu shapes calibrated (%0.3f sec), timings not saved (--no-wisdom)\n", table.measured, table.measure_time);
+    printf("Memory\n");
+    printf("    %0.1f MB peak RSS\n", peak_rss_kb / 1024.0);
+    printf("Latency per image (%lu recorded after %d warm-up, %s clock)\n", image_latency.count, warmup, clock_source_name(timer_source));
+    latency_summary_print("iteration", &image_latency);
+    printf("Wall time\n");
+    printf("    Took %0.3f sec to blur %d images\n", wall_time, niters);
+    printf("    %0.3f images/sec\n\n", images_per_sec);
+
+    conv_table_destroy(&table);
 }
 
-int nextPowerOfTwo(int n){
-    /*
-     * This function computes the next power of two from a value "n"
-     *
-     * See https://www.geeksforgeeks.org/smallest-power-of-2-greater-than-or-equal-to-n/
-     */
-    if (n && !(n & (n-1)))
-        return n;
+static void blur_precision(planar_image *image, int niters, int nthreads, unsigned flags, bool analytic_filter, pad_mode pad, const precision_engine *engine, int warmup, clock_source timer_source, const char *filename, struct timeval program_start){
+/* Precision mode of the benchmark: blurs with the FFTW API of another precision and measures what it costs in accuracy
+ *
+ * Inputs
+ * ======
+ *   planar_image *image
+ *       The loaded image, blurred 'niters' times by 'engine' and 'niters' times by the double engine (the reference)
+ *
+ *   pad_mode pad
+ *       Padding from "--pad", as for the classic engines
+ *
+ *   const precision_engine *engine
+ *       Engine from "--precision"
+ *
+ *   int warmup, clock_source timer_source
+ *       Images left out of the latency percentiles ("--warmup"), and the clock they are timed with ("--clock")
+ *
+ *   const char *filename
+ *       JSON document to append the results to
+ */
+    int height = image->height, width = image->width;
+    int c;
+
+    size_choice size;
+    choose_fft_size(pad, NULL, height, width, FILTER_SIZE, nthreads, &size);
+
+    // One filter spectrum (in double) from the kernel cache, converted by each engine
+    plan_cache cache;
+    plan_cache_init(&cache);
+    kernel_cache kernels;
+    kernel_cache_init(&kernels);
+    fftw_complex *filter = kernel_cache_gaussian(&kernels, &cache, size.height, size.width, D0, FILTER_SIZE, analytic_filter, nthreads, flags);
+    if (!filter){
+        printf("Could not build the filter spectrum. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double *reference[3], *out[3];
+    for (c=0; c<3; c++){
+        reference[c] = (double*)fftw_malloc(sizeof(double) * (size_t)height * width);
+        out[c] = (double*)fftw_malloc(sizeof(double) * (size_t)height * width);
+        if (!reference[c] || !out[c]){
+            printf("Could not allocate memory for the blurred image. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    precision_blur_job job = {
+        .height = height,
+        .width = width,
+        .padded_height = size.height,
+        .padded_width = size.width,
+        .channels = {image->red, image->green, image->blue},
+        .filter = filter,
+        .out = {reference[0], reference[1], reference[2]},
+        .iterations = niters,
+        .nthreads = nthreads,
+        .flags = flags,
+        .latency = NULL
+    };
+
+    // The double engine first: the reference image, and the time the other precision is compared with
+    const precision_engine *reference_engine = find_precision_engine("double");
+    precision_timings reference_timings, timings;
+    reference_engine->init_threads();
+    if (!reference_engine->blur(&job, &reference_timings)){
+        printf("Could not run the double engine. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The engine records every image, so that the tail latencies can be reported and not just the totals. The
+    // first 'warmup' images are left out
+    latency_histogram latency;
+    latency_summary image_latency;
+    if (!latency_histogram_init(&latency, warmup)){
+        printf("Could not allocate the latency histogram. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t wall_time_start, wall_time_stop;
+    for (c=0; c<3; c++)
+        job.out[c] = out[c];
+    job.latency = &latency;
+    engine->init_threads();
+    wall_time_start = timing_now(); //start clock
+    if (!engine->blur(&job, &timings)){
+        printf("Could not run the %s engine. Exiting.\n", engine->name);
+        exit(EXIT_FAILURE);
+    }
+    wall_time_stop = timing_now(); //stop clock
+    latency_histogram_summarize(&latency, &image_latency);
+    latency_histogram_destroy(&latency);
+    double wall_time = timing_elapsed(wall_time_start, wall_time_stop);
+    double images_per_sec = (wall_time > 0.0) ? niters / wall_time : 0.0;
+    double reference_time = reference_timings.copy_time + reference_timings.forward_time + reference_timings.multiply_time + reference_timings.backward_time;
+    double engine_time = timings.copy_time + timings.forward_time + timings.multiply_time + timings.backward_time;
+    double speedup = (engine_time > 0.0) ? reference_time / engine_time : 0.0;
+
+    precision_error error;
+    precision_error_init(&error);
+    for (c=0; c<3; c++)
+        precision_error_add(&error, reference[c], out[c], (size_t)height * width);
+    precision_error_finish(&error);
+
+    flop_rates forward_rates, backward_rates;
+    flop_count_rates(&timings.forward_count, timings.forward_time, &forward_rates);
+    flop_count_rates(&timings.backward_count, timings.backward_time, &backward_rates);
 
-    unsigned count = 0;
-    while (n != 0){
-        n >>= 1;
-        count++;
+#ifdef SAVEIMAGE
+    planar_image blurred = *image;
+    blurred.red = out[0];
+    blurred.green = out[1];
+    blurred.blue = out[2];
+    if (image_save_planar(OUTIMAGE, &blurred) != IMAGE_OK)
+        printf("Could not write `%s`.\n", OUTIMAGE);
+#endif
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_rss_kb = usage.ru_maxrss;
+
+    struct timeval program_stop;
+    gettimeofday(&program_stop, NULL);
+    double program_time = (program_stop.tv_sec - program_start.tv_sec) + (program_stop.tv_usec - program_start.tv_usec) * (1.0e-6);
+
+    for (c=0; c<3; c++){
+        fftw_free(reference[c]);
+        fftw_free(out[c]);
     }
+    kernel_cache_destroy(&kernels);
+    plan_cache_destroy(&cache);
+    engine->cleanup_threads();
+    reference_engine->cleanup_threads();
+
+    // Save as JSON
+    results_record record;
+    FILE *results_file = results_begin(&record, filename);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"num_images\": %d,\n", niters);
+    fprintf(results_file, "                \"image_dims\": [%d, %d],\n", width, height);
+    fprintf(results_file, "                \"transform_dims\": [%d, %d],\n", size.width, size.height);
+    fprintf(results_file, "                \"pad\": \"%s\",\n", pad_mode_name(pad));
+    fprintf(results_file, "                \"threads\": %d,\n", nthreads);
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(flags));
+    fprintf(results_file, "                \"engine\": \"separate\",\n");
+    fprintf(results_file, "                \"filter_spectrum\": \"%s\"\n", analytic_filter ? "analytic" : "fft");
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"precision\": {\n");
+    fprintf(results_file, "                \"name\": \"%s\",\n", engine->name);
+    fprintf(results_file, "                \"api\": \"%s\",\n", engine->prefix);
+    fprintf(results_file, "                \"real_bytes\": %zu,\n", engine->real_bytes);
+    fprintf(results_file, "                \"epsilon\": %0.6e,\n", engine->epsilon);
+    fprintf(results_file, "                \"reference\": \"double\",\n");
+    fprintf(results_file, "                \"reference_time_seconds\": %0.5f,\n", reference_time);
+    fprintf(results_file, "                \"speedup_vs_double\": %0.5f,\n", speedup);
+    precision_error_json(results_file, "                ", "accuracy", &error, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"phases\": {\n");
+    fprintf(results_file, "                \"plan_time_seconds\": %0.5f,\n", timings.plan_time);
+    fprintf(results_file, "                \"copy_time_seconds\": %0.5f,\n", timings.copy_time);
+    fprintf(results_file, "                \"blur_time_seconds\": %0.5f\n", timings.multiply_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"forward_dft_results\": {\n");
+    fprintf(results_file, "                \"total_execution_time_seconds\": %0.5f,\n", timings.forward_time);
+    flop_rates_json(results_file, "                ", &timings.forward_count, &forward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"backward_dft_results\": {\n");
+    fprintf(results_file, "                \"total_execution_time_seconds\": %0.5f,\n", timings.backward_time);
+    flop_rates_json(results_file, "                ", &timings.backward_count, &backward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"latency\": {\n");
+    fprintf(results_file, "                \"clock\": \"%s\",\n", clock_source_name(timer_source));
+    fprintf(results_file, "                \"warmup_iterations\": %d,\n", warmup);
+    fprintf(results_file, "                \"phases\": {\n");
+    latency_summary_json(results_file, "                    ", "iteration", &image_latency, true);
+    fprintf(results_file, "                }\n");
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"memory\": {\n");
+    fprintf(results_file, "                \"peak_rss_kilobytes\": %ld\n", peak_rss_kb);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"misc\": {\n");
+    fprintf(results_file, "                \"wall_time_seconds\": %0.5f,\n", wall_time);
+    fprintf(results_file, "                \"images_per_second\": %0.5f,\n", images_per_sec);
+    fprintf(results_file, "                \"program_time_seconds\": %0.5f\n", program_time);
+    fprintf(results_file, "            }\n");
+    fprintf(results_file, "        }\n");
+    results_end(&record);
 
-    return 1 << count;
+    // Print out performance results
+    printf("\nPERFORMANCE RESULTS (%s PRECISION)\n", engine->name);
+    printf("===============================\n");
+    printf("Operations:\n");
+    printf("    %d images of size %dx%d blurred (%dx%d transforms)\n", niters, width, height, size.width, size.height);
+    printf("    %d threads used, plan effort: %s\n", nthreads, plan_effort_name(flags));
+    printf("Precision\n");
+    printf("    %s (%s API, %zu byte reals, epsilon %0.3e), %0.3fx the speed of double\n", engine->name, engine->prefix, engine->real_bytes, engine->epsilon, speedup);
+    precision_error_print("Accuracy", &error);
+    printf("Phases\n");
+    printf("    %0.3f sec planning, %0.3f sec copying, %0.3f sec FFT, %0.3f sec blur, %0.3f sec IFFT\n", timings.plan_time, timings.copy_time, timings.forward_time, timings.multiply_time, timings.backward_time);
+    printf("Operation counts\n");
+    flop_rates_print("Forward", &timings.forward_count, &forward_rates);
+    flop_rates_print("Backward", &timings.backward_count, &backward_rates);
+    printf("Memory\n");
+    printf("    %0.1f MB peak RSS\n", peak_rss_kb / 1024.0);
+    printf("Latency per image (%lu recorded after %d warm-up, %s clock)\n", image_latency.count, warmup, clock_source_name(timer_source));
+    latency_summary_print("iteration", &image_latency);
+    printf("Wall time\n");
+    printf("    Took %0.3f sec to blur %d images\n", wall_time, niters);
+    printf("    %0.3f images/sec\n\n", images_per_sec);
 }
 
 int main(int argc, char* argv[]){
 
+    // Start the clock for "time to first FFT" (this includes loading wisdom and planning)
+    struct timeval program_start;
+    gettimeofday(&program_start, NULL);
+
     // Get num threads and num iterations
     int nthreads, niters;
     char *filename;
     char *pEnd;
-    if (argc == 1){
+    bool cache_plans = true; //plan once, execute many. "--plan-mode=replan" re-plans every image instead
+    unsigned flags = FFTW_ESTIMATE; //planner effort, set with "--plan-effort"
+    bool use_wisdom = true; //load/save FFTW wisdom ("--no-wisdom" turns this off)
+    char *wisdom_dir = NULL; //where wisdom is kept ("--wisdom-dir"), defaults to $FFTW_WISDOM_DIR or ./wisdom
+    bool batched = false; //"--engine=batched" transforms all channels (of several images) with one plan_many call
+    bool interleaved = false; //"--layout=interleaved" interleaves the batched planes instead of storing them one after another
+    int images_per_batch = 1; //"--batch", number of images per batched call
+    bool analytic_filter = false; //"--filter-spectrum=analytic" synthesizes the filter's spectrum instead of transforming it
+    simd_level simd = detect_simd_level(); //vector extension used by the spectral multiply ("--simd")
+    bool in_place = false; //"--in-place" runs the forward DFT, blur and backward DFT in one buffer per channel
+    char *stream_input = NULL; //"--input" (directory) or "--input-list" (file with one path per line) turns on streaming
+    bool stream_input_is_list = false;
+    int decode_threads = 1; //"--decode-threads", streaming decode stage threads
+    int queue_depth = 4; //"--queue-depth", images that fit in each ring between two streaming stages
+    char *output_dir = NULL; //"--output-dir" adds the streaming encode stage, which writes the blurred images here
+    bool async_staging = false; //"--staging=async" stages the next batch on worker threads while this one transforms
+    int staging_threads = 1; //"--staging-threads", workers used by --staging=async
+    bool decode_each_image = false; //"--decode-each-image" decodes IMAGE again for every image instead of once
+    pad_mode pad = PAD_NONE; //"--pad" zero-pads the image to an FFT-friendly size that fits the linear convolution
+    size_cost_source size_cost = SIZE_COST_MODEL; //"--size-cost", how "--pad=smooth" ranks the candidate sizes
+    bool tiled = false; //"--engine=tiled" blurs cache-sized tiles with small transforms (overlap-save)
+    int tile_transform = 0; //"--tile", transform size per tile side (0 sizes the tiles from the cache)
+    tile_cache_level tile_cache = TILE_CACHE_L2; //"--tile-cache", cache the tiles are sized for
+    bool tile_options = false; //"--tile" or "--tile-cache" was given (they need "--engine=tiled")
+    bool use_conv_backend = false; //"--convolution" blurs through the direct/separable/FFT convolution backend
+    conv_engine convolution = CONV_AUTO;
+    bool conv_sweep = false; //"--conv-sweep" calibrates a grid of image and filter sizes first
+    int warmup = 1; //"--warmup", iterations left out of the latency percentiles
+    clock_source timer_source = CLOCK_SOURCE_MONOTONIC_RAW; //"--clock", what the timers read
+    bool use_counters = false; //"--counters" reads hardware performance counters around every phase
+    char *csv_path = NULL; //"--csv" also appends every result to this long-format CSV file
+    thread_backend_kind thread_kind = THREAD_BACKEND_FFTW; //"--thread-backend", threads the transforms and our loops run on
+    pin_policy pin = PIN_NONE; //"--pin" pins those threads to CPUs
+    static int pin_cpus[THREAD_BACKEND_MAX_CPUS]; //with "--pin=<list of CPUs>"
+    int num_pin_cpus = 0;
+    numa_policy numa = NUMA_POLICY_NONE; //"--numa", where the transform buffers' pages go
+    huge_pages huge = HUGE_PAGES_NONE; //"--huge-pages" carves the transform buffers from one huge-page arena
+    const precision_engine *precision = find_precision_engine("double"); //"--precision", FFTW API the blur runs on
+
+    // Parse the optional arguments first (these can go anywhere on the command line)
+    static struct option long_options[] = {
+        {"plan-mode", required_argument, NULL, 'p'},
+        {"plan-effort", required_argument, NULL, 'e'},
+        {"wisdom-dir", required_argument, NULL, 'w'},
+        {"no-wisdom", no_argument, NULL, 'n'},
+        {"engine", required_argument, NULL, 'g'},
+        {"layout", required_argument, NULL, 'l'},
+        {"batch", required_argument, NULL, 'b'},
+        {"filter-spectrum", required_argument, NULL, 'f'},
+        {"simd", required_argument, NULL, 's'},
+        {"in-place", no_argument, NULL, 'i'},
+        {"input", required_argument, NULL, 'I'},
+        {"input-list", required_argument, NULL, 'L'},
+        {"decode-threads", required_argument, NULL, 'd'},
+        {"queue-depth", required_argument, NULL, 'q'},
+        {"output-dir", required_argument, NULL, 'o'},
+        {"staging", required_argument, NULL, 'a'},
+        {"staging-threads", required_argument, NULL, 't'},
+        {"decode-each-image", no_argument, NULL, 'D'},
+        {"pad", required_argument, NULL, 'P'},
+        {"size-cost", required_argument, NULL, 'c'},
+        {"tile", required_argument, NULL, 'T'},
+        {"tile-cache", required_argument, NULL, 'C'},
+        {"convolution", required_argument, NULL, 'v'},
+        {"conv-sweep", no_argument, NULL, 'S'},
+        {"warmup", required_argument, NULL, 'W'},
+        {"clock", required_argument, NULL, 'K'},
+        {"counters", no_argument, NULL, 'H'},
+        {"csv", required_argument, NULL, 'x'},
+        {"thread-backend", required_argument, NULL, 'B'},
+        {"pin", required_argument, NULL, 'A'},
+        {"numa", required_argument, NULL, 'M'},
+        {"huge-pages", required_argument, NULL, 'G'},
+        {"precision", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1){
+        switch (opt){
+            case 'p':
+                if (strcmp(optarg, "cached") == 0)
+                    cache_plans = true;
+                else if (strcmp(optarg, "replan") == 0)
+                    cache_plans = false;
+                else{
+                    printf("Invalid plan mode '%s'. Please use \"cached\" or \"replan\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'e':
+                if (!parse_plan_effort(optarg, &flags)){
+                    printf("Invalid plan effort '%s'. Please use \"estimate\", \"measure\", \"patient\" or \"exhaustive\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'w':
+                wisdom_dir = optarg;
+                break;
+            case 'n':
+                use_wisdom = false;
+                break;
+            case 'g':
+                batched = tiled = false;
+                if (strcmp(optarg, "separate") == 0)
+                    batched = false;
+                else if (strcmp(optarg, "batched") == 0)
+                    batched = true;
+                else if (strcmp(optarg, "tiled") == 0)
+                    tiled = true;
+                else{
+                    printf("Invalid engine '%s'. Please use \"separate\", \"batched\" or \"tiled\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'l':
+                if (strcmp(optarg, "planar") == 0)
+                    interleaved = false;
+                else if (strcmp(optarg, "interleaved") == 0)
+                    interleaved = true;
+                else{
+                    printf("Invalid layout '%s'. Please use \"planar\" or \"interleaved\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'b':
+                images_per_batch = (int)strtol(optarg, &pEnd, 10);
+                if (images_per_batch < 1){
+                    printf("Number of images per batch must be greater than or equal to 1.\n");
+                    exit(0);
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "fft") == 0)
+                    analytic_filter = false;
+                else if (strcmp(optarg, "analytic") == 0)
+                    analytic_filter = true;
+                else{
+                    printf("Invalid filter spectrum '%s'. Please use \"fft\" or \"analytic\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 's':
+                if (!parse_simd_level(optarg, &simd)){
+                    printf("Invalid SIMD level '%s'. Please use \"auto\", \"avx512\", \"avx2\" or \"generic\".\n", optarg);
+                    exit(0);
+                }
+                if (simd > detect_simd_level()){
+                    printf("This CPU does not support %s. Please use \"%s\" or lower.\n", simd_level_name(simd), simd_level_name(detect_simd_level()));
+                    exit(0);
+                }
+                break;
+            case 'i':
+                in_place = true;
+                break;
+            case 'I':
+            case 'L':
+                stream_input = optarg;
+                stream_input_is_list = (opt == 'L');
+                break;
+            case 'd':
+                decode_threads = (int)strtol(optarg, &pEnd, 10);
+                if (decode_threads < 1){
+                    printf("Number of decode threads must be greater than or equal to 1.\n");
+                    exit(0);
+                }
+                break;
+            case 'q':
+                queue_depth = (int)strtol(optarg, &pEnd, 10);
+                if (queue_depth < 1){
+                    printf("Queue depth must be greater than or equal to 1.\n");
+                    exit(0);
+                }
+                break;
+            case 'o':
+                output_dir = optarg;
+                break;
+            case 'a':
+                if (strcmp(optarg, "sync") == 0)
+                    async_staging = false;
+                else if (strcmp(optarg, "async") == 0)
+                    async_staging = true;
+                else{
+                    printf("Invalid staging mode '%s'. Please use \"sync\" or \"async\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 't':
+                staging_threads = (int)strtol(optarg, &pEnd, 10);
+                if (staging_threads < 1){
+                    printf("Number of staging threads must be greater than or equal to 1.\n");
+                    exit(0);
+                }
+                break;
+            case 'D':
+                decode_each_image = true;
+                break;
+            case 'P':
+                if (!parse_pad_mode(optarg, &pad)){
+                    printf("Invalid padding '%s'. Please use \"none\", \"pow2\" or \"smooth\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'c':
+                if (!parse_size_cost(optarg, &size_cost)){
+                    printf("Invalid size cost '%s'. Please use \"model\" or \"measured\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'T':
+                tile_transform = (int)strtol(optarg, &pEnd, 10);
+                if (tile_transform < min_tile_transform(FILTER_SIZE)){
+                    printf("Tile transform size must be at least %d (%d output pixels per tile side for the %d pixel overlap).\n", min_tile_transform(FILTER_SIZE), min_tile_transform(FILTER_SIZE) - (FILTER_SIZE - 1), FILTER_SIZE - 1);
+                    exit(0);
+                }
+                tile_options = true;
+                break;
+            case 'C':
+                if (!parse_tile_cache_level(optarg, &tile_cache)){
+                    printf("Invalid tile cache '%s'. Please use \"l2\" or \"llc\".\n", optarg);
+                    exit(0);
+                }
+                tile_options = true;
+                break;
+            case 'v':
+                if (!parse_conv_engine(optarg, &convolution)){
+                    printf("Invalid convolution '%s'. Please use \"auto\", \"direct\", \"separable\" or \"fft\".\n", optarg);
+                    exit(0);
+                }
+                use_conv_backend = true;
+                break;
+            case 'S':
+                use_conv_backend = true;
+                conv_sweep = true;
+                break;
+            case 'W':
+                warmup = (int)strtol(optarg, &pEnd, 10);
+                if (warmup < 0){
+                    printf("Number of warm-up iterations must be greater than or equal to 0.\n");
+                    exit(0);
+                }
+                break;
+            case 'K':
+                if (!parse_clock_source(optarg, &timer_source)){
+                    printf("Invalid clock '%s'. Please use \"monotonic\" or \"tsc\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'H':
+                use_counters = true;
+                break;
+            case 'x':
+                csv_path = optarg;
+                break;
+            case 'B':
+                if (!parse_thread_backend(optarg, &thread_kind)){
+                    printf("Invalid thread backend '%s'. Please use \"fftw\", \"pool\" or \"openmp\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'A':
+                if (!parse_pin_policy(optarg, &pin, pin_cpus, &num_pin_cpus)){
+                    printf("Invalid pinning '%s'. Please use \"none\", \"compact\", \"scatter\" or a list of CPUs (e.g. \"0,2,4-7\").\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'M':
+                if (!parse_numa_policy(optarg, &numa)){
+                    printf("Invalid NUMA policy '%s'. Please use \"none\", \"local\", \"interleave\" or \"first-touch\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'G':
+                if (!parse_huge_pages(optarg, &huge)){
+                    printf("Invalid huge pages '%s'. Please use \"none\", \"thp\", \"2m\" or \"1g\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'r':
+                precision = find_precision_engine(optarg);
+                if (!precision){
+                    printf("Invalid precision '%s'. This build has: %s.\n", optarg, precision_engine_names());
+                    exit(0);
+                }
+                break;
+            default:
+                exit(0);
+        }
+    }
+
+    // Now the positional arguments
+    int nargs = argc - optind;
+    if (nargs == 0){
         printf("Please enter number of threads to use and number of iterations to execute.\n");
         exit(0);
     }
-    else if (argc == 2){
+    else if (nargs == 1){
         printf("Only one argument was passed. Please pass all three arguments: (1.) number of threads, (2.) number of iterations to execute, and (3.) JSON document filename to save the results to.\n");
         exit(0);
     }
-    else if (argc == 3){
+    else if (nargs == 2){
         printf("Only two arguments were passed. Please pass all three arguments: (1.) number of threads, (2.) number of iterations to execute, and (3.) JSON document filename to save the results to.\n");
         exit(0);
     }
     else{
 
-        nthreads = (int)strtol(argv[1], &pEnd, 10);
-        niters = (int)strtol(argv[2], &pEnd, 10);
-        filename = argv[3];
+        nthreads = (int)strtol(argv[optind], &pEnd, 10);
+        niters = (int)strtol(argv[optind+1], &pEnd, 10);
+        filename = argv[optind+2];
 
         if (nthreads < 1){
             printf("Number of threads must be greater than or equal to 1.\n");
@@ -97,201 +1367,212 @@ int main(int argc, char* argv[]){
         }
     }
 
+    // Every run appends one record to the results file (plus rows to the CSV file, if any)
+    results_init("2d_fft", argc, argv, csv_path);
+
+    // Pick the clock for the timers (the TSC is calibrated here)
+    timer_source = timing_init(timer_source);
+
+    if (tile_options && !tiled){
+        printf("--tile and --tile-cache only apply to the tiled engine (--engine=tiled).\n");
+        exit(0);
+    }
+
+    // The streaming pipeline, tiled engine and convolution backend thread their stages themselves
+    if ((thread_kind != THREAD_BACKEND_FFTW || pin != PIN_NONE) && (stream_input || tiled || use_conv_backend)){
+        printf("--thread-backend and --pin only apply to the separate and batched engines.\n");
+        exit(0);
+    }
+    if ((numa != NUMA_POLICY_NONE || huge != HUGE_PAGES_NONE) && (stream_input || tiled || use_conv_backend)){
+        printf("--numa and --huge-pages only apply to the separate and batched engines.\n");
+        exit(0);
+    }
+    bool other_precision = strcmp(precision->name, "double") != 0;
+    if (other_precision && (stream_input || tiled || use_conv_backend || batched || in_place || thread_kind != THREAD_BACKEND_FFTW || pin != PIN_NONE || numa != NUMA_POLICY_NONE || huge != HUGE_PAGES_NONE)){
+        printf("--precision other than double only applies to the separate engine (without --in-place, --thread-backend, --pin, --numa or --huge-pages).\n");
+        exit(0);
+    }
+
+    // Streaming mode: push every image of a directory or list through the decode -> blur -> encode pipeline
+    // 'niters' times instead of blurring IMAGE 'niters' times
+    if (stream_input){
+        pipeline_config config = {
+            .passes = niters,
+            .decode_threads = decode_threads,
+            .queue_depth = queue_depth,
+            .output_dir = output_dir,
+            .nthreads = nthreads,
+            .flags = flags,
+            .cache_plans = cache_plans,
+            .simd = simd,
+            .sigma = D0,
+            .filter_size = FILTER_SIZE,
+            .analytic_filter = analytic_filter,
+            .pad = pad
+        };
+        stream_images(stream_input, stream_input_is_list, &config, size_cost, filename, use_wisdom, wisdom_dir, program_start);
+        return 0;
+    }
+
+    // Async staging fills the next batch's buffers right after its plans are looked up, so a plan created later
+    // (as --plan-mode=replan does for every batch) could overwrite a staged image while planning
+    if (async_staging && !cache_plans){
+        printf("--staging=async needs --plan-mode=cached, since re-planning would overwrite the staged images.\n");
+        exit(0);
+    }
+
+    // The separate engine transforms one channel of one image per call
+    if (!batched)
+        images_per_batch = 1;
+    else if (images_per_batch > niters)
+        images_per_batch = niters;
+
+    // Open the hardware counters before MagickWand, FFTW and OpenMP start their threads, so that those threads
+    // inherit them and are counted too
+    perf_counters counters = {.enabled = false};
+    if (use_counters && !perf_counters_open(&counters))
+        printf("  WARNING: No hardware performance counters could be opened (no PMU, or kernel.perf_event_paranoid is too high), continuing without them.\n");
+
+    // Start (and pin) the threads the transforms and the copy and blur loops run on, before anything else starts
+    // threads that should inherit the pinning
+    thread_backend threads;
+    if (!thread_backend_init(&threads, thread_kind, pin, pin_cpus, num_pin_cpus, nthreads)){
+        printf("Could not start the %s thread backend. Exiting.\n", thread_backend_name(thread_kind));
+        exit(EXIT_FAILURE);
+    }
+
+    // Place the transform buffers' pages on the NUMA nodes, optionally in a huge-page arena (first touch runs on the
+    // threads just started)
+    numa_allocator buffers;
+    numa_allocator_init(&buffers, numa, huge, &threads);
+    if (numa != NUMA_POLICY_NONE)
+        numa_measure_bandwidth(&buffers);
+
 #ifdef DEBUG
         printf("<< LOADING IMAGE >>\n");
 #endif
-    // Initialize Magick and vars
+    // Initialize Magick
     MagickWandGenesis();
 
-    // Load image, while making sure it CAN be loaded
-    MagickBooleanType can_load_image;
-    MagickWand *magick_wand = NewMagickWand();
-    can_load_image = MagickReadImage(magick_wand, IMAGE);
-    if (can_load_image == MagickFalse){
+    // Load the image straight into planar [0,1] R, G and B buffers, while making sure it CAN be loaded
+    planar_image image;
+    image_status load_status = image_load_planar(IMAGE, &image, simd);
+    if (load_status == IMAGE_READ_FAILED){
         printf("Image `%s` could not be loaded. Either the image does not exist or the ImageMagick delegate does not exist. (See `magick identify -list format`.) Exiting.\n", IMAGE);
         exit(EXIT_FAILURE);
     }
-
-    // Make sure we can iterate through the image
-    PixelIterator *iterator = NewPixelIterator(magick_wand);
-    if (iterator == (PixelIterator *) NULL){
+    else if (load_status == IMAGE_EXPORT_FAILED){
         printf("Image `%s` was found, but could not be processed. Is your image corrupted? Exiting.\n", IMAGE);
         exit(EXIT_FAILURE);
     }
-
-
-    PixelWand **row;
-    PixelInfo pixel;
-
-    // Vars for iterating through the image
-    size_t x, y, row_width;
+    else if (load_status == IMAGE_ALLOC_FAILED){
+        printf("Could not allocate memory for image `%s`. Exiting.\n", IMAGE);
+        exit(EXIT_FAILURE);
+    }
+    double *red = image.red;
+    double *green = image.green;
+    double *blue = image.blue;
 
     // Vars for keeping track of padded vs unpadded image sizes
     int width, height;
 
     // Get original image height and widths, then save a copy of both
-    height = MagickGetImageHeight(magick_wand);
-    width = MagickGetImageWidth(magick_wand);
+    height = image.height;
+    width = image.width;
 
 #ifdef DEBUG
-        printf("  Image loaded. Size: %d x %d\n\n", width, height);
-        printf("<< PUTTING IMAGE INTO MEMORY >>\n");
+        printf("  Image loaded. Size: %d x %d, %d bits per sample\n", width, height, image.depth);
+        printf("  Decode: %0.5f sec, export: %0.5f sec, convert: %0.5f sec\n\n", image.decode_time, image.export_time, image.convert_time);
 #endif
 
     fftw_set_timelimit(TIMELIMIT);
 
-    // FFTW is most efficient for powers of two
-    //int adjusted_height = nextPowerOfTwo(height);
-    //int adjusted_width = nextPowerOfTwo(width);
-    int adjusted_height = height;
-    int adjusted_width = width;
-
 #ifdef DEBUG
-        printf("  Padded image size: %d x %d\n\n", adjusted_width, adjusted_height);
+        printf("<< PREPARE THREADING >>\n");
 #endif
-
-    // Input matrix size is simply height * width (since we're storing the matrix in a single array)
-    size_t input_matrix_size = adjusted_height * adjusted_width;
-
-    // Output matrix size would normally be height * width, too, but FFTs have a mirroring property
-    // whereby FFTs are symmetrical and have redundant information. Thus, we want to take the non-
-    // redundant information
-    size_t output_matrix_size = (adjusted_width/2+1) * adjusted_height;
-
-    // Let's get the size of the two matrices in bytes.
-    size_t input_matrix_size_in_bytes = sizeof(double) * input_matrix_size;
-    size_t output_matrix_size_in_bytes = sizeof(fftw_complex) * output_matrix_size;
-
-    // These arrays will store our RGB colors and we use aligned_alloc to ensure AVX2 instructions run optimally
-    double *red   = aligned_alloc(ALIGNMENT, input_matrix_size);
-    double *green = aligned_alloc(ALIGNMENT, input_matrix_size);
-    double *blue  = aligned_alloc(ALIGNMENT, input_matrix_size);
+    // Set threading
+    fftw_init_threads();
+    fftw_plan_with_nthreads(nthreads);
+    if (thread_kind != THREAD_BACKEND_FFTW && !thread_backend_install_fftw(&threads))
+        printf("  NOTE: This FFTW has no fftw_threads_set_callback() (FFTW 3.3.9+), so its transforms run on its own threads. The %s backend runs the copy and blur loops.\n", thread_backend_name(thread_kind));
 #ifdef DEBUG
-        printf("<< PROCESSING IMAGE PIXELS >>\n");
+        printf("  FFTW is set to use %d threads.\n\n", nthreads);
+        printf("<< LOADING WISDOM >>\n");
 #endif
 
-    // This variable is used for converting quantum values to RGB 0-255
-    int range = pow(2, 8);
-
-    // Temporary variables. The r0_1 stands for the "red" channel being converted to a 0-1 scale,
-    // rather than being on a 0-255 scale. Similar case for g0_1 and b_01.
-    double r0_1, g0_1, b0_1;
-
-    for (y=0; y<adjusted_height; ++y){
-
-        if (y < height)
-            row = PixelGetNextIteratorRow(iterator, &row_width);
-
-        for (x=0; x<adjusted_width; ++x){
-
-            if (x < width){
-                // Get color of the pixel, which is on a "Quantum Scale"
-                PixelGetMagickColor(row[x], &pixel);
+    // Load wisdom saved by earlier runs on this host, so that MEASURE/PATIENT plans are only paid for once
+    wisdom_store wisdom;
+    wisdom_init(&wisdom, wisdom_dir);
+    wisdom.enabled = use_wisdom;
+    wisdom_load(&wisdom);
+#ifdef DEBUG
+        printf("  Wisdom file: %s (%s)\n\n", wisdom.path, wisdom.imported ? "imported" : "not imported");
+#endif
 
-                // Convert the RGB quantum colors to a [0,1] scale
-                r0_1 = (double)(pixel.red   / (range * 255));
-                g0_1 = (double)(pixel.green / (range * 255));
-                b0_1 = (double)(pixel.blue  / (range * 255));
+    // Tiled engine: blur the image tile by tile instead of transforming it whole
+    if (tiled){
+        tile_images(&image, niters, nthreads, flags, analytic_filter, simd, tile_cache, tile_transform, warmup, timer_source, &wisdom, use_wisdom, filename, program_start);
+        return 0;
+    }
 
-                // Check for rounding errors
-                if (r0_1 > 1.0){
-                    r0_1 = 1.0;
-                }
-                if (g0_1 > 1.0){
-                    g0_1 = 1.0;
-                }
-                if (b0_1 > 1.0){
-                    b0_1 = 1.0;
-            }
-            else{
-                r0_1 = 0.0;
-                g0_1 = 0.0;
-                b0_1 = 0.0;
-            }
+    // Convolution backend: blur with the direct, separable or FFT engine, or whichever is measured to be fastest
+    if (use_conv_backend){
+        convolve_images(&image, niters, nthreads, flags, analytic_filter, simd, convolution, conv_sweep, warmup, timer_source, &wisdom, use_wisdom, filename, program_start);
+        return 0;
+    }
 
-            // Finally, store the values
-            red[y*width + x]   = r0_1;
-            green[y*width + x] = g0_1;
-            blue[y*width + x]  = b0_1;
-            }
-        }
-        PixelSyncIterator(iterator);
+    // Other precisions: blur through the fftwf_/fftwl_/fftwq_ engine, and compare with the double engine. Wisdom is
+    // kept for double plans only
+    if (other_precision){
+        blur_precision(&image, niters, nthreads, flags, analytic_filter, pad, precision, warmup, timer_source, filename, program_start);
+        return 0;
     }
 #ifdef DEBUG
-        printf("  Pixels processed. Converted from quantum scale to RGB [0,1] scale.\n\n");
-        printf("<< CREATING FILTER >>\n");
+        printf("<< CHOOSING TRANSFORM SIZE >>\n");
 #endif
 
-    // Set up filter, and do the same with aligned_alloc for AVX2 instructions
-    double *gaussian_filter = aligned_alloc(ALIGNMENT, sizeof(double) * FILTER_SIZE * FILTER_SIZE);
-    double x_dist, y_dist;
-    double gaussian_sum = 0.0, gaussian_value = 0.0, gaussian_max = -1.0;
-    for (y=0; y<FILTER_SIZE; ++y){
-        for (x=0; x<FILTER_SIZE; ++x){
+    // FFTW is most efficient for sizes made of small primes, so with --pad the image is zero-padded to the cheapest
+    // such shape that also leaves room for the filter (image + filter - 1), which keeps the blur from wrapping around
+    // the edges. Measured timings are kept next to the wisdom file
+    size_table sizes;
+    size_table_init(&sizes, wisdom.path);
+    if (size_cost == SIZE_COST_MEASURED)
+        size_table_load(&sizes);
+    size_choice size;
+    choose_fft_size(pad, (size_cost == SIZE_COST_MEASURED) ? &sizes : NULL, height, width, FILTER_SIZE, nthreads, &size);
+    int adjusted_height = size.height;
+    int adjusted_width = size.width;
 
-            // Compute the distnace of point (x,y) from the center of the image
-            x_dist = (double)(x - FILTER_SIZE/2);
-            y_dist = (double)(y - FILTER_SIZE/2);
-
-            // Compute the gaussian value
-            gaussian_value = G(x_dist,y_dist,D0);
+#ifdef DEBUG
+        printf("  Padded image size: %d x %d (%d candidates, %0.2fx vs. native)\n\n", adjusted_width, adjusted_height, size.candidates, size.speedup);
+#endif
 
-            // Keep track of the sum so that we can normalize everything afterward
-            gaussian_sum += gaussian_value;
+    // Input matrix size is simply height * width (since we're storing the matrix in a single array)
+    size_t input_matrix_size = adjusted_height * adjusted_width;
 
-            if (gaussian_value > gaussian_max){
-                gaussian_max = gaussian_value;
-            }
+    // Output matrix size would normally be height * width, too, but FFTs have a mirroring property
+    // whereby FFTs are symmetrical and have redundant information. Thus, we want to take the non-
+    // redundant information
+    size_t output_matrix_size = (adjusted_width/2+1) * adjusted_height;
 
-            // Save gaussian filter
-            gaussian_filter[y*FILTER_SIZE+x] = gaussian_value;
-        }
-    }
+    // Let's get the size of the two matrices in bytes.
+    size_t input_matrix_size_in_bytes = sizeof(double) * input_matrix_size;
+    size_t output_matrix_size_in_bytes = sizeof(fftw_complex) * output_matrix_size;
 
-    // Pad filter
-    double *padded_filter = malloc(input_matrix_size);
-
-    double value = -1;
-    int xf_idx = 0, yf_idx = 0;
-    int right = FILTER_SIZE;
-    int bottom = FILTER_SIZE;
-    for (y=0; y<adjusted_height; ++y){
-        for (x=0; x<adjusted_width; ++x){
-            if (x >= right){
-                value = 0;
-            }
-            else if (y >= bottom){
-                value = 0;
-            }
-            else{
-                value = gaussian_filter[yf_idx*FILTER_SIZE + xf_idx] / gaussian_sum;
-                if (xf_idx >= FILTER_SIZE){
-                    yf_idx++;
-                    xf_idx = 0;
-                }
-                else{
-                    xf_idx++;
-                }
-            }
-            padded_filter[y*width+x] = value;
-            value = -1;
-        }
-    }
-#ifdef DEBUG
-        printf("  Filter created.\n\n");
-#endif
+    // The dTLB probe walks about as much memory as the three channels' transforms do
+    numa_measure_tlb(&buffers, 3 * (input_matrix_size_in_bytes + output_matrix_size_in_bytes));
 
     // Set up timer for array creation
-    struct timeval mem_start, mem_stop;
+    uint64_t mem_start, mem_stop;
 
     // Set up timer for FFTs
-    struct timeval fft_start, ifft_start, fft_stop, ifft_stop;
+    uint64_t fft_start, ifft_start, fft_stop, ifft_stop;
 
     // Set up timer for wall time
-    struct timeval wall_time_start, wall_time_stop;
+    uint64_t wall_time_start, wall_time_stop;
 
     // Set up timer for blurring
-    struct timeval blur_start, blur_stop;
+    uint64_t blur_start, blur_stop;
 
     // Create temporary variables for computing execution time
     double fft_execution_time = 0.0;
@@ -306,61 +1587,118 @@ int main(int argc, char* argv[]){
     double wall_time = 0.0;
 
 #ifdef DEBUG
-        printf("<< PREPARE THREADING >>\n");
-#endif
-    // Set threading
-    fftw_init_threads();
-    fftw_plan_with_nthreads(nthreads);
-#ifdef DEBUG
-        printf("  FFTW is set to use %d threads.\n\n", nthreads);
         printf("<< CREATING PLANS >>\n");
 #endif
-    // Create plans 
-    fftw_plan r_plan; //for time->frequency
-    fftw_plan g_plan; //for time->frequency
-    fftw_plan b_plan; //for time->frequency
-    fftw_plan r_complex_plan; //for frequency->time
-    fftw_plan g_complex_plan; //for frequency->time
-    fftw_plan b_complex_plan; //for frequency->time
-    fftw_plan filter_plan; //for FFT filter
+    // Create plans. The R, G and B channels share one shape and one (fftw_malloc) alignment, so the plan cache hands
+    // out a single forward plan and a single backward plan that get executed on each channel's arrays with the
+    // new-array execute functions.
+    //
+    // The batched engine instead stores the 3 channels of 'images_per_batch' images in one buffer and transforms
+    // all of them with a single plan_many call (howmany = 3 * images_per_batch). This gives FFTW's threads one
+    // larger job to split and pays the per-call overhead once per batch.
+    plan_cache cache;
+    plan_cache_init(&cache);
+    fftw_plan forward_plan; //for time->frequency (R, G and B)
+    fftw_plan backward_plan; //for frequency->time (R, G and B)
+
+    // The filter never changes, so its spectrum is built once per image shape and then served from the kernel cache
+    kernel_cache kernels;
+    kernel_cache_init(&kernels);
 
 #ifdef DEBUG
         printf("  Plans created.\n\n");
         printf("<< ESTABLISHING INPUT AND OUPUT ARRAYS >>\n");
 #endif
 
+    // In-place transforms use FFTW's padded layout: every real row holds 2*(width/2+1) doubles, which is exactly
+    // enough room for the row's width/2+1 complex outputs. So one buffer per channel holds the image, its spectrum
+    // (blurred in place) and the blurred image, instead of three
+    size_t real_row_width = in_place ? 2*(adjusted_width/2+1) : adjusted_width;
+    size_t real_matrix_size = adjusted_height * real_row_width;
+    size_t real_matrix_size_in_bytes = sizeof(double) * real_matrix_size;
+    size_t transform_buffer_bytes = 0; //everything allocated for the transforms below
+
     // Initialize input and ouput arrays for time->frequency
     double *image_r_in; //R channel input
     double *image_g_in; //G channel input
     double *image_b_in; //B channel input
-    double *filter_in; //filter input
     fftw_complex *image_r_out; //R channel output (image_r_in -> DFT -> image_r_out)
     fftw_complex *image_g_out; //G channel output (image_g_in -> DFT -> image_g_out) 
     fftw_complex *image_b_out; //B channel output (image_b_in -> DFT -> image_b_out)
-    fftw_complex *filter_out; //filter output
+    fftw_complex *filter_out; //filter spectrum (owned by the kernel cache)
 
-    // Initialize input and ouput arrays for frequency->time
-    fftw_complex *convolved_r_in; //R channel input
-    fftw_complex *convolved_g_in; //G channel input
-    fftw_complex *convolved_b_in; //B channel input
+    // Initialize ouput arrays for frequency->time. The blur is applied in place on image_*_out, which is then the
+    // input of the backward DFT
     double *convolved_r_out; //R channel output
     double *convolved_g_out; //G channel output
     double *convolved_b_out; //B channel output
 
+    // Initialize the batched arrays. Plane p (image p/3, channel p%3) holds pixel z at [z*istride + p*idist] and
+    // spectrum entry z at [z*ostride + p*odist]
+    int max_planes = 3 * images_per_batch;
+    double *batch_in = NULL; //R, G and B channels of every image in the batch
+    fftw_complex *batch_out = NULL; //batch_in -> DFT -> batch_out (blurred in place)
+    double *batch_convolved_out = NULL; //batch_out -> IDFT -> batch_convolved_out
+    image_r_in = image_g_in = image_b_in = NULL;
+    image_r_out = image_g_out = image_b_out = NULL;
+    convolved_r_out = convolved_g_out = convolved_b_out = NULL;
+
     // Allocate memory for Forward DFT (FFT)
-    gettimeofday(&mem_start, NULL); //start clock
-    image_r_in = (double*)fftw_malloc(input_matrix_size_in_bytes); image_r_out = (fftw_complex*)fftw_malloc(output_matrix_size_in_bytes);
-    image_g_in = (double*)fftw_malloc(input_matrix_size_in_bytes); image_g_out = (fftw_complex*)fftw_malloc(output_matrix_size_in_bytes);
-    image_b_in = (double*)fftw_malloc(input_matrix_size_in_bytes); image_b_out = (fftw_complex*)fftw_malloc(output_matrix_size_in_bytes);
-    filter_in = (double*)fftw_malloc(input_matrix_size_in_bytes); filter_out = (fftw_complex*)fftw_malloc(output_matrix_size_in_bytes);
+    mem_start = timing_now(); //start clock
+    if (in_place && batched){
+        batch_in = (double*)numa_alloc(&buffers, max_planes * real_matrix_size_in_bytes);
+        batch_out = (fftw_complex*)batch_in;
+        batch_convolved_out = batch_in;
+        transform_buffer_bytes = max_planes * real_matrix_size_in_bytes;
+    }
+    else if (in_place){
+        image_r_in = (double*)numa_alloc(&buffers, real_matrix_size_in_bytes); image_r_out = (fftw_complex*)image_r_in; convolved_r_out = image_r_in;
+        image_g_in = (double*)numa_alloc(&buffers, real_matrix_size_in_bytes); image_g_out = (fftw_complex*)image_g_in; convolved_g_out = image_g_in;
+        image_b_in = (double*)numa_alloc(&buffers, real_matrix_size_in_bytes); image_b_out = (fftw_complex*)image_b_in; convolved_b_out = image_b_in;
+        transform_buffer_bytes = 3 * real_matrix_size_in_bytes;
+    }
+    else if (batched){
+        batch_in = (double*)numa_alloc(&buffers, max_planes * input_matrix_size_in_bytes);
+        batch_out = (fftw_complex*)numa_alloc(&buffers, max_planes * output_matrix_size_in_bytes);
+        transform_buffer_bytes = max_planes * (input_matrix_size_in_bytes + output_matrix_size_in_bytes);
+    }
+    else{
+        image_r_in = (double*)numa_alloc(&buffers, input_matrix_size_in_bytes); image_r_out = (fftw_complex*)numa_alloc(&buffers, output_matrix_size_in_bytes);
+        image_g_in = (double*)numa_alloc(&buffers, input_matrix_size_in_bytes); image_g_out = (fftw_complex*)numa_alloc(&buffers, output_matrix_size_in_bytes);
+        image_b_in = (double*)numa_alloc(&buffers, input_matrix_size_in_bytes); image_b_out = (fftw_complex*)numa_alloc(&buffers, output_matrix_size_in_bytes);
+        transform_buffer_bytes = 3 * (input_matrix_size_in_bytes + output_matrix_size_in_bytes);
+    }
 
     // Allocate memory for Backward DFT (IFFT)
-    convolved_r_in = (fftw_complex*)fftw_malloc(output_matrix_size_in_bytes); convolved_r_out = (double*)fftw_malloc(input_matrix_size_in_bytes);
-    convolved_g_in = (fftw_complex*)fftw_malloc(output_matrix_size_in_bytes); convolved_g_out = (double*)fftw_malloc(input_matrix_size_in_bytes);
-    convolved_b_in = (fftw_complex*)fftw_malloc(output_matrix_size_in_bytes); convolved_b_out = (double*)fftw_malloc(input_matrix_size_in_bytes);
-    gettimeofday(&mem_stop, NULL); //start clock
-    total_memory_allocation_time = (mem_stop.tv_sec - mem_start.tv_sec) * 1000.0;// sec to ms
-    total_memory_allocation_time += (mem_stop.tv_usec - mem_start.tv_usec)/ 1000.0;// us to ms
+    if (in_place){
+        // Nothing to do, the backward DFT writes over its input
+    }
+    else if (batched){
+        batch_convolved_out = (double*)numa_alloc(&buffers, max_planes * input_matrix_size_in_bytes);
+        transform_buffer_bytes += max_planes * input_matrix_size_in_bytes;
+    }
+    else{
+        convolved_r_out = (double*)numa_alloc(&buffers, input_matrix_size_in_bytes);
+        convolved_g_out = (double*)numa_alloc(&buffers, input_matrix_size_in_bytes);
+        convolved_b_out = (double*)numa_alloc(&buffers, input_matrix_size_in_bytes);
+        transform_buffer_bytes += 3 * input_matrix_size_in_bytes;
+    }
+
+    // Async staging double-buffers the input arrays: the workers stage the next batch into the spare set while the
+    // current set is being transformed, then the two are swapped. In place, the input arrays are the whole buffers
+    double *spare_r_in = NULL, *spare_g_in = NULL, *spare_b_in = NULL, *spare_batch_in = NULL;
+    if (async_staging && batched){
+        spare_batch_in = (double*)numa_alloc(&buffers, max_planes * real_matrix_size_in_bytes);
+        transform_buffer_bytes += max_planes * real_matrix_size_in_bytes;
+    }
+    else if (async_staging){
+        spare_r_in = (double*)numa_alloc(&buffers, real_matrix_size_in_bytes);
+        spare_g_in = (double*)numa_alloc(&buffers, real_matrix_size_in_bytes);
+        spare_b_in = (double*)numa_alloc(&buffers, real_matrix_size_in_bytes);
+        transform_buffer_bytes += 3 * real_matrix_size_in_bytes;
+    }
+    mem_stop = timing_now(); //stop clock
+    total_memory_allocation_time += timing_elapsed(mem_start, mem_stop) * 1000.0;// sec to ms
     //total_memory_allocation_time *= (1.0e-3);
 
 #ifdef DEBUG
@@ -371,30 +1709,36 @@ int main(int argc, char* argv[]){
     printf("  - R channel: %p (in),  %p (out)\n", image_r_in, convolved_r_out);
     printf("  - G channel: %p (in),  %p (out)\n", image_g_in, convolved_g_out);
     printf("  - B channel: %p (in),  %p (out)\n", image_b_in, convolved_b_out);
-    printf("  - filter:    %p (in)\n", filter_in);
 
     // Check inputs from real -> complex
     printf("  Checking validity of complex pointers:\n");
-    printf("  - R channel: %p (in),  %p (out)\n", image_r_out, convolved_r_in);
-    printf("  - G channel: %p (in),  %p (out)\n", image_g_out, convolved_g_in);
-    printf("  - B channel: %p (in),  %p (out)\n", image_b_out, convolved_b_in);
+    printf("  - R channel: %p\n", image_r_out);
+    printf("  - G channel: %p\n", image_g_out);
+    printf("  - B channel: %p\n", image_b_out);
+    printf("  - batch:     %p (real in), %p (complex), %p (real out)\n", batch_in, batch_out, batch_convolved_out);
 
 #endif
 
-    if (!image_r_in || !image_g_in || !image_b_in || !image_r_out || !image_g_out || !image_b_out || !convolved_r_out || !convolved_g_out || !convolved_b_out || !convolved_r_in || !convolved_g_in || !convolved_b_in){
+    if (async_staging && (batched ? !spare_batch_in : (!spare_r_in || !spare_g_in || !spare_b_in))){
+        printf("  FFTW pointer checks FAILED. Could not allocate the spare buffers for --staging=async.\n");
+        exit(0);
+    }
+    if (batched && (!batch_in || !batch_out || !batch_convolved_out)){
+        printf("  FFTW pointer checks FAILED. One or more pointers is nil. Set DEBUG to see which pointers have failed.\n");
+        exit(0);
+    }
+    if (!batched && (!image_r_in || !image_g_in || !image_b_in || !image_r_out || !image_g_out || !image_b_out || !convolved_r_out || !convolved_g_out || !convolved_b_out)){
         printf("  FFTW pointer checks FAILED. One or more pointers is nil. Set DEBUG to see which pointers have failed.\n");
         exit(0);
     }
 
-    // Checking alignments
-    int in_r_alignment = (int)(((uintptr_t) image_r_in) % ALIGNMENT);
-    int in_g_alignment = (int)(((uintptr_t) image_g_in) % ALIGNMENT);
-    int in_b_alignment = (int)(((uintptr_t) image_b_in) % ALIGNMENT);
-    int in_filter_alignment = (int)(((uintptr_t) filter_in) % ALIGNMENT);
+    // Checking alignments (in batched mode, every channel lives in the same buffer)
+    int in_r_alignment = (int)(((uintptr_t) (batched ? batch_in : image_r_in)) % ALIGNMENT);
+    int in_g_alignment = (int)(((uintptr_t) (batched ? batch_in : image_g_in)) % ALIGNMENT);
+    int in_b_alignment = (int)(((uintptr_t) (batched ? batch_in : image_b_in)) % ALIGNMENT);
     int out_r_alignment = (int)(((uintptr_t) red) % ALIGNMENT);
     int out_g_alignment = (int)(((uintptr_t) green) % ALIGNMENT);
     int out_b_alignment = (int)(((uintptr_t) blue) % ALIGNMENT);
-    int out_filter_alignment = (int)(((uintptr_t) filter_out) % ALIGNMENT);
 
 #ifdef DEBUG
     printf("\n  Checking pointer alignments:\n");
@@ -428,65 +1772,228 @@ int main(int argc, char* argv[]){
         else
             printf("  - B channel 'in' is -NOT- aligned, 'out' is aligned\n");
     }
-    if ((in_filter_alignment == out_filter_alignment) && (in_filter_alignment == 0))
-        printf("  - Filter in/out are aligned\n");
-    else
-        printf("  - Filter in/out are -NOT- aligned\n");
 #endif
 
     if ((in_r_alignment != 0) || (in_g_alignment != 0) || (in_b_alignment != 0) || (out_r_alignment != 0) || (out_g_alignment != 0) || (out_b_alignment != 0))
         printf("  WARNING: One or more RGB channels are not aligned, and improper alignment worsens performance. Set DEBUG for more info.\n");
-     
-    if (in_filter_alignment != 0 || out_filter_alignment != 0)
-        printf("  WARNING: One or more filter channels are not aligned, and improper alignment worsens performance. Set DEBUG for more info.");
 
-    // Variables for creating a gaussian blur
-    unsigned int w, h;
-    double r_real, g_real, b_real, filter_real;
-    double r_imaginary, g_imaginary, b_imaginary, filter_imaginary;
+    // Spectra to blur (every plane of the batch, or the R, G and B channels)
+    fftw_complex **planes = malloc(max_planes * sizeof(fftw_complex*));
+    int plane_stride = 1;
+    if (!batched){
+        planes[0] = image_r_out;
+        planes[1] = image_g_out;
+        planes[2] = image_b_out;
+    }
+
+    // Set up timer for a single image. The first image pays for planning ("cold"), every image after that only
+    // executes cached plans ("warm"). With --plan-mode=replan, every image is cold.
+    uint64_t image_start, image_stop;
+    struct timeval first_fft_stop = program_start;
+    double image_time = 0.0;
+    double cold_image_time = 0.0;
+    double total_warm_image_time = 0.0;
+    int cold_images = 0; //images in the first (cold) batch
+
+    // Shape of the current batch. Planar: planes are contiguous and stored one after another. Interleaved: the
+    // planes' pixels alternate, so pixel z of every plane is stored next to each other
+    int howmany = 0;
+    int istride = 1, idist = 0; //real arrays
+    int ostride = 1, odist = 0; //complex arrays
+    int n[2] = {adjusted_height, adjusted_width};
+
+    // Staging: every image of a batch is one staging job, run on the main thread or (async) on the staging workers
+    staging_job *staging = calloc(images_per_batch, sizeof(staging_job));
+    worker_task *staging_tasks = calloc(images_per_batch, sizeof(worker_task));
+    worker_pool staging_pool;
+    uint64_t stage_start, stage_stop;
+    double stage_time = 0.0;
+    double staging_decode_time = 0.0; //decoding (with --decode-each-image)
+    double staging_copy_time = 0.0; //copying into the input arrays
+    double background_staging_time = 0.0; //decode + copy time of the batches staged by the workers
+    double foreground_staging_time = 0.0; //time the main thread spent staging batches itself
+    double staging_wait_time = 0.0; //time the main thread spent waiting for the workers
+    if (!staging || !staging_tasks){
+        printf("Could not allocate memory for the staging jobs. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (async_staging && !worker_pool_init(&staging_pool, staging_threads)){
+        printf("Could not start the staging workers. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+    int i;
+    for (i=0; i<images_per_batch; i++){
+        staging[i].index = i;
+        staging[i].real_row_width = real_row_width;
+        staging[i].width = width;
+        staging[i].height = height;
+        staging[i].padded_width = adjusted_width;
+        staging[i].padded_height = adjusted_height;
+        staging[i].channels[0] = red;
+        staging[i].channels[1] = green;
+        staging[i].channels[2] = blue;
+        staging[i].decode = decode_each_image;
+        staging[i].path = IMAGE;
+        staging[i].simd = simd;
+    }
+
+    // With a pool or OpenMP backend, the copy-in is split across its threads too. The default backend copies on the
+    // main thread, as the benchmark always did
+    thread_backend *copy_threads = (thread_kind == THREAD_BACKEND_FFTW) ? NULL : &threads;
+
+    // Every iteration (image, or batch of images) is recorded per phase, so that the tail latencies can be reported
+    // and not just the totals. The first 'warmup' iterations are left out
+    const char *phase_names[LATENCY_PHASES] = {"plan", "copy_in", "forward", "multiply", "backward", "iteration"};
+    latency_histogram latency[LATENCY_PHASES];
+    latency_summary latency_summaries[LATENCY_PHASES];
+    double phase_seconds[LATENCY_PHASES]; //time spent in each phase over the recorded iterations
+    uint64_t plan_stop;
+
+    // Operations and bytes of every executed transform, counted from the plans themselves
+    flop_count forward_count, backward_count;
+    memset(&forward_count, 0, sizeof(flop_count));
+    memset(&backward_count, 0, sizeof(flop_count));
+
+    // The hardware counters (if any) are read around the same phases. Reads happen outside the timed regions
+    perf_totals counter_totals[LATENCY_PHASES];
+    perf_sample iteration_counters, phase_counters;
+    memset(counter_totals, 0, sizeof(counter_totals));
+    for (i=0; i<LATENCY_PHASES; i++){
+        if (!latency_histogram_init(&latency[i], warmup)){
+            printf("Could not allocate the latency histograms. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // Capture wall time
-    gettimeofday(&wall_time_start, NULL); //start clock
+    wall_time_start = timing_now(); //start clock
 
     // This loop executes 'niters' times to represent a total of 'niters' images
     int a=0;
 
-    for (int k=0; k<niters; k++){
+    for (int k=0; k<niters; k+=images_per_batch){
 
 #ifdef DEBUG
         if (k == 0)
             printf("\n<< BLURRING IMAGES >>\n");
 #endif
-        // Define plans
-        r_plan = fftw_plan_dft_r2c_2d(adjusted_height, adjusted_width, image_r_in, image_r_out, FFTW_ESTIMATE);
-        g_plan = fftw_plan_dft_r2c_2d(adjusted_height, adjusted_width, image_g_in, image_g_out, FFTW_ESTIMATE);
-        b_plan = fftw_plan_dft_r2c_2d(adjusted_height, adjusted_width, image_b_in, image_b_out, FFTW_ESTIMATE);
-        filter_plan = fftw_plan_dft_r2c_2d(adjusted_height, adjusted_width, filter_in, filter_out, FFTW_ESTIMATE);
+        // The last batch holds whatever images are left
+        int batch_images = (niters - k < images_per_batch) ? niters - k : images_per_batch;
+        double batch_elements = 3.0 * batch_images * adjusted_height * adjusted_width;
+        bool record_counters = k / images_per_batch >= warmup;
+
+        perf_counters_read(&counters, &iteration_counters);
+        image_start = timing_now(); //start clock
+
+        // Get the filter's spectrum (only the first lookup actually builds it)
+        filter_out = kernel_cache_gaussian(&kernels, &cache, adjusted_height, adjusted_width, D0, FILTER_SIZE, analytic_filter, nthreads, flags);
+
+        // Get plans from the cache (only the first lookup of each plan actually runs the FFTW planner)
+        if (batched){
+            howmany = 3 * batch_images;
+            istride = interleaved ? howmany : 1;
+            idist = interleaved ? 1 : (int)real_matrix_size;
+            ostride = interleaved ? howmany : 1;
+            odist = interleaved ? 1 : (int)output_matrix_size;
+            forward_plan = plan_cache_r2c(&cache, 2, n, howmany, batch_in, istride, idist, batch_out, ostride, odist, nthreads, flags);
+            backward_plan = plan_cache_c2r(&cache, 2, n, howmany, batch_out, ostride, odist, batch_convolved_out, istride, idist, nthreads, flags);
+        }
+        else{
+            forward_plan = plan_cache_r2c_2d(&cache, adjusted_height, adjusted_width, image_r_in, image_r_out, nthreads, flags);
+            backward_plan = plan_cache_c2r_2d(&cache, adjusted_height, adjusted_width, image_r_out, convolved_r_out, nthreads, flags);
+        }
 #ifdef DEBUG
-        printf("  Plans set #%d of %d successfully populated.\n", k+1, niters);
+        printf("  Plans set #%d of %d successfully populated.\n", k/images_per_batch+1, (niters+images_per_batch-1)/images_per_batch);
 #endif
 
-        // Fill input arrays (Note: This MUST be done AFTER we define the plans; otherwise, the FFT will fail.)
-        unsigned int z;
-        for (z=0; z<width*height; z++){
-            image_r_in[z] = red[z];
-            image_g_in[z] = green[z];
-            image_b_in[z] = blue[z];
-            filter_in[z] = padded_filter[z];
+        // With async staging, the last (smaller) batch needs plans of its own. Create them now, before the workers
+        // stage anything into the spare buffers, because planning may overwrite its arrays
+        int next_k = k + images_per_batch;
+        if (async_staging && batched && k == 0 && niters > images_per_batch && niters % images_per_batch != 0){
+            int last_howmany = 3 * (niters % images_per_batch);
+            int last_stride = interleaved ? last_howmany : 1;
+            plan_cache_r2c(&cache, 2, n, last_howmany, spare_batch_in, last_stride, idist, in_place ? (fftw_complex*)spare_batch_in : batch_out, last_stride, odist, nthreads, flags);
+            plan_cache_c2r(&cache, 2, n, last_howmany, in_place ? (fftw_complex*)spare_batch_in : batch_out, last_stride, odist, in_place ? spare_batch_in : batch_convolved_out, last_stride, idist, nthreads, flags);
+        }
+
+        plan_stop = timing_now();
+        latency_histogram_record(&latency[PHASE_PLAN], timing_elapsed(image_start, plan_stop));
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_PLAN], &iteration_counters, batch_elements, record_counters);
+
+        // Stage the batch's images into the input arrays (Note: This MUST be done AFTER we define the plans;
+        // otherwise, the FFT will fail.) With async staging, every batch after the first one was already staged into
+        // these arrays by the workers while the previous batch was being transformed, so we only wait for them
+        int p;
+        bool staged_in_background = async_staging && k > 0;
+        perf_counters_read(&counters, &phase_counters);
+        stage_start = timing_now(); //start clock
+        for (i=0; i<batch_images; i++){
+            if (staged_in_background)
+                worker_pool_wait(&staging_pool, &staging_tasks[i]);
+            else{
+                staging[i].r = image_r_in;
+                staging[i].g = image_g_in;
+                staging[i].b = image_b_in;
+                staging[i].batch = batched ? batch_in : NULL;
+                staging[i].istride = istride;
+                staging[i].idist = idist;
+                staging[i].threads = copy_threads;
+                stage_image(&staging[i]);
+            }
+        }
+        stage_stop = timing_now(); //stop clock
+        stage_time = timing_elapsed(stage_start, stage_stop);
+        latency_histogram_record(&latency[PHASE_COPY_IN], stage_time);
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_COPY_IN], &phase_counters, batch_elements, record_counters);
+        if (staged_in_background)
+            staging_wait_time += stage_time;
+        else
+            foreground_staging_time += stage_time;
+        for (i=0; i<batch_images; i++){
+            if (staging[i].status != IMAGE_OK){
+                printf("Image `%s` could not be decoded while staging image %d. Exiting.\n", IMAGE, k+i+1);
+                exit(EXIT_FAILURE);
+            }
+            staging_decode_time += staging[i].decode_time;
+            staging_copy_time += staging[i].copy_time;
+            if (staged_in_background)
+                background_staging_time += staging[i].decode_time + staging[i].copy_time;
+        }
+
+        // Start staging the next batch into the spare arrays, so that it overlaps this batch's transforms
+        if (async_staging && next_k < niters){
+            int next_images = (niters - next_k < images_per_batch) ? niters - next_k : images_per_batch;
+            for (i=0; i<next_images; i++){
+                staging[i].r = spare_r_in;
+                staging[i].g = spare_g_in;
+                staging[i].b = spare_b_in;
+                staging[i].batch = spare_batch_in;
+                staging[i].istride = (batched && interleaved) ? 3 * next_images : 1;
+                staging[i].idist = idist;
+                staging[i].threads = NULL; //the staging workers copy on their own
+                worker_pool_submit(&staging_pool, &staging_tasks[i], stage_image, &staging[i]);
+            }
         }
 
         // Execute plans to perform forward FFT and capture time
-        gettimeofday(&fft_start, NULL); //start clock
-        fftw_execute(r_plan);
-        fftw_execute(g_plan);
-        fftw_execute(b_plan);
-        gettimeofday(&fft_stop, NULL); //stop clock
-        fftw_execute(filter_plan);
+        perf_counters_read(&counters, &phase_counters);
+        fft_start = timing_now(); //start clock
+        if (batched)
+            fftw_execute_dft_r2c(forward_plan, batch_in, batch_out);
+        else{
+            fftw_execute_dft_r2c(forward_plan, image_r_in, image_r_out);
+            fftw_execute_dft_r2c(forward_plan, image_g_in, image_g_out);
+            fftw_execute_dft_r2c(forward_plan, image_b_in, image_b_out);
+        }
+        fft_stop = timing_now(); //stop clock
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_FORWARD], &phase_counters, batch_elements, record_counters);
+        if (k == 0)
+            gettimeofday(&first_fft_stop, NULL); //same clock as program_start
 
         // Compute execution time
-        fft_execution_time = (fft_stop.tv_sec - fft_start.tv_sec) * 1000.0;// sec to ms
-        fft_execution_time += (fft_stop.tv_usec - fft_start.tv_usec)/ 1000.0;// us to ms
-        fft_execution_time *= (1.0e-3);
+        fft_execution_time = timing_elapsed(fft_start, fft_stop);
+        flop_count_real_plan(&forward_count, forward_plan, 2, n, batched ? howmany : 1, batched ? 1 : 3);
+        latency_histogram_record(&latency[PHASE_FORWARD], fft_execution_time);
 
         // Update total execution time
         total_fft_execution_time += fft_execution_time;
@@ -494,63 +2001,25 @@ int main(int argc, char* argv[]){
         printf("      - Forward FFT successfully executed: %0.3f sec\n", fft_execution_time);
 #endif
         
-        // Now let's bring the complex values back to the time domain values
-        r_complex_plan = fftw_plan_dft_c2r_2d(adjusted_height, adjusted_width, convolved_r_in, convolved_r_out, FFTW_ESTIMATE);
-        g_complex_plan = fftw_plan_dft_c2r_2d(adjusted_height, adjusted_width, convolved_g_in, convolved_g_out, FFTW_ESTIMATE);
-        b_complex_plan = fftw_plan_dft_c2r_2d(adjusted_height, adjusted_width, convolved_b_in, convolved_b_out, FFTW_ESTIMATE);
-
-        // Apply gaussian blur + start blur clock
-        gettimeofday(&blur_start, NULL); //start clock
-        unsigned int idx;
-        double r_re_convolved, g_re_convolved, b_re_convolved;
-        double r_im_convolved, g_im_convolved, b_im_convolved;
-        for (h=0; h<height; h++){
-            for (w=0; w<(width/2+1); w++){
-
-                idx = h * (width / 2 + 1) + w;
-
-                // Collect real values from the convolved image
-                r_real = image_r_out[idx][0];
-                g_real = image_g_out[idx][0];
-                b_real = image_b_out[idx][0];
-
-                // Collect imaginary values from the convolved image
-                r_imaginary = image_r_out[idx][1];
-                g_imaginary = image_g_out[idx][1];
-                b_imaginary = image_b_out[idx][1];
-
-                // Get real values from convolved filter
-                filter_real = filter_out[idx][0];
-                
-                // Get complex values from the convolved filter
-                filter_imaginary = filter_out[idx][1];
-
-                // Complex multiply
-                complex_multiply(r_real, r_imaginary, filter_real, filter_imaginary, &r_re_convolved, &r_im_convolved);
-                complex_multiply(g_real, g_imaginary, filter_real, filter_imaginary, &g_re_convolved, &g_im_convolved);
-                complex_multiply(b_real, b_imaginary, filter_real, filter_imaginary, &b_re_convolved, &b_im_convolved);
-
-                // Save real and imaginary 'R' values
-                convolved_r_in[idx][0] = r_re_convolved;
-                convolved_r_in[idx][1] = r_im_convolved;
-
-                // Save real and imaginary 'G' values
-                convolved_g_in[idx][0] = g_re_convolved;
-                convolved_g_in[idx][1] = g_im_convolved;
+        // Point the blur at every plane of the batch
+        if (batched){
+            for (p=0; p<howmany; p++)
+                planes[p] = batch_out + (size_t)p*odist;
+            plane_stride = ostride;
+        }
 
-                // Save real and imaginary 'B' values
-                convolved_b_in[idx][0] = b_re_convolved;
-                convolved_b_in[idx][1] = b_im_convolved;
+        // Apply gaussian blur (in place, all channels in one pass over the filter) + start blur clock
+        perf_counters_read(&counters, &phase_counters);
+        blur_start = timing_now(); //start clock
+        spectral_multiply_on(&threads, simd, filter_out, adjusted_height, adjusted_width/2+1, planes, planes, batched ? howmany : 3, plane_stride);
 
-            }
-        }
         // Stop blur clock
-        gettimeofday(&blur_stop, NULL); //start clock
+        blur_stop = timing_now(); //stop clock
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_MULTIPLY], &phase_counters, batch_elements, record_counters);
 
         // Compute execution time
-        blur_execution_time = (blur_stop.tv_sec - blur_start.tv_sec) * 1000.0;// sec to ms
-        blur_execution_time += (blur_stop.tv_usec - blur_start.tv_usec)/ 1000.0;// us to ms
-        blur_execution_time *= (1.0e-3);
+        blur_execution_time = timing_elapsed(blur_start, blur_stop);
+        latency_histogram_record(&latency[PHASE_MULTIPLY], blur_execution_time);
 
         // Update total execution time
         total_blur_execution_time += blur_execution_time;
@@ -559,16 +2028,22 @@ int main(int argc, char* argv[]){
 #endif
 
         // Execute IFFT plans and capture execution time
-        gettimeofday(&ifft_start, NULL); //start clock
-        fftw_execute(r_complex_plan);
-        fftw_execute(g_complex_plan);
-        fftw_execute(b_complex_plan);
-        gettimeofday(&ifft_stop, NULL); //stop clock
+        perf_counters_read(&counters, &phase_counters);
+        ifft_start = timing_now(); //start clock
+        if (batched)
+            fftw_execute_dft_c2r(backward_plan, batch_out, batch_convolved_out);
+        else{
+            fftw_execute_dft_c2r(backward_plan, image_r_out, convolved_r_out);
+            fftw_execute_dft_c2r(backward_plan, image_g_out, convolved_g_out);
+            fftw_execute_dft_c2r(backward_plan, image_b_out, convolved_b_out);
+        }
+        ifft_stop = timing_now(); //stop clock
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_BACKWARD], &phase_counters, batch_elements, record_counters);
 
         // Compute execution time
-        ifft_execution_time = (ifft_stop.tv_sec - ifft_start.tv_sec) * 1000.0;// sec to ms
-        ifft_execution_time += (ifft_stop.tv_usec - ifft_start.tv_usec)/ 1000.0;// us to ms
-        ifft_execution_time *= (1.0e-3);
+        ifft_execution_time = timing_elapsed(ifft_start, ifft_stop);
+        flop_count_real_plan(&backward_count, backward_plan, 2, n, batched ? howmany : 1, batched ? 1 : 3);
+        latency_histogram_record(&latency[PHASE_BACKWARD], ifft_execution_time);
 
         // Update total execution time
         total_ifft_execution_time += ifft_execution_time;
@@ -579,31 +2054,104 @@ int main(int argc, char* argv[]){
         // Just to keep the compiler from optimizing the 'for' loops
         a++;
 
+        // Swap in the arrays the workers are staging the next batch into
+        if (async_staging && next_k < niters){
+            double *swap;
+            swap = image_r_in; image_r_in = spare_r_in; spare_r_in = swap;
+            swap = image_g_in; image_g_in = spare_g_in; spare_g_in = swap;
+            swap = image_b_in; image_b_in = spare_b_in; spare_b_in = swap;
+            swap = batch_in; batch_in = spare_batch_in; spare_batch_in = swap;
+            if (in_place && batched){
+                batch_out = (fftw_complex*)batch_in;
+                batch_convolved_out = batch_in;
+            }
+            else if (in_place){
+                image_r_out = (fftw_complex*)image_r_in; convolved_r_out = image_r_in; planes[0] = image_r_out;
+                image_g_out = (fftw_complex*)image_g_in; convolved_g_out = image_g_in; planes[1] = image_g_out;
+                image_b_out = (fftw_complex*)image_b_in; convolved_b_out = image_b_in; planes[2] = image_b_out;
+            }
+        }
+
+        // In replan mode, throw the plans away so that the next image has to plan again
+        if (!cache_plans)
+            plan_cache_clear(&cache);
+
+        image_stop = timing_now(); //stop clock
+        image_time = timing_elapsed(image_start, image_stop);
+        latency_histogram_record(&latency[PHASE_ITERATION], image_time);
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_ITERATION], &iteration_counters, batch_elements, record_counters);
+        if (k == 0){
+            cold_image_time = image_time;
+            cold_images = batch_images;
+        }
+        else
+            total_warm_image_time += image_time;
+
         }
     // Stop clock
-    gettimeofday(&wall_time_stop, NULL); //stop clock
+    wall_time_stop = timing_now(); //stop clock
+    for (i=0; i<LATENCY_PHASES; i++){
+        latency_histogram_summarize(&latency[i], &latency_summaries[i]);
+        phase_seconds[i] = latency_summaries[i].mean * latency_summaries[i].count;
+        latency_histogram_destroy(&latency[i]);
+    }
+
+    if (async_staging)
+        worker_pool_destroy(&staging_pool);
+    free(staging);
+    free(staging_tasks);
+
+    // Staging work the main thread did not have to wait for
+    double hidden_staging_time = background_staging_time - staging_wait_time;
+    if (hidden_staging_time < 0.0)
+        hidden_staging_time = 0.0;
+    double total_staging_time = staging_decode_time + staging_copy_time;
+    double hidden_staging_fraction = (total_staging_time > 0.0) ? hidden_staging_time / total_staging_time : 0.0;
+
+    // Peak resident set size (Linux reports ru_maxrss in kilobytes)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_rss_kb = usage.ru_maxrss;
 
     // Compute execution time
-    wall_time = (wall_time_stop.tv_sec - wall_time_start.tv_sec) * 1000.0;// sec to ms
-    wall_time += (wall_time_stop.tv_usec - wall_time_start.tv_usec)/ 1000.0;// us to ms
-    wall_time *= (1.0e-3);
+    wall_time = timing_elapsed(wall_time_start, wall_time_stop);
+
+    // Save wisdom (cleaning up the threads makes FFTW forget it), and any transform sizes timed during this run
+    wisdom_save(&wisdom);
+    size_table_save(&sizes);
+    size_table_destroy(&sizes);
+
+    // Time from program start to the end of the first forward FFT
+    double time_to_first_fft = (first_fft_stop.tv_sec - program_start.tv_sec) + (first_fft_stop.tv_usec - program_start.tv_usec) * (1.0e-6);
+
+    // Save the plan cache statistics, then destroy the plans (this must happen before cleaning up the threads)
+    unsigned long plans_created = cache.misses;
+    unsigned long plan_cache_hits = cache.hits;
+    double total_planning_time = cache.total_planning_time;
+    plan_cache_destroy(&cache);
+
+    // Same for the kernel cache
+    unsigned long filter_spectra_created = kernels.misses;
+    unsigned long kernel_cache_hits = kernels.hits;
+    double filter_setup_time = kernels.total_setup_time;
+    kernel_cache_destroy(&kernels);
 
     // Handle threading
     fftw_cleanup_threads();
 
+    // Cold = plan + execute (first image or batch), warm = execute only (every image after that)
+    double cold_images_per_sec = (cold_image_time > 0.0) ? cold_images / cold_image_time : 0.0;
+    double warm_images_per_sec = (total_warm_image_time > 0.0) ? (niters - cold_images) / total_warm_image_time : 0.0;
 
-    // Destroy the plan
-    fftw_destroy_plan(r_plan);
-    fftw_destroy_plan(g_plan);
-    fftw_destroy_plan(b_plan);
-    fftw_destroy_plan(filter_plan);
-    fftw_destroy_plan(r_complex_plan);
-    fftw_destroy_plan(g_complex_plan);
-    fftw_destroy_plan(b_complex_plan);
+    // Overall throughput (this is what --batch should move)
+    double images_per_sec = (wall_time > 0.0) ? niters / wall_time : 0.0;
+    const char *engine_name = batched ? "batched" : "separate";
+    const char *layout_name = interleaved ? "interleaved" : "planar";
 
-    // Compute gigaflops
-    long double fft_gflops_approx = niters / total_fft_execution_time;
-    long double ifft_gflops_approx = niters / total_ifft_execution_time;
+    // Compute gigaflops (and bytes per second and arithmetic intensity) from the executed plans
+    flop_rates forward_rates, backward_rates;
+    flop_count_rates(&forward_count, total_fft_execution_time, &forward_rates);
+    flop_count_rates(&backward_count, total_ifft_execution_time, &backward_rates);
 
     // Get average wall times
     double average_wall_time = wall_time / (double)niters;
@@ -617,101 +2165,110 @@ int main(int argc, char* argv[]){
     double single_image_setup_time = overall_setup_time / (double)niters;
 
     // Prepare file to save results to
-    char *tmp_filename = "tmp.json";
-
-    // Open the temporary file for writing
-    FILE *tmp_file = fopen(tmp_filename, "w");
-
-    // If there's an existing file, we'll need to open it, read it, copy the lines, then add to a new file
-    bool file_exists = false;
-    int i;
-    if (access(filename, F_OK) != -1){
-
-        // Change file_exists to 'true' because the file exists!
-        file_exists = true;
-
-        // Create temporary file and open
-        FILE *results_file = fopen(filename, "r");
-
-        // Iterate through all the lines to get the length of the file
-        int file_length = 0;
-        char buffer[BUFFSIZE] = {'\0'};
-        while (fgets(buffer, BUFFSIZE, results_file))
-            file_length++;
-        fclose(results_file);
-
-        // Clear buffer by setting all chars to NULL
-        for (i=0; i<BUFFSIZE; i++)
-            buffer[i] = '\0';
-
-        // Now open again
-        int current_line_no = 0;
-        results_file = fopen(filename, "r");
-
-        // We want to copy every single line into a temporary file EXCEPT the last line, hence "current_line_no < file_length"
-        char curr_char = '\0';
-        while (fgets(buffer, BUFFSIZE, results_file) && (current_line_no < file_length-2)){
-
-            // Iterate through all the characters in 'buffer'
-            for (i=0; i<BUFFSIZE; i++){
-
-                // Get current character
-                curr_char = buffer[i];
-
-                // If the last character is not "\n", then it means we still have characters that we need to write to the file
-                if (curr_char != '\0')
-                    fputc(curr_char, tmp_file);
-
-                // Clear buffer
-                buffer[i] = '\0';
-            }
-
-            // Update line number
-            current_line_no++;
-        }
-        fprintf(tmp_file, "    },\n");
-    }
-
-    // Get timestamp
-    time_t raw_time = time(NULL);
-    struct tm *timeinfo;
-    timeinfo = localtime(&raw_time);
-
-    // Save as JSON
-    if (file_exists == false)
-        fprintf(tmp_file, "{\n");
-    else
-        fprintf(tmp_file, "\n");
-    fprintf(tmp_file, "    \"%d-%d-%d %d:%d:%d\": {\n", timeinfo->tm_year+1900, timeinfo->tm_mon+1, timeinfo->tm_mday, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
-    fprintf(tmp_file, "        \"performance_results\": {\n");
-    fprintf(tmp_file, "            \"inputs\": {\n");
-    fprintf(tmp_file, "                \"num_images\": %d,\n", niters);
-    fprintf(tmp_file, "                \"image_dims\": [%d, %d],\n", width, height);
-    fprintf(tmp_file, "                \"threads\": %d\n", nthreads);
-    fprintf(tmp_file, "            },\n");
-    fprintf(tmp_file, "            \"forward_dft_results\": {\n");
-    fprintf(tmp_file, "                \"total_execution_time_seconds\": %0.5f,\n", total_fft_execution_time);
-    fprintf(tmp_file, "                \"average_gflops\": %0.5Lf\n", fft_gflops_approx);
-    fprintf(tmp_file, "            },\n");
-    fprintf(tmp_file, "            \"backward_dft_results\": {\n");
-    fprintf(tmp_file, "                \"total_execution_time_seconds\": %0.5f,\n", total_ifft_execution_time);
-    fprintf(tmp_file, "                \"average_gflops\": %0.5Lf\n", ifft_gflops_approx);
-    fprintf(tmp_file, "            },\n");
-    fprintf(tmp_file, "            \"misc\": {\n");
-    fprintf(tmp_file, "                \"overall_setup_time_seconds\": %0.5f,\n", overall_setup_time);
-    fprintf(tmp_file, "                \"blur_time_seconds\": %0.5f,\n", total_blur_execution_time);
-    fprintf(tmp_file, "                \"wall_time_without_blur_seconds\": %0.5f,\n", wall_time - total_blur_execution_time);
-    fprintf(tmp_file, "                \"wall_time_seconds\": %0.5f\n", wall_time);
-    fprintf(tmp_file, "            }\n");
-    fprintf(tmp_file, "        }\n");
-    fprintf(tmp_file, "    }\n");
-    fprintf(tmp_file, "}\n");
-
-    // Make sure to close
-    fclose(tmp_file);
-
-    // Rename the temp file
-    rename(tmp_filename, filename);
+    results_record record;
+    FILE *results_file = results_begin(&record, filename);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"num_images\": %d,\n", niters);
+    fprintf(results_file, "                \"image_dims\": [%d, %d],\n", width, height);
+    fprintf(results_file, "                \"threads\": %d,\n", nthreads);
+    fprintf(results_file, "                \"plan_mode\": \"%s\",\n", cache_plans ? "cached" : "replan");
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(flags));
+    fprintf(results_file, "                \"engine\": \"%s\",\n", engine_name);
+    fprintf(results_file, "                \"layout\": \"%s\",\n", batched ? layout_name : "");
+    fprintf(results_file, "                \"images_per_batch\": %d,\n", images_per_batch);
+    fprintf(results_file, "                \"simd\": \"%s\",\n", simd_level_name(simd));
+    fprintf(results_file, "                \"in_place\": %s\n", in_place ? "true" : "false");
+    fprintf(results_file, "            },\n");
+    thread_backend_json(results_file, "            ", &threads);
+    numa_allocator_json(results_file, "            ", &buffers);
+    fprintf(results_file, "            \"forward_dft_results\": {\n");
+    fprintf(results_file, "                \"total_execution_time_seconds\": %0.5f,\n", total_fft_execution_time);
+    flop_rates_json(results_file, "                ", &forward_count, &forward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"backward_dft_results\": {\n");
+    fprintf(results_file, "                \"total_execution_time_seconds\": %0.5f,\n", total_ifft_execution_time);
+    flop_rates_json(results_file, "                ", &backward_count, &backward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"plan_cache\": {\n");
+    fprintf(results_file, "                \"plans_created\": %lu,\n", plans_created);
+    fprintf(results_file, "                \"cache_hits\": %lu,\n", plan_cache_hits);
+    fprintf(results_file, "                \"planning_time_seconds\": %0.5f,\n", total_planning_time);
+    fprintf(results_file, "                \"cold_image_time_seconds\": %0.5f,\n", cold_image_time);
+    fprintf(results_file, "                \"cold_images_per_second\": %0.5f,\n", cold_images_per_sec);
+    fprintf(results_file, "                \"warm_images_per_second\": %0.5f\n", warm_images_per_sec);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"filter\": {\n");
+    fprintf(results_file, "                \"spectrum\": \"%s\",\n", analytic_filter ? "analytic" : "fft");
+    fprintf(results_file, "                \"spectra_created\": %lu,\n", filter_spectra_created);
+    fprintf(results_file, "                \"cache_hits\": %lu,\n", kernel_cache_hits);
+    fprintf(results_file, "                \"setup_time_seconds\": %0.5f\n", filter_setup_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"wisdom\": {\n");
+    fprintf(results_file, "                \"file\": ");
+    results_json_string(results_file, use_wisdom ? wisdom.path : "");
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"imported\": %s,\n", wisdom.imported ? "true" : "false");
+    fprintf(results_file, "                \"import_time_seconds\": %0.5f,\n", wisdom.import_time);
+    fprintf(results_file, "                \"export_time_seconds\": %0.5f,\n", wisdom.export_time);
+    fprintf(results_file, "                \"time_to_first_fft_seconds\": %0.5f\n", time_to_first_fft);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"transform_size\": {\n");
+    fprintf(results_file, "                \"pad\": \"%s\",\n", pad_mode_name(pad));
+    fprintf(results_file, "                \"cost\": \"%s\",\n", size_cost_name(size.measured ? SIZE_COST_MEASURED : SIZE_COST_MODEL));
+    fprintf(results_file, "                \"native_dims\": [%d, %d],\n", width, height);
+    fprintf(results_file, "                \"min_dims\": [%d, %d],\n", size.min_width, size.min_height);
+    fprintf(results_file, "                \"padded_dims\": [%d, %d],\n", adjusted_width, adjusted_height);
+    fprintf(results_file, "                \"candidates\": %d,\n", size.candidates);
+    fprintf(results_file, "                \"native_cost\": %0.5e,\n", size.native_cost);
+    fprintf(results_file, "                \"padded_cost\": %0.5e,\n", size.cost);
+    fprintf(results_file, "                \"speedup_vs_native\": %0.5f,\n", size.speedup);
+    fprintf(results_file, "                \"table_file\": ");
+    results_json_string(results_file, (size_cost == SIZE_COST_MEASURED) ? sizes.path : "");
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"shapes_timed\": %lu,\n", sizes.measured);
+    fprintf(results_file, "                \"timing_time_seconds\": %0.5f\n", sizes.measure_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"ingest\": {\n");
+    fprintf(results_file, "                \"bits_per_sample\": %d,\n", image.depth);
+    fprintf(results_file, "                \"decode_time_seconds\": %0.5f,\n", image.decode_time);
+    fprintf(results_file, "                \"export_time_seconds\": %0.5f,\n", image.export_time);
+    fprintf(results_file, "                \"convert_time_seconds\": %0.5f\n", image.convert_time);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"staging\": {\n");
+    fprintf(results_file, "                \"mode\": \"%s\",\n", async_staging ? "async" : "sync");
+    fprintf(results_file, "                \"workers\": %d,\n", async_staging ? staging_threads : 0);
+    fprintf(results_file, "                \"decode_each_image\": %s,\n", decode_each_image ? "true" : "false");
+    fprintf(results_file, "                \"decode_time_seconds\": %0.5f,\n", staging_decode_time);
+    fprintf(results_file, "                \"copy_time_seconds\": %0.5f,\n", staging_copy_time);
+    fprintf(results_file, "                \"foreground_time_seconds\": %0.5f,\n", foreground_staging_time);
+    fprintf(results_file, "                \"wait_time_seconds\": %0.5f,\n", staging_wait_time);
+    fprintf(results_file, "                \"hidden_time_seconds\": %0.5f,\n", hidden_staging_time);
+    fprintf(results_file, "                \"hidden_fraction\": %0.5f\n", hidden_staging_fraction);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"latency\": {\n");
+    fprintf(results_file, "                \"clock\": \"%s\",\n", clock_source_name(timer_source));
+    fprintf(results_file, "                \"warmup_iterations\": %d,\n", warmup);
+    fprintf(results_file, "                \"images_per_iteration\": %d,\n", images_per_batch);
+    fprintf(results_file, "                \"phases\": {\n");
+    for (i=0; i<LATENCY_PHASES; i++)
+        latency_summary_json(results_file, "                    ", phase_names[i], &latency_summaries[i], i == LATENCY_PHASES-1);
+    fprintf(results_file, "                }\n");
+    fprintf(results_file, "            },\n");
+    perf_counters_json(results_file, "            ", use_counters, &counters, counter_totals, phase_names, phase_seconds, LATENCY_PHASES, false);
+    fprintf(results_file, "            \"memory\": {\n");
+    fprintf(results_file, "                \"transform_buffer_bytes\": %zu,\n", transform_buffer_bytes);
+    fprintf(results_file, "                \"peak_rss_kilobytes\": %ld\n", peak_rss_kb);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"misc\": {\n");
+    fprintf(results_file, "                \"overall_setup_time_seconds\": %0.5f,\n", overall_setup_time);
+    fprintf(results_file, "                \"blur_time_seconds\": %0.5f,\n", total_blur_execution_time);
+    fprintf(results_file, "                \"wall_time_without_blur_seconds\": %0.5f,\n", wall_time - total_blur_execution_time);
+    fprintf(results_file, "                \"wall_time_seconds\": %0.5f,\n", wall_time);
+    fprintf(results_file, "                \"images_per_second\": %0.5f\n", images_per_sec);
+    fprintf(results_file, "            }\n");
+    fprintf(results_file, "        }\n");
+    results_end(&record);
 
     // Print out performance results
     printf("\nPERFORMANCE RESULTS\n");
@@ -719,21 +2276,72 @@ int main(int argc, char* argv[]){
     printf("Operations:\n");
     printf("    %d images of size %dx%d analyzed\n", niters, width, height);
     printf("    %d threads used\n", nthreads);
+    printf("    Plan mode: %s, plan effort: %s\n", cache_plans ? "cached" : "replan", plan_effort_name(flags));
+    if (batched)
+        printf("    Engine: batched, %s layout, %d images (%d transforms) per call\n", layout_name, images_per_batch, 3 * images_per_batch);
+    else
+        printf("    Engine: separate, 1 transform per call\n");
+    printf("    Transforms: %s\n", in_place ? "in-place" : "out-of-place");
+    thread_backend_print(&threads);
+    numa_allocator_print(&buffers);
     printf("FFT Performance Results\n");
-    printf("    %0.3Lf FFT performance GFlops\n", fft_gflops_approx);
+    flop_rates_print("Forward", &forward_count, &forward_rates);
     printf("    %0.3f sec FFT execution time\n", total_fft_execution_time * (1.0));
     printf("Inverse FFT Performance Results\n");
-    printf("    %0.3Lf IFFT performance GFlops\n", ifft_gflops_approx);
+    flop_rates_print("Backward", &backward_count, &backward_rates);
     printf("    %0.3f sec IFFT execution time\n", total_ifft_execution_time * (1.0));
     printf("FFT + IFFT Setup time\n");
     printf("    Took %0.3f sec to setup %d images\n", overall_setup_time, niters);
     printf("    Took %0.3f sec to setup a single image\n", single_image_setup_time);
-    printf("Blur time (non-FFTW computations)\n");
+    printf("Plan cache\n");
+    printf("    %lu plans created, %lu cache hits, %0.3f sec spent planning\n", plans_created, plan_cache_hits, total_planning_time);
+    printf("    Cold (plan + execute): %0.3f sec for the first %s, %0.3f images/sec\n", cold_image_time, batched ? "batch" : "image", cold_images_per_sec);
+    if (niters > cold_images && cache_plans)
+        printf("    Warm (execute only): %0.3f images/sec over %d images\n", warm_images_per_sec, niters - cold_images);
+    else if (niters > cold_images)
+        printf("    Re-planned (plan + execute): %0.3f images/sec over %d images\n", warm_images_per_sec, niters - cold_images);
+    printf("Filter\n");
+    printf("    %s spectrum, %lu created, %lu cache hits, %0.5f sec setup\n", analytic_filter ? "Analytic" : "FFT", filter_spectra_created, kernel_cache_hits, filter_setup_time);
+    printf("Wisdom\n");
+    if (use_wisdom)
+        printf("    %s %s\n", wisdom.imported ? "Imported wisdom from" : "No wisdom found, saved new wisdom to", wisdom.path);
+    else
+        printf("    Disabled\n");
+    printf("    Time to first FFT: %0.3f sec (includes loading the image, wisdom and planning)\n", time_to_first_fft);
+    printf("Transform size\n");
+    if (pad == PAD_NONE)
+        printf("    Native %dx%d (no padding, the blur wraps around the edges)\n", width, height);
+    else
+        printf("    %dx%d padded to %dx%d (needs at least %dx%d, %d candidates, %s cost), %0.2fx %s than native\n", width, height, adjusted_width, adjusted_height, size.min_width, size.min_height, size.candidates, size_cost_name(size.measured ? SIZE_COST_MEASURED : SIZE_COST_MODEL), (size.speedup >= 1.0) ? size.speedup : 1.0 / size.speedup, (size.speedup >= 1.0) ? "faster" : "slower");
+    if (size_cost == SIZE_COST_MEASURED)
+        printf("    %lu shapes timed (%0.3f sec), %s %s\n", sizes.measured, sizes.measure_time, sizes.loaded ? "timings loaded from" : "timings saved to", sizes.path);
+    printf("Ingest\n");
+    printf("    Took %0.5f sec to decode the image, %0.5f sec to export its %d-bit pixels, %0.5f sec to convert them to doubles\n", image.decode_time, image.export_time, image.depth, image.convert_time);
+    printf("Staging (%s the image into the input arrays)\n", decode_each_image ? "decoding and copying" : "copying");
+    printf("    %0.3f sec decoding, %0.3f sec copying\n", staging_decode_time, staging_copy_time);
+    if (async_staging)
+        printf("    Async, %d worker%s: %0.3f sec staged in the foreground, %0.3f sec waiting on the workers, %0.3f sec (%0.1f%%) hidden behind the transforms\n", staging_threads, (staging_threads == 1) ? "" : "s", foreground_staging_time, staging_wait_time, hidden_staging_time, 100.0 * hidden_staging_fraction);
+    else
+        printf("    Sync: %0.3f sec staged in the foreground\n", foreground_staging_time);
+    printf("Latency per %s (%lu recorded after %d warm-up, %s clock)\n", batched ? "batch" : "image", latency_summaries[PHASE_ITERATION].count, warmup, clock_source_name(timer_source));
+    for (i=0; i<LATENCY_PHASES; i++)
+        latency_summary_print(phase_names[i], &latency_summaries[i]);
+    if (use_counters){
+        printf("Hardware counters (same iterations as the latencies)\n");
+        if (!counters.enabled)
+            printf("    Not available on this host\n");
+        for (i=0; i<LATENCY_PHASES && counters.enabled; i++)
+            perf_totals_print(phase_names[i], &counters, &counter_totals[i], phase_seconds[i]);
+    }
+    printf("Memory\n");
+    printf("    %0.1f MB of transform buffers, %0.1f MB peak RSS\n", transform_buffer_bytes / (1024.0 * 1024.0), peak_rss_kb / 1024.0);
+    printf("Blur time (non-FFTW computations, %s kernel)\n", simd_level_name(simd));
     printf("    Took %0.3f sec to blur %d images\n", total_blur_execution_time, niters);
     printf("    Took %0.3f sec to setup a single image\n", average_blur_time);
     printf("Wall time\n");
     printf("    Took %0.3f sec to blur %d images (includes non-FFTW computations)\n", wall_time, niters);
     printf("    Took %0.3f sec to blur single image (includes non-FFTW computations)\n", average_wall_time);
+    printf("    %0.3f images/sec\n", images_per_sec);
     printf("Wall time (excluding blur time)\n");
     printf("    Took %0.3f sec to blur %d images (only FFTW computations)\n", wall_time - total_blur_execution_time, niters);
     printf("    Took %0.3f sec to blur single image (only FFTW computations)\n\n", average_wall_time_excluding_blur);
@@ -757,6 +2365,15 @@ int main(int argc, char* argv[]){
     size_t xx, yy, new_row_width;
     char rgb[16];
     long double scale_factor = (long double)height * (long double)width * (long double)FILTER_SIZE * (long double)FILTER_SIZE;
+
+    // In batched mode, save the first image of the last batch
+    size_t out_stride = 1;
+    if (batched){
+        convolved_r_out = batch_convolved_out;
+        convolved_g_out = batch_convolved_out + idist;
+        convolved_b_out = batch_convolved_out + 2*idist;
+        out_stride = istride;
+    }
     printf("\n<< Final RGB Values >>\n");
     printf("  - scale_factor = ~%0.2e\n", (double)scale_factor);
     for (yy=0; yy<height; yy++){
@@ -764,9 +2381,9 @@ int main(int argc, char* argv[]){
             for (xx=0; xx<new_row_width; xx++){
                 
                 // Get the raw color
-                R_raw = abs(convolved_r_out[yy*width + xx]);
-                G_raw = abs(convolved_g_out[yy*width + xx]);
-                B_raw = abs(convolved_b_out[yy*width + xx]);
+                R_raw = abs(convolved_r_out[(yy*real_row_width + xx)*out_stride]);
+                G_raw = abs(convolved_g_out[(yy*real_row_width + xx)*out_stride]);
+                B_raw = abs(convolved_b_out[(yy*real_row_width + xx)*out_stride]);
 
                 // Convert back to RGB
                 _R = (int)(R_raw / scale_factor * 255.0 * 255.0);
@@ -790,9 +2407,11 @@ int main(int argc, char* argv[]){
         }
     MagickWriteImage(new_image_wand, OUTIMAGE);
     DestroyMagickWand(new_image_wand);
-    DestroyMagickWand(magick_wand);
     MagickWandTerminus();
 #endif
 
+    numa_allocator_destroy(&buffers);
+    thread_backend_destroy(&threads);
+    perf_counters_close(&counters);
     return 0;
 }
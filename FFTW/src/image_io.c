@@ -0,0 +1,253 @@
+/* Image ingest for the image blurring benchmark
+ *
+ * Instead of walking the image pixel by pixel with a PixelIterator, each channel is pulled out of ImageMagick with a
+ * single MagickExportImagePixels call as 8 or 16 bit samples (ImageMagick does the de-interleaving), and then
+ * converted to doubles on a [0,1] scale with a vectorized pass. The decode, export and conversion times are
+ * measured separately.
+ *
+ * image_save_planar() goes the other way for the pipeline's encode stage: the planar channels are clamped,
+ * interleaved into RGB samples of the image's original depth and handed to MagickConstituteImage in one call.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <MagickWand.h>
+#include "image_io.h"
+
+static double elapsed_seconds(struct timeval *start, struct timeval *stop){
+    return (stop->tv_sec - start->tv_sec) + (stop->tv_usec - start->tv_usec) * (1.0e-6);
+}
+
+double *alloc_aligned_doubles(size_t count){
+/* Allocates 'count' doubles aligned to INGEST_ALIGNMENT bytes (aligned_alloc needs a multiple of the alignment) */
+    size_t bytes = count * sizeof(double);
+    bytes = (bytes + INGEST_ALIGNMENT - 1) / INGEST_ALIGNMENT * INGEST_ALIGNMENT;
+    return (double*)aligned_alloc(INGEST_ALIGNMENT, bytes ? bytes : INGEST_ALIGNMENT);
+}
+
+/*
+ * Sample -> double conversion: out[i] = in[i] * scale
+ */
+
+static void u8_to_double_generic(const uint8_t *in, double *out, size_t n, double scale){
+    size_t i;
+    for (i=0; i<n; i++)
+        out[i] = in[i] * scale;
+}
+
+static void u16_to_double_generic(const uint16_t *in, double *out, size_t n, double scale){
+    size_t i;
+    for (i=0; i<n; i++)
+        out[i] = in[i] * scale;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void u8_to_double_avx2(const uint8_t *in, double *out, size_t n, double scale){
+    size_t i;
+    __m256d vscale = _mm256_set1_pd(scale);
+    for (i=0; i+8<=n; i+=8){
+        __m256i samples = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(in + i)));
+        _mm256_storeu_pd(out + i,     _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(samples)), vscale));
+        _mm256_storeu_pd(out + i + 4, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(samples, 1)), vscale));
+    }
+    u8_to_double_generic(in + i, out + i, n - i, scale);
+}
+
+__attribute__((target("avx2")))
+static void u16_to_double_avx2(const uint16_t *in, double *out, size_t n, double scale){
+    size_t i;
+    __m256d vscale = _mm256_set1_pd(scale);
+    for (i=0; i+8<=n; i+=8){
+        __m256i samples = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        _mm256_storeu_pd(out + i,     _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(samples)), vscale));
+        _mm256_storeu_pd(out + i + 4, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(samples, 1)), vscale));
+    }
+    u16_to_double_generic(in + i, out + i, n - i, scale);
+}
+
+__attribute__((target("avx512f")))
+static void u8_to_double_avx512(const uint8_t *in, double *out, size_t n, double scale){
+    size_t i;
+    __m512d vscale = _mm512_set1_pd(scale);
+    for (i=0; i+16<=n; i+=16){
+        __m512i samples = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+        _mm512_storeu_pd(out + i,     _mm512_mul_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(samples)), vscale));
+        _mm512_storeu_pd(out + i + 8, _mm512_mul_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(samples, 1)), vscale));
+    }
+    u8_to_double_generic(in + i, out + i, n - i, scale);
+}
+
+__attribute__((target("avx512f")))
+static void u16_to_double_avx512(const uint16_t *in, double *out, size_t n, double scale){
+    size_t i;
+    __m512d vscale = _mm512_set1_pd(scale);
+    for (i=0; i+16<=n; i+=16){
+        __m512i samples = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(in + i)));
+        _mm512_storeu_pd(out + i,     _mm512_mul_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(samples)), vscale));
+        _mm512_storeu_pd(out + i + 8, _mm512_mul_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(samples, 1)), vscale));
+    }
+    u16_to_double_generic(in + i, out + i, n - i, scale);
+}
+#endif
+
+static void samples_to_double(simd_level simd, const void *in, int depth, double *out, size_t n){
+/* Converts 8 or 16 bit samples into doubles on a [0,1] scale */
+    if (depth == 8){
+        void (*convert)(const uint8_t*, double*, size_t, double) = u8_to_double_generic;
+#if defined(__x86_64__) || defined(__i386__)
+        if (simd == SIMD_AVX512)
+            convert = u8_to_double_avx512;
+        else if (simd == SIMD_AVX2)
+            convert = u8_to_double_avx2;
+#endif
+        convert((const uint8_t*)in, out, n, 1.0 / 255.0);
+    }
+    else{
+        void (*convert)(const uint16_t*, double*, size_t, double) = u16_to_double_generic;
+#if defined(__x86_64__) || defined(__i386__)
+        if (simd == SIMD_AVX512)
+            convert = u16_to_double_avx512;
+        else if (simd == SIMD_AVX2)
+            convert = u16_to_double_avx2;
+#endif
+        convert((const uint16_t*)in, out, n, 1.0 / 65535.0);
+    }
+}
+
+image_status image_load_planar(const char *path, planar_image *image, simd_level simd){
+/* Reads an image and splits it into planar R, G and B double buffers
+ *
+ * Inputs
+ * ======
+ *   const char *path
+ *       Image to read (any format ImageMagick has a delegate for)
+ *
+ *   planar_image *image
+ *       Filled in with the image's size, channels and timings. Free the channels with image_free_planar()
+ *
+ *   simd_level simd
+ *       Which kernel converts the samples to doubles
+ *
+ * MagickWandGenesis() must have been called first
+ */
+    struct timeval start, stop;
+    image_status status = IMAGE_OK;
+
+    memset(image, 0, sizeof(planar_image));
+
+    // Decode
+    MagickWand *wand = NewMagickWand();
+    gettimeofday(&start, NULL); //start clock
+    if (MagickReadImage(wand, path) == MagickFalse){
+        DestroyMagickWand(wand);
+        return IMAGE_READ_FAILED;
+    }
+    gettimeofday(&stop, NULL); //stop clock
+    image->decode_time = elapsed_seconds(&start, &stop);
+
+    image->width = (int)MagickGetImageWidth(wand);
+    image->height = (int)MagickGetImageHeight(wand);
+    image->depth = (MagickGetImageDepth(wand) <= 8) ? 8 : 16;
+    size_t num_pixels = (size_t)image->width * image->height;
+
+    // Planar output channels, plus one scratch buffer for a channel's raw samples
+    image->red = alloc_aligned_doubles(num_pixels);
+    image->green = alloc_aligned_doubles(num_pixels);
+    image->blue = alloc_aligned_doubles(num_pixels);
+    size_t sample_bytes = (num_pixels * (image->depth / 8) + INGEST_ALIGNMENT - 1) / INGEST_ALIGNMENT * INGEST_ALIGNMENT;
+    void *samples = aligned_alloc(INGEST_ALIGNMENT, sample_bytes ? sample_bytes : INGEST_ALIGNMENT);
+    if (!image->red || !image->green || !image->blue || !samples){
+        free(samples);
+        image_free_planar(image);
+        DestroyMagickWand(wand);
+        return IMAGE_ALLOC_FAILED;
+    }
+
+    // Export one channel at a time, converting each to doubles while its samples are still in cache
+    const char *maps[3] = {"R", "G", "B"};
+    double *channels[3] = {image->red, image->green, image->blue};
+    StorageType storage = (image->depth == 8) ? CharPixel : ShortPixel;
+    int c;
+    for (c=0; c<3 && status == IMAGE_OK; c++){
+        gettimeofday(&start, NULL); //start clock
+        if (MagickExportImagePixels(wand, 0, 0, image->width, image->height, maps[c], storage, samples) == MagickFalse)
+            status = IMAGE_EXPORT_FAILED;
+        gettimeofday(&stop, NULL); //stop clock
+        image->export_time += elapsed_seconds(&start, &stop);
+
+        if (status == IMAGE_OK){
+            gettimeofday(&start, NULL); //start clock
+            samples_to_double(simd, samples, image->depth, channels[c], num_pixels);
+            gettimeofday(&stop, NULL); //stop clock
+            image->convert_time += elapsed_seconds(&start, &stop);
+        }
+    }
+
+    free(samples);
+    DestroyMagickWand(wand);
+    if (status != IMAGE_OK)
+        image_free_planar(image);
+
+    return status;
+}
+
+image_status image_save_planar(const char *path, const planar_image *image){
+/* Writes planar R, G and B double buffers to an image file
+ *
+ * Inputs
+ * ======
+ *   const char *path
+ *       File to write. ImageMagick picks the format from the extension
+ *
+ *   const planar_image *image
+ *       Channels on a [0,1] scale (values outside are clamped), written with 'depth' bits per sample
+ *
+ * MagickWandGenesis() must have been called first
+ */
+    size_t i, num_pixels = (size_t)image->width * image->height;
+    int depth = (image->depth == 16) ? 16 : 8;
+    double max_sample = (depth == 8) ? 255.0 : 65535.0;
+    const double *channels[3] = {image->red, image->green, image->blue};
+    image_status status = IMAGE_OK;
+
+    void *samples = malloc(3 * num_pixels * (depth / 8));
+    if (!samples)
+        return IMAGE_ALLOC_FAILED;
+
+    // Interleave, clamp and round
+    int c;
+    for (c=0; c<3; c++){
+        const double *channel = channels[c];
+        for (i=0; i<num_pixels; i++){
+            double value = channel[i];
+            value = (value < 0.0) ? 0.0 : (value > 1.0) ? 1.0 : value;
+            if (depth == 8)
+                ((uint8_t*)samples)[3*i + c] = (uint8_t)(value * max_sample + 0.5);
+            else
+                ((uint16_t*)samples)[3*i + c] = (uint16_t)(value * max_sample + 0.5);
+        }
+    }
+
+    MagickWand *wand = NewMagickWand();
+    if (MagickConstituteImage(wand, image->width, image->height, "RGB", (depth == 8) ? CharPixel : ShortPixel, samples) == MagickFalse ||
+        MagickWriteImage(wand, path) == MagickFalse)
+        status = IMAGE_WRITE_FAILED;
+
+    DestroyMagickWand(wand);
+    free(samples);
+    return status;
+}
+
+void image_free_planar(planar_image *image){
+    free(image->red);
+    free(image->green);
+    free(image->blue);
+    image->red = image->green = image->blue = NULL;
+}
@@ -0,0 +1,33 @@
+/* Image ingest: decodes an image with ImageMagick into planar, aligned [0,1] double buffers (and encodes them back) */
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include <stddef.h>
+#include "simd.h"
+
+#define INGEST_ALIGNMENT 64 //cache line (and AVX-512 register) size
+
+typedef enum {
+    IMAGE_OK,
+    IMAGE_READ_FAILED,   //the file doesn't exist or ImageMagick has no delegate for it
+    IMAGE_EXPORT_FAILED, //the image was read, but its pixels could not be exported
+    IMAGE_ALLOC_FAILED,
+    IMAGE_WRITE_FAILED   //the pixels could not be imported or the file could not be written
+} image_status;
+
+typedef struct {
+    int width, height;
+    double *red, *green, *blue; //planar channels on a [0,1] scale, width*height each, INGEST_ALIGNMENT-aligned
+    int depth;                  //bits per sample that were exported (8 or 16)
+    double decode_time;         //seconds spent reading and decoding the file (MagickReadImage)
+    double export_time;         //seconds spent exporting the pixels (MagickExportImagePixels)
+    double convert_time;        //seconds spent converting the samples to doubles
+} planar_image;
+
+double *alloc_aligned_doubles(size_t count);
+
+image_status image_load_planar(const char *path, planar_image *image, simd_level simd);
+image_status image_save_planar(const char *path, const planar_image *image);
+void image_free_planar(planar_image *image);
+
+#endif
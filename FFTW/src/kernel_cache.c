@@ -0,0 +1,215 @@
+/* Kernel cache for the image blurring benchmark
+ *
+ * The gaussian blur filter only depends on the image shape, the standard deviation and the filter size, so its
+ * spectrum is computed once per (height, width, sigma, filter size) and re-used for every image with that shape.
+ * The spectrum is either the r2c transform of the padded spatial filter, or the gaussian's transfer function
+ * synthesized directly in the frequency domain (no FFT at all).
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "kernel_cache.h"
+
+#define PI 3.14159265359
+
+static double elapsed_seconds(struct timeval *start, struct timeval *stop){
+    return (stop->tv_sec - start->tv_sec) + (stop->tv_usec - start->tv_usec) * (1.0e-6);
+}
+
+static double G(double x, double y, double sigma){
+    /*
+     * This function computes G(x,y), the gaussian distribution for 2 dimensions
+     */
+
+    return (1.0 / (2.0 * PI * sigma * sigma)) * exp( -(x*x + y*y) / (2.0 * sigma * sigma));
+}
+
+void gaussian_filter(double *filter, double sigma, int filter_size){
+/* Writes the normalized filter_size x filter_size gaussian (centered on (filter_size/2, filter_size/2)) */
+    int x, y;
+    double gaussian_sum = 0.0;
+
+    for (y=0; y<filter_size; y++){
+        for (x=0; x<filter_size; x++)
+            gaussian_sum += G((double)(x - filter_size/2), (double)(y - filter_size/2), sigma);
+    }
+    for (y=0; y<filter_size; y++){
+        for (x=0; x<filter_size; x++)
+            filter[y*filter_size + x] = G((double)(x - filter_size/2), (double)(y - filter_size/2), sigma) / gaussian_sum;
+    }
+}
+
+static void fill_padded_filter(double *padded_filter, int height, int width, double sigma, int filter_size){
+/* Writes the normalized filter_size x filter_size gaussian into the top left corner of a height x width array
+ *
+ * Inputs
+ * ======
+ *   double *padded_filter
+ *       Array of height * width doubles. Everything outside of the filter is set to 0
+ *
+ *   int height, width
+ *       Shape of the (padded) image
+ *
+ *   double sigma
+ *       Standard deviation of the gaussian
+ *
+ *   int filter_size
+ *       Size of the filter. The gaussian is centered on (filter_size/2, filter_size/2)
+ */
+    int x, y;
+    double *filter = malloc(sizeof(double) * filter_size * filter_size);
+    if (!filter){
+        printf("Could not allocate the filter. Exiting now.\n");
+        exit(EXIT_FAILURE);
+    }
+    gaussian_filter(filter, sigma, filter_size);
+
+    memset(padded_filter, 0, sizeof(double) * height * width);
+    for (y=0; y<filter_size && y<height; y++){
+        for (x=0; x<filter_size && x<width; x++)
+            padded_filter[y*width + x] = filter[y*filter_size + x];
+    }
+    free(filter);
+}
+
+static void transform_filter(fftw_complex *spectrum, plan_cache *plans, int height, int width, double sigma, int filter_size, int nthreads, unsigned flags){
+/* Computes the spectrum of the padded spatial filter with an r2c FFT */
+    double *padded_filter = (double*)fftw_malloc(sizeof(double) * height * width);
+    if (!padded_filter){
+        printf("Could not allocate the padded filter. Exiting now.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Plan first, since any planner flag other than FFTW_ESTIMATE overwrites the arrays
+    fftw_plan plan = plan_cache_r2c_2d(plans, height, width, padded_filter, spectrum, nthreads, flags);
+    fill_padded_filter(padded_filter, height, width, sigma, filter_size);
+    fftw_execute_dft_r2c(plan, padded_filter, spectrum);
+
+    fftw_free(padded_filter);
+}
+
+static void synthesize_filter(fftw_complex *spectrum, int height, int width, double sigma, int filter_size){
+/* Writes the gaussian's transfer function straight into the r2c spectrum
+ *
+ * The DFT of a gaussian with standard deviation sigma is (approximately) exp(-2 pi^2 sigma^2 (fy^2 + fx^2)), with
+ * fy and fx in cycles per pixel. The spatial filter is centered on (filter_size/2, filter_size/2) rather than on
+ * (0, 0), so the transfer function is multiplied by the matching phase shift. This matches the FFT of the padded
+ * filter up to the truncation of the spatial filter to filter_size x filter_size.
+ */
+    int kx, ky;
+    int half_width = width/2 + 1;
+    double center = (double)(filter_size/2);
+
+    for (ky=0; ky<height; ky++){
+        // Frequencies above the Nyquist frequency wrap around to negative frequencies
+        double fy = (double)((ky <= height/2) ? ky : ky - height) / height;
+        for (kx=0; kx<half_width; kx++){
+            double fx = (double)kx / width;
+            double magnitude = exp(-2.0 * PI * PI * sigma * sigma * (fx*fx + fy*fy));
+            double phase = -2.0 * PI * center * (fx + fy);
+            spectrum[ky*half_width + kx][0] = magnitude * cos(phase);
+            spectrum[ky*half_width + kx][1] = magnitude * sin(phase);
+        }
+    }
+}
+
+void kernel_cache_init(kernel_cache *cache){
+    cache->entries = NULL;
+    cache->num_entries = 0;
+    cache->capacity = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->total_setup_time = 0.0;
+}
+
+void kernel_cache_destroy(kernel_cache *cache){
+    int i;
+    for (i=0; i<cache->num_entries; i++)
+        fftw_free(cache->entries[i].spectrum);
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->num_entries = 0;
+    cache->capacity = 0;
+}
+
+fftw_complex *kernel_cache_gaussian(kernel_cache *cache, plan_cache *plans, int height, int width, double sigma, int filter_size, bool analytic, int nthreads, unsigned flags){
+/* Returns the height x (width/2+1) spectrum of a gaussian blur filter, building it on the first request
+ *
+ * Inputs
+ * ======
+ *   kernel_cache *cache
+ *       The cache to search
+ *
+ *   plan_cache *plans
+ *       Where the filter's r2c plan comes from (only used if the spectrum has to be transformed)
+ *
+ *   int height, width
+ *       Shape of the (padded) image
+ *
+ *   double sigma
+ *       Standard deviation of the gaussian
+ *
+ *   int filter_size
+ *       Size of the spatial filter
+ *
+ *   bool analytic
+ *       If true, synthesize the transfer function instead of transforming the spatial filter
+ *
+ *   int nthreads, unsigned flags
+ *       Threads and planner flags for the filter's FFT
+ *
+ * The returned spectrum belongs to the cache and must not be modified or freed
+ */
+    int i;
+    kernel_cache_entry *entry;
+
+    for (i=0; i<cache->num_entries; i++){
+        entry = &cache->entries[i];
+        if (entry->height == height && entry->width == width && entry->sigma == sigma && entry->filter_size == filter_size && entry->analytic == analytic){
+            entry->hits++;
+            cache->hits++;
+            return entry->spectrum;
+        }
+    }
+
+    if (cache->num_entries == cache->capacity){
+        cache->capacity = (cache->capacity == 0) ? 4 : cache->capacity * 2;
+        cache->entries = realloc(cache->entries, cache->capacity * sizeof(kernel_cache_entry));
+        if (!cache->entries){
+            printf("Could not grow the kernel cache to %d entries. Exiting now.\n", cache->capacity);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct timeval setup_start, setup_stop;
+    gettimeofday(&setup_start, NULL); //start clock
+
+    fftw_complex *spectrum = (fftw_complex*)fftw_malloc(sizeof(fftw_complex) * height * (width/2+1));
+    if (!spectrum){
+        printf("Could not allocate the filter spectrum. Exiting now.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (analytic)
+        synthesize_filter(spectrum, height, width, sigma, filter_size);
+    else
+        transform_filter(spectrum, plans, height, width, sigma, filter_size, nthreads, flags);
+
+    gettimeofday(&setup_stop, NULL); //stop clock
+
+    entry = &cache->entries[cache->num_entries++];
+    entry->height = height;
+    entry->width = width;
+    entry->sigma = sigma;
+    entry->filter_size = filter_size;
+    entry->analytic = analytic;
+    entry->spectrum = spectrum;
+    entry->setup_time = elapsed_seconds(&setup_start, &setup_stop);
+    entry->hits = 0;
+    cache->total_setup_time += entry->setup_time;
+    cache->misses++;
+
+    return spectrum;
+}
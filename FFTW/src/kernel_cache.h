@@ -0,0 +1,35 @@
+/* Kernel cache: computes the spectrum of each blur filter once per (image shape, sigma, filter size) */
+#ifndef KERNEL_CACHE_H
+#define KERNEL_CACHE_H
+
+#include <stdbool.h>
+#include <fftw3.h>
+#include "plan_cache.h"
+
+typedef struct {
+    int height, width;     //image shape the spectrum was computed for
+    double sigma;          //standard deviation of the gaussian
+    int filter_size;       //the spatial filter is filter_size x filter_size
+    bool analytic;         //true if the spectrum was synthesized instead of transformed
+    fftw_complex *spectrum; //height x (width/2+1) r2c spectrum (owned by the cache)
+    double setup_time;     //seconds spent building the spectrum
+    unsigned long hits;    //number of times this spectrum was handed out after creation
+} kernel_cache_entry;
+
+typedef struct {
+    kernel_cache_entry *entries;
+    int num_entries;
+    int capacity;
+    unsigned long hits;      //lookups served from the cache
+    unsigned long misses;    //lookups that had to build a spectrum
+    double total_setup_time; //seconds spent building spectra
+} kernel_cache;
+
+void gaussian_filter(double *filter, double sigma, int filter_size);
+
+void kernel_cache_init(kernel_cache *cache);
+void kernel_cache_destroy(kernel_cache *cache);
+
+fftw_complex *kernel_cache_gaussian(kernel_cache *cache, plan_cache *plans, int height, int width, double sigma, int filter_size, bool analytic, int nthreads, unsigned flags);
+
+#endif
@@ -0,0 +1,412 @@
+/* Distributed-memory mode of nd_cosine_ffts ("--mpi")
+ *
+ * nd_cosine_ffts started under mpirun -np K with --mpi transforms one N-dimensional signal spread over the K processes
+ * with FFTW's MPI interface (fftw3-mpi). FFTW distributes multidimensional data in slabs: each process owns a block of
+ * consecutive rows of the first dimension (fftw_mpi_local_size_many() says which), and a distributed r2c transform is
+ * local transforms of the slab's rows and planes, then all-to-all transposes that bring the first dimension in, and
+ * local transforms along it. By default the output is transposed back to the slab layout, which costs a second
+ * transpose; with --transposed-out, the forward plan leaves it transposed (FFTW_MPI_TRANSPOSED_OUT, first two
+ * dimensions swapped and distributed over the second) and the backward plan takes it like that (FFTW_MPI_TRANSPOSED_IN).
+ *
+ * Every process generates its own slab of the input (signal_generate_range(), the same samples as a single-process
+ * run) and copies it into FFTW's padded r2c layout (the last dimension padded to 2 (n/2+1) reals) before each
+ * forward transform. The transforms are timed per process between barriers, so that the time a process waits for the
+ * slowest one is reported apart from its own execution time.
+ *
+ * FFTW doesn't say how long its plans spend communicating, so the all-to-all share is estimated: a standalone
+ * distributed transpose of the spectrum (fftw_mpi_plan_many_transpose(), the same amount of data the transforms'
+ * transposes move) is timed, and each direction is charged one (--transposed-out) or two of them. The rest of a
+ * transform's time is its compute. Rank 0 gathers every process's timings and writes one record: per-process compute,
+ * all-to-all and wait times for strong scaling (same dims, more processes) and weak scaling (dims growing with the
+ * processes) studies, and aggregate rates over the slowest process's time.
+ *
+ * Only built with -DHAVE_FFTW_MPI (compile_benchmark_code.sh, when mpicc and FFTW's MPI library are found). Otherwise
+ * --mpi reports that this build doesn't have it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "mpi_cosine.h"
+
+#ifdef HAVE_FFTW_MPI
+
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+#include <fftw3-mpi.h>
+#include "flops.h"
+#include "results.h"
+#include "wisdom.h"
+
+// One process's measurements, gathered by rank 0 as an array of doubles
+typedef struct {
+    double local_n0, local_0_start;          //slab of the input: rows of the first dimension
+    double local_n1, local_1_start;          //slab of the transposed spectrum (--transposed-out), rows of the second
+    double generation_time, plan_time;
+    double copy_time;                        //copying the slab into the padded input, summed over the timed iterations
+    double forward_time, backward_time;      //same, executing the transforms
+    double forward_wait, backward_wait;      //waiting at the barrier after them for the slower processes
+    double transpose_time;                   //standalone all-to-all transpose of the spectrum, same
+    double forward_ops[3], backward_ops[3];  //adds, muls and fmas of one execution of this process's plans
+    double round_trip_error;                 //largest |back / size - input| over the slab
+} rank_stats;
+
+#define RANK_STATS_VALUES (sizeof(rank_stats) / sizeof(double))
+
+static const char *thread_level_name(int level){
+    switch (level){
+        case MPI_THREAD_SINGLE: return "single";
+        case MPI_THREAD_FUNNELED: return "funneled";
+        case MPI_THREAD_SERIALIZED: return "serialized";
+        default: return "multiple";
+    }
+}
+
+static void total_count(flop_count *count, const rank_stats *stats, int nprocs, bool forward, int rank, const int *n, int executions){
+/* Accounting of the whole distributed transform: every process's operations, and the work and bytes of one transform
+ * of the full size */
+    double add = 0.0, mul = 0.0, fma = 0.0;
+    int r;
+    for (r=0; r<nprocs; r++){
+        const double *ops = forward ? stats[r].forward_ops : stats[r].backward_ops;
+        add += ops[0];
+        mul += ops[1];
+        fma += ops[2];
+    }
+    memset(count, 0, sizeof(flop_count));
+    flop_count_real_ops(count, add, mul, fma, sizeof(double), rank, n, 1, executions);
+}
+
+bool mpi_cosine_available(void){
+    return true;
+}
+
+void mpi_cosine_run(int *argc, char ***argv, const mpi_cosine_job *job){
+/* Runs the job on every process of MPI_COMM_WORLD and writes the results from rank 0. Initializes and finalizes MPI
+ *
+ * Inputs
+ * ======
+ *   int *argc, char ***argv
+ *       main()'s, for MPI_Init_thread()
+ *
+ *   const mpi_cosine_job *job
+ *       Size of the transform and how to run it (see mpi_cosine.h). Every process is given the same one
+ */
+    int me, nprocs, provided, d, k, r;
+    rank_stats stats;
+    memset(&stats, 0, sizeof(rank_stats));
+
+    // FFTW's threads only call MPI from the main thread
+    MPI_Init_thread(argc, argv, (job->nthreads > 1) ? MPI_THREAD_FUNNELED : MPI_THREAD_SINGLE, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &me);
+    MPI_Comm_size(MPI_COMM_WORLD, &nprocs);
+    if (job->nthreads > 1 && provided < MPI_THREAD_FUNNELED && me == 0)
+        printf("  WARNING: This MPI only provides MPI_THREAD_SINGLE, so the %d threads per process may not be safe.\n", job->nthreads);
+    fftw_init_threads();
+    fftw_mpi_init();
+    fftw_plan_with_nthreads(job->nthreads);
+
+    // Logical sizes of the real input, and of the spectrum (the last dimension halved), which FFTW distributes
+    int rank = job->rank;
+    ptrdiff_t *n = malloc(rank * sizeof(ptrdiff_t));
+    ptrdiff_t *nc = malloc(rank * sizeof(ptrdiff_t));
+    if (!n || !nc){
+        printf("Could not allocate the dimensions. Exiting.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    size_t n_total = 1, rows = 1; //samples, and rows of the last dimension in one row of the first
+    for (d=0; d<rank; d++){
+        n[d] = nc[d] = job->n[d];
+        n_total *= (size_t)job->n[d];
+        if (d > 0 && d < rank-1)
+            rows *= (size_t)job->n[d];
+    }
+    nc[rank-1] = n[rank-1]/2 + 1;
+    size_t last = (size_t)n[rank-1], padded = 2 * (size_t)nc[rank-1];
+
+    // This process's slab
+    ptrdiff_t local_n0, local_0_start, local_n1 = 0, local_1_start = 0, alloc_local;
+    if (job->transposed)
+        alloc_local = fftw_mpi_local_size_many_transposed(rank, nc, 1, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, MPI_COMM_WORLD, &local_n0, &local_0_start, &local_n1, &local_1_start);
+    else
+        alloc_local = fftw_mpi_local_size_many(rank, nc, 1, FFTW_MPI_DEFAULT_BLOCK, MPI_COMM_WORLD, &local_n0, &local_0_start);
+    if (alloc_local < 1)
+        alloc_local = 1; //processes left without rows still take part in the transposes
+    stats.local_n0 = (double)local_n0;
+    stats.local_0_start = (double)local_0_start;
+    stats.local_n1 = (double)local_n1;
+    stats.local_1_start = (double)local_1_start;
+    size_t local_rows = (size_t)local_n0 * rows, local_samples = local_rows * last;
+
+    double *original = malloc((local_samples > 0 ? local_samples : 1) * sizeof(double));
+    double *in = fftw_alloc_real(2 * (size_t)alloc_local);
+    fftw_complex *out = fftw_alloc_complex((size_t)alloc_local);
+    double *back = fftw_alloc_real(2 * (size_t)alloc_local);
+    if (!original || !in || !out || !back){
+        printf("Rank %d could not allocate its slab of %zu samples. Exiting.\n", me, local_samples);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+
+    // The slab's samples are the ones a single process would generate at the same offsets
+    uint64_t generation_start = timing_now();
+    signal_generate_range(original, (size_t)local_0_start * rows * last, local_samples, n_total, job->signal);
+    stats.generation_time = timing_elapsed(generation_start, timing_now());
+
+    // Rank 0 reads the wisdom and shares it. Planning is collective: every process plans the same transform
+    wisdom_store wisdom;
+    memset(&wisdom, 0, sizeof(wisdom_store));
+    if (me == 0){
+        wisdom_init(&wisdom, job->wisdom_dir);
+        wisdom.enabled = job->use_wisdom;
+        wisdom_load(&wisdom);
+    }
+    if (job->use_wisdom)
+        fftw_mpi_broadcast_wisdom(MPI_COMM_WORLD);
+
+    unsigned forward_flags = job->flags | (job->transposed ? FFTW_MPI_TRANSPOSED_OUT : 0);
+    unsigned backward_flags = job->flags | (job->transposed ? FFTW_MPI_TRANSPOSED_IN : 0);
+    MPI_Barrier(MPI_COMM_WORLD);
+    uint64_t plan_start = timing_now();
+    fftw_plan forward = fftw_mpi_plan_many_dft_r2c(rank, n, 1, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, in, out, MPI_COMM_WORLD, forward_flags);
+    fftw_plan backward = fftw_mpi_plan_many_dft_c2r(rank, n, 1, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, out, back, MPI_COMM_WORLD, backward_flags);
+    stats.plan_time = timing_elapsed(plan_start, timing_now());
+
+    // The all-to-all on its own: the spectrum as an nc[0] x nc[1] matrix of 2 x (the remaining dimensions) doubles
+    ptrdiff_t tuple = 2, t_n0, t_0_start, t_n1, t_1_start, t_alloc;
+    for (d=2; d<rank; d++)
+        tuple *= nc[d];
+    t_alloc = fftw_mpi_local_size_many_transposed(2, nc, tuple, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, MPI_COMM_WORLD, &t_n0, &t_0_start, &t_n1, &t_1_start);
+    if (t_alloc < 1)
+        t_alloc = 1;
+    double *transpose_in = fftw_alloc_real((size_t)t_alloc);
+    double *transpose_out = fftw_alloc_real((size_t)t_alloc);
+    if (!transpose_in || !transpose_out){
+        printf("Rank %d could not allocate the transpose buffers. Exiting.\n", me);
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    fftw_plan transpose = fftw_mpi_plan_many_transpose(nc[0], nc[1], tuple, FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK, transpose_in, transpose_out, MPI_COMM_WORLD, job->flags);
+    if (!forward || !backward || !transpose){
+        if (me == 0)
+            printf("FFTW could not plan the distributed transforms. Exiting.\n");
+        MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+    }
+    memset(transpose_in, 0, (size_t)t_alloc * sizeof(double));
+
+    if (job->use_wisdom){
+        fftw_mpi_gather_wisdom(MPI_COMM_WORLD);
+        if (me == 0)
+            wisdom_save(&wisdom);
+    }
+
+    // The transforms: a copy into the padded slab (the distributed plans may overwrite their input), then forward and
+    // backward, each followed by a barrier that the faster processes wait at
+    size_t row, j;
+    for (k=0; k<job->warmup + job->niters; k++){
+        uint64_t copy_start = timing_now();
+        for (row=0; row<local_rows; row++)
+            memcpy(in + row*padded, original + row*last, last * sizeof(double));
+        uint64_t copy_stop = timing_now();
+        MPI_Barrier(MPI_COMM_WORLD);
+
+        uint64_t forward_start = timing_now();
+        fftw_execute(forward);
+        uint64_t forward_stop = timing_now();
+        MPI_Barrier(MPI_COMM_WORLD);
+        uint64_t backward_start = timing_now();
+        fftw_execute(backward);
+        uint64_t backward_stop = timing_now();
+        MPI_Barrier(MPI_COMM_WORLD);
+        uint64_t iteration_stop = timing_now();
+
+        if (k < job->warmup)
+            continue;
+        stats.copy_time += timing_elapsed(copy_start, copy_stop);
+        stats.forward_time += timing_elapsed(forward_start, forward_stop);
+        stats.forward_wait += timing_elapsed(forward_stop, backward_start);
+        stats.backward_time += timing_elapsed(backward_start, backward_stop);
+        stats.backward_wait += timing_elapsed(backward_stop, iteration_stop);
+    }
+    for (k=0; k<job->warmup + job->niters; k++){
+        MPI_Barrier(MPI_COMM_WORLD);
+        uint64_t transpose_start = timing_now();
+        fftw_execute(transpose);
+        uint64_t transpose_stop = timing_now();
+        if (k >= job->warmup)
+            stats.transpose_time += timing_elapsed(transpose_start, transpose_stop);
+    }
+
+    // FFTW's transforms are unnormalized
+    for (row=0; row<local_rows; row++){
+        for (j=0; j<last; j++){
+            double error = fabs(back[row*padded + j] / (double)n_total - original[row*last + j]);
+            if (error > stats.round_trip_error)
+                stats.round_trip_error = error;
+        }
+    }
+    fftw_flops(forward, &stats.forward_ops[0], &stats.forward_ops[1], &stats.forward_ops[2]);
+    fftw_flops(backward, &stats.backward_ops[0], &stats.backward_ops[1], &stats.backward_ops[2]);
+
+    rank_stats *all = NULL;
+    if (me == 0){
+        all = malloc(nprocs * sizeof(rank_stats));
+        if (!all){
+            printf("Could not allocate the per-process results. Exiting.\n");
+            MPI_Abort(MPI_COMM_WORLD, EXIT_FAILURE);
+        }
+    }
+    MPI_Gather(&stats, RANK_STATS_VALUES, MPI_DOUBLE, all, RANK_STATS_VALUES, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+
+    fftw_destroy_plan(forward);
+    fftw_destroy_plan(backward);
+    fftw_destroy_plan(transpose);
+    fftw_free(in);
+    fftw_free(out);
+    fftw_free(back);
+    fftw_free(transpose_in);
+    fftw_free(transpose_out);
+    free(original);
+    free(n);
+    free(nc);
+
+    if (me != 0){
+        fftw_mpi_cleanup();
+        MPI_Finalize();
+        return;
+    }
+
+    // A distributed transform takes as long as its slowest process. The all-to-all estimate is per execution
+    int niters = job->niters, transposes = job->transposed ? 1 : 2;
+    double forward_max = 0.0, backward_max = 0.0, generation_max = 0.0, plan_max = 0.0, error_max = 0.0;
+    double busy_max = 0.0, busy_sum = 0.0;
+    for (r=0; r<nprocs; r++){
+        double busy = all[r].forward_time + all[r].backward_time;
+        forward_max = fmax(forward_max, all[r].forward_time);
+        backward_max = fmax(backward_max, all[r].backward_time);
+        generation_max = fmax(generation_max, all[r].generation_time);
+        plan_max = fmax(plan_max, all[r].plan_time);
+        error_max = fmax(error_max, all[r].round_trip_error);
+        busy_max = fmax(busy_max, busy);
+        busy_sum += busy;
+    }
+    double imbalance = (busy_sum > 0.0) ? busy_max / (busy_sum / nprocs) : 1.0;
+
+    flop_count forward_count, backward_count;
+    flop_rates forward_rates, backward_rates;
+    total_count(&forward_count, all, nprocs, true, rank, job->n, niters);
+    total_count(&backward_count, all, nprocs, false, rank, job->n, niters);
+    flop_count_rates(&forward_count, forward_max, &forward_rates);
+    flop_count_rates(&backward_count, backward_max, &backward_rates);
+
+    // Save as JSON
+    results_record record;
+    FILE *results_file = results_begin(&record, job->filename);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"rank\": %d,\n", rank);
+    fprintf(results_file, "                \"dims\": [");
+    for (d=0; d<rank-1; d++)
+        fprintf(results_file, " %d,", job->n[d]);
+    fprintf(results_file, " %d],\n", job->n[rank-1]);
+    fprintf(results_file, "                \"fs_Hz\": %0.2e,\n", job->fs);
+    fprintf(results_file, "                \"iterations\": %d,\n", niters);
+    fprintf(results_file, "                \"warmup\": %d,\n", job->warmup);
+    fprintf(results_file, "                \"threads\": %d,\n", job->nthreads);
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(job->flags));
+    fprintf(results_file, "                \"mpi_processes\": %d,\n", nprocs);
+    fprintf(results_file, "                \"transposed_out\": %s\n", job->transposed ? "true" : "false");
+    fprintf(results_file, "            },\n");
+    signal_json(results_file, "            ", job->signal, n_total, generation_max);
+    fprintf(results_file, "            \"mpi\": {\n");
+    fprintf(results_file, "                \"decomposition\": \"slab\",\n");
+    fprintf(results_file, "                \"thread_support\": \"%s\",\n", thread_level_name(provided));
+    fprintf(results_file, "                \"transposes_per_transform\": %d,\n", transposes);
+    fprintf(results_file, "                \"load_imbalance\": %0.5f,\n", imbalance);
+    fprintf(results_file, "                \"processes\": [\n");
+    for (r=0; r<nprocs; r++){
+        double forward = all[r].forward_time / niters, backward = all[r].backward_time / niters;
+        double all_to_all = 2 * transposes * all[r].transpose_time / niters;
+        fprintf(results_file, "                    {\n");
+        fprintf(results_file, "                        \"rank\": %d,\n", r);
+        fprintf(results_file, "                        \"local_n0\": %0.0f,\n", all[r].local_n0);
+        fprintf(results_file, "                        \"local_0_start\": %0.0f,\n", all[r].local_0_start);
+        fprintf(results_file, "                        \"local_n1\": %0.0f,\n", all[r].local_n1);
+        fprintf(results_file, "                        \"local_1_start\": %0.0f,\n", all[r].local_1_start);
+        fprintf(results_file, "                        \"planning_time_seconds\": %0.5f,\n", all[r].plan_time);
+        fprintf(results_file, "                        \"copy_in_seconds\": %0.5f,\n", all[r].copy_time / niters);
+        fprintf(results_file, "                        \"forward_seconds\": %0.5f,\n", forward);
+        fprintf(results_file, "                        \"backward_seconds\": %0.5f,\n", backward);
+        fprintf(results_file, "                        \"wait_seconds\": %0.5f,\n", (all[r].forward_wait + all[r].backward_wait) / niters);
+        fprintf(results_file, "                        \"transpose_seconds\": %0.5f,\n", all[r].transpose_time / niters);
+        fprintf(results_file, "                        \"all_to_all_seconds\": %0.5f,\n", all_to_all);
+        fprintf(results_file, "                        \"compute_seconds\": %0.5f,\n", fmax(forward + backward - all_to_all, 0.0));
+        fprintf(results_file, "                        \"round_trip_max_error\": %0.3e\n", all[r].round_trip_error);
+        fprintf(results_file, "                    }%s\n", (r < nprocs-1) ? "," : "");
+    }
+    fprintf(results_file, "                ]\n");
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"planning_time_seconds\": %0.5f,\n", plan_max);
+    fprintf(results_file, "            \"forward_dft_results\": {\n");
+    fprintf(results_file, "                \"average_execution_time_seconds\": %0.5f,\n", forward_max / niters);
+    flop_rates_json(results_file, "                ", &forward_count, &forward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"backward_dft_results\": {\n");
+    fprintf(results_file, "                \"average_execution_time_seconds\": %0.5f,\n", backward_max / niters);
+    flop_rates_json(results_file, "                ", &backward_count, &backward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"round_trip_max_error\": %0.3e,\n", error_max);
+    fprintf(results_file, "            \"clock\": \"%s\",\n", clock_source_name(job->timer_source));
+    fprintf(results_file, "            \"wisdom\": {\n");
+    fprintf(results_file, "                \"enabled\": %s,\n", wisdom.enabled ? "true" : "false");
+    fprintf(results_file, "                \"imported\": %s\n", wisdom.imported ? "true" : "false");
+    fprintf(results_file, "            }\n");
+    fprintf(results_file, "        }\n");
+    results_end(&record);
+
+    printf("\nPERFORMANCE RESULTS (MPI, %d process(es))\n", nprocs);
+    printf("===============================\n");
+    printf("Input Info:\n");
+    printf("    One %dD cosine: %d", rank, job->n[0]);
+    for (d=1; d<rank; d++)
+        printf(" x %d", job->n[d]);
+    printf(" samples, in slabs of the first dimension\n");
+    printf("    fs = %0.2e Hz\n", job->fs);
+    printf("    %d iterations (after %d untimed)\n", niters, job->warmup);
+    printf("    %d processes x %d threads (MPI thread support: %s)\n", nprocs, job->nthreads, thread_level_name(provided));
+    printf("    Plan effort: %s, %s output\n", plan_effort_name(job->flags), job->transposed ? "transposed" : "slab-ordered");
+    signal_print(job->signal, n_total, generation_max);
+    printf("Per process (seconds per execution, all-to-all estimated from %d transpose(s) per transform)\n", transposes);
+    printf("    rank      rows  forward  backward  compute  all-to-all     wait\n");
+    for (r=0; r<nprocs; r++){
+        double forward = all[r].forward_time / niters, backward = all[r].backward_time / niters;
+        double all_to_all = 2 * transposes * all[r].transpose_time / niters;
+        printf("    %4d  %8.0f  %7.4f  %8.4f  %7.4f  %10.4f  %7.4f\n", r, all[r].local_n0, forward, backward,
+               fmax(forward + backward - all_to_all, 0.0), all_to_all, (all[r].forward_wait + all[r].backward_wait) / niters);
+    }
+    printf("    Load imbalance (slowest / mean transform time): %0.3f\n", imbalance);
+    printf("DFT Results\n");
+    printf("    Planning time: %0.3f sec\n", plan_max);
+    printf("    Forward DFT execution time: %0.3f sec\n", forward_max / niters);
+    flop_rates_print("Forward DFT", &forward_count, &forward_rates);
+    printf("    Backward DFT execution time: %0.3f sec\n", backward_max / niters);
+    flop_rates_print("Backward DFT", &backward_count, &backward_rates);
+    printf("    Round trip max error: %0.3e\n", error_max);
+
+    free(all);
+    fftw_mpi_cleanup();
+    MPI_Finalize();
+}
+
+#else
+
+bool mpi_cosine_available(void){
+    return false;
+}
+
+void mpi_cosine_run(int *argc, char ***argv, const mpi_cosine_job *job){
+    (void)argc;
+    (void)argv;
+    (void)job;
+    printf("This nd_cosine_ffts was built without FFTW's MPI library, so --mpi is not available.\n");
+    exit(0);
+}
+
+#endif
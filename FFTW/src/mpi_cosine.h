@@ -0,0 +1,27 @@
+/* Distributed-memory mode of nd_cosine_ffts: slab-decomposed r2c/c2r transforms with FFTW's MPI interface */
+#ifndef MPI_COSINE_H
+#define MPI_COSINE_H
+
+#include <stdbool.h>
+#include "signal_gen.h"
+#include "timing.h"
+
+typedef struct {
+    int rank;                  //of the transform (at least 2: FFTW distributes the first dimension)
+    const int *n;
+    double fs;
+    int niters, warmup;        //timed executions, and untimed ones before them
+    int nthreads;              //FFTW threads per MPI process
+    unsigned flags;            //planner effort
+    bool transposed;           //FFTW_MPI_TRANSPOSED_OUT forward (and _IN backward), which skips the transposes back
+    const signal_spec *signal;
+    bool use_wisdom;
+    const char *wisdom_dir;
+    clock_source timer_source;
+    const char *filename;      //JSON document rank 0 appends the results to
+} mpi_cosine_job;
+
+bool mpi_cosine_available(void);
+void mpi_cosine_run(int *argc, char ***argv, const mpi_cosine_job *job);
+
+#endif
@@ -1,7 +1,7 @@
 #define _DEFAULT_SOURCE
 #define PI 3.141592653589793238462643383279
 #define TIMELIMIT 2
-#define BUFFSIZE 4096
+#define LATENCY_PHASES 5 //plan, copy-in, forward DFT, backward DFT and the whole iteration
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,15 +12,41 @@
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <getopt.h>
+#include <limits.h>
+#include "wisdom.h"
+#include "timing.h"
+#include "perf_counters.h"
+#include "flops.h"
+#include "results.h"
+#include "sweep.h"
+#include "thread_backend.h"
+#include "numa_alloc.h"
+#include "precision.h"
+#include "cache_flush.h"
+#include "signal_gen.h"
+#include "mpi_cosine.h"
+
+enum {PHASE_PLAN, PHASE_COPY_IN, PHASE_FORWARD, PHASE_BACKWARD, PHASE_ITERATION};
+
+// How the iterations get their plans: planned once before the loop and executed as they are (cached), created and
+// destroyed by every iteration (replan), or planned once and executed on two sets of arrays in turn with the
+// new-array execute functions (new-array)
+typedef enum {PLAN_MODE_CACHED, PLAN_MODE_REPLAN, PLAN_MODE_NEW_ARRAY} plan_mode;
+static const char *plan_mode_names[3] = {"cached", "replan", "new-array"};
 
-void generate_cosine_data(double *cosine, double fs, int rank, int *n, int matrix_size);
-void fill_row(double *cosine, double fs, int row_length, int start_idx, int n_sum, int matrix_size);
 void plot1D(double *cosine, int dim, int rank, int *n, double fs, char *title);
+void cosine_precision(const precision_engine *engine, double *cosine, const signal_spec *signal, double generation_time, int rank, int *n, size_t n_total, int batch, bool interleaved, double fs, int niters, int warmup, int nthreads, unsigned flags, clock_source timer_source, bool plot, char *filename);
 
 int main(int argc, char* argv[]){
 
+    // Start the clock for "time to first FFT" (this includes loading wisdom and planning)
+    struct timeval program_start;
+    gettimeofday(&program_start, NULL);
+
     // Loop variables
-    int i,j;
+    int i,j,k,b;
+    size_t idx; //over the samples, of which there can be more than INT_MAX
 
     // Parse inputs
     bool plot; //to plot or not to plot -- that is the question!
@@ -28,18 +54,287 @@ int main(int argc, char* argv[]){
     double fs; //sampling frequency (double values)
     int nthreads, niters, rank;
     char *filename;
-    int n[100]; //will hold all of the rank data... max of 100 dims
+    int *n = NULL; //will hold all of the rank data (one entry per dimension)
     char *pEnd;
-    if (argc == 1){
+
+    // FFTW variables
+    unsigned flags = FFTW_ESTIMATE; //planner effort, set with "--plan-effort"
+    bool use_wisdom = true; //load/save FFTW wisdom ("--no-wisdom" turns this off)
+    char *wisdom_dir = NULL; //where wisdom is kept ("--wisdom-dir"), defaults to $FFTW_WISDOM_DIR or ./wisdom
+    int warmup = 1; //"--warmup", untimed iterations run before the timed ones
+    plan_mode mode = PLAN_MODE_CACHED; //"--plan-mode", when the plans are created
+    bool cold_cache = false; //"--cache=cold" evicts the last level cache before every iteration
+    clock_source timer_source = CLOCK_SOURCE_MONOTONIC_RAW; //"--clock", what the timers read
+    bool use_counters = false; //"--counters" reads hardware performance counters around every phase
+    char *csv_path = NULL; //"--csv" also appends the results to this long-format CSV file
+    char *sweep_path = NULL; //"--sweep" runs every configuration listed in this file, in this process
+    thread_backend_kind thread_kind = THREAD_BACKEND_FFTW; //"--thread-backend", threads the transforms run on
+    pin_policy pin = PIN_NONE; //"--pin" pins those threads to CPUs
+    static int pin_cpus[THREAD_BACKEND_MAX_CPUS]; //with "--pin=<list of CPUs>"
+    int num_pin_cpus = 0;
+    numa_policy numa = NUMA_POLICY_NONE; //"--numa", where the transform buffers' pages go
+    huge_pages huge = HUGE_PAGES_NONE; //"--huge-pages" carves the transform buffers from one huge-page arena
+    const precision_engine *precision = find_precision_engine("double"); //"--precision", FFTW API the transforms run on
+    int batch = 1; //"--batch", cosines transformed per execution (fftw_plan_many_dft_r2c/c2r)
+    bool interleaved = false; //"--layout=interleaved" interleaves the batch's cosines instead of storing them one after another
+    signal_spec signal = {SIGNAL_COSINE, 0.0, 1, SIMD_GENERIC, 1}; //"--signal", "--seed" and "--simd": the input
+    signal.level = detect_simd_level();
+    bool signal_set = false; //"--seed" or "--simd" given
+    bool use_mpi = false; //"--mpi" distributes one transform over the processes of mpirun (see mpi_cosine.c)
+    bool transposed_out = false; //"--transposed-out" leaves the distributed spectrum transposed
+
+    // Parse the optional arguments first (these can go anywhere on the command line)
+    static struct option long_options[] = {
+        {"plan-mode", required_argument, NULL, 'p'},
+        {"cache", required_argument, NULL, 'c'},
+        {"plan-effort", required_argument, NULL, 'e'},
+        {"wisdom-dir", required_argument, NULL, 'w'},
+        {"no-wisdom", no_argument, NULL, 'n'},
+        {"warmup", required_argument, NULL, 'W'},
+        {"clock", required_argument, NULL, 'K'},
+        {"counters", no_argument, NULL, 'H'},
+        {"csv", required_argument, NULL, 'x'},
+        {"sweep", required_argument, NULL, 'z'},
+        {"thread-backend", required_argument, NULL, 'B'},
+        {"pin", required_argument, NULL, 'A'},
+        {"numa", required_argument, NULL, 'M'},
+        {"huge-pages", required_argument, NULL, 'G'},
+        {"precision", required_argument, NULL, 'r'},
+        {"batch", required_argument, NULL, 'b'},
+        {"layout", required_argument, NULL, 'l'},
+        {"signal", required_argument, NULL, 'g'},
+        {"seed", required_argument, NULL, 'S'},
+        {"simd", required_argument, NULL, 's'},
+        {"mpi", no_argument, NULL, 'P'},
+        {"transposed-out", no_argument, NULL, 'T'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1){
+        switch (opt){
+            case 'p':
+                if (strcmp(optarg, "cached") == 0)
+                    mode = PLAN_MODE_CACHED;
+                else if (strcmp(optarg, "replan") == 0)
+                    mode = PLAN_MODE_REPLAN;
+                else if (strcmp(optarg, "new-array") == 0)
+                    mode = PLAN_MODE_NEW_ARRAY;
+                else{
+                    printf("Invalid plan mode '%s'. Please use \"cached\", \"replan\" or \"new-array\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'c':
+                if (strcmp(optarg, "warm") == 0)
+                    cold_cache = false;
+                else if (strcmp(optarg, "cold") == 0)
+                    cold_cache = true;
+                else{
+                    printf("Invalid cache state '%s'. Please use \"warm\" or \"cold\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'e':
+                if (!parse_plan_effort(optarg, &flags)){
+                    printf("Invalid plan effort '%s'. Please use \"estimate\", \"measure\", \"patient\" or \"exhaustive\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'w':
+                wisdom_dir = optarg;
+                break;
+            case 'n':
+                use_wisdom = false;
+                break;
+            case 'W':
+                warmup = (int)strtol(optarg, &pEnd, 10);
+                if (warmup < 0){
+                    printf("Number of warm-up iterations must be greater than or equal to 0.\n");
+                    exit(0);
+                }
+                break;
+            case 'K':
+                if (!parse_clock_source(optarg, &timer_source)){
+                    printf("Invalid clock '%s'. Please use \"monotonic\" or \"tsc\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'H':
+                use_counters = true;
+                break;
+            case 'x':
+                csv_path = optarg;
+                break;
+            case 'z':
+                sweep_path = optarg;
+                break;
+            case 'B':
+                if (!parse_thread_backend(optarg, &thread_kind)){
+                    printf("Invalid thread backend '%s'. Please use \"fftw\", \"pool\" or \"openmp\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'A':
+                if (!parse_pin_policy(optarg, &pin, pin_cpus, &num_pin_cpus)){
+                    printf("Invalid pinning '%s'. Please use \"none\", \"compact\", \"scatter\" or a list of CPUs (e.g. \"0,2,4-7\").\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'M':
+                if (!parse_numa_policy(optarg, &numa)){
+                    printf("Invalid NUMA policy '%s'. Please use \"none\", \"local\", \"interleave\" or \"first-touch\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'G':
+                if (!parse_huge_pages(optarg, &huge)){
+                    printf("Invalid huge pages '%s'. Please use \"none\", \"thp\", \"2m\" or \"1g\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'r':
+                precision = find_precision_engine(optarg);
+                if (!precision){
+                    printf("Invalid precision '%s'. This build has: %s.\n", optarg, precision_engine_names());
+                    exit(0);
+                }
+                break;
+            case 'b':
+                batch = (int)strtol(optarg, &pEnd, 10);
+                if (batch < 1){
+                    printf("Number of cosines per batch must be greater than or equal to 1.\n");
+                    exit(0);
+                }
+                break;
+            case 'l':
+                if (strcmp(optarg, "contiguous") == 0)
+                    interleaved = false;
+                else if (strcmp(optarg, "interleaved") == 0)
+                    interleaved = true;
+                else{
+                    printf("Invalid layout '%s'. Please use \"contiguous\" or \"interleaved\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'g':
+                if (!parse_signal_kind(optarg, &signal.kind)){
+                    printf("Invalid signal '%s'. Please use \"cosine\", \"noise\" or \"chirp\".\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 'S':
+                signal_set = true;
+                signal.seed = strtoull(optarg, &pEnd, 10);
+                if (*pEnd != '\0'){
+                    printf("Invalid seed '%s'. Please use a non-negative integer.\n", optarg);
+                    exit(0);
+                }
+                break;
+            case 's':
+                signal_set = true;
+                if (!parse_simd_level(optarg, &signal.level)){
+                    printf("Invalid SIMD level '%s'. Please use \"auto\", \"avx512\", \"avx2\" or \"generic\".\n", optarg);
+                    exit(0);
+                }
+                if (signal.level > detect_simd_level()){
+                    printf("This CPU does not support %s. Please use \"%s\" or lower.\n", simd_level_name(signal.level), simd_level_name(detect_simd_level()));
+                    exit(0);
+                }
+                break;
+            case 'P':
+                if (!mpi_cosine_available()){
+                    printf("This nd_cosine_ffts was built without FFTW's MPI library, so --mpi is not available.\n");
+                    exit(0);
+                }
+                use_mpi = true;
+                break;
+            case 'T':
+                transposed_out = true;
+                break;
+            default:
+                exit(0);
+        }
+    }
+
+    // Now the positional arguments
+    int nargs = argc - optind;
+    char **args = argv + optind - 1; //so that args[1] is the first positional argument
+    bool other_precision = strcmp(precision->name, "double") != 0;
+    if (other_precision && sweep_path){
+        printf("With --sweep, please list the precisions in the config file ('precisions = ...').\n");
+        exit(0);
+    }
+    if ((mode != PLAN_MODE_CACHED || cold_cache) && (sweep_path || other_precision)){
+        printf("--plan-mode and --cache only apply to a double run of nd_cosine_ffts (sweeps and other precisions plan once and run warm).\n");
+        exit(0);
+    }
+    if ((signal_set || signal.kind != SIGNAL_COSINE) && sweep_path){
+        printf("With --sweep, please set the input in the config file ('signal = ...', 'fs = ...', 'seed = ...').\n");
+        exit(0);
+    }
+    if ((batch != 1 || interleaved) && sweep_path){
+        printf("With --sweep, please list the batch sizes and layouts in the config file ('batch = ...', 'layouts = ...').\n");
+        exit(0);
+    }
+    if (transposed_out && !use_mpi){
+        printf("--transposed-out only applies to --mpi.\n");
+        exit(0);
+    }
+    if (use_mpi && (sweep_path || other_precision || batch != 1 || interleaved || mode != PLAN_MODE_CACHED || cold_cache || use_counters || thread_kind != THREAD_BACKEND_FFTW || pin != PIN_NONE || numa != NUMA_POLICY_NONE || huge != HUGE_PAGES_NONE)){
+        printf("--mpi runs one double transform with FFTW's threads, and can't be combined with --sweep, --precision, --batch, --layout, --plan-mode, --cache, --counters, --thread-backend, --pin, --numa or --huge-pages.\n");
+        exit(0);
+    }
+    if (other_precision && (use_counters || thread_kind != THREAD_BACKEND_FFTW || pin != PIN_NONE || numa != NUMA_POLICY_NONE || huge != HUGE_PAGES_NONE)){
+        printf("--precision other than double can't be combined with --counters, --thread-backend, --pin, --numa or --huge-pages.\n");
+        exit(0);
+    }
+
+    // Sweep mode: the config file lists the configurations, and the only positional argument is the results file
+    if (sweep_path){
+        if (nargs != 1){
+            printf("With --sweep, please enter only the JSON document name to save results to.\n");
+            exit(0);
+        }
+        sweep_config *config = malloc(sizeof(sweep_config));
+        if (!config){
+            printf("Could not allocate the sweep config. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+        sweep_config_load(config, sweep_path);
+        results_init("nd_cosine_ffts", argc, argv, csv_path);
+        timing_init(timer_source);
+
+        // One backend, as big as the biggest thread count, serves every configuration
+        thread_backend threads;
+        int max_threads = 1;
+        for (i=0; i<config->num_threads; i++)
+            if (config->threads[i] > max_threads)
+                max_threads = config->threads[i];
+        if (!thread_backend_init(&threads, thread_kind, pin, pin_cpus, num_pin_cpus, max_threads)){
+            printf("Could not start the %s thread backend. Exiting.\n", thread_backend_name(thread_kind));
+            exit(EXIT_FAILURE);
+        }
+        numa_allocator buffers;
+        numa_allocator_init(&buffers, numa, huge, &threads);
+        if (numa != NUMA_POLICY_NONE)
+            numa_measure_bandwidth(&buffers);
+        sweep_run(config, sweep_path, args[1], use_wisdom, wisdom_dir, &threads, &buffers);
+        numa_allocator_destroy(&buffers);
+        thread_backend_destroy(&threads);
+        free(config);
+        return 0;
+    }
+
+    if (nargs == 0){
         printf("No arguments were passed! Please enter: (1.) \"noplot\" or \"plot\" for plotting, (2.) JSON document name to save results to, (3.) number of threads to use, (4.) number of iterations to execute, (5.) the sampling frequency \"fs\" for the cosine, (6.) the rank of the cosine, and (7.) the size of each dimension.\n");
         exit(0);
     }
-    else if (argc < 5){
-        printf("Only %d argument(s) given. Minimum number of arguments is 6. Please enter: (1.) \"noplot\" or \"plot\" for plotting, (2.) JSON document name to save results to, (3.) number of threads to use, (4.) number of iterations to execute, (5.) the sampling frequency \"fs\" for the cosine, (6.) the rank of the cosine, and (7.) the size of each dimension", argc-1);
+    else if (nargs < 7){
+        printf("Only %d argument(s) given. Minimum number of arguments is 7. Please enter: (1.) \"noplot\" or \"plot\" for plotting, (2.) JSON document name to save results to, (3.) number of threads to use, (4.) number of iterations to execute, (5.) the sampling frequency \"fs\" for the cosine, (6.) the rank of the cosine, and (7.) the size of each dimension\n", nargs);
         exit(0);
     }
     else{
-        plot_opt = argv[1]; //set to "plot" to plot or "noplot" to not plot
+        plot_opt = args[1]; //set to "plot" to plot or "noplot" to not plot
 
         if (strcmp(plot_opt, "plot") == 0)
             plot=true;
@@ -50,19 +345,36 @@ int main(int argc, char* argv[]){
             exit(0);
         }
 
-        filename = argv[2];
-        nthreads = (int)strtol(argv[3], &pEnd, 10);
-        niters = (int)strtol(argv[4], &pEnd, 10);
-        fs = atof(argv[5]);
-        rank = (int)strtol(argv[6], &pEnd, 10);
+        filename = args[2];
+        nthreads = (int)strtol(args[3], &pEnd, 10);
+        niters = (int)strtol(args[4], &pEnd, 10);
+        fs = atof(args[5]);
+        rank = (int)strtol(args[6], &pEnd, 10);
+
+        if (nargs < rank+6){
+            printf("Rank is set to %d, but %d dimensions were passed. The number of dimensions passed must equal the rank. Exiting now.\n", rank, nargs-6);
+            exit(0);
+        }
 
-        if (argc <= rank+6){
-            printf("Rank is set to %d, but %d dimensions were passed. The number of dimensions passed must equal the rank. Exiting now.\n", rank, (rank+6-argc));
+        if (rank < 1){
+            printf("The rank must be greater than or equal to 1.\n");
             exit(0);
         }
 
+        // Any rank works: the dimensions are kept on the heap. Each one has to fit FFTW's int sizes, but their product
+        // (the number of samples) is 64-bit
+        n = (int*)malloc(rank * sizeof(int));
+        if (!n){
+            printf("Could not allocate the dimensions. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
         for (i=7; i<rank+7; i++){
-            n[i-7] = (int)strtol(argv[i], &pEnd, 10);
+            long dim = strtol(args[i], &pEnd, 10);
+            if (dim < 1 || dim > INT_MAX){
+                printf("Dimension %d must be between 1 and %d. You entered: %s\n", i-6, INT_MAX, args[i]);
+                exit(0);
+            }
+            n[i-7] = (int)dim;
         }
 
         if (nthreads < 1){
@@ -77,24 +389,23 @@ int main(int argc, char* argv[]){
             printf("Sampling frequency must be greater than 0.0. You entered: %0.2e\n", fs);
             exit(0);
         }
-        if (rank < 1){
-            printf("The rank must be greater than or equal to 1.\n");
+        if (use_mpi && (plot || rank < 2)){
+            printf("With --mpi, please use \"noplot\" and a rank of at least 2 (FFTW distributes the first dimension).\n");
             exit(0);
         }
     }
 
     // Cosine variables
-    int n_total = 1;
+    size_t n_total = 1;
 
     // Plot variables
     char *title = "Resulting cosine Curve After Forward and Backward DFTs";
 
-    // FFTW variables
-    unsigned flags = FFTW_ESTIMATE;
-
     // Performance variables
-    struct timeval forward_dft_start, forward_dft_stop;
-    struct timeval backward_dft_start, backward_dft_stop;
+    uint64_t iteration_start, plan_stop = 0, copy_stop = 0;
+    uint64_t forward_dft_start, forward_dft_stop;
+    uint64_t backward_dft_start, backward_dft_stop;
+    struct timeval first_fft_stop = program_start;
     double forward_dft_execution_time_us = 0.0; //Forward DFT execution time in microseconds (us)
     double backward_dft_execution_time_us = 0.0; //Backward DFT in us
     double total_f_dft_exec_time_us = 0.0; //total forward DFT in us
@@ -102,93 +413,326 @@ int main(int argc, char* argv[]){
 
     // Get the total number of indices
     for (i=0; i<rank; i++){
-        n_total *= n[i];
+        n_total *= (size_t)n[i];
     }
 
     // For a complex transform, we have n[0] x n[1] x n[2] x ... x (n[rank-1]/2 + 1). So, our math is
     // as follows: n_total = n[0] x n[1] x n[2] x ... x n[rank-1]. Since n_total includes n[d-1], we have
     // to divide n_total by n[rank-1] to get n_toral = n[0] x n[1] x n[2] x ... x n[rank-2]. Then we 
     // multiply by n[rank-1] / 2 + 1
-    int n_complex_total = (n_total / n[rank-1]) * (n[rank-1] / 2 + 1);
+    size_t n_complex_total = (n_total / n[rank-1]) * (n[rank-1] / 2 + 1);
+
+    // A batch holds 'batch' cosines, transformed by one plan_many call. They are stored one after another
+    // (contiguous: stride 1, dist = the size of one cosine) or with sample i of every cosine next to each other
+    // (interleaved: stride = batch, dist 1). FFTW's strides and distances are ints, so a contiguous batch of
+    // cosines with more than INT_MAX samples each can't be described
+    if (batch > 1 && !interleaved && n_total > INT_MAX){
+        printf("A contiguous batch of cosines with more than %d samples each can't be planned. Please use --layout=interleaved or --batch=1.\n", INT_MAX);
+        exit(0);
+    }
+    int istride = interleaved ? batch : 1, idist = interleaved ? 1 : (int)n_total;
+    int ostride = interleaved ? batch : 1, odist = interleaved ? 1 : (int)n_complex_total;
+    size_t batch_total = n_total * batch;
+
+    // The run appends one record to the results file (plus rows to the CSV file, if any)
+    results_init("nd_cosine_ffts", argc, argv, csv_path);
+
+    // Pick the clock for the timers (the TSC is calibrated here)
+    timer_source = timing_init(timer_source);
+
+    // MPI mode: every process of mpirun transforms its slab of one distributed signal, and rank 0 writes the record
+    if (use_mpi){
+        signal.fs = fs;
+        signal.nthreads = nthreads;
+        mpi_cosine_job job = {
+            .rank = rank,
+            .n = n,
+            .fs = fs,
+            .niters = niters,
+            .warmup = warmup,
+            .nthreads = nthreads,
+            .flags = flags,
+            .transposed = transposed_out,
+            .signal = &signal,
+            .use_wisdom = use_wisdom,
+            .wisdom_dir = wisdom_dir,
+            .timer_source = timer_source,
+            .filename = filename
+        };
+        mpi_cosine_run(&argc, &argv, &job);
+        free(n);
+        return 0;
+    }
+
+    // Every iteration is recorded per phase, so that the tail latencies can be reported and not just the averages.
+    // The first 'warmup' iterations are left out. The plan and copy_in phases only happen in the iterations with
+    // --plan-mode=replan
+    const char *phase_names[LATENCY_PHASES] = {"plan", "copy_in", "forward", "backward", "iteration"};
+    latency_histogram latency[LATENCY_PHASES];
+    latency_summary latency_summaries[LATENCY_PHASES];
+    double phase_seconds[LATENCY_PHASES]; //time spent in each phase over the recorded iterations
+    for (i=0; i<LATENCY_PHASES; i++){
+        if (!latency_histogram_init(&latency[i], warmup)){
+            printf("Could not allocate the latency histograms. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The hardware counters (if any) are read around the same phases, outside the timed regions. They are opened
+    // before FFTW starts its threads, so that those threads inherit them and are counted too
+    perf_counters counters = {.enabled = false};
+    perf_totals counter_totals[LATENCY_PHASES];
+    perf_sample iteration_counters, phase_counters;
+    memset(counter_totals, 0, sizeof(counter_totals));
+    if (use_counters && !perf_counters_open(&counters))
+        printf("  WARNING: No hardware performance counters could be opened (no PMU, or kernel.perf_event_paranoid is too high), continuing without them.\n");
+
+    // Start (and pin) the threads the transforms run on
+    thread_backend threads;
+    if (!thread_backend_init(&threads, thread_kind, pin, pin_cpus, num_pin_cpus, nthreads)){
+        printf("Could not start the %s thread backend. Exiting.\n", thread_backend_name(thread_kind));
+        exit(EXIT_FAILURE);
+    }
+
+    // Place the buffers' pages on the NUMA nodes, optionally in a huge-page arena (first touch runs on the threads
+    // just started)
+    numa_allocator buffers;
+    numa_allocator_init(&buffers, numa, huge, &threads);
+    if (numa != NUMA_POLICY_NONE)
+        numa_measure_bandwidth(&buffers);
+    numa_measure_tlb(&buffers, 2 * batch_total * sizeof(double) + n_complex_total * batch * sizeof(fftw_complex));
 
     // Set threading
     fftw_init_threads();
     fftw_plan_with_nthreads(nthreads);
+    if (thread_kind != THREAD_BACKEND_FFTW && !thread_backend_install_fftw(&threads))
+        printf("  NOTE: This FFTW has no fftw_threads_set_callback() (FFTW 3.3.9+), so its transforms run on its own threads.\n");
+
+    // Load wisdom saved by earlier runs on this host, so that MEASURE/PATIENT plans are only paid for once
+    wisdom_store wisdom;
+    wisdom_init(&wisdom, wisdom_dir);
+    wisdom.enabled = use_wisdom;
+    wisdom_load(&wisdom);
 
     // Allocate memory for cosine data
-    double *cosine = (double*)malloc(n_total * sizeof(double));
+    double *cosine = (double*)numa_alloc(&buffers, n_total * sizeof(double));
+    if (!cosine){
+        printf("Could not allocate memory for %zu samples. Exiting.\n", n_total);
+        exit(EXIT_FAILURE);
+    }
 
-    // Fill N-dimensional cosine matrix
-    generate_cosine_data(cosine, fs, rank, n, n_total);
+    // Fill the N-dimensional input, in parallel (see signal_gen.c)
+    signal.fs = fs;
+    signal.nthreads = nthreads;
+    uint64_t generation_start = timing_now();
+    signal_generate(cosine, n_total, &signal);
+    double generation_time = timing_elapsed(generation_start, timing_now());
+
+    // Other precisions: run the transforms through the fftwf_/fftwl_/fftwq_ engine, and compare with double. Wisdom is
+    // kept for double plans only
+    if (other_precision){
+        cosine_precision(precision, cosine, &signal, generation_time, rank, n, n_total, batch, interleaved, fs, niters, warmup, nthreads, flags, timer_source, plot, filename);
+        numa_free(&buffers, cosine);
+        numa_allocator_destroy(&buffers);
+        thread_backend_destroy(&threads);
+        free(n);
+        return 0;
+    }
 
     // Set time limit so that FFTW doesn't spend too much time trying to figure out the "best" algorithm.
     fftw_set_timelimit(TIMELIMIT);
 
     // Initialize real-to-complex cosine input and output
-    double *cosine_original = (double*)fftw_malloc(n_total * sizeof(double));
-    fftw_complex *cosine_complex = (fftw_complex*)fftw_malloc(n_complex_total * sizeof(fftw_complex));
+    double *cosine_original = (double*)numa_alloc(&buffers, batch_total * sizeof(double));
+    fftw_complex *cosine_complex = (fftw_complex*)numa_alloc(&buffers, n_complex_total * batch * sizeof(fftw_complex));
 
     // Initialize the cosine that will be returned from the complex DFT
-    double *cosine_back = (double*)fftw_malloc(n_total * sizeof(double));
+    double *cosine_back = (double*)numa_alloc(&buffers, batch_total * sizeof(double));
+    if (!cosine_original || !cosine_complex || !cosine_back){
+        printf("Could not allocate memory for a batch of %d cosines. Exiting.\n", batch);
+        exit(EXIT_FAILURE);
+    }
 
-    // We'll need to do work on a dummy array to prevent the compiler from optimizing the loop
-    int dummy[niters];
-    srand(time(0));
-    int rand_idx; //random index
-    int max_idx = n_total - 1; //max index of the cosine array (matrix)
+    // With --plan-mode=new-array, the iterations alternate between these arrays and a second set, which the new-array
+    // execute functions only accept if it has the same alignment
+    double *original_sets[2] = {cosine_original, cosine_original};
+    fftw_complex *complex_sets[2] = {cosine_complex, cosine_complex};
+    double *back_sets[2] = {cosine_back, cosine_back};
+    int num_sets = (mode == PLAN_MODE_NEW_ARRAY) ? 2 : 1;
+    if (mode == PLAN_MODE_NEW_ARRAY){
+        original_sets[1] = (double*)numa_alloc(&buffers, batch_total * sizeof(double));
+        complex_sets[1] = (fftw_complex*)numa_alloc(&buffers, n_complex_total * batch * sizeof(fftw_complex));
+        back_sets[1] = (double*)numa_alloc(&buffers, batch_total * sizeof(double));
+        if (!original_sets[1] || !complex_sets[1] || !back_sets[1]){
+            printf("Could not allocate memory for the second set of arrays. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+        if (fftw_alignment_of(original_sets[1]) != fftw_alignment_of(cosine_original) || fftw_alignment_of((double*)complex_sets[1]) != fftw_alignment_of((double*)cosine_complex) || fftw_alignment_of(back_sets[1]) != fftw_alignment_of(cosine_back)){
+            printf("The second set of arrays is not aligned like the first, so it can't be used with the same plans. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // Iterate
-    for (j=0; j<niters; j++){
-        // Create FFTW plans
-        fftw_plan forward_cos_dft_plan = fftw_plan_dft_r2c(rank, n, cosine_original, cosine_complex, flags);
-        fftw_plan backward_cos_dft_plan = fftw_plan_dft_c2r(rank, n, cosine_complex, cosine_back, flags);
+    // With --cache=cold, the last level cache is evicted before every iteration (outside the timed phases)
+    cache_flusher flusher;
+    if (!cache_flusher_init(&flusher, cold_cache)){
+        printf("Could not allocate the cache eviction buffer. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
 
-        // Fill input cosine array (this MUST be done after the fftw plans are created)
-        for (i=0; i<n_total; i++)
-            cosine_original[i] = cosine[i];
+    // We'll need to do work on a dummy array to prevent the compiler from optimizing the loop (on the heap, since
+    // there can be any number of iterations)
+    int *dummy = (int*)malloc(niters * sizeof(int));
+    if (!dummy){
+        printf("Could not allocate memory for %d iterations. Exiting.\n", niters);
+        exit(EXIT_FAILURE);
+    }
+    srand(time(0));
+    size_t rand_idx; //random index
+
+    // Operations and bytes of every executed transform, counted from the plans themselves
+    flop_count forward_count, backward_count;
+    memset(&forward_count, 0, sizeof(flop_count));
+    memset(&backward_count, 0, sizeof(flop_count));
+
+    // Plan once up front, unless every iteration re-plans. The input is copied in after planning (planning may
+    // overwrite the arrays), and the out-of-place r2c transform leaves it as it is, so it is only copied once
+    fftw_plan forward_cos_dft_plan = NULL, backward_cos_dft_plan = NULL;
+    double initial_planning_time = 0.0, initial_copy_time = 0.0;
+    if (mode != PLAN_MODE_REPLAN){
+        uint64_t planning_start = timing_now();
+        forward_cos_dft_plan = fftw_plan_many_dft_r2c(rank, n, batch, cosine_original, NULL, istride, idist, cosine_complex, NULL, ostride, odist, flags);
+        backward_cos_dft_plan = fftw_plan_many_dft_c2r(rank, n, batch, cosine_complex, NULL, ostride, odist, cosine_back, NULL, istride, idist, flags);
+        uint64_t planning_stop = timing_now();
+        for (k=0; k<num_sets; k++)
+            for (b=0; b<batch; b++)
+                for (idx=0; idx<n_total; idx++)
+                    original_sets[k][idx*istride + (size_t)b*idist] = cosine[idx];
+        initial_planning_time = timing_elapsed(planning_start, planning_stop);
+        initial_copy_time = timing_elapsed(planning_stop, timing_now());
+    }
+
+    // Iterate: 'warmup' untimed iterations, then 'niters' timed ones
+    int set = 0; //array set of the iteration (alternates with --plan-mode=new-array)
+    for (j=0; j<warmup+niters; j++){
+        bool timed = j >= warmup;
+        set = j % num_sets;
+        cache_flusher_flush(&flusher);
+
+        // Create FFTW plans (replan only)
+        perf_counters_read(&counters, &iteration_counters);
+        iteration_start = timing_now();
+        if (mode == PLAN_MODE_REPLAN){
+            forward_cos_dft_plan = fftw_plan_many_dft_r2c(rank, n, batch, cosine_original, NULL, istride, idist, cosine_complex, NULL, ostride, odist, flags);
+            backward_cos_dft_plan = fftw_plan_many_dft_c2r(rank, n, batch, cosine_complex, NULL, ostride, odist, cosine_back, NULL, istride, idist, flags);
+
+            // Fill input cosine array (this MUST be done after the fftw plans are created)
+            plan_stop = timing_now();
+            perf_counters_accumulate(&counters, &counter_totals[PHASE_PLAN], &iteration_counters, batch_total, timed);
+            perf_counters_read(&counters, &phase_counters);
+            for (b=0; b<batch; b++)
+                for (idx=0; idx<n_total; idx++)
+                    cosine_original[idx*istride + (size_t)b*idist] = cosine[idx];
+            copy_stop = timing_now();
+            perf_counters_accumulate(&counters, &counter_totals[PHASE_COPY_IN], &phase_counters, batch_total, timed);
+            latency_histogram_record(&latency[PHASE_PLAN], timing_elapsed(iteration_start, plan_stop));
+            latency_histogram_record(&latency[PHASE_COPY_IN], timing_elapsed(plan_stop, copy_stop));
+        }
 
         // Execute Forward DFT and capture performance time
-        gettimeofday(&forward_dft_start, NULL); //start clock
-        fftw_execute(forward_cos_dft_plan);
-        gettimeofday(&forward_dft_stop, NULL); //stop clock
-        forward_dft_execution_time_us = (forward_dft_stop.tv_sec - forward_dft_start.tv_sec) * (1e6); //sec to us
-        forward_dft_execution_time_us += (forward_dft_stop.tv_usec - forward_dft_start.tv_usec);
-        total_f_dft_exec_time_us += forward_dft_execution_time_us;
+        perf_counters_read(&counters, &phase_counters);
+        forward_dft_start = timing_now(); //start clock
+        if (mode == PLAN_MODE_NEW_ARRAY)
+            fftw_execute_dft_r2c(forward_cos_dft_plan, original_sets[set], complex_sets[set]);
+        else
+            fftw_execute(forward_cos_dft_plan);
+        forward_dft_stop = timing_now(); //stop clock
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_FORWARD], &phase_counters, batch_total, timed);
+        if (j == 0)
+            gettimeofday(&first_fft_stop, NULL); //same clock as program_start
+        forward_dft_execution_time_us = timing_elapsed(forward_dft_start, forward_dft_stop) * (1e6); //sec to us
+        latency_histogram_record(&latency[PHASE_FORWARD], forward_dft_execution_time_us * (1e-6));
 
         // Execute Backward DFT and capture performance time
-        gettimeofday(&backward_dft_start, NULL); //start clock
-        fftw_execute(backward_cos_dft_plan);
-        gettimeofday(&backward_dft_stop, NULL); //stop clock
-        backward_dft_execution_time_us = (backward_dft_stop.tv_sec - backward_dft_start.tv_sec) * (1e6);// sec to us
-        backward_dft_execution_time_us += (backward_dft_stop.tv_usec - backward_dft_start.tv_usec);
-        total_b_dft_exec_time_us += backward_dft_execution_time_us;
-
-        // Do work on dummy array to prevent the compiler from optimizing on its own
-        rand_idx = rand() % (max_idx + 1);
-        dummy[j] = j + cosine_back[rand_idx];
-
-        // Destroy FFTW plans
+        perf_counters_read(&counters, &phase_counters);
+        backward_dft_start = timing_now(); //start clock
+        if (mode == PLAN_MODE_NEW_ARRAY)
+            fftw_execute_dft_c2r(backward_cos_dft_plan, complex_sets[set], back_sets[set]);
+        else
+            fftw_execute(backward_cos_dft_plan);
+        backward_dft_stop = timing_now(); //stop clock
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_BACKWARD], &phase_counters, batch_total, timed);
+        backward_dft_execution_time_us = timing_elapsed(backward_dft_start, backward_dft_stop) * (1e6);// sec to us
+        latency_histogram_record(&latency[PHASE_BACKWARD], backward_dft_execution_time_us * (1e-6));
+
+        if (timed){
+            total_f_dft_exec_time_us += forward_dft_execution_time_us;
+            total_b_dft_exec_time_us += backward_dft_execution_time_us;
+
+            // Do work on dummy array to prevent the compiler from optimizing on its own
+            rand_idx = (size_t)rand() % n_total;
+            dummy[j-warmup] = j + back_sets[set][rand_idx];
+
+            // Count the executed operations (before the plans go away)
+            flop_count_real_plan(&forward_count, forward_cos_dft_plan, rank, n, batch, 1);
+            flop_count_real_plan(&backward_count, backward_cos_dft_plan, rank, n, batch, 1);
+        }
+
+        // Destroy FFTW plans (replan only)
+        if (mode == PLAN_MODE_REPLAN){
+            fftw_destroy_plan(forward_cos_dft_plan);
+            fftw_destroy_plan(backward_cos_dft_plan);
+        }
+        latency_histogram_record(&latency[PHASE_ITERATION], timing_elapsed(iteration_start, timing_now()));
+        perf_counters_accumulate(&counters, &counter_totals[PHASE_ITERATION], &iteration_counters, batch_total, timed);
+    }
+    if (mode != PLAN_MODE_REPLAN){
         fftw_destroy_plan(forward_cos_dft_plan);
         fftw_destroy_plan(backward_cos_dft_plan);
     }
+    cache_flusher_destroy(&flusher);
+
+    // The last iteration's output is the one checked (and plotted)
+    cosine_back = back_sets[set];
+    for (i=0; i<LATENCY_PHASES; i++){
+        latency_histogram_summarize(&latency[i], &latency_summaries[i]);
+        phase_seconds[i] = latency_summaries[i].mean * latency_summaries[i].count;
+        latency_histogram_destroy(&latency[i]);
+    }
+
+    // Save wisdom (cleaning up the threads makes FFTW forget it)
+    wisdom_save(&wisdom);
 
     // Handle threading
     fftw_cleanup_threads();
 
+    // Time from program start to the end of the first forward FFT
+    double time_to_first_fft = (first_fft_stop.tv_sec - program_start.tv_sec) + (first_fft_stop.tv_usec - program_start.tv_usec) * (1.0e-6);
+
     // Get average times
     double average_forward_dft_exec_time_us = total_f_dft_exec_time_us / niters;
     double average_backward_dft_exec_time_us = total_b_dft_exec_time_us / niters;
 
-    // Compute teraflops (see here for info on how to calculate mflops: http://www.fftw.org/speed/)
-    long double forward_dft_mflops_approx = 5 * n_total * log2l(n_total) / (average_forward_dft_exec_time_us * 2);
-    long double backward_dft_mflops_approx = 5 * n_total * log2l(n_total) / (average_backward_dft_exec_time_us * 2);
-
-    long double forward_dft_gflops_approx = forward_dft_mflops_approx * (1e-3);
-    long double backward_dft_gflops_approx = backward_dft_mflops_approx * (1e-3);
+    // Compute gigaflops, both counted by FFTW and by the benchFFT convention (see http://www.fftw.org/speed/ -- a
+    // real transform counts 2.5 N log2(N)), and the bytes per second and arithmetic intensity
+    flop_rates forward_rates, backward_rates;
+    flop_count_rates(&forward_count, total_f_dft_exec_time_us * (1e-6), &forward_rates);
+    flop_count_rates(&backward_count, total_b_dft_exec_time_us * (1e-6), &backward_rates);
+
+    // Transforms per second and time per transform, to find the batch size where the per-execution overhead stops
+    // dominating small transforms
+    double forward_transforms_per_sec = (total_f_dft_exec_time_us > 0.0) ? (double)batch * niters / (total_f_dft_exec_time_us * (1e-6)) : 0.0;
+    double backward_transforms_per_sec = (total_b_dft_exec_time_us > 0.0) ? (double)batch * niters / (total_b_dft_exec_time_us * (1e-6)) : 0.0;
+
+    // The first cosine of the batch is the one checked (and plotted), so gather its samples
+    if (interleaved){
+        for (idx=0; idx<n_total; idx++)
+            cosine_back[idx] = cosine_back[idx*batch];
+    }
 
     // Fix cosine_back because its height has been adjusted by the FFT
-    for (i=0; i<n_total; i++)
-        cosine_back[i] /= n_total;
+    for (idx=0; idx<n_total; idx++)
+        cosine_back[idx] /= (double)n_total;
 
     // Plot result to ensure we get back what we put in!
     if (plot == true)
@@ -196,207 +740,133 @@ int main(int argc, char* argv[]){
 
     //Now put 'dummy' to use so that the compiler doesn't get rid of it
     cosine_back[0] = dummy[0];
-
-    // Prepare file to save results to
-    //char *filename = "fftw_cosine_performance_results.json";
-    char *tmp_filename = "tmp.json";
-
-    // Open the temporary file for writing
-    FILE *tmp_file = fopen(tmp_filename, "w");
-
-    // If there's an existing file, we'll need to open it, read it, copy the lines, then add to a new file
-    bool file_exists = false;
-    if (access(filename, F_OK) != -1){
-
-        // Change file_exists to 'true' because the file exists!
-        file_exists = true;
-
-        // Create temporary file and open
-        FILE *results_file = fopen(filename, "r");
-
-        // Iterate through all the lines to get the length of the file
-        int file_length = 0;
-        char buffer[BUFFSIZE] = {'\0'};
-        while (fgets(buffer, BUFFSIZE, results_file))
-            file_length++;
-        fclose(results_file);
-
-        // Clear buffer by setting all chars to NULL
-        for (i=0; i<BUFFSIZE; i++)
-            buffer[i] = '\0';
-
-        // Now open again
-        int current_line_no = 0;
-        results_file = fopen(filename, "r");
-
-        // We want to copy every single line into a temporary file EXCEPT the last line, hence "current_line_no < file_length"
-        char curr_char = '\0';
-        while (fgets(buffer, BUFFSIZE, results_file) && (current_line_no < file_length-2)){
-
-            // Iterate through all the characters in 'buffer'
-            for (i=0; i<BUFFSIZE; i++){
-
-                // Get current character
-                curr_char = buffer[i];
-
-                // If the last character is not "\n", then it means we still have characters that we need to write to the file
-                if (curr_char != '\0')
-                    fputc(curr_char, tmp_file);
-
-                // Clear buffer
-                buffer[i] = '\0';
-            }
-
-            // Update line number
-            current_line_no++;
-        }
-
-        // Finally,
-        fprintf(tmp_file, "    },\n");
-    }
-
-    // Get timestamp
-    time_t raw_time = time(NULL);
-    struct tm *timeinfo;
-    timeinfo = localtime(&raw_time);
+    free(dummy);
 
     // Save as JSON
-    if (file_exists == false)
-        fprintf(tmp_file, "{\n");
-    else
-        fprintf(tmp_file, "\n");
-    fprintf(tmp_file, "    \"%d-%d-%d %d:%d:%d\": {\n", timeinfo->tm_year+1900, timeinfo->tm_mon+1, timeinfo->tm_mday, timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
-    fprintf(tmp_file, "        \"performance_results\": {\n");
-    fprintf(tmp_file, "            \"inputs\": {\n");
-    fprintf(tmp_file, "                \"rank\": %d,\n", rank);
-    fprintf(tmp_file, "                \"dims\": [");
+    results_record record;
+    FILE *results_file = results_begin(&record, filename);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"rank\": %d,\n", rank);
+    fprintf(results_file, "                \"dims\": [");
     for (i=0; i<rank-1; i++){
-        fprintf(tmp_file, " %d,", n[i]);
-    }
-    fprintf(tmp_file, " %d],\n", n[rank-1]);
-    fprintf(tmp_file, "                \"fs_Hz\": %0.2e,\n", fs);
-    fprintf(tmp_file, "                \"iterations\": %d,\n", niters);
-    fprintf(tmp_file, "                \"threads\": %d\n", nthreads);
-    fprintf(tmp_file, "            },\n");
-    fprintf(tmp_file, "            \"forward_dft_results\": {\n");
-    fprintf(tmp_file, "                \"average_execution_time_seconds\": %0.5f,\n", average_forward_dft_exec_time_us * (1e-6));
-    fprintf(tmp_file, "                \"average_gflops\": %0.5Lf\n", forward_dft_gflops_approx);
-    fprintf(tmp_file, "            },\n");
-    fprintf(tmp_file, "            \"backward_dft_results\": {\n");
-    fprintf(tmp_file, "                \"average_execution_time_seconds\": %0.5f,\n", average_backward_dft_exec_time_us * (1e-6));
-    fprintf(tmp_file, "                \"average_gflops\": %0.5Lf\n", backward_dft_gflops_approx);
-    fprintf(tmp_file, "            }\n");
-    fprintf(tmp_file, "        }\n");
-    fprintf(tmp_file, "    }\n");
-    fprintf(tmp_file, "}\n");
-
-    // Make sure to close file!
-    fclose(tmp_file);
-
-    // Change filename now
-    rename(tmp_filename, filename);
-
-    printf("\nPERFORMANCE RESULTS\n");
+        fprintf(results_file, " %d,", n[i]);
+    }
+    fprintf(results_file, " %d],\n", n[rank-1]);
+    fprintf(results_file, "                \"fs_Hz\": %0.2e,\n", fs);
+    fprintf(results_file, "                \"iterations\": %d,\n", niters);
+    fprintf(results_file, "                \"threads\": %d,\n", nthreads);
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(flags));
+    fprintf(results_file, "                \"batch\": %d,\n", batch);
+    fprintf(results_file, "                \"layout\": \"%s\",\n", interleaved ? "interleaved" : "contiguous");
+    fprintf(results_file, "                \"plan_mode\": \"%s\",\n", plan_mode_names[mode]);
+    fprintf(results_file, "                \"cache\": \"%s\"\n", cold_cache ? "cold" : "warm");
+    fprintf(results_file, "            },\n");
+    signal_json(results_file, "            ", &signal, n_total, generation_time);
+    fprintf(results_file, "            \"iteration_engine\": {\n");
+    fprintf(results_file, "                \"warmup_iterations\": %d,\n", warmup);
+    fprintf(results_file, "                \"timed_iterations\": %d,\n", niters);
+    fprintf(results_file, "                \"planning_time_seconds\": %0.6f,\n", (mode == PLAN_MODE_REPLAN) ? phase_seconds[PHASE_PLAN] : initial_planning_time);
+    fprintf(results_file, "                \"copy_time_seconds\": %0.6f,\n", (mode == PLAN_MODE_REPLAN) ? phase_seconds[PHASE_COPY_IN] : initial_copy_time);
+    fprintf(results_file, "                \"execute_time_seconds\": %0.6f,\n", (total_f_dft_exec_time_us + total_b_dft_exec_time_us) * (1e-6));
+    fprintf(results_file, "                \"llc_bytes\": %zu,\n", flusher.llc_bytes);
+    fprintf(results_file, "                \"flush_bytes\": %zu,\n", flusher.bytes);
+    fprintf(results_file, "                \"flushes\": %lu,\n", flusher.flushes);
+    fprintf(results_file, "                \"flush_time_seconds\": %0.6f\n", flusher.flush_time);
+    fprintf(results_file, "            },\n");
+    thread_backend_json(results_file, "            ", &threads);
+    numa_allocator_json(results_file, "            ", &buffers);
+    fprintf(results_file, "            \"batch_results\": {\n");
+    fprintf(results_file, "                \"transforms_per_execution\": %d,\n", batch);
+    fprintf(results_file, "                \"forward_transforms_per_second\": %0.3f,\n", forward_transforms_per_sec);
+    fprintf(results_file, "                \"backward_transforms_per_second\": %0.3f,\n", backward_transforms_per_sec);
+    fprintf(results_file, "                \"forward_seconds_per_transform\": %0.9f,\n", average_forward_dft_exec_time_us * (1e-6) / batch);
+    fprintf(results_file, "                \"backward_seconds_per_transform\": %0.9f,\n", average_backward_dft_exec_time_us * (1e-6) / batch);
+    fprintf(results_file, "                \"p50_iteration_seconds_per_transform\": %0.9f,\n", latency_summaries[PHASE_ITERATION].p50 / batch);
+    fprintf(results_file, "                \"p99_iteration_seconds_per_transform\": %0.9f\n", latency_summaries[PHASE_ITERATION].p99 / batch);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"forward_dft_results\": {\n");
+    fprintf(results_file, "                \"average_execution_time_seconds\": %0.5f,\n", average_forward_dft_exec_time_us * (1e-6));
+    flop_rates_json(results_file, "                ", &forward_count, &forward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"backward_dft_results\": {\n");
+    fprintf(results_file, "                \"average_execution_time_seconds\": %0.5f,\n", average_backward_dft_exec_time_us * (1e-6));
+    flop_rates_json(results_file, "                ", &backward_count, &backward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"wisdom\": {\n");
+    fprintf(results_file, "                \"file\": ");
+    results_json_string(results_file, use_wisdom ? wisdom.path : "");
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"imported\": %s,\n", wisdom.imported ? "true" : "false");
+    fprintf(results_file, "                \"import_time_seconds\": %0.5f,\n", wisdom.import_time);
+    fprintf(results_file, "                \"export_time_seconds\": %0.5f,\n", wisdom.export_time);
+    fprintf(results_file, "                \"time_to_first_fft_seconds\": %0.5f\n", time_to_first_fft);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"latency\": {\n");
+    fprintf(results_file, "                \"clock\": \"%s\",\n", clock_source_name(timer_source));
+    fprintf(results_file, "                \"warmup_iterations\": %d,\n", warmup);
+    fprintf(results_file, "                \"phases\": {\n");
+    for (i=0; i<LATENCY_PHASES; i++)
+        latency_summary_json(results_file, "                    ", phase_names[i], &latency_summaries[i], i == LATENCY_PHASES-1);
+    fprintf(results_file, "                }\n");
+    fprintf(results_file, "            },\n");
+    perf_counters_json(results_file, "            ", use_counters, &counters, counter_totals, phase_names, phase_seconds, LATENCY_PHASES, true);
+    fprintf(results_file, "        }\n");
+    results_end(&record);
+
+    printf("\nPERFORMANCE RESULTS (%s plans, %s cache)\n", plan_mode_names[mode], cold_cache ? "cold" : "warm");
     printf("===================\n");
     printf("Input Info:\n");
     printf("    One %dD cosine: %d", rank, n[0]);
     for (i=1; i<rank; i++)
         printf(" x %d", n[i]);
-    printf(" samples\n");
+    printf(" samples, %d per batch (%s)\n", batch, interleaved ? "interleaved" : "contiguous");
     printf("    fs = %0.2e Hz\n", fs);
-    printf("    %d iterations\n", niters);
+    printf("    %d iterations (after %d untimed)\n", niters, warmup);
     printf("    %d threads used\n", nthreads);
+    printf("    Plan effort: %s\n", plan_effort_name(flags));
+    signal_print(&signal, n_total, generation_time);
+    printf("Iteration engine\n");
+    if (mode == PLAN_MODE_REPLAN)
+        printf("    Plans created and destroyed by every iteration: %0.6f sec planning, %0.6f sec copying in (timed iterations)\n", phase_seconds[PHASE_PLAN], phase_seconds[PHASE_COPY_IN]);
+    else
+        printf("    Planned once (%0.6f sec) and copied in once (%0.6f sec), then execute only%s\n", initial_planning_time, initial_copy_time, (mode == PLAN_MODE_NEW_ARRAY) ? " on two sets of arrays in turn (new-array execute)" : "");
+    if (cold_cache)
+        printf("    Cold cache: %0.1f MB swept before each of %lu iterations (LLC %0.1f MB), %0.3f sec not timed\n", flusher.bytes / (1024.0 * 1024.0), flusher.flushes, flusher.llc_bytes / (1024.0 * 1024.0), flusher.flush_time);
+    else
+        printf("    Warm cache: iterations run back to back\n");
+    thread_backend_print(&threads);
+    numa_allocator_print(&buffers);
     printf("DFT Results\n");
     printf("    Forward DFT execution time: %0.3f sec\n", average_forward_dft_exec_time_us * (1e-6));
-    printf("    Forward DFT GFlops: %0.3Lf\n", forward_dft_gflops_approx);
+    flop_rates_print("Forward DFT", &forward_count, &forward_rates);
     printf("    Backward DFT execution time: %0.3f sec\n", average_backward_dft_exec_time_us * (1e-6));
-    printf("    Backward DFT GFlops: %0.3Lf\n", backward_dft_gflops_approx);
-
-    return 0;
-}
-
-void fill_row(double *cosine, double fs, int row_length, int start_idx, int n_sum, int matrix_size){
-/* Helper function to fill a row of data in an N-dimensional cosine matrix
- *
- * Inputs
- * ======
- *   double *cosine
- *       The array to be filled with cosine data
- *
- *   int fs
- *       Sample size for the cosine
- *
- *   int row_length
- *       Length of the dimension (AKA the length of the row to fill)
- *
- *   int start_idx
- *       Index of the cosine array to start filling
- *
- *   int n_sum
- *       Sum of all the values in n
- *
- *   int matrix_size
- *       Total number of samples in the "cosine" matrix across all dimensions (i.e., n0*n1*n2*...*nK)
- */
-    if (start_idx < matrix_size){
-        int i; //iterative var
-        for (i=0; i<row_length; i++){
-            cosine[i+start_idx] = cos((i+start_idx)*fs*PI);
-        }
-
-        fill_row(cosine, fs, row_length, start_idx+n_sum, n_sum, matrix_size);
-    }
-}
-
-void generate_cosine_data(double *cosine, double fs, int rank, int *n, int matrix_size){
-/* Generates data for a forward FFT
- *
- * Inputs
- * ======
- *   double *cosine
- *       The array to be filled with cosine data
- *
- *   int fs
- *       Sample size for the cosine
- *
- *   int rank
- *       Number of dimensions in the data array
- *
- *   int *n
- *       An array which contains the dimensions of the data array
- *
- *   int matrix_size
- *       Total number of samples in the "cosine" matrix across all dimensions (i.e., n0*n1*n2*...*nK)
- */
-
-    // Init values
-    int i; //iterative value
-    int start = 0; //start of the next dimension
-    int prev = 0; //start of the previous dimension
-    int dim; //current dimension
-    int n_sum = 0; //sum of all the dimensions
-
-    // Get the sum of all N values. This will help us with indexing the cosine matrix when we go to
-    // fill it with data
-    for (i=0; i<rank; i++){
-        n_sum += n[i];
+    flop_rates_print("Backward DFT", &backward_count, &backward_rates);
+    printf("Batch\n");
+    printf("    %0.1f forward and %0.1f backward transforms/sec\n", forward_transforms_per_sec, backward_transforms_per_sec);
+    printf("    %0.3f us forward, %0.3f us backward per transform, p50 iteration %0.3f us per transform\n", average_forward_dft_exec_time_us / batch, average_backward_dft_exec_time_us / batch, 1e6 * latency_summaries[PHASE_ITERATION].p50 / batch);
+    printf("Wisdom\n");
+    if (use_wisdom)
+        printf("    %s %s\n", wisdom.imported ? "Imported wisdom from" : "No wisdom found, saved new wisdom to", wisdom.path);
+    else
+        printf("    Disabled\n");
+    printf("    Time to first FFT: %0.3f sec (includes generating the cosine, loading wisdom and planning)\n", time_to_first_fft);
+    printf("Latency per iteration (%lu recorded after %d warm-up, %s clock)\n", latency_summaries[PHASE_ITERATION].count, warmup, clock_source_name(timer_source));
+    for (i=0; i<LATENCY_PHASES; i++)
+        latency_summary_print(phase_names[i], &latency_summaries[i]);
+    if (use_counters){
+        printf("Hardware counters (same iterations as the latencies)\n");
+        if (!counters.enabled)
+            printf("    Not available on this host\n");
+        for (i=0; i<LATENCY_PHASES && counters.enabled; i++)
+            perf_totals_print(phase_names[i], &counters, &counter_totals[i], phase_seconds[i]);
     }
 
-    // Fill cosine array
-    for (i=0; i<rank; i++){
-
-        // Get current dimension
-        dim = n[i];
-
-        // Get starting point
-        start += prev;
-
-        // Fill array
-        fill_row(cosine, fs, dim, start, n_sum, matrix_size);
-
-        // Update 'prev'
-        prev = dim;
-    }
+    numa_allocator_destroy(&buffers);
+    thread_backend_destroy(&threads);
+    perf_counters_close(&counters);
+    free(n);
+    return 0;
 }
 
 void plot1D(double *cosine, int dim_to_plot, int rank, int *n, double fs, char *title){
@@ -473,3 +943,175 @@ void plot1D(double *cosine, int dim_to_plot, int rank, int *n, double fs, char *
         fprintf(gnuplot_pipe, "%s \n", gnuplot_cmds[i]);
     }
 }
+
+void cosine_precision(const precision_engine *engine, double *cosine, const signal_spec *signal, double generation_time, int rank, int *n, size_t n_total, int batch, bool interleaved, double fs, int niters, int warmup, int nthreads, unsigned flags, clock_source timer_source, bool plot, char *filename){
+/* Runs the forward and backward DFTs of the cosine on another precision's engine, and compares them with double
+ *
+ * Inputs
+ * ======
+ *   const precision_engine *engine
+ *       Engine from "--precision" (see precision_engine.c)
+ *
+ *   double *cosine
+ *       The generated cosine, converted to the engine's precision when it is copied in
+ *
+ *   const signal_spec *signal, double generation_time
+ *       How the input was generated and how long that took, for the results
+ *
+ *   int batch, bool interleaved
+ *       Cosines per execution and their layout, as for double
+ *
+ *   int warmup
+ *       Untimed executions before the 'niters' timed ones
+ *
+ *   char *filename
+ *       JSON document to append the results to
+ */
+    const char *phase_names[3] = {"forward", "backward", "iteration"};
+    latency_histogram latency[3];
+    latency_summary latency_summaries[3];
+    precision_timings timings, reference_timings;
+    precision_error spectrum_error, round_trip_error;
+    int i;
+
+    size_t n_complex_total = (n_total / n[rank-1]) * (n[rank-1] / 2 + 1);
+    fftw_complex *spectrum = (fftw_complex*)fftw_malloc(n_complex_total * sizeof(fftw_complex));
+    fftw_complex *reference = (fftw_complex*)fftw_malloc(n_complex_total * sizeof(fftw_complex));
+    double *cosine_back = (double*)fftw_malloc(n_total * sizeof(double));
+    if (!spectrum || !reference || !cosine_back){
+        printf("Could not allocate memory for the %s results. Exiting.\n", engine->name);
+        exit(EXIT_FAILURE);
+    }
+    for (i=0; i<3; i++){
+        if (!latency_histogram_init(&latency[i], warmup)){
+            printf("Could not allocate the latency histograms. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // The double spectrum of the same cosine is the reference
+    precision_cosine_job job = {
+        .rank = rank,
+        .n = n,
+        .howmany = 1,
+        .input = cosine,
+        .iterations = 1,
+        .nthreads = nthreads,
+        .flags = flags,
+        .spectrum = reference
+    };
+    if (!find_precision_engine("double")->cosine(&job, &reference_timings)){
+        printf("Could not compute the double reference spectrum. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    job.howmany = batch;
+    job.interleaved = interleaved;
+    job.warmup = warmup;
+    job.iterations = niters;
+    job.spectrum = spectrum;
+    job.back = cosine_back;
+    job.latency = latency;
+    engine->init_threads();
+    if (!engine->cosine(&job, &timings)){
+        printf("FFTW (%s) could not plan the cosine. Exiting.\n", engine->prefix);
+        exit(EXIT_FAILURE);
+    }
+    engine->cleanup_threads();
+    for (i=0; i<3; i++){
+        latency_histogram_summarize(&latency[i], &latency_summaries[i]);
+        latency_histogram_destroy(&latency[i]);
+    }
+
+    precision_error_init(&spectrum_error);
+    precision_error_add(&spectrum_error, (double*)reference, (double*)spectrum, 2 * n_complex_total);
+    precision_error_finish(&spectrum_error);
+    precision_error_init(&round_trip_error);
+    precision_error_add(&round_trip_error, cosine, cosine_back, n_total);
+    precision_error_finish(&round_trip_error);
+
+    flop_rates forward_rates, backward_rates;
+    flop_count_rates(&timings.forward_count, timings.forward_time, &forward_rates);
+    flop_count_rates(&timings.backward_count, timings.backward_time, &backward_rates);
+
+    // Plot result to ensure we get back what we put in!
+    if (plot == true)
+        plot1D(cosine_back, 1, rank, n, fs, "Resulting cosine Curve After Forward and Backward DFTs");
+
+    // Save as JSON
+    results_record record;
+    FILE *results_file = results_begin(&record, filename);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"rank\": %d,\n", rank);
+    fprintf(results_file, "                \"dims\": [");
+    for (i=0; i<rank-1; i++){
+        fprintf(results_file, " %d,", n[i]);
+    }
+    fprintf(results_file, " %d],\n", n[rank-1]);
+    fprintf(results_file, "                \"fs_Hz\": %0.2e,\n", fs);
+    fprintf(results_file, "                \"iterations\": %d,\n", niters);
+    fprintf(results_file, "                \"threads\": %d,\n", nthreads);
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(flags));
+    fprintf(results_file, "                \"batch\": %d,\n", batch);
+    fprintf(results_file, "                \"layout\": \"%s\"\n", interleaved ? "interleaved" : "contiguous");
+    fprintf(results_file, "            },\n");
+    signal_json(results_file, "            ", signal, n_total, generation_time);
+    fprintf(results_file, "            \"precision\": {\n");
+    fprintf(results_file, "                \"name\": \"%s\",\n", engine->name);
+    fprintf(results_file, "                \"api\": \"%s\",\n", engine->prefix);
+    fprintf(results_file, "                \"real_bytes\": %zu,\n", engine->real_bytes);
+    fprintf(results_file, "                \"epsilon\": %0.6e,\n", engine->epsilon);
+    fprintf(results_file, "                \"reference\": \"double\",\n");
+    precision_error_json(results_file, "                ", "spectrum", &spectrum_error, false);
+    precision_error_json(results_file, "                ", "round_trip", &round_trip_error, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"planning_time_seconds\": %0.5f,\n", timings.plan_time);
+    fprintf(results_file, "            \"forward_dft_results\": {\n");
+    fprintf(results_file, "                \"average_execution_time_seconds\": %0.5f,\n", timings.forward_time / niters);
+    flop_rates_json(results_file, "                ", &timings.forward_count, &forward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"backward_dft_results\": {\n");
+    fprintf(results_file, "                \"average_execution_time_seconds\": %0.5f,\n", timings.backward_time / niters);
+    flop_rates_json(results_file, "                ", &timings.backward_count, &backward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"latency\": {\n");
+    fprintf(results_file, "                \"clock\": \"%s\",\n", clock_source_name(timer_source));
+    fprintf(results_file, "                \"warmup_iterations\": %d,\n", warmup);
+    fprintf(results_file, "                \"phases\": {\n");
+    for (i=0; i<3; i++)
+        latency_summary_json(results_file, "                    ", phase_names[i], &latency_summaries[i], i == 2);
+    fprintf(results_file, "                }\n");
+    fprintf(results_file, "            }\n");
+    fprintf(results_file, "        }\n");
+    results_end(&record);
+
+    printf("\nPERFORMANCE RESULTS (%s PRECISION)\n", engine->name);
+    printf("===============================\n");
+    printf("Input Info:\n");
+    printf("    One %dD cosine: %d", rank, n[0]);
+    for (i=1; i<rank; i++)
+        printf(" x %d", n[i]);
+    printf(" samples\n");
+    printf("    fs = %0.2e Hz\n", fs);
+    printf("    %d iterations (after %d untimed), %d cosines per batch (%s)\n", niters, warmup, batch, interleaved ? "interleaved" : "contiguous");
+    printf("    %d threads used\n", nthreads);
+    printf("    Plan effort: %s\n", plan_effort_name(flags));
+    signal_print(signal, n_total, generation_time);
+    printf("Precision\n");
+    printf("    %s (%s API, %zu byte reals, epsilon %0.3e)\n", engine->name, engine->prefix, engine->real_bytes, engine->epsilon);
+    precision_error_print("Spectrum", &spectrum_error);
+    precision_error_print("Round trip", &round_trip_error);
+    printf("DFT Results\n");
+    printf("    Forward DFT execution time: %0.3f sec\n", timings.forward_time / niters);
+    flop_rates_print("Forward DFT", &timings.forward_count, &forward_rates);
+    printf("    Backward DFT execution time: %0.3f sec\n", timings.backward_time / niters);
+    flop_rates_print("Backward DFT", &timings.backward_count, &backward_rates);
+    printf("Latency per iteration (%lu recorded after %d warm-up, %s clock)\n", latency_summaries[2].count, warmup, clock_source_name(timer_source));
+    for (i=0; i<3; i++)
+        latency_summary_print(phase_names[i], &latency_summaries[i]);
+
+    fftw_free(spectrum);
+    fftw_free(reference);
+    fftw_free(cosine_back);
+}
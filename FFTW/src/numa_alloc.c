@@ -0,0 +1,581 @@
+/* NUMA-aware allocation of the transform buffers
+ *
+ * The buffers used to come from fftw_malloc() and were first touched by the main thread, so on a multi-socket host
+ * every page landed on the main thread's node and the other sockets' threads did all of their transforms over the
+ * interconnect. `numactl -i` could interleave them, but only from outside, and not in a container without the
+ * seccomp profile. The allocator places the buffers itself:
+ *
+ *   - none: fftw_malloc(), as before
+ *   - local: the pages prefer the main thread's node (mbind MPOL_PREFERRED)
+ *   - interleave: the pages are spread round-robin over every node with memory (mbind MPOL_INTERLEAVE)
+ *   - first-touch: every buffer is split into one contiguous share per thread, and each thread of the thread backend
+ *     touches its own share first, so that the share lands on the node of the thread that works on it. This needs
+ *     no mbind() at all, so it works in an unprivileged container too
+ *
+ * The policies other than none map fresh pages with mmap() so that nothing has touched them yet. If mbind() is
+ * refused (Docker's and Podman's default seccomp profiles only allow it with CAP_SYS_NICE), the pages are placed by
+ * first touch and the results say so.
+ *
+ * Where the pages actually are is read back with move_pages() (a sample of each buffer's pages), and the single-thread
+ * read bandwidth from the main thread to every node is measured, so that the results show both the placement and
+ * what a remote page costs. The system calls are made directly, so there is no libnuma to install in the images.
+ *
+ * With huge pages, the buffers aren't mapped one by one: they are carved (page aligned) out of one arena that is
+ * reserved in big blocks backed by 2 MB or 1 GB pages, so that a large transform walks its working set through a few
+ * hundred TLB entries instead of hundreds of thousands. hugetlbfs pages (--huge-pages=2m|1g) are only there if the
+ * host reserved them (vm.nr_hugepages), so without them the arena falls back to transparent huge pages, which the
+ * kernel may or may not manage to give (the results show how much of the arena it did). Freed buffers go back to
+ * the arena and are handed out again to the next request that fits, so the sweep's shapes reuse the same pages
+ * instead of mapping new ones.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <fftw3.h>
+#include "numa_alloc.h"
+#include "perf_counters.h"
+#include "timing.h"
+
+#define PLACEMENT_SAMPLES 1024       //pages of each buffer whose node is looked up
+#define BANDWIDTH_BYTES (64UL << 20) //buffer read from every node, well past the LLC
+#define BANDWIDTH_PASSES 3           //best of
+
+#define ARENA_BLOCK_BYTES (256UL << 20)  //smallest block the arena reserves (address space only, until touched)
+#define THP_BYTES (2UL << 20)
+#define TLB_PROBE_MIN_BYTES (8UL << 20)   //a few huge pages, past the reach of the base-page dTLB
+#define TLB_PROBE_MAX_BYTES (64UL << 20)  //the probe stays cheap next to the benchmark however large it is
+#define TLB_PROBE_PASSES 4
+
+#define MASK_BITS (8 * sizeof(unsigned long))
+
+bool parse_numa_policy(const char *name, numa_policy *policy){
+    if (strcmp(name, "none") == 0)
+        *policy = NUMA_POLICY_NONE;
+    else if (strcmp(name, "local") == 0)
+        *policy = NUMA_POLICY_LOCAL;
+    else if (strcmp(name, "interleave") == 0)
+        *policy = NUMA_POLICY_INTERLEAVE;
+    else if (strcmp(name, "first-touch") == 0)
+        *policy = NUMA_POLICY_FIRST_TOUCH;
+    else
+        return false;
+    return true;
+}
+
+const char *numa_policy_name(numa_policy policy){
+    switch (policy){
+        case NUMA_POLICY_LOCAL:
+            return "local";
+        case NUMA_POLICY_INTERLEAVE:
+            return "interleave";
+        case NUMA_POLICY_FIRST_TOUCH:
+            return "first-touch";
+        default:
+            return "none";
+    }
+}
+
+bool parse_huge_pages(const char *name, huge_pages *huge){
+    if (strcmp(name, "none") == 0)
+        *huge = HUGE_PAGES_NONE;
+    else if (strcmp(name, "thp") == 0)
+        *huge = HUGE_PAGES_THP;
+    else if (strcmp(name, "2m") == 0)
+        *huge = HUGE_PAGES_2M;
+    else if (strcmp(name, "1g") == 0)
+        *huge = HUGE_PAGES_1G;
+    else
+        return false;
+    return true;
+}
+
+const char *huge_pages_name(huge_pages huge){
+    switch (huge){
+        case HUGE_PAGES_THP:
+            return "thp";
+        case HUGE_PAGES_2M:
+            return "2m";
+        case HUGE_PAGES_1G:
+            return "1g";
+        default:
+            return "none";
+    }
+}
+
+static bool read_node_list(const char *path, int *nodes, int *num_nodes){
+    char line[1024];
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+    bool ok = fgets(line, sizeof(line), f) && parse_cpu_list(line, nodes, num_nodes, NUMA_MAX_NODES);
+    fclose(f);
+    return ok && nodes[*num_nodes-1] < NUMA_MAX_NODES; //the list is sorted
+}
+
+void numa_allocator_init(numa_allocator *alloc, numa_policy policy, huge_pages huge, thread_backend *threads){
+/* Finds the nodes with memory. 'threads' first touches the buffers with the first-touch policy. Nothing is reserved
+ * for the arena until the first allocation */
+    unsigned cpu, node;
+
+    memset(alloc, 0, sizeof(numa_allocator));
+    alloc->policy = policy;
+    alloc->threads = threads;
+    alloc->huge = huge;
+    if (huge == HUGE_PAGES_1G)
+        alloc->page_bytes = 1UL << 30;
+    else if (huge != HUGE_PAGES_NONE)
+        alloc->page_bytes = THP_BYTES;
+    else
+        alloc->page_bytes = (size_t)sysconf(_SC_PAGESIZE);
+    if (!read_node_list("/sys/devices/system/node/has_memory", alloc->nodes, &alloc->num_nodes) &&
+        !read_node_list("/sys/devices/system/node/online", alloc->nodes, &alloc->num_nodes)){
+        alloc->nodes[0] = 0; //no sysfs (or more nodes than we track): treat the host as one node
+        alloc->num_nodes = 1;
+    }
+    alloc->local_node = (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) ? (int)node : alloc->nodes[0];
+}
+
+void numa_allocator_destroy(numa_allocator *alloc){
+/* Unmaps the arena, so nothing carved from it may be used afterwards. Buffers allocated one by one stay valid until
+ * the program exits */
+    int b;
+    for (b=0; b<alloc->num_blocks; b++)
+        munmap(alloc->blocks[b].base, alloc->blocks[b].bytes);
+    free(alloc->blocks);
+    free(alloc->buffers);
+    alloc->blocks = NULL;
+    alloc->buffers = NULL;
+    alloc->num_blocks = alloc->max_blocks = 0;
+    alloc->num_buffers = alloc->max_buffers = 0;
+}
+
+static bool bind_pages(numa_allocator *alloc, void *ptr, size_t bytes, int mode, const int *nodes, int num_nodes){
+    unsigned long mask[NUMA_MAX_NODES / MASK_BITS + 1];
+    int i;
+
+    memset(mask, 0, sizeof(mask));
+    for (i=0; i<num_nodes; i++)
+        mask[nodes[i] / MASK_BITS] |= 1UL << (nodes[i] % MASK_BITS);
+    if (syscall(SYS_mbind, ptr, bytes, mode, mask, NUMA_MAX_NODES + 1, 0) == 0)
+        return true;
+    if (!alloc->mbind_failed)
+        printf("  WARNING: mbind() failed (%s), so the buffers are placed by first touch. In a container, mbind() needs CAP_SYS_NICE or the seccomp profile.\n", strerror(errno));
+    alloc->mbind_failed = true;
+    return false;
+}
+
+typedef struct {
+    char *ptr;
+    size_t bytes;
+    size_t page;   //every page is touched
+    size_t align;  //shares start on these boundaries (huge pages are placed whole)
+    int shares;
+} touch_job;
+
+static void touch_shares(void *arg, int begin, int end){
+/* Writes one byte of every page of shares [begin, end), which places each page on the node of the running thread */
+    touch_job *job = (touch_job*)arg;
+    int share;
+    size_t offset, stop;
+    for (share=begin; share<end; share++){
+        offset = job->bytes / job->shares * share / job->align * job->align;
+        stop = (share == job->shares-1) ? job->bytes : job->bytes / job->shares * (share+1) / job->align * job->align;
+        for (; offset<stop; offset+=job->page)
+            job->ptr[offset] = 0;
+    }
+}
+
+static void place_pages(numa_allocator *alloc, void *ptr, size_t bytes){
+/* Applies the policy to fresh (untouched) pages */
+    if (alloc->policy == NUMA_POLICY_LOCAL)
+        bind_pages(alloc, ptr, bytes, MPOL_PREFERRED, &alloc->local_node, 1);
+    else if (alloc->policy == NUMA_POLICY_INTERLEAVE && alloc->num_nodes > 1)
+        bind_pages(alloc, ptr, bytes, MPOL_INTERLEAVE, alloc->nodes, alloc->num_nodes);
+    else if (alloc->policy == NUMA_POLICY_FIRST_TOUCH){
+        touch_job job = {ptr, bytes, (size_t)sysconf(_SC_PAGESIZE), alloc->page_bytes, alloc->threads->nthreads};
+        thread_backend_parallel_for(alloc->threads, job.shares, touch_shares, &job);
+    }
+}
+
+static bool hugetlb_arena(const numa_allocator *alloc){
+    return (alloc->huge == HUGE_PAGES_2M || alloc->huge == HUGE_PAGES_1G) && !alloc->huge_fallback;
+}
+
+static size_t carve_alignment(const numa_allocator *alloc){
+/* hugetlbfs carves whole huge pages (mbind() can't split them), everything else base pages */
+    return hugetlb_arena(alloc) ? alloc->page_bytes : (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static numa_block *reserve_block(numa_allocator *alloc, size_t bytes){
+/* Maps a new arena block with room for 'bytes'. hugetlbfs blocks are only as big as asked for, since their pages
+ * are taken from the host's pool when mapped; transparent ones are reserved generously, as untouched pages cost
+ * nothing */
+    char *base;
+    size_t size;
+
+    if (alloc->num_blocks == alloc->max_blocks){
+        int max_blocks = alloc->max_blocks ? 2 * alloc->max_blocks : 4;
+        numa_block *blocks = realloc(alloc->blocks, max_blocks * sizeof(numa_block));
+        if (!blocks)
+            return NULL;
+        alloc->blocks = blocks;
+        alloc->max_blocks = max_blocks;
+    }
+
+    if (hugetlb_arena(alloc)){
+        int page_flag = (alloc->huge == HUGE_PAGES_1G) ? (30 << MAP_HUGE_SHIFT) : (21 << MAP_HUGE_SHIFT);
+        size = (bytes + alloc->page_bytes - 1) / alloc->page_bytes * alloc->page_bytes;
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | page_flag, -1, 0);
+        if (base == MAP_FAILED){
+            printf("  WARNING: No %s hugetlbfs pages for a %0.1f MiB arena block (%s), so the arena uses transparent huge pages. Reserve some with vm.nr_hugepages.\n", huge_pages_name(alloc->huge), size / 1048576.0, strerror(errno));
+            alloc->huge_fallback = true;
+            alloc->page_bytes = THP_BYTES;
+        }
+        else{
+            alloc->blocks[alloc->num_blocks] = (numa_block){base, size, 0};
+            return &alloc->blocks[alloc->num_blocks++];
+        }
+    }
+
+    // Transparent huge pages: map one huge page more than needed and trim it, so the block starts on a huge page
+    size = (bytes + THP_BYTES - 1) / THP_BYTES * THP_BYTES;
+    if (size < ARENA_BLOCK_BYTES)
+        size = ARENA_BLOCK_BYTES;
+    base = mmap(NULL, size + THP_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+    size_t lead = (THP_BYTES - (size_t)base % THP_BYTES) % THP_BYTES;
+    if (lead)
+        munmap(base, lead);
+    munmap(base + lead + size, THP_BYTES - lead);
+    base += lead;
+    if (madvise(base, size, MADV_HUGEPAGE) != 0 && !alloc->huge_fallback){
+        printf("  WARNING: madvise(MADV_HUGEPAGE) failed (%s), so the arena is on base pages. Is transparent_hugepage set to never?\n", strerror(errno));
+        alloc->huge_fallback = true;
+    }
+    alloc->blocks[alloc->num_blocks] = (numa_block){base, size, 0};
+    return &alloc->blocks[alloc->num_blocks++];
+}
+
+static void *carve(numa_allocator *alloc, size_t bytes){
+/* Takes 'bytes' from the arena's last block, or from a new one if they don't fit */
+    size_t align = carve_alignment(alloc);
+    numa_block *block = alloc->num_blocks ? &alloc->blocks[alloc->num_blocks-1] : NULL;
+    size_t offset = block ? (block->used + align - 1) / align * align : 0;
+
+    if (!block || offset + bytes > block->bytes){
+        block = reserve_block(alloc, bytes);
+        if (!block)
+            return NULL;
+        align = carve_alignment(alloc);
+        offset = 0;
+    }
+    block->used = offset + (bytes + align - 1) / align * align;
+    return block->base + offset;
+}
+
+void *numa_alloc(numa_allocator *alloc, size_t bytes){
+/* Allocates 'bytes' (at least 16-byte aligned, as fftw_malloc) placed by the allocator's policy. NULL if out of
+ * memory. Free with numa_free() */
+    void *ptr;
+    int i, best = -1;
+
+    // A buffer freed into the arena that fits is reused as it is (its pages are already placed)
+    for (i=0; i<alloc->num_buffers; i++){
+        if (alloc->buffers[i].free && alloc->buffers[i].bytes >= bytes && (best < 0 || alloc->buffers[i].bytes < alloc->buffers[best].bytes))
+            best = i;
+    }
+    if (best >= 0){
+        alloc->buffers[best].free = false;
+        alloc->reused++;
+        return alloc->buffers[best].ptr;
+    }
+
+    if (alloc->num_buffers == alloc->max_buffers){
+        int max_buffers = alloc->max_buffers ? 2 * alloc->max_buffers : 16;
+        numa_buffer *buffers = realloc(alloc->buffers, max_buffers * sizeof(numa_buffer));
+        if (!buffers)
+            return NULL;
+        alloc->buffers = buffers;
+        alloc->max_buffers = max_buffers;
+    }
+
+    if (alloc->huge != HUGE_PAGES_NONE){
+        ptr = carve(alloc, bytes);
+        if (!ptr)
+            return NULL;
+        place_pages(alloc, ptr, bytes);
+    }
+    else if (alloc->policy == NUMA_POLICY_NONE){
+        ptr = fftw_malloc(bytes);
+        if (!ptr)
+            return NULL;
+    }
+    else{
+        ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            return NULL;
+        place_pages(alloc, ptr, bytes);
+    }
+
+    alloc->buffers[alloc->num_buffers] = (numa_buffer){ptr, bytes, alloc->huge != HUGE_PAGES_NONE, false};
+    alloc->num_buffers++;
+    return ptr;
+}
+
+void numa_free(numa_allocator *alloc, void *ptr){
+/* Buffers carved from the arena stay mapped for the next request that fits */
+    int i;
+    for (i=0; i<alloc->num_buffers; i++){
+        if (alloc->buffers[i].ptr != ptr || alloc->buffers[i].free)
+            continue;
+        if (alloc->buffers[i].in_arena){
+            numa_block *block = &alloc->blocks[alloc->num_blocks-1];
+            size_t align = carve_alignment(alloc);
+            if ((char*)ptr >= block->base && (char*)ptr + (alloc->buffers[i].bytes + align - 1) / align * align == block->base + block->used){
+                block->used = (char*)ptr - block->base; //the last one carved: give its space back to the block
+                alloc->buffers[i] = alloc->buffers[--alloc->num_buffers];
+            }
+            else
+                alloc->buffers[i].free = true;
+            return;
+        }
+        if (alloc->policy == NUMA_POLICY_NONE)
+            fftw_free(ptr);
+        else
+            munmap(ptr, alloc->buffers[i].bytes);
+        alloc->buffers[i] = alloc->buffers[--alloc->num_buffers];
+        return;
+    }
+}
+
+static bool measure_placement(const numa_allocator *alloc, double *bytes_per_node, double *total_bytes){
+/* Estimates how many bytes of the live buffers are on each node from a sample of their pages. Pages that were never
+ * touched aren't anywhere yet and aren't counted. Returns false if move_pages() isn't allowed */
+    void *addresses[PLACEMENT_SAMPLES];
+    int status[PLACEMENT_SAMPLES];
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    int i, s;
+
+    memset(bytes_per_node, 0, NUMA_MAX_NODES * sizeof(double));
+    *total_bytes = 0.0;
+    for (i=0; i<alloc->num_buffers; i++){
+        if (alloc->buffers[i].free)
+            continue;
+        char *base = (char*)((size_t)alloc->buffers[i].ptr / page * page);
+        size_t pages = ((char*)alloc->buffers[i].ptr + alloc->buffers[i].bytes - base + page - 1) / page;
+        int samples = (pages < PLACEMENT_SAMPLES) ? (int)pages : PLACEMENT_SAMPLES;
+        for (s=0; s<samples; s++)
+            addresses[s] = base + pages * s / samples * page;
+        if (syscall(SYS_move_pages, 0, (unsigned long)samples, addresses, NULL, status, 0) != 0)
+            return false;
+        for (s=0; s<samples; s++){
+            if (status[s] >= 0 && status[s] < NUMA_MAX_NODES)
+                bytes_per_node[status[s]] += (double)alloc->buffers[i].bytes / samples;
+        }
+        *total_bytes += alloc->buffers[i].bytes;
+    }
+    return true;
+}
+
+void numa_measure_bandwidth(numa_allocator *alloc){
+/* Times the main thread reading a buffer bound to each node. Needs mbind() */
+    int i, pass;
+    size_t j, count = BANDWIDTH_BYTES / sizeof(double);
+
+    for (i=0; i<alloc->num_nodes; i++){
+        double *buffer = mmap(NULL, BANDWIDTH_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buffer == MAP_FAILED)
+            return;
+        if (!bind_pages(alloc, buffer, BANDWIDTH_BYTES, MPOL_BIND, &alloc->nodes[i], 1)){
+            munmap(buffer, BANDWIDTH_BYTES);
+            return;
+        }
+        for (j=0; j<count; j++)
+            buffer[j] = 1.0;
+
+        double best = 0.0;
+        for (pass=0; pass<BANDWIDTH_PASSES; pass++){
+            double sum[4] = {0.0, 0.0, 0.0, 0.0};
+            uint64_t start = timing_now();
+            for (j=0; j<count; j+=4){
+                sum[0] += buffer[j];
+                sum[1] += buffer[j+1];
+                sum[2] += buffer[j+2];
+                sum[3] += buffer[j+3];
+            }
+            double seconds = timing_elapsed(start, timing_now());
+            if (sum[0] + sum[1] + sum[2] + sum[3] != (double)count) //keeps the reads from being optimized away
+                printf("  WARNING: Bandwidth buffer on node %d reads back wrong.\n", alloc->nodes[i]);
+            if (seconds > 0.0 && BANDWIDTH_BYTES / seconds * 1e-9 > best)
+                best = BANDWIDTH_BYTES / seconds * 1e-9;
+        }
+        alloc->bandwidth[alloc->nodes[i]] = best;
+        munmap(buffer, BANDWIDTH_BYTES);
+    }
+    alloc->bandwidth_measured = true;
+}
+
+static double probe_tlb(const perf_counters *counters, char *buffer, size_t bytes){
+/* dTLB misses per read of a walk that touches a new base page (and a new cache line) every time */
+    size_t page = (size_t)sysconf(_SC_PAGESIZE), offset, reads = 0;
+    perf_sample start, stop;
+    volatile char sink = 0;
+    int pass;
+
+    memset(buffer, 1, bytes); //faults everything in first
+    perf_counters_read(counters, &start);
+    for (pass=0; pass<TLB_PROBE_PASSES; pass++){
+        for (offset=(pass * 64) % page; offset<bytes; offset+=page, reads++)
+            sink += buffer[offset];
+    }
+    perf_counters_read(counters, &stop);
+    (void)sink;
+    return (stop.values[PERF_DTLB_MISSES] - start.values[PERF_DTLB_MISSES]) / reads;
+}
+
+void numa_measure_tlb(numa_allocator *alloc, size_t working_set){
+/* Compares the dTLB misses of the same walk over a buffer from the arena and one from fftw_malloc(). The arena
+ * buffer is freed back into the arena afterwards, so the transform buffers reuse it. Needs a dTLB miss counter
+ *
+ * Inputs
+ * ======
+ *   size_t working_set
+ *       Bytes of the buffers the benchmark transforms. The probe walks that many bytes, clamped to
+ *       [TLB_PROBE_MIN_BYTES, TLB_PROBE_MAX_BYTES]
+ */
+    perf_counters counters;
+    if (alloc->huge == HUGE_PAGES_NONE || !perf_counters_open(&counters))
+        return;
+    size_t bytes = working_set < TLB_PROBE_MIN_BYTES ? TLB_PROBE_MIN_BYTES : working_set > TLB_PROBE_MAX_BYTES ? TLB_PROBE_MAX_BYTES : working_set;
+    bytes = (bytes + THP_BYTES - 1) / THP_BYTES * THP_BYTES;
+    if (perf_counters_available(&counters, PERF_DTLB_MISSES)){
+        char *arena = numa_alloc(alloc, bytes);
+        char *standard = fftw_malloc(bytes);
+        if (arena && standard){
+            alloc->tlb_misses_arena = probe_tlb(&counters, arena, bytes);
+            alloc->tlb_misses_default = probe_tlb(&counters, standard, bytes);
+            alloc->tlb_probe_bytes = bytes;
+            alloc->tlb_measured = true;
+        }
+        if (arena)
+            madvise(arena, bytes, MADV_DONTNEED); //so the transform buffers' pages are placed afresh
+        numa_free(alloc, arena);
+        fftw_free(standard);
+    }
+    perf_counters_close(&counters);
+}
+
+static double huge_backed_bytes(const numa_allocator *alloc){
+/* Bytes of the arena the kernel backs with huge pages: all of it on hugetlbfs, else the AnonHugePages that
+ * /proc/self/smaps reports for the arena's mappings */
+    char line[256];
+    unsigned long start, end, kb;
+    bool in_arena = false;
+    double bytes = 0.0;
+    int b;
+
+    if (hugetlb_arena(alloc)){
+        for (b=0; b<alloc->num_blocks; b++)
+            bytes += alloc->blocks[b].bytes;
+        return bytes;
+    }
+    FILE *f = fopen("/proc/self/smaps", "r");
+    if (!f)
+        return 0.0;
+    while (fgets(line, sizeof(line), f)){
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2){
+            in_arena = false;
+            for (b=0; b<alloc->num_blocks; b++)
+                if (start < (unsigned long)alloc->blocks[b].base + alloc->blocks[b].bytes && end > (unsigned long)alloc->blocks[b].base)
+                    in_arena = true;
+        }
+        else if (in_arena && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+            bytes += kb * 1024.0;
+    }
+    fclose(f);
+    return bytes;
+}
+
+static int live_buffers(const numa_allocator *alloc){
+    int i, live = 0;
+    for (i=0; i<alloc->num_buffers; i++)
+        live += !alloc->buffers[i].free;
+    return live;
+}
+
+static double arena_bytes(const numa_allocator *alloc){
+    double bytes = 0.0;
+    int b;
+    for (b=0; b<alloc->num_blocks; b++)
+        bytes += alloc->blocks[b].used;
+    return bytes;
+}
+
+void numa_allocator_json(FILE *f, const char *indent, const numa_allocator *alloc){
+/* Writes a "numa" object (followed by a comma): the policy, and where the live buffers' pages are */
+    double bytes_per_node[NUMA_MAX_NODES], total_bytes;
+    bool placed = measure_placement(alloc, bytes_per_node, &total_bytes);
+    int i;
+
+    fprintf(f, "%s\"numa\": {\n", indent);
+    fprintf(f, "%s    \"policy\": \"%s\",\n", indent, numa_policy_name(alloc->policy));
+    fprintf(f, "%s    \"main_thread_node\": %d,\n", indent, alloc->local_node);
+    fprintf(f, "%s    \"mbind_refused\": %s,\n", indent, alloc->mbind_failed ? "true" : "false");
+    fprintf(f, "%s    \"buffers\": %d,\n", indent, live_buffers(alloc));
+    fprintf(f, "%s    \"placement_available\": %s,\n", indent, placed ? "true" : "false");
+    fprintf(f, "%s    \"bandwidth_measured\": %s,\n", indent, alloc->bandwidth_measured ? "true" : "false");
+    fprintf(f, "%s    \"nodes\": [\n", indent);
+    for (i=0; i<alloc->num_nodes; i++){
+        int node = alloc->nodes[i];
+        fprintf(f, "%s        {\"node\": %d, ", indent, node);
+        fprintf(f, "\"buffer_bytes\": %0.0f, ", placed ? bytes_per_node[node] : 0.0);
+        fprintf(f, "\"buffer_share\": %0.5f, ", (placed && total_bytes > 0.0) ? bytes_per_node[node] / total_bytes : 0.0);
+        fprintf(f, "\"read_gbytes_per_second\": %0.3f}%s\n", alloc->bandwidth[node], (i == alloc->num_nodes-1) ? "" : ",");
+    }
+    fprintf(f, "%s    ],\n", indent);
+    fprintf(f, "%s    \"huge_pages\": {\n", indent);
+    fprintf(f, "%s        \"requested\": \"%s\",\n", indent, huge_pages_name(alloc->huge));
+    fprintf(f, "%s        \"fell_back\": %s,\n", indent, alloc->huge_fallback ? "true" : "false");
+    fprintf(f, "%s        \"page_bytes\": %zu,\n", indent, alloc->page_bytes);
+    fprintf(f, "%s        \"arena_blocks\": %d,\n", indent, alloc->num_blocks);
+    fprintf(f, "%s        \"arena_bytes\": %0.0f,\n", indent, arena_bytes(alloc));
+    fprintf(f, "%s        \"huge_backed_bytes\": %0.0f,\n", indent, huge_backed_bytes(alloc));
+    fprintf(f, "%s        \"reused_buffers\": %lu,\n", indent, alloc->reused);
+    fprintf(f, "%s        \"tlb_probe_measured\": %s,\n", indent, alloc->tlb_measured ? "true" : "false");
+    fprintf(f, "%s        \"tlb_probe_bytes\": %zu,\n", indent, alloc->tlb_probe_bytes);
+    fprintf(f, "%s        \"dtlb_misses_per_read_arena\": %0.5f,\n", indent, alloc->tlb_misses_arena);
+    fprintf(f, "%s        \"dtlb_misses_per_read_fftw_malloc\": %0.5f\n", indent, alloc->tlb_misses_default);
+    fprintf(f, "%s    }\n", indent);
+    fprintf(f, "%s},\n", indent);
+}
+
+void numa_allocator_print(const numa_allocator *alloc){
+    double bytes_per_node[NUMA_MAX_NODES], total_bytes;
+    int i;
+
+    printf("    NUMA: %s policy, %d node(s) with memory, main thread on node %d%s\n", numa_policy_name(alloc->policy), alloc->num_nodes, alloc->local_node, alloc->mbind_failed ? " (mbind refused, placed by first touch)" : "");
+    if (measure_placement(alloc, bytes_per_node, &total_bytes) && total_bytes > 0.0){
+        printf("    Buffer pages per node:");
+        for (i=0; i<alloc->num_nodes; i++)
+            printf(" %d: %0.1f%%", alloc->nodes[i], 100.0 * bytes_per_node[alloc->nodes[i]] / total_bytes);
+        printf("\n");
+    }
+    if (alloc->bandwidth_measured){
+        printf("    Main thread read bandwidth per node:");
+        for (i=0; i<alloc->num_nodes; i++)
+            printf(" %d: %0.2f GB/s", alloc->nodes[i], alloc->bandwidth[alloc->nodes[i]]);
+        printf("\n");
+    }
+    if (alloc->huge != HUGE_PAGES_NONE){
+        printf("    Huge pages: %s%s, %0.1f MiB arena in %d block(s), %0.1f MiB on huge pages, %lu buffer(s) reused\n", huge_pages_name(alloc->huge), alloc->huge_fallback ? " (fell back)" : "", arena_bytes(alloc) / 1048576.0, alloc->num_blocks, huge_backed_bytes(alloc) / 1048576.0, alloc->reused);
+        if (alloc->tlb_measured)
+            printf("    dTLB misses per page-strided read over %0.0f MiB: %0.4f arena, %0.4f fftw_malloc\n", alloc->tlb_probe_bytes / 1048576.0, alloc->tlb_misses_arena, alloc->tlb_misses_default);
+    }
+}
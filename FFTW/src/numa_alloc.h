@@ -0,0 +1,78 @@
+/* NUMA placement of the transform buffers, carved from a huge-page arena or allocated one by one */
+#ifndef NUMA_ALLOC_H
+#define NUMA_ALLOC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "thread_backend.h"
+
+#define NUMA_MAX_NODES 64
+
+typedef enum {
+    NUMA_POLICY_NONE,        //fftw_malloc, pages land wherever they are first touched (what the benchmarks always did)
+    NUMA_POLICY_LOCAL,       //pages prefer the node the main thread runs on
+    NUMA_POLICY_INTERLEAVE,  //pages interleaved across every node with memory
+    NUMA_POLICY_FIRST_TOUCH  //every thread first touches its own share of each buffer, so it lands on that thread's node
+} numa_policy;
+
+typedef enum {
+    HUGE_PAGES_NONE,  //one allocation per buffer on base pages (what the benchmarks always did)
+    HUGE_PAGES_THP,   //one arena, madvise(MADV_HUGEPAGE) so the kernel backs it with transparent 2 MB pages
+    HUGE_PAGES_2M,    //one arena on hugetlbfs 2 MB pages (vm.nr_hugepages must have some)
+    HUGE_PAGES_1G     //one arena on hugetlbfs 1 GB pages
+} huge_pages;
+
+typedef struct {
+    void *ptr;
+    size_t bytes;
+    bool in_arena;  //carved from an arena block, handed back to the arena (not the OS) when freed
+    bool free;      //freed into the arena, the next request that fits reuses it
+} numa_buffer;
+
+typedef struct {
+    char *base;
+    size_t bytes;
+    size_t used;
+} numa_block;
+
+typedef struct {
+    numa_policy policy;
+    thread_backend *threads;   //first touches the buffers with NUMA_POLICY_FIRST_TOUCH
+    int num_nodes;             //nodes with memory
+    int nodes[NUMA_MAX_NODES];
+    int local_node;            //node the main thread was on when the allocator was set up
+    bool mbind_failed;         //mbind() was refused (e.g. by a container's seccomp profile), pages were first touched
+    numa_buffer *buffers;      //live allocations
+    int num_buffers, max_buffers;
+    double bandwidth[NUMA_MAX_NODES]; //GB/s the main thread reads from each node, 0 if not measured
+    bool bandwidth_measured;
+
+    // Huge-page arena
+    huge_pages huge;
+    bool huge_fallback;        //the huge pages asked for weren't available, the arena fell back to transparent ones
+    size_t page_bytes;         //page size the arena is backed with (the base page size without an arena)
+    numa_block *blocks;        //regions reserved so far, buffers are carved from the last one
+    int num_blocks, max_blocks;
+    unsigned long reused;      //requests served by a buffer freed into the arena
+    bool tlb_measured;         //dTLB misses per page-strided read, arena vs fftw_malloc
+    double tlb_misses_arena, tlb_misses_default;
+    size_t tlb_probe_bytes;    //bytes each walk covered
+} numa_allocator;
+
+bool parse_numa_policy(const char *name, numa_policy *policy);
+const char *numa_policy_name(numa_policy policy);
+bool parse_huge_pages(const char *name, huge_pages *huge);
+const char *huge_pages_name(huge_pages huge);
+
+void numa_allocator_init(numa_allocator *alloc, numa_policy policy, huge_pages huge, thread_backend *threads);
+void numa_allocator_destroy(numa_allocator *alloc);
+void *numa_alloc(numa_allocator *alloc, size_t bytes);
+void numa_free(numa_allocator *alloc, void *ptr);
+
+void numa_measure_bandwidth(numa_allocator *alloc);
+void numa_measure_tlb(numa_allocator *alloc, size_t working_set);
+void numa_allocator_json(FILE *f, const char *indent, const numa_allocator *alloc);
+void numa_allocator_print(const numa_allocator *alloc);
+
+#endif
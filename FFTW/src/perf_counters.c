@@ -0,0 +1,252 @@
+/* Hardware performance counters for the benchmarks
+ *
+ * Timings say that a transform size is slow; the counters say why. Each benchmark phase is bracketed with reads of
+ * a few hardware counters opened with perf_event_open():
+ *
+ *   - cycles and instructions give the IPC. A low IPC with many LLC/dTLB misses per element points at a memory-bound
+ *     size, a high IPC at a compute-bound one
+ *   - LLC and dTLB misses per element show cache and page-walk pressure (e.g. power-of-two strides)
+ *   - branch misses per element
+ *   - on Intel, retired double precision FP instructions by vector width, which give the achieved GFLOP/s
+ *
+ * The counters are opened for the calling process with inherit set, so they also count the FFTW and OpenMP threads,
+ * as long as those threads are created after the counters are opened. Counters that can't be opened (no PMU in a VM,
+ * perf_event_paranoid, seccomp, another vendor's FP events) are left out, and if none can be opened every call here
+ * is a no-op. If the kernel has to multiplex the counters, the counts are scaled up by enabled/running time.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "perf_counters.h"
+
+// Intel FP_ARITH_INST_RETIRED (event 0xC7), one umask per vector width. An FMA counts twice
+#define INTEL_FP_ARITH(umask) (((umask) << 8) | 0xC7)
+
+static const char *event_names[PERF_NUM_EVENTS] = {
+    "cycles", "instructions", "branch_misses", "llc_misses", "dtlb_misses",
+    "fp_scalar_double", "fp_128b_packed_double", "fp_256b_packed_double", "fp_512b_packed_double"
+};
+
+static const double flops_per_instruction[PERF_NUM_EVENTS] = {0, 0, 0, 0, 0, 1, 2, 4, 8};
+
+const char *perf_event_name(perf_event event){
+    return event_names[event];
+}
+
+static bool intel_cpu(void){
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+        return false;
+    return ebx == 0x756e6547 && edx == 0x49656e69 && ecx == 0x6c65746e; //"GenuineIntel"
+#else
+    return false;
+#endif
+}
+
+static int open_event(uint32_t type, uint64_t config, int group_fd){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (group_fd == -1); //the group leader starts the whole group
+    attr.inherit = 1;                 //count the threads created from now on, too
+    attr.exclude_kernel = 1;          //allowed with perf_event_paranoid <= 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static void open_group(perf_counters *counters, const perf_event *events, const uint32_t *types, const uint64_t *configs, int count){
+/* Events of one group are scheduled on the PMU together, so their ratios (e.g. IPC) are taken over the same time.
+ * If the leader can't be opened, neither can the rest */
+    int leader = -1, i;
+    for (i=0; i<count; i++){
+        int fd = open_event(types[i], configs[i], leader);
+        counters->fds[events[i]] = fd;
+        if (fd < 0){
+            if (i == 0)
+                return;
+            continue;
+        }
+        if (i == 0)
+            leader = fd;
+        counters->num_available++;
+    }
+    ioctl(leader, PERF_EVENT_IOC_RESET, 0);
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+bool perf_counters_open(perf_counters *counters){
+/* Opens every counter this host allows. Returns false (and disables the counters) if there are none */
+    int e;
+    memset(counters, 0, sizeof(perf_counters));
+    for (e=0; e<PERF_NUM_EVENTS; e++)
+        counters->fds[e] = -1;
+
+    perf_event core_events[3] = {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES};
+    uint32_t core_types[3] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+    uint64_t core_configs[3] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES};
+    open_group(counters, core_events, core_types, core_configs, 3);
+
+    perf_event memory_events[2] = {PERF_LLC_MISSES, PERF_DTLB_MISSES};
+    uint32_t memory_types[2] = {PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE};
+    uint64_t memory_configs[2] = {
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    };
+    open_group(counters, memory_events, memory_types, memory_configs, 2);
+
+    if (intel_cpu()){
+        perf_event fp_events[4] = {PERF_FP_SCALAR, PERF_FP_PACKED_128, PERF_FP_PACKED_256, PERF_FP_PACKED_512};
+        uint32_t fp_types[4] = {PERF_TYPE_RAW, PERF_TYPE_RAW, PERF_TYPE_RAW, PERF_TYPE_RAW};
+        uint64_t fp_configs[4] = {INTEL_FP_ARITH(0x01), INTEL_FP_ARITH(0x04), INTEL_FP_ARITH(0x10), INTEL_FP_ARITH(0x40)};
+        open_group(counters, fp_events, fp_types, fp_configs, 4);
+    }
+
+    counters->enabled = (counters->num_available > 0);
+    return counters->enabled;
+}
+
+void perf_counters_close(perf_counters *counters){
+    int e;
+    for (e=0; e<PERF_NUM_EVENTS; e++){
+        if (counters->fds[e] >= 0)
+            close(counters->fds[e]);
+        counters->fds[e] = -1;
+    }
+    counters->enabled = false;
+}
+
+bool perf_counters_available(const perf_counters *counters, perf_event event){
+    return counters->enabled && counters->fds[event] >= 0;
+}
+
+void perf_counters_read(const perf_counters *counters, perf_sample *sample){
+/* Current value of every open counter */
+    uint64_t data[3]; //value, time enabled, time running
+    int e;
+    if (!counters->enabled)
+        return;
+    for (e=0; e<PERF_NUM_EVENTS; e++){
+        sample->values[e] = 0.0;
+        if (counters->fds[e] < 0 || read(counters->fds[e], data, sizeof(data)) != sizeof(data))
+            continue;
+        sample->values[e] = (data[2] > 0 && data[2] < data[1]) ? (double)data[0] * data[1] / data[2] : (double)data[0];
+    }
+}
+
+void perf_counters_accumulate(const perf_counters *counters, perf_totals *totals, const perf_sample *start, double elements, bool record){
+/* Adds the counts since 'start', and the 'elements' the phase worked on, to the phase's totals (unless 'record' is
+ * false, e.g. for warm-up iterations) */
+    perf_sample stop;
+    int e;
+    if (!counters->enabled || !record)
+        return;
+    perf_counters_read(counters, &stop);
+    for (e=0; e<PERF_NUM_EVENTS; e++)
+        totals->values[e] += stop.values[e] - start->values[e];
+    totals->elements += elements;
+    totals->runs++;
+}
+
+static double fp_ops(const perf_counters *counters, const perf_totals *totals, bool *available){
+    double flops = 0.0;
+    int e;
+    *available = false;
+    for (e=PERF_FP_SCALAR; e<=PERF_FP_PACKED_512; e++){
+        if (perf_counters_available(counters, (perf_event)e)){
+            flops += flops_per_instruction[e] * totals->values[e];
+            *available = true;
+        }
+    }
+    return flops;
+}
+
+void perf_totals_json(FILE *f, const char *indent, const char *name, const perf_counters *counters, const perf_totals *totals, double seconds, bool last){
+/* Writes '"name": {...}' on one line: raw counts, then the derived metrics. Counters that aren't available are left
+ * out. 'seconds' is the time spent in the phase over the same runs the counters were accumulated over */
+    double total_elements = totals->elements;
+    bool have_flops;
+    int e;
+
+    fprintf(f, "%s\"%s\": {\"runs\": %lu", indent, name, totals->runs);
+    for (e=0; e<PERF_NUM_EVENTS; e++){
+        if (perf_counters_available(counters, (perf_event)e))
+            fprintf(f, ", \"%s\": %0.0f", event_names[e], totals->values[e]);
+    }
+    if (perf_counters_available(counters, PERF_CYCLES) && perf_counters_available(counters, PERF_INSTRUCTIONS) && totals->values[PERF_CYCLES] > 0.0)
+        fprintf(f, ", \"ipc\": %0.4f", totals->values[PERF_INSTRUCTIONS] / totals->values[PERF_CYCLES]);
+    perf_event per_element[3] = {PERF_LLC_MISSES, PERF_DTLB_MISSES, PERF_BRANCH_MISSES};
+    for (e=0; e<3; e++){
+        if (perf_counters_available(counters, per_element[e]) && total_elements > 0.0)
+            fprintf(f, ", \"%s_per_element\": %0.6f", event_names[per_element[e]], totals->values[per_element[e]] / total_elements);
+    }
+    double flops = fp_ops(counters, totals, &have_flops);
+    if (have_flops){
+        fprintf(f, ", \"fp_ops\": %0.0f", flops);
+        if (seconds > 0.0)
+            fprintf(f, ", \"gflops\": %0.4f", flops / seconds * 1.0e-9);
+    }
+    fprintf(f, "}%s\n", last ? "" : ",");
+}
+
+void perf_totals_print(const char *name, const perf_counters *counters, const perf_totals *totals, double seconds){
+/* One line: IPC, misses per element and GFLOP/s, whichever are available */
+    double total_elements = totals->elements;
+    bool have_flops;
+
+    printf("    %-9s", name);
+    if (totals->runs == 0){
+        printf(" no runs recorded\n");
+        return;
+    }
+    if (perf_counters_available(counters, PERF_CYCLES) && perf_counters_available(counters, PERF_INSTRUCTIONS) && totals->values[PERF_CYCLES] > 0.0)
+        printf(" IPC %0.2f", totals->values[PERF_INSTRUCTIONS] / totals->values[PERF_CYCLES]);
+    if (perf_counters_available(counters, PERF_LLC_MISSES) && total_elements > 0.0)
+        printf("  LLC misses/elem %0.4f", totals->values[PERF_LLC_MISSES] / total_elements);
+    if (perf_counters_available(counters, PERF_DTLB_MISSES) && total_elements > 0.0)
+        printf("  dTLB misses/elem %0.4f", totals->values[PERF_DTLB_MISSES] / total_elements);
+    if (perf_counters_available(counters, PERF_BRANCH_MISSES) && total_elements > 0.0)
+        printf("  branch misses/elem %0.4f", totals->values[PERF_BRANCH_MISSES] / total_elements);
+    double flops = fp_ops(counters, totals, &have_flops);
+    if (have_flops && seconds > 0.0)
+        printf("  %0.2f GFLOP/s", flops / seconds * 1.0e-9);
+    printf("\n");
+}
+
+void perf_counters_json(FILE *f, const char *indent, bool requested, const perf_counters *counters, const perf_totals *totals, const char **phase_names, const double *phase_seconds, int num_phases, bool last){
+/* Writes the '"counters": {...}' section of a results entry: which events were available and every phase's totals.
+ * 'indent' is the indentation of the section's name */
+    int e, i;
+    fprintf(f, "%s\"counters\": {\n", indent);
+    fprintf(f, "%s    \"requested\": %s,\n", indent, requested ? "true" : "false");
+    fprintf(f, "%s    \"available\": %s%s\n", indent, counters->enabled ? "true" : "false", counters->enabled ? "," : "");
+    if (counters->enabled){
+        bool first = true;
+        fprintf(f, "%s    \"events\": [", indent);
+        for (e=0; e<PERF_NUM_EVENTS; e++){
+            if (perf_counters_available(counters, (perf_event)e)){
+                fprintf(f, "%s\"%s\"", first ? "" : ", ", event_names[e]);
+                first = false;
+            }
+        }
+        fprintf(f, "],\n");
+        fprintf(f, "%s    \"phases\": {\n", indent);
+        char phase_indent[64];
+        snprintf(phase_indent, sizeof(phase_indent), "%s        ", indent);
+        for (i=0; i<num_phases; i++)
+            perf_totals_json(f, phase_indent, phase_names[i], counters, &totals[i], phase_seconds[i], i == num_phases-1);
+        fprintf(f, "%s    }\n", indent);
+    }
+    fprintf(f, "%s}%s\n", indent, last ? "" : ",");
+}
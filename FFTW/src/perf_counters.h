@@ -0,0 +1,50 @@
+/* Hardware performance counters (perf_event_open) around the timed phases: IPC, misses per element, GFLOP/s */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_LLC_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_FP_SCALAR,      //retired double precision FP instructions, by vector width (Intel only)
+    PERF_FP_PACKED_128,
+    PERF_FP_PACKED_256,
+    PERF_FP_PACKED_512,
+    PERF_NUM_EVENTS
+} perf_event;
+
+typedef struct {
+    bool enabled;                   //false if no counter could be opened (everything else is then a no-op)
+    int fds[PERF_NUM_EVENTS];       //-1 for events that are not available
+    int num_available;
+} perf_counters;
+
+typedef struct {
+    double values[PERF_NUM_EVENTS]; //counts, scaled up if the kernel had to multiplex the counters
+} perf_sample;
+
+typedef struct {
+    double values[PERF_NUM_EVENTS]; //summed over every recorded run of the phase
+    double elements;                //pixels or samples worked on, summed over the same runs
+    unsigned long runs;
+} perf_totals;
+
+bool perf_counters_open(perf_counters *counters);
+void perf_counters_close(perf_counters *counters);
+bool perf_counters_available(const perf_counters *counters, perf_event event);
+const char *perf_event_name(perf_event event);
+
+void perf_counters_read(const perf_counters *counters, perf_sample *sample);
+void perf_counters_accumulate(const perf_counters *counters, perf_totals *totals, const perf_sample *start, double elements, bool record);
+
+void perf_totals_json(FILE *f, const char *indent, const char *name, const perf_counters *counters, const perf_totals *totals, double seconds, bool last);
+void perf_counters_json(FILE *f, const char *indent, bool requested, const perf_counters *counters, const perf_totals *totals, const char **phase_names, const double *phase_seconds, int num_phases, bool last);
+void perf_totals_print(const char *name, const perf_counters *counters, const perf_totals *totals, double seconds);
+
+#endif
@@ -0,0 +1,471 @@
+/* Streaming pipeline for the image blurring benchmark
+ *
+ * Instead of blurring the same image over and over, the streaming mode pushes a directory (or list) of images
+ * through three stages:
+ *
+ *   decode threads --[decoded ring]--> blur stage --[blurred ring]--> encode thread
+ *
+ * The decode threads read and convert images with image_load_planar(). The blur stage (the calling thread) runs
+ * the in-place forward DFT, spectral multiply and backward DFT with the FFTW threads, getting its plans and filter
+ * spectra from the plan and kernel caches, so every image shape is planned once. With padding, each image shape
+ * gets its own transform size (chosen once per shape). The encode stage writes the
+ * blurred images with image_save_planar(); without an output directory the blur stage frees them instead.
+ *
+ * The rings are bounded, so a stage that runs ahead blocks once the ring in front of it is full. Each stage keeps
+ * track of the time it spends working (as opposed to waiting on a ring), and each ring of how full it gets, which
+ * shows which stage saturates first.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fftw3.h>
+#include "pipeline.h"
+#include "ring_buffer.h"
+#include "spectral_multiply.h"
+#include "image_io.h"
+
+#define PATH_BUFFSIZE 4096
+
+typedef struct {
+    const char *path;
+    planar_image image;
+} pipeline_job;
+
+typedef struct {
+    const pipeline_config *config;
+    ring_buffer decoded;
+    ring_buffer blurred;
+    int total_jobs;
+    atomic_int next_job;
+    atomic_int active_decoders; //the last decoder to finish closes the decoded ring
+    atomic_ulong failed;
+    double *decode_busy;        //per decode thread
+    double encode_busy;
+    unsigned long encoded;
+} pipeline;
+
+typedef struct {
+    pipeline *p;
+    int id;
+} decoder_args;
+
+static double elapsed_seconds(struct timeval *start, struct timeval *stop){
+    return (stop->tv_sec - start->tv_sec) + (stop->tv_usec - start->tv_usec) * (1.0e-6);
+}
+
+static int compare_paths(const void *a, const void *b){
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static bool append_path(char ***paths, int *num_paths, int *capacity, const char *path){
+    if (*num_paths == *capacity){
+        int new_capacity = (*capacity == 0) ? 16 : 2 * (*capacity);
+        char **grown = realloc(*paths, new_capacity * sizeof(char*));
+        if (!grown)
+            return false;
+        *paths = grown;
+        *capacity = new_capacity;
+    }
+    (*paths)[*num_paths] = strdup(path);
+    if (!(*paths)[*num_paths])
+        return false;
+    (*num_paths)++;
+    return true;
+}
+
+int pipeline_list_directory(const char *dir, char ***paths){
+/* Collects the regular, non-hidden files in 'dir' (sorted by name). Returns the number of files, or -1 if the
+ * directory can't be read */
+    DIR *d = opendir(dir);
+    struct dirent *entry;
+    struct stat info;
+    char path[PATH_BUFFSIZE];
+    int num_paths = 0, capacity = 0;
+
+    *paths = NULL;
+    if (!d)
+        return -1;
+
+    while ((entry = readdir(d)) != NULL){
+        if (entry->d_name[0] == '.')
+            continue;
+        snprintf(path, PATH_BUFFSIZE, "%s/%s", dir, entry->d_name);
+        if (stat(path, &info) != 0 || !S_ISREG(info.st_mode))
+            continue;
+        if (!append_path(paths, &num_paths, &capacity, path)){
+            closedir(d);
+            pipeline_free_paths(*paths, num_paths);
+            *paths = NULL;
+            return -1;
+        }
+    }
+    closedir(d);
+
+    qsort(*paths, num_paths, sizeof(char*), compare_paths);
+    return num_paths;
+}
+
+int pipeline_read_file_list(const char *list, char ***paths){
+/* Reads one image path per line from 'list' (blank lines and lines starting with '#' are skipped). Returns the
+ * number of paths, or -1 if the list can't be read */
+    FILE *f = fopen(list, "r");
+    char line[PATH_BUFFSIZE];
+    int num_paths = 0, capacity = 0;
+
+    *paths = NULL;
+    if (!f)
+        return -1;
+
+    while (fgets(line, PATH_BUFFSIZE, f)){
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+        if (!append_path(paths, &num_paths, &capacity, line)){
+            fclose(f);
+            pipeline_free_paths(*paths, num_paths);
+            *paths = NULL;
+            return -1;
+        }
+    }
+    fclose(f);
+
+    return num_paths;
+}
+
+void pipeline_free_paths(char **paths, int num_paths){
+    int i;
+    for (i=0; i<num_paths; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+static void *decode_stage(void *arg){
+/* Decodes images until every job has been handed out, then closes the decoded ring if it is the last decoder */
+    decoder_args *args = (decoder_args*)arg;
+    pipeline *p = args->p;
+    const pipeline_config *config = p->config;
+    struct timeval start, stop;
+    double busy = 0.0;
+    int index;
+
+    while ((index = atomic_fetch_add(&p->next_job, 1)) < p->total_jobs){
+        pipeline_job *job = malloc(sizeof(pipeline_job));
+        if (!job){
+            atomic_fetch_add(&p->failed, 1);
+            continue;
+        }
+        job->path = config->paths[index % config->num_paths];
+
+        gettimeofday(&start, NULL); //start clock
+        image_status status = image_load_planar(job->path, &job->image, config->simd);
+        gettimeofday(&stop, NULL); //stop clock
+        busy += elapsed_seconds(&start, &stop);
+
+        if (status != IMAGE_OK){
+            printf("  WARNING: Image `%s` could not be decoded, skipping it.\n", job->path);
+            atomic_fetch_add(&p->failed, 1);
+            free(job);
+            continue;
+        }
+
+        // Blocks while the blur stage is 'queue_depth' images behind
+        ring_buffer_push(&p->decoded, job);
+    }
+
+    p->decode_busy[args->id] = busy;
+    if (atomic_fetch_sub(&p->active_decoders, 1) == 1)
+        ring_buffer_close(&p->decoded);
+
+    return NULL;
+}
+
+static void *encode_stage(void *arg){
+/* Writes blurred images into the output directory, under the name of the file they were read from */
+    pipeline *p = (pipeline*)arg;
+    char path[PATH_BUFFSIZE];
+    struct timeval start, stop;
+    void *item;
+
+    while (ring_buffer_pop(&p->blurred, &item)){
+        pipeline_job *job = (pipeline_job*)item;
+        const char *name = strrchr(job->path, '/');
+        name = name ? name + 1 : job->path;
+        snprintf(path, PATH_BUFFSIZE, "%s/%s", p->config->output_dir, name);
+
+        gettimeofday(&start, NULL); //start clock
+        image_status status = image_save_planar(path, &job->image);
+        gettimeofday(&stop, NULL); //stop clock
+        p->encode_busy += elapsed_seconds(&start, &stop);
+
+        if (status != IMAGE_OK){
+            printf("  WARNING: Blurred image `%s` could not be written.\n", path);
+            atomic_fetch_add(&p->failed, 1);
+        }
+        else
+            p->encoded++;
+
+        image_free_planar(&job->image);
+        free(job);
+    }
+
+    return NULL;
+}
+
+typedef struct {
+    size_choice *choices; //one per image shape seen so far
+    int num_choices;
+    int capacity;
+} size_choices;
+
+static const size_choice *transform_size(const pipeline_config *config, size_choices *known, int height, int width){
+/* The transform size for an image shape, choosing it the first time the shape comes along */
+    int i;
+    for (i=0; i<known->num_choices; i++){
+        if (known->choices[i].native_height == height && known->choices[i].native_width == width)
+            return &known->choices[i];
+    }
+    if (known->num_choices == known->capacity){
+        int new_capacity = (known->capacity == 0) ? 8 : 2 * known->capacity;
+        size_choice *grown = realloc(known->choices, new_capacity * sizeof(size_choice));
+        if (!grown)
+            return NULL;
+        known->choices = grown;
+        known->capacity = new_capacity;
+    }
+    choose_fft_size(config->pad, config->sizes, height, width, config->filter_size, config->nthreads, &known->choices[known->num_choices]);
+    return &known->choices[known->num_choices++];
+}
+
+static bool blur_image(const pipeline_config *config, size_choices *known, planar_image *image, double **scratch, size_t *scratch_bytes){
+/* Blurs an image's R, G and B channels in place
+ *
+ * The three channels are copied into one padded, in-place buffer (rows of 2*(width/2+1) doubles, one plane after
+ * another) and transformed with a single howmany = 3 plan. The scratch buffer is kept between images and only
+ * grows, so that images of the same shape reuse the same (cached) plans. With padding, the image sits in the
+ * top-left corner of a larger, zeroed transform.
+ */
+    int height = image->height, width = image->width;
+    const size_choice *size = transform_size(config, known, height, width);
+    if (!size)
+        return false;
+    int padded_height = size->height, padded_width = size->width;
+    size_t real_row_width = 2*(padded_width/2+1);
+    size_t plane_size = (size_t)padded_height * real_row_width;
+    size_t bytes = 3 * plane_size * sizeof(double);
+    double *channels[3] = {image->red, image->green, image->blue};
+    int n[2] = {padded_height, padded_width};
+    size_t x, y;
+    int c;
+
+    if (bytes > *scratch_bytes){
+        fftw_free(*scratch);
+        *scratch = (double*)fftw_malloc(bytes);
+        *scratch_bytes = *scratch ? bytes : 0;
+        if (!*scratch)
+            return false;
+    }
+    double *buffer = *scratch;
+    fftw_complex *spectrum = (fftw_complex*)buffer;
+
+    // Plans and filter spectrum (only the first image of each shape pays for these)
+    fftw_complex *filter = kernel_cache_gaussian(config->kernels, config->plans, padded_height, padded_width, config->sigma, config->filter_size, config->analytic_filter, config->nthreads, config->flags);
+    fftw_plan forward_plan = plan_cache_r2c(config->plans, 2, n, 3, buffer, 1, (int)plane_size, spectrum, 1, (int)(plane_size/2), config->nthreads, config->flags);
+    fftw_plan backward_plan = plan_cache_c2r(config->plans, 2, n, 3, spectrum, 1, (int)(plane_size/2), buffer, 1, (int)plane_size, config->nthreads, config->flags);
+
+    // Fill the buffer (after planning, which may overwrite it), zeroing the padding
+    for (c=0; c<3; c++){
+        for (y=0; y<height; y++){
+            memcpy(buffer + c*plane_size + y*real_row_width, channels[c] + y*width, width * sizeof(double));
+            memset(buffer + c*plane_size + y*real_row_width + width, 0, (padded_width - width) * sizeof(double));
+        }
+        for (y=height; y<padded_height; y++)
+            memset(buffer + c*plane_size + y*real_row_width, 0, padded_width * sizeof(double));
+    }
+
+    // Forward DFT, blur, backward DFT
+    fftw_complex *planes[3] = {spectrum, spectrum + plane_size/2, spectrum + plane_size};
+    fftw_execute_dft_r2c(forward_plan, buffer, spectrum);
+    spectral_multiply(config->simd, filter, padded_height, padded_width/2+1, planes, planes, 3, 1, config->nthreads);
+    fftw_execute_dft_c2r(backward_plan, spectrum, buffer);
+
+    // Copy back, undoing FFTW's scaling by the transform size
+    double scale = 1.0 / ((double)padded_height * padded_width);
+    for (c=0; c<3; c++){
+        for (y=0; y<height; y++){
+            for (x=0; x<width; x++)
+                channels[c][y*width + x] = buffer[c*plane_size + y*real_row_width + x] * scale;
+        }
+    }
+
+    if (!config->cache_plans)
+        plan_cache_clear(config->plans);
+
+    return true;
+}
+
+static void queue_stats(ring_buffer *ring, pipeline_queue_stats *stats){
+    stats->capacity = ring->capacity;
+    stats->average_occupancy = ring_buffer_average_occupancy(ring);
+    stats->max_occupancy = atomic_load(&ring->max_occupancy);
+    stats->full_stalls = atomic_load(&ring->full_stalls);
+    stats->empty_stalls = atomic_load(&ring->empty_stalls);
+}
+
+bool pipeline_run(const pipeline_config *config, pipeline_stats *stats){
+/* Streams every image through the pipeline 'passes' times
+ *
+ * Inputs
+ * ======
+ *   const pipeline_config *config
+ *       Images, stage sizes and blur parameters. FFTW's threads must have been initialized, and
+ *       MagickWandGenesis() called
+ *
+ *   pipeline_stats *stats
+ *       Filled in with the throughput, per-stage utilization and per-ring occupancy
+ *
+ * Returns false if the rings or threads could not be set up
+ */
+    pipeline p;
+    pthread_t *decoders;
+    decoder_args *args;
+    pthread_t encoder;
+    bool encode = (config->output_dir != NULL);
+    struct timeval wall_start, wall_stop, start, stop;
+    double *scratch = NULL;
+    size_t scratch_bytes = 0;
+    size_choices known_sizes = {NULL, 0, 0};
+    double blur_busy = 0.0;
+    unsigned long blurred = 0;
+    void *item;
+    int i, started = 0;
+
+    memset(stats, 0, sizeof(pipeline_stats));
+    memset(&p, 0, sizeof(pipeline));
+    p.config = config;
+    p.total_jobs = config->num_paths * config->passes;
+    atomic_init(&p.next_job, 0);
+    atomic_init(&p.active_decoders, config->decode_threads);
+    atomic_init(&p.failed, 0);
+
+    decoders = malloc(config->decode_threads * sizeof(pthread_t));
+    args = malloc(config->decode_threads * sizeof(decoder_args));
+    p.decode_busy = calloc(config->decode_threads, sizeof(double));
+    if (!decoders || !args || !p.decode_busy || !ring_buffer_init(&p.decoded, config->queue_depth)){
+        free(decoders); free(args); free(p.decode_busy);
+        return false;
+    }
+    if (!ring_buffer_init(&p.blurred, config->queue_depth)){
+        ring_buffer_destroy(&p.decoded);
+        free(decoders); free(args); free(p.decode_busy);
+        return false;
+    }
+
+    gettimeofday(&wall_start, NULL); //start clock
+
+    // Start the decode and encode stages
+    for (i=0; i<config->decode_threads; i++){
+        args[i].p = &p;
+        args[i].id = i;
+        if (pthread_create(&decoders[i], NULL, decode_stage, &args[i]) != 0)
+            break;
+        started++;
+    }
+    if (started < config->decode_threads){
+        // The decoders that never started still have to count themselves out
+        int missing = config->decode_threads - started;
+        if (atomic_fetch_sub(&p.active_decoders, missing) == missing)
+            ring_buffer_close(&p.decoded);
+    }
+    if (encode && pthread_create(&encoder, NULL, encode_stage, &p) != 0)
+        encode = false;
+
+    // Blur stage
+    while (ring_buffer_pop(&p.decoded, &item)){
+        pipeline_job *job = (pipeline_job*)item;
+
+        gettimeofday(&start, NULL); //start clock
+        bool ok = blur_image(config, &known_sizes, &job->image, &scratch, &scratch_bytes);
+        gettimeofday(&stop, NULL); //stop clock
+        blur_busy += elapsed_seconds(&start, &stop);
+
+        if (!ok){
+            printf("  WARNING: Could not allocate memory to blur image `%s`, skipping it.\n", job->path);
+            atomic_fetch_add(&p.failed, 1);
+        }
+        else
+            blurred++;
+
+        // Blocks while the encode stage is 'queue_depth' images behind
+        if (ok && encode)
+            ring_buffer_push(&p.blurred, job);
+        else{
+            image_free_planar(&job->image);
+            free(job);
+        }
+    }
+    ring_buffer_close(&p.blurred);
+
+    for (i=0; i<started; i++)
+        pthread_join(decoders[i], NULL);
+    if (encode)
+        pthread_join(encoder, NULL);
+
+    gettimeofday(&wall_stop, NULL); //stop clock
+    stats->wall_time = elapsed_seconds(&wall_start, &wall_stop);
+
+    // Throughput counts the images that made it all the way through
+    stats->images = blurred;
+    stats->failed = atomic_load(&p.failed);
+    stats->images_per_second = (stats->wall_time > 0.0) ? (encode ? p.encoded : blurred) / stats->wall_time : 0.0;
+
+    stats->decode.threads = config->decode_threads;
+    stats->decode.items = atomic_load(&p.decoded.pushes);
+    for (i=0; i<config->decode_threads; i++)
+        stats->decode.busy_time += p.decode_busy[i];
+    stats->blur.threads = 1;
+    stats->blur.items = blurred;
+    stats->blur.busy_time = blur_busy;
+    stats->encode.threads = encode ? 1 : 0;
+    stats->encode.items = encode ? p.encoded : 0;
+    stats->encode.busy_time = p.encode_busy;
+
+    pipeline_stage_stats *stages[3] = {&stats->decode, &stats->blur, &stats->encode};
+    for (i=0; i<3; i++){
+        if (stages[i]->threads > 0 && stats->wall_time > 0.0)
+            stages[i]->utilization = stages[i]->busy_time / (stages[i]->threads * stats->wall_time);
+    }
+
+    queue_stats(&p.decoded, &stats->decoded);
+    queue_stats(&p.blurred, &stats->blurred);
+
+    stats->sizes = known_sizes.choices;
+    stats->num_sizes = known_sizes.num_choices;
+
+    fftw_free(scratch);
+    ring_buffer_destroy(&p.decoded);
+    ring_buffer_destroy(&p.blurred);
+    free(decoders);
+    free(args);
+    free(p.decode_busy);
+
+    return true;
+}
+
+const char *pipeline_bottleneck(const pipeline_stats *stats){
+/* The stage with the highest utilization, i.e. the one the others end up waiting on */
+    const char *name = "decode";
+    double utilization = stats->decode.utilization;
+    if (stats->blur.utilization > utilization){
+        name = "blur";
+        utilization = stats->blur.utilization;
+    }
+    if (stats->encode.threads > 0 && stats->encode.utilization > utilization)
+        name = "encode";
+    return name;
+}
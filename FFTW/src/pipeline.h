@@ -0,0 +1,68 @@
+/* Streaming pipeline: decode -> blur -> (optional) encode, with the stages connected by bounded lock-free rings */
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "plan_cache.h"
+#include "kernel_cache.h"
+#include "simd.h"
+#include "fft_size.h"
+
+typedef struct {
+    char **paths;           //images to blur
+    int num_paths;
+    int passes;             //number of times every image goes through the pipeline
+    int decode_threads;
+    int queue_depth;        //capacity of each ring between two stages (rounded up to a power of two)
+    const char *output_dir; //where the encode stage writes the blurred images (NULL disables the encode stage)
+
+    // Blur stage
+    int nthreads;           //FFTW and spectral multiply threads
+    unsigned flags;         //FFTW planner flags
+    bool cache_plans;       //false re-plans every image
+    simd_level simd;
+    double sigma;
+    int filter_size;
+    bool analytic_filter;
+    pad_mode pad;           //transform size for each image shape
+    size_table *sizes;      //measured timings to choose sizes with (NULL uses the cost model)
+    plan_cache *plans;      //only the blur stage plans, so the caches need no locking
+    kernel_cache *kernels;
+} pipeline_config;
+
+typedef struct {
+    int threads;
+    unsigned long items; //images that went through the stage
+    double busy_time;    //seconds spent working instead of waiting on a ring (summed over the stage's threads)
+    double utilization;  //busy_time / (threads * wall time)
+} pipeline_stage_stats;
+
+typedef struct {
+    size_t capacity;
+    double average_occupancy; //queued images right after a push, averaged over every push
+    size_t max_occupancy;
+    unsigned long full_stalls;  //pushes that had to wait for the next stage (backpressure)
+    unsigned long empty_stalls; //pops that had to wait for the previous stage
+} pipeline_queue_stats;
+
+typedef struct {
+    unsigned long images; //images blurred
+    unsigned long failed; //images that could not be decoded or written
+    double wall_time;
+    double images_per_second;
+    pipeline_stage_stats decode, blur, encode;
+    pipeline_queue_stats decoded; //decode -> blur
+    pipeline_queue_stats blurred; //blur -> encode
+    size_choice *sizes;           //transform size chosen for each image shape (free() when done)
+    int num_sizes;
+} pipeline_stats;
+
+int pipeline_list_directory(const char *dir, char ***paths);
+int pipeline_read_file_list(const char *list, char ***paths);
+void pipeline_free_paths(char **paths, int num_paths);
+
+bool pipeline_run(const pipeline_config *config, pipeline_stats *stats);
+const char *pipeline_bottleneck(const pipeline_stats *stats);
+
+#endif
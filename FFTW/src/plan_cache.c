@@ -0,0 +1,205 @@
+/* Plan cache for the FFTW benchmarks
+ *
+ * FFTW plans are expensive to create and cheap to execute. Every plan handed out by this cache is keyed by
+ * (shape, direction, precision, alignment, thread count, flags), so a plan created for one set of arrays can be
+ * re-used on any other set of arrays with the same alignment through the new-array execute functions
+ * (fftw_execute_dft_r2c / fftw_execute_dft_c2r).
+ *
+ * Passing the same array as input and output asks for an in-place plan. In-place r2c/c2r transforms use FFTW's
+ * padded layout, where each real row along the last dimension holds 2*(n/2+1) doubles so that it can also hold the
+ * n/2+1 complex numbers of its spectrum.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "plan_cache.h"
+
+static double elapsed_seconds(struct timeval *start, struct timeval *stop){
+    return (stop->tv_sec - start->tv_sec) + (stop->tv_usec - start->tv_usec) * (1.0e-6);
+}
+
+static bool keys_match(plan_key *a, plan_key *b){
+/* Returns true if two plan keys describe the same transform
+ *
+ * Inputs
+ * ======
+ *   plan_key *a, *b
+ *       The keys to compare
+ */
+    if (a->rank != b->rank || a->howmany != b->howmany || a->direction != b->direction || a->precision != b->precision)
+        return false;
+    if (a->istride != b->istride || a->idist != b->idist || a->ostride != b->ostride || a->odist != b->odist)
+        return false;
+    if (a->in_place != b->in_place)
+        return false;
+    if (a->in_alignment != b->in_alignment || a->out_alignment != b->out_alignment)
+        return false;
+    if (a->nthreads != b->nthreads || a->flags != b->flags)
+        return false;
+
+    return memcmp(a->n, b->n, a->rank * sizeof(int)) == 0;
+}
+
+static plan_cache_entry *find_entry(plan_cache *cache, plan_key *key){
+    int i;
+    for (i=0; i<cache->num_entries; i++){
+        if (keys_match(&cache->entries[i].key, key))
+            return &cache->entries[i];
+    }
+    return NULL;
+}
+
+static plan_cache_entry *add_entry(plan_cache *cache, plan_key *key){
+/* Appends a new (empty) entry to the cache, copying the key's dimensions so that the caller's array can go away */
+    if (cache->num_entries == cache->capacity){
+        cache->capacity = (cache->capacity == 0) ? 8 : cache->capacity * 2;
+        cache->entries = realloc(cache->entries, cache->capacity * sizeof(plan_cache_entry));
+        if (!cache->entries){
+            printf("Could not grow the plan cache to %d entries. Exiting now.\n", cache->capacity);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    plan_cache_entry *entry = &cache->entries[cache->num_entries++];
+    entry->key = *key;
+    entry->key.n = malloc(key->rank * sizeof(int));
+    memcpy(entry->key.n, key->n, key->rank * sizeof(int));
+    entry->plan = NULL;
+    entry->planning_time = 0.0;
+    entry->hits = 0;
+
+    return entry;
+}
+
+void plan_cache_init(plan_cache *cache){
+    cache->entries = NULL;
+    cache->num_entries = 0;
+    cache->capacity = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->total_planning_time = 0.0;
+}
+
+void plan_cache_clear(plan_cache *cache){
+/* Destroys every cached plan but keeps the cache (and its statistics) usable */
+    int i;
+    for (i=0; i<cache->num_entries; i++){
+        fftw_destroy_plan(cache->entries[i].plan);
+        free(cache->entries[i].key.n);
+    }
+    cache->num_entries = 0;
+}
+
+void plan_cache_destroy(plan_cache *cache){
+    plan_cache_clear(cache);
+    free(cache->entries);
+    cache->entries = NULL;
+    cache->capacity = 0;
+}
+
+static fftw_plan lookup(plan_cache *cache, plan_key *key, double *in_real, fftw_complex *in_complex, double *out_real, fftw_complex *out_complex){
+/* Returns the cached plan for 'key', creating it with the given arrays on a miss
+ *
+ * Inputs
+ * ======
+ *   plan_cache *cache
+ *       The cache to search
+ *
+ *   plan_key *key
+ *       Describes the transform. Alignments are filled in by the caller
+ *
+ *   double *in_real, fftw_complex *in_complex, double *out_real, fftw_complex *out_complex
+ *       Arrays used for planning (only the ones matching the key's direction are used). With any flag other than
+ *       FFTW_ESTIMATE, the planner overwrites these arrays, so they must be filled AFTER this call
+ */
+    plan_cache_entry *entry = find_entry(cache, key);
+    if (entry){
+        entry->hits++;
+        cache->hits++;
+        return entry->plan;
+    }
+
+    struct timeval plan_start, plan_stop;
+    fftw_plan plan;
+
+    // In-place transforms need the padded real layout spelled out through nembed (out-of-place ones use n)
+    int *real_nembed = NULL, *complex_nembed = NULL;
+    if (key->in_place){
+        real_nembed = malloc(key->rank * sizeof(int));
+        complex_nembed = malloc(key->rank * sizeof(int));
+        memcpy(real_nembed, key->n, key->rank * sizeof(int));
+        memcpy(complex_nembed, key->n, key->rank * sizeof(int));
+        real_nembed[key->rank-1] = 2 * (key->n[key->rank-1]/2 + 1);
+        complex_nembed[key->rank-1] = key->n[key->rank-1]/2 + 1;
+    }
+
+    gettimeofday(&plan_start, NULL); //start clock
+    fftw_plan_with_nthreads(key->nthreads);
+    if (key->direction == PLAN_R2C)
+        plan = fftw_plan_many_dft_r2c(key->rank, key->n, key->howmany, in_real, real_nembed, key->istride, key->idist, out_complex, complex_nembed, key->ostride, key->odist, key->flags);
+    else
+        plan = fftw_plan_many_dft_c2r(key->rank, key->n, key->howmany, in_complex, complex_nembed, key->istride, key->idist, out_real, real_nembed, key->ostride, key->odist, key->flags);
+    gettimeofday(&plan_stop, NULL); //stop clock
+
+    free(real_nembed);
+    free(complex_nembed);
+
+    if (plan == NULL){
+        printf("FFTW could not create a %s plan of rank %d. Exiting now.\n", (key->direction == PLAN_R2C) ? "r2c" : "c2r", key->rank);
+        exit(EXIT_FAILURE);
+    }
+
+    entry = add_entry(cache, key);
+    entry->plan = plan;
+    entry->planning_time = elapsed_seconds(&plan_start, &plan_stop);
+    cache->total_planning_time += entry->planning_time;
+    cache->misses++;
+
+    return plan;
+}
+
+fftw_plan plan_cache_r2c(plan_cache *cache, int rank, const int *n, int howmany, double *in, int istride, int idist, fftw_complex *out, int ostride, int odist, int nthreads, unsigned flags){
+/* Returns a real -> complex plan (see fftw_plan_many_dft_r2c for the meaning of the arguments)
+ *
+ * The plan can be executed on any other pair of arrays with the same alignment as 'in' and 'out' via
+ * fftw_execute_dft_r2c(plan, new_in, new_out). If 'in' and 'out' are the same array, the plan is in-place (with
+ * padded rows, and 'idist' counted in doubles), and so must every pair of arrays it is executed on be
+ */
+    plan_key key = {
+        .rank = rank, .n = (int*)n, .howmany = howmany,
+        .istride = istride, .idist = idist, .ostride = ostride, .odist = odist,
+        .in_place = ((void*)in == (void*)out), .direction = PLAN_R2C, .precision = PRECISION_DOUBLE,
+        .in_alignment = fftw_alignment_of(in), .out_alignment = fftw_alignment_of((double*)out),
+        .nthreads = nthreads, .flags = flags
+    };
+    return lookup(cache, &key, in, NULL, NULL, out);
+}
+
+fftw_plan plan_cache_c2r(plan_cache *cache, int rank, const int *n, int howmany, fftw_complex *in, int istride, int idist, double *out, int ostride, int odist, int nthreads, unsigned flags){
+/* Returns a complex -> real plan (see fftw_plan_many_dft_c2r for the meaning of the arguments)
+ *
+ * The plan can be executed on any other pair of arrays with the same alignment as 'in' and 'out' via
+ * fftw_execute_dft_c2r(plan, new_in, new_out). As with plan_cache_r2c, passing the same array twice gives an
+ * in-place plan
+ */
+    plan_key key = {
+        .rank = rank, .n = (int*)n, .howmany = howmany,
+        .istride = istride, .idist = idist, .ostride = ostride, .odist = odist,
+        .in_place = ((void*)in == (void*)out), .direction = PLAN_C2R, .precision = PRECISION_DOUBLE,
+        .in_alignment = fftw_alignment_of((double*)in), .out_alignment = fftw_alignment_of(out),
+        .nthreads = nthreads, .flags = flags
+    };
+    return lookup(cache, &key, NULL, in, out, NULL);
+}
+
+fftw_plan plan_cache_r2c_2d(plan_cache *cache, int n0, int n1, double *in, fftw_complex *out, int nthreads, unsigned flags){
+    int n[2] = {n0, n1};
+    return plan_cache_r2c(cache, 2, n, 1, in, 1, 0, out, 1, 0, nthreads, flags);
+}
+
+fftw_plan plan_cache_c2r_2d(plan_cache *cache, int n0, int n1, fftw_complex *in, double *out, int nthreads, unsigned flags){
+    int n[2] = {n0, n1};
+    return plan_cache_c2r(cache, 2, n, 1, in, 1, 0, out, 1, 0, nthreads, flags);
+}
@@ -0,0 +1,57 @@
+/* Plan cache: builds each FFTW plan once and hands it back on every later request with the same key */
+#ifndef PLAN_CACHE_H
+#define PLAN_CACHE_H
+
+#include <stdbool.h>
+#include <fftw3.h>
+
+typedef enum {
+    PLAN_R2C, //real -> complex (forward)
+    PLAN_C2R  //complex -> real (backward)
+} plan_direction;
+
+typedef enum {
+    PRECISION_DOUBLE
+} plan_precision;
+
+typedef struct {
+    int rank;
+    int *n;            //dimensions (rank entries, owned by the cache)
+    int howmany;       //number of transforms per execute
+    int istride, idist;
+    int ostride, odist;
+    bool in_place;     //true if the input and output arrays are the same (padded r2c/c2r layout)
+    plan_direction direction;
+    plan_precision precision;
+    int in_alignment;  //fftw_alignment_of() of the input array
+    int out_alignment; //fftw_alignment_of() of the output array
+    int nthreads;
+    unsigned flags;
+} plan_key;
+
+typedef struct {
+    plan_key key;
+    fftw_plan plan;
+    double planning_time; //seconds spent creating this plan
+    unsigned long hits;   //number of times this plan was handed out after creation
+} plan_cache_entry;
+
+typedef struct {
+    plan_cache_entry *entries;
+    int num_entries;
+    int capacity;
+    unsigned long hits;         //lookups served from the cache
+    unsigned long misses;       //lookups that had to create a plan
+    double total_planning_time; //seconds spent in the FFTW planner
+} plan_cache;
+
+void plan_cache_init(plan_cache *cache);
+void plan_cache_clear(plan_cache *cache);
+void plan_cache_destroy(plan_cache *cache);
+
+fftw_plan plan_cache_r2c(plan_cache *cache, int rank, const int *n, int howmany, double *in, int istride, int idist, fftw_complex *out, int ostride, int odist, int nthreads, unsigned flags);
+fftw_plan plan_cache_c2r(plan_cache *cache, int rank, const int *n, int howmany, fftw_complex *in, int istride, int idist, double *out, int ostride, int odist, int nthreads, unsigned flags);
+fftw_plan plan_cache_r2c_2d(plan_cache *cache, int n0, int n1, double *in, fftw_complex *out, int nthreads, unsigned flags);
+fftw_plan plan_cache_c2r_2d(plan_cache *cache, int n0, int n1, fftw_complex *in, double *out, int nthreads, unsigned flags);
+
+#endif
@@ -0,0 +1,111 @@
+/* Precision variants of the benchmarks, and their accuracy
+ *
+ * The same blur and cosine engines (precision_engine.c) are built once per FFTW precision whose libraries
+ * compile_benchmark_code.sh finds: double always, single (fftwf_), long double (fftwl_) and quad (fftwq_) when
+ * HAVE_FFTW_SINGLE, HAVE_FFTW_LONG_DOUBLE or HAVE_FFTW_QUAD are defined. Single precision halves the bytes every
+ * transform moves, so it is the obvious speedup for the blur, if the blurred image is still good enough.
+ *
+ * Accuracy is measured against the double engine's output for the same input: the largest absolute error, the RMS
+ * error, the relative L2 error and, for images, the PSNR relative to the reference's peak value.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "precision.h"
+
+extern const precision_engine precision_engine_double;
+#ifdef HAVE_FFTW_SINGLE
+extern const precision_engine precision_engine_single;
+#endif
+#ifdef HAVE_FFTW_LONG_DOUBLE
+extern const precision_engine precision_engine_long_double;
+#endif
+#ifdef HAVE_FFTW_QUAD
+extern const precision_engine precision_engine_quad;
+#endif
+
+static const precision_engine *engines[] = {
+#ifdef HAVE_FFTW_SINGLE
+    &precision_engine_single,
+#endif
+    &precision_engine_double,
+#ifdef HAVE_FFTW_LONG_DOUBLE
+    &precision_engine_long_double,
+#endif
+#ifdef HAVE_FFTW_QUAD
+    &precision_engine_quad,
+#endif
+};
+
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+const precision_engine *find_precision_engine(const char *name){
+/* The engine called 'name' ("float" and "long" are accepted too), or NULL if it isn't one, or wasn't built */
+    size_t i;
+    if (strcmp(name, "float") == 0)
+        name = "single";
+    else if (strcmp(name, "long") == 0)
+        name = "long-double";
+    for (i=0; i<NUM_ENGINES; i++){
+        if (strcmp(engines[i]->name, name) == 0)
+            return engines[i];
+    }
+    return NULL;
+}
+
+const char *precision_engine_names(void){
+/* The engines that were built, for usage messages, e.g. "single, double, long-double" */
+    static char names[64];
+    size_t i;
+    names[0] = '\0';
+    for (i=0; i<NUM_ENGINES; i++){
+        if (i > 0)
+            strcat(names, ", ");
+        strcat(names, engines[i]->name);
+    }
+    return names;
+}
+
+void precision_error_init(precision_error *error){
+    memset(error, 0, sizeof(precision_error));
+}
+
+void precision_error_add(precision_error *error, const double *reference, const double *test, size_t count){
+/* Adds 'count' values to the comparison, which may be built up over several calls (e.g. one per channel) */
+    size_t i;
+    for (i=0; i<count; i++){
+        double diff = fabs(test[i] - reference[i]);
+        if (diff > error->max_abs_error)
+            error->max_abs_error = diff;
+        if (fabs(reference[i]) > error->peak)
+            error->peak = fabs(reference[i]);
+        error->error_squares += diff * diff;
+        error->reference_squares += reference[i] * reference[i];
+    }
+    error->count += count;
+}
+
+void precision_error_finish(precision_error *error){
+    error->rms_error = error->count ? sqrt(error->error_squares / error->count) : 0;
+    error->relative_l2_error = error->reference_squares > 0 ? sqrt(error->error_squares / error->reference_squares) : 0;
+    error->psnr_db = error->rms_error > 0 && error->peak > 0 ? 20 * log10(error->peak / error->rms_error) : -1;
+}
+
+void precision_error_json(FILE *f, const char *indent, const char *name, const precision_error *error, bool last){
+/* Writes '"name": {...}' on one line. The PSNR is null if the two were identical */
+    fprintf(f, "%s\"%s\": {\"count\": %lu, \"max_abs_error\": %0.6e, \"rms_error\": %0.6e, \"relative_l2_error\": %0.6e, \"peak\": %0.6e, ", indent, name, error->count, error->max_abs_error, error->rms_error, error->relative_l2_error, error->peak);
+    if (error->psnr_db < 0)
+        fprintf(f, "\"psnr_db\": null}%s\n", last ? "" : ",");
+    else
+        fprintf(f, "\"psnr_db\": %0.3f}%s\n", error->psnr_db, last ? "" : ",");
+}
+
+void precision_error_print(const char *name, const precision_error *error){
+/* One line */
+    if (error->psnr_db < 0){
+        printf("    %-10s identical to the reference (%lu values)\n", name, error->count);
+        return;
+    }
+    printf("    %-10s max abs %0.3e  rms %0.3e  relative L2 %0.3e  PSNR %0.2f dB\n", name, error->max_abs_error, error->rms_error, error->relative_l2_error, error->psnr_db);
+}
@@ -0,0 +1,77 @@
+/* Precision-generic blur and cosine engines (fftwf_, fftw_, fftwl_, fftwq_), and their accuracy against double */
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <fftw3.h>
+#include "flops.h"
+#include "timing.h"
+
+#define PRECISION_MAX_RANK 100
+
+typedef struct {
+    int height, width;               //image
+    int padded_height, padded_width; //transform size
+    const double *channels[3];       //planar R, G and B input
+    const fftw_complex *filter;      //padded_height x (padded_width/2+1) spectrum of the blur filter
+    double *out[3];                  //blurred R, G and B (height x width), after the last iteration
+    int iterations;
+    int nthreads;
+    unsigned flags;
+    latency_histogram *latency;      //latency of every image (all three channels), warm-up included (NULL if not wanted)
+} precision_blur_job;
+
+typedef struct {
+    int rank;
+    const int *n;
+    int howmany;                //transforms per execution
+    bool interleaved;           //sample i of every transform next to each other (stride howmany, dist 1)
+    const double *input;        //one transform's input, copied into every transform of the batch
+    int warmup, iterations;     //untimed executions first, then timed ones
+    int nthreads;
+    unsigned flags;
+    fftw_complex *spectrum;     //first transform's spectrum after the last execution (NULL if not wanted)
+    double *back;               //first transform's round trip, divided by the size (NULL if not wanted)
+    latency_histogram *latency; //forward, backward and iteration latencies, warm-up included (NULL if not wanted)
+} precision_cosine_job;
+
+typedef struct {
+    double plan_time;
+    double copy_time;           //blur only: copying the channels into the (padded) input array
+    double forward_time, multiply_time, backward_time; //summed over the timed executions
+    flop_count forward_count, backward_count;
+} precision_timings;
+
+typedef struct {
+    const char *name;        //"single", "double", "long-double" or "quad"
+    const char *prefix;      //of its FFTW API, e.g. "fftwf_"
+    size_t real_bytes;       //sizeof one real
+    double epsilon;          //machine epsilon
+    void (*init_threads)(void);
+    void (*cleanup_threads)(void);
+    bool (*blur)(const precision_blur_job *job, precision_timings *timings);
+    bool (*cosine)(const precision_cosine_job *job, precision_timings *timings);
+} precision_engine;
+
+typedef struct {
+    size_t count;
+    double max_abs_error;     //largest |test - reference|
+    double rms_error;
+    double relative_l2_error; //||test - reference|| / ||reference||
+    double peak;              //largest |reference|
+    double psnr_db;           //20 log10(peak / rms_error), negative if the two are identical
+    double error_squares, reference_squares; //sums, until precision_error_finish()
+} precision_error;
+
+const precision_engine *find_precision_engine(const char *name);
+const char *precision_engine_names(void);
+
+void precision_error_init(precision_error *error);
+void precision_error_add(precision_error *error, const double *reference, const double *test, size_t count);
+void precision_error_finish(precision_error *error);
+void precision_error_json(FILE *f, const char *indent, const char *name, const precision_error *error, bool last);
+void precision_error_print(const char *name, const precision_error *error);
+
+#endif
@@ -0,0 +1,4 @@
+/* The precision engines built against FFTW's double API (see precision_engine.c) */
+#define PRECISION_DOUBLE
+#define PRECISION_ENGINE precision_engine_double
+#include "precision_engine.c"
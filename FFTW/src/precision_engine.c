@@ -0,0 +1,256 @@
+/* Precision-generic blur and cosine engines
+ *
+ * This file is not compiled on its own: precision_single.c, precision_double.c, precision_long_double.c and
+ * precision_quad.c each define one of PRECISION_SINGLE, PRECISION_DOUBLE, PRECISION_LONG_DOUBLE or PRECISION_QUAD and
+ * include it, which builds the same engines against fftwf_, fftw_, fftwl_ or fftwq_. FFTW(name) picks the API,
+ * 'real' is the precision's floating point type and PRECISION_ENGINE is the name of the engine exported for it
+ * (see precision.c, which lists the engines that were built).
+ *
+ *   - the blur engine zero-pads every channel into a real array, runs the r2c transform, multiplies by the filter's
+ *     spectrum (converted to the precision once), runs the c2r transform and crops and scales the result
+ *   - the cosine engine runs a (batched) r2c/c2r pair on a copy of the input, as nd_cosine_ffts and the sweep do
+ *
+ * Everything the callers see is double: the inputs are converted when they are copied in and the outputs when they
+ * are copied out, so the outputs of every precision can be compared with the double engine's (see precision.c).
+ */
+#ifndef PRECISION_ENGINE
+#error "precision_engine.c is included by precision_<precision>.c, which selects the precision"
+#endif
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "precision.h"
+
+#if defined(PRECISION_SINGLE)
+typedef float real;
+#define FFTW(name) fftwf_##name
+#define PRECISION_NAME "single"
+#define PRECISION_PREFIX "fftwf_"
+#define PRECISION_EPSILON FLT_EPSILON
+#elif defined(PRECISION_LONG_DOUBLE)
+typedef long double real;
+#define FFTW(name) fftwl_##name
+#define PRECISION_NAME "long-double"
+#define PRECISION_PREFIX "fftwl_"
+#define PRECISION_EPSILON LDBL_EPSILON
+#elif defined(PRECISION_QUAD)
+typedef __float128 real;
+#define FFTW(name) fftwq_##name
+#define PRECISION_NAME "quad"
+#define PRECISION_PREFIX "fftwq_"
+#define PRECISION_EPSILON 1.92592994438723585305597794258492732e-34 //FLT128_EPSILON, without quadmath.h
+#else
+typedef double real;
+#define FFTW(name) fftw_##name
+#define PRECISION_NAME "double"
+#define PRECISION_PREFIX "fftw_"
+#define PRECISION_EPSILON DBL_EPSILON
+#endif
+
+typedef FFTW(complex) complex_real;
+
+static bool threads_started = false;
+
+static void init_threads(void){
+    if (!threads_started)
+        FFTW(init_threads)();
+    threads_started = true;
+}
+
+static void cleanup_threads(void){
+    if (threads_started)
+        FFTW(cleanup_threads)();
+    threads_started = false;
+}
+
+static void count_plan(flop_count *count, const FFTW(plan) plan, int rank, const int *n, int howmany, int executions){
+    double add, mul, fma;
+    FFTW(flops)(plan, &add, &mul, &fma);
+    flop_count_real_ops(count, add, mul, fma, sizeof(real), rank, n, howmany, executions);
+}
+
+static bool blur(const precision_blur_job *job, precision_timings *timings){
+/* Blurs the job's channels 'iterations' times. Returns false if out of memory or FFTW can't plan */
+    int ph = job->padded_height, pw = job->padded_width, cw = pw/2 + 1;
+    int n[2] = {ph, pw};
+    size_t real_size = (size_t)ph * pw, complex_size = (size_t)ph * cw, i;
+    int c, k, x, y;
+
+    memset(timings, 0, sizeof(precision_timings));
+    real *in = FFTW(malloc)(real_size * sizeof(real));
+    complex_real *spectrum = FFTW(malloc)(complex_size * sizeof(complex_real));
+    complex_real *filter = FFTW(malloc)(complex_size * sizeof(complex_real));
+    real *back = FFTW(malloc)(real_size * sizeof(real));
+    if (!in || !spectrum || !filter || !back){
+        FFTW(free)(in);
+        FFTW(free)(spectrum);
+        FFTW(free)(filter);
+        FFTW(free)(back);
+        return false;
+    }
+    for (i=0; i<complex_size; i++){
+        filter[i][0] = (real)job->filter[i][0];
+        filter[i][1] = (real)job->filter[i][1];
+    }
+
+    FFTW(plan_with_nthreads)(job->nthreads);
+    uint64_t plan_start = timing_now();
+    FFTW(plan) forward = FFTW(plan_dft_r2c_2d)(ph, pw, in, spectrum, job->flags);
+    FFTW(plan) backward = FFTW(plan_dft_c2r_2d)(ph, pw, spectrum, back, job->flags);
+    timings->plan_time = timing_elapsed(plan_start, timing_now());
+    if (!forward || !backward){
+        if (forward)
+            FFTW(destroy_plan)(forward);
+        if (backward)
+            FFTW(destroy_plan)(backward);
+        FFTW(free)(in);
+        FFTW(free)(spectrum);
+        FFTW(free)(filter);
+        FFTW(free)(back);
+        return false;
+    }
+
+    real scale = (real)1 / (real)real_size; //FFTW's transforms are unnormalized
+    for (k=0; k<job->iterations; k++){
+        uint64_t image_start = timing_now();
+        for (c=0; c<3; c++){
+            uint64_t copy_start = timing_now();
+            for (y=0; y<ph; y++){
+                for (x=0; x<pw; x++)
+                    in[(size_t)y*pw + x] = (y < job->height && x < job->width) ? (real)job->channels[c][(size_t)y*job->width + x] : (real)0;
+            }
+            uint64_t forward_start = timing_now();
+            FFTW(execute)(forward);
+            uint64_t multiply_start = timing_now();
+            for (i=0; i<complex_size; i++){
+                real re = spectrum[i][0] * filter[i][0] - spectrum[i][1] * filter[i][1];
+                real im = spectrum[i][0] * filter[i][1] + spectrum[i][1] * filter[i][0];
+                spectrum[i][0] = re;
+                spectrum[i][1] = im;
+            }
+            uint64_t backward_start = timing_now();
+            FFTW(execute)(backward);
+            uint64_t backward_stop = timing_now();
+
+            timings->copy_time += timing_elapsed(copy_start, forward_start);
+            timings->forward_time += timing_elapsed(forward_start, multiply_start);
+            timings->multiply_time += timing_elapsed(multiply_start, backward_start);
+            timings->backward_time += timing_elapsed(backward_start, backward_stop);
+            if (k == job->iterations-1){
+                for (y=0; y<job->height; y++)
+                    for (x=0; x<job->width; x++)
+                        job->out[c][(size_t)y*job->width + x] = (double)(back[(size_t)y*pw + x] * scale);
+            }
+        }
+        if (job->latency)
+            latency_histogram_record(job->latency, timing_elapsed(image_start, timing_now()));
+    }
+    count_plan(&timings->forward_count, forward, 2, n, 1, 3 * job->iterations);
+    count_plan(&timings->backward_count, backward, 2, n, 1, 3 * job->iterations);
+
+    FFTW(destroy_plan)(forward);
+    FFTW(destroy_plan)(backward);
+    FFTW(free)(in);
+    FFTW(free)(spectrum);
+    FFTW(free)(filter);
+    FFTW(free)(back);
+    return true;
+}
+
+static bool cosine(const precision_cosine_job *job, precision_timings *timings){
+/* Runs 'warmup' untimed and 'iterations' timed forward + backward executions of the job's shape. Returns false if
+ * out of memory or FFTW can't plan */
+    size_t real_size = 1, complex_size, i;
+    int d, b, k;
+    int stride = job->interleaved ? job->howmany : 1;
+
+    memset(timings, 0, sizeof(precision_timings));
+    for (d=0; d<job->rank; d++)
+        real_size *= job->n[d];
+    complex_size = real_size / job->n[job->rank-1] * (job->n[job->rank-1]/2 + 1);
+
+    real *in = FFTW(malloc)(real_size * job->howmany * sizeof(real));
+    complex_real *out = FFTW(malloc)(complex_size * job->howmany * sizeof(complex_real));
+    real *back = FFTW(malloc)(real_size * job->howmany * sizeof(real));
+    if (!in || !out || !back){
+        FFTW(free)(in);
+        FFTW(free)(out);
+        FFTW(free)(back);
+        return false;
+    }
+
+    FFTW(plan_with_nthreads)(job->nthreads);
+    uint64_t plan_start = timing_now();
+    int real_dist = job->interleaved ? 1 : (int)real_size, complex_dist = job->interleaved ? 1 : (int)complex_size;
+    FFTW(plan) forward = FFTW(plan_many_dft_r2c)(job->rank, job->n, job->howmany, in, NULL, stride, real_dist, out, NULL, stride, complex_dist, job->flags);
+    FFTW(plan) backward = FFTW(plan_many_dft_c2r)(job->rank, job->n, job->howmany, out, NULL, stride, complex_dist, back, NULL, stride, real_dist, job->flags);
+    timings->plan_time = timing_elapsed(plan_start, timing_now());
+    if (!forward || !backward){
+        if (forward)
+            FFTW(destroy_plan)(forward);
+        if (backward)
+            FFTW(destroy_plan)(backward);
+        FFTW(free)(in);
+        FFTW(free)(out);
+        FFTW(free)(back);
+        return false;
+    }
+
+    // Planning may have overwritten the input, so it is copied in afterwards
+    for (b=0; b<job->howmany; b++)
+        for (i=0; i<real_size; i++)
+            in[i*stride + (size_t)b*real_dist] = (real)job->input[i];
+
+    for (k=0; k<job->warmup + job->iterations; k++){
+        uint64_t forward_start = timing_now();
+        FFTW(execute)(forward);
+        uint64_t forward_stop = timing_now();
+        FFTW(execute)(backward);
+        uint64_t backward_stop = timing_now();
+
+        if (job->latency){
+            latency_histogram_record(&job->latency[0], timing_elapsed(forward_start, forward_stop));
+            latency_histogram_record(&job->latency[1], timing_elapsed(forward_stop, backward_stop));
+            latency_histogram_record(&job->latency[2], timing_elapsed(forward_start, backward_stop));
+        }
+        if (k < job->warmup)
+            continue;
+        timings->forward_time += timing_elapsed(forward_start, forward_stop);
+        timings->backward_time += timing_elapsed(forward_stop, backward_stop);
+    }
+    count_plan(&timings->forward_count, forward, job->rank, job->n, job->howmany, job->iterations);
+    count_plan(&timings->backward_count, backward, job->rank, job->n, job->howmany, job->iterations);
+
+    // An out-of-place c2r may overwrite its input unless FFTW_PRESERVE_INPUT is given, so the backward transforms
+    // above may have clobbered the spectrum: it is taken from one more forward execution
+    FFTW(execute)(forward);
+    if (job->spectrum){
+        for (i=0; i<complex_size; i++){
+            job->spectrum[i][0] = (double)out[i*stride][0];
+            job->spectrum[i][1] = (double)out[i*stride][1];
+        }
+    }
+    if (job->back){
+        real scale = (real)1 / (real)real_size;
+        for (i=0; i<real_size; i++)
+            job->back[i] = (double)(back[i*stride] * scale);
+    }
+
+    FFTW(destroy_plan)(forward);
+    FFTW(destroy_plan)(backward);
+    FFTW(free)(in);
+    FFTW(free)(out);
+    FFTW(free)(back);
+    return true;
+}
+
+const precision_engine PRECISION_ENGINE = {
+    PRECISION_NAME,
+    PRECISION_PREFIX,
+    sizeof(real),
+    (double)PRECISION_EPSILON,
+    init_threads,
+    cleanup_threads,
+    blur,
+    cosine
+};
@@ -0,0 +1,4 @@
+/* The precision engines built against FFTW's long double API (see precision_engine.c) */
+#define PRECISION_LONG_DOUBLE
+#define PRECISION_ENGINE precision_engine_long_double
+#include "precision_engine.c"
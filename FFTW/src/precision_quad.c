@@ -0,0 +1,4 @@
+/* The precision engines built against FFTW's quad API (see precision_engine.c) */
+#define PRECISION_QUAD
+#define PRECISION_ENGINE precision_engine_quad
+#include "precision_engine.c"
@@ -0,0 +1,4 @@
+/* The precision engines built against FFTW's single API (see precision_engine.c) */
+#define PRECISION_SINGLE
+#define PRECISION_ENGINE precision_engine_single
+#include "precision_engine.c"
@@ -0,0 +1,361 @@
+/* Results sink for the benchmarks
+ *
+ * Every run used to re-read the whole results document, copy it line by line into tmp.json (in the working directory)
+ * and rename it over the original, so a run cost O(history), lines over 4 KB were split, and concurrent runs sharing
+ * tmp.json or the results file clobbered each other. Now every run is one JSON record on one line (JSONL), written
+ * with a single write() on a file opened with O_APPEND. The kernel appends each write() as a unit, so concurrent runs
+ * can share a results file, and a run costs the same whatever the history.
+ *
+ * The programs still write their results with fprintf(), pretty-printed, into a memory stream. results_end() squeezes
+ * out the whitespace outside strings to get the record onto one line.
+ *
+ * With a CSV path, the record is also flattened into long-format rows (record, program, metric, value), one per leaf
+ * of the JSON record, with the metric named by its path (e.g. "performance_results.latency.phases.forward.p99_seconds").
+ * The columns never change whichever engine or options a run used, so a sweep's runs can be appended to one file and
+ * pivoted into a table afterwards.
+ *
+ * Every record starts with the metadata needed to compare runs across machines: host, kernel, CPU model and ISA, FFTW
+ * version and build flags, compiler, the git commit the benchmarks were built from and the command line.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+#include <fftw3.h>
+#include "results.h"
+#include "wisdom.h"
+
+// Configure flags FFTW was built with, and the commit the benchmarks were built from (compile_benchmark_code.sh)
+#ifndef FFTW_BUILD_FLAGS
+#define FFTW_BUILD_FLAGS "unknown"
+#endif
+#ifndef GIT_SHA
+#define GIT_SHA "unknown"
+#endif
+
+#define CSV_HEADER "record,program,metric,value\n"
+#define METRIC_SIZE 1024
+
+static const char *program_name = "unknown";
+static const char *csv_file = NULL;
+static int arg_count = 0;
+static char **arg_values = NULL;
+
+void results_init(const char *program, int argc, char **argv, const char *csv_path){
+/* Called once, from main(): what the records are tagged with, and where (if anywhere) they are exported to as CSV */
+    program_name = program;
+    arg_count = argc;
+    arg_values = argv;
+    csv_file = csv_path;
+}
+
+void results_json_string(FILE *f, const char *str){
+/* Writes a quoted JSON string */
+    fputc('"', f);
+    for (; *str; str++){
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            fputc(c, f);
+    }
+    fputc('"', f);
+}
+
+static void write_metadata(FILE *f){
+    char host[256] = "unknown", cpu_model[256], isa[128];
+    struct utsname system;
+    int i;
+
+    gethostname(host, sizeof(host));
+    host[sizeof(host)-1] = '\0';
+    get_cpu_model(cpu_model, sizeof(cpu_model));
+    get_isa_flags(isa, sizeof(isa));
+
+    fprintf(f, "    \"metadata\": {\n");
+    fprintf(f, "        \"host\": ");
+    results_json_string(f, host);
+    fprintf(f, ",\n");
+    if (uname(&system) == 0){
+        fprintf(f, "        \"kernel\": ");
+        results_json_string(f, system.release);
+        fprintf(f, ",\n");
+    }
+    fprintf(f, "        \"cpu_model\": ");
+    results_json_string(f, cpu_model);
+    fprintf(f, ",\n");
+    fprintf(f, "        \"isa\": \"%s\",\n", isa);
+    fprintf(f, "        \"online_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(f, "        \"fftw_version\": ");
+    results_json_string(f, fftw_version);
+    fprintf(f, ",\n");
+    fprintf(f, "        \"fftw_compiler\": ");
+    results_json_string(f, fftw_cc);
+    fprintf(f, ",\n");
+    fprintf(f, "        \"fftw_build_flags\": ");
+    results_json_string(f, FFTW_BUILD_FLAGS);
+    fprintf(f, ",\n");
+    fprintf(f, "        \"compiler\": ");
+    results_json_string(f, __VERSION__);
+    fprintf(f, ",\n");
+    fprintf(f, "        \"git_sha\": ");
+    results_json_string(f, GIT_SHA);
+    fprintf(f, ",\n");
+    fprintf(f, "        \"command_line\": [");
+    for (i=0; i<arg_count; i++){
+        fprintf(f, "%s", (i == 0) ? "" : ", ");
+        results_json_string(f, arg_values[i]);
+    }
+    fprintf(f, "]\n");
+    fprintf(f, "    },\n");
+}
+
+FILE *results_begin(results_record *record, const char *path){
+/* Opens a new record in memory, with its timestamp and metadata already written. The caller writes the rest of the
+ * record's fields (starting with a comma-free '"name": value' line) and then calls results_end() */
+    char host[64] = "unknown";
+    char timestamp[32];
+    time_t raw_time = time(NULL);
+    struct tm timeinfo;
+
+    memset(record, 0, sizeof(results_record));
+    record->path = path;
+    record->stream = open_memstream(&record->buffer, &record->size);
+    if (!record->stream){
+        printf("Could not allocate the results record. Exiting.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    gmtime_r(&raw_time, &timeinfo);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &timeinfo);
+    gethostname(host, sizeof(host));
+    host[sizeof(host)-1] = '\0';
+    snprintf(record->id, sizeof(record->id), "%s/%s/%d", timestamp, host, (int)getpid());
+
+    fprintf(record->stream, "{\n");
+    fprintf(record->stream, "    \"timestamp\": \"%s\",\n", timestamp);
+    fprintf(record->stream, "    \"program\": \"%s\",\n", program_name);
+    write_metadata(record->stream);
+    return record->stream;
+}
+
+static size_t compact_json(char *json, size_t size){
+/* Drops the whitespace outside strings, in place. Returns the new size */
+    size_t in, out = 0;
+    bool in_string = false, escaped = false;
+    for (in=0; in<size; in++){
+        char c = json[in];
+        if (in_string){
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = true;
+            else if (c == '"')
+                in_string = false;
+        }
+        else if (c == '"')
+            in_string = true;
+        else if (isspace((unsigned char)c))
+            continue;
+        json[out++] = c;
+    }
+    return out;
+}
+
+static bool append(const char *path, const char *data, size_t size, const char *header){
+/* Appends 'data' to 'path' with one write(). If the file is new, 'header' (if any) goes in front of the data */
+    bool created = false;
+    int fd = -1;
+    if (header){
+        fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_EXCL, 0644);
+        created = (fd >= 0);
+    }
+    if (fd < 0)
+        fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0){
+        printf("  WARNING: Could not open %s (%s). The results were not saved.\n", path, strerror(errno));
+        return false;
+    }
+
+    char *joined = NULL;
+    if (created){
+        size_t header_size = strlen(header);
+        joined = malloc(header_size + size);
+        if (joined){
+            memcpy(joined, header, header_size);
+            memcpy(joined + header_size, data, size);
+            data = joined;
+            size += header_size;
+        }
+    }
+
+    // A regular file's write() only comes back short on errors (disk full, signals), which we report
+    size_t written = 0;
+    while (written < size){
+        ssize_t n = write(fd, data + written, size - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        written += (size_t)n;
+    }
+    free(joined);
+    close(fd);
+
+    if (written < size){
+        printf("  WARNING: Could not write the results to %s (%s).\n", path, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Long-format CSV
+ */
+
+typedef struct {
+    const char *json;
+    size_t pos, size;
+    char metric[METRIC_SIZE];
+    FILE *rows;
+    const char *id;
+} flattener;
+
+static void csv_field(FILE *f, const char *str, size_t length){
+/* Writes a field, quoted if it needs to be */
+    size_t i;
+    bool quote = false;
+    for (i=0; i<length; i++)
+        if (str[i] == ',' || str[i] == '"' || str[i] == '\n')
+            quote = true;
+    if (!quote){
+        fwrite(str, 1, length, f);
+        return;
+    }
+    fputc('"', f);
+    for (i=0; i<length; i++){
+        if (str[i] == '"')
+            fputc('"', f);
+        fputc(str[i], f);
+    }
+    fputc('"', f);
+}
+
+static size_t string_end(const flattener *fl, size_t start){
+/* Index of the closing quote of the string whose opening quote is at 'start' */
+    size_t i;
+    for (i=start+1; i<fl->size; i++){
+        if (fl->json[i] == '\\')
+            i++;
+        else if (fl->json[i] == '"')
+            return i;
+    }
+    return fl->size;
+}
+
+static void flatten_value(flattener *fl);
+
+static void flatten_child(flattener *fl, const char *name, size_t length){
+/* Flattens the value at the current position, named 'metric.name' */
+    size_t parent = strlen(fl->metric);
+    if (parent + length + 2 < METRIC_SIZE){
+        if (parent > 0)
+            fl->metric[parent] = '.';
+        memcpy(fl->metric + parent + (parent > 0), name, length);
+        fl->metric[parent + (parent > 0) + length] = '\0';
+    }
+    flatten_value(fl);
+    fl->metric[parent] = '\0';
+}
+
+static void flatten_value(flattener *fl){
+/* Emits one row per scalar in the (compacted) JSON value at the current position */
+    if (fl->pos >= fl->size)
+        return;
+
+    char c = fl->json[fl->pos];
+    if (c == '{' || c == '['){
+        int index = 0;
+        fl->pos++;
+        while (fl->pos < fl->size && fl->json[fl->pos] != '}' && fl->json[fl->pos] != ']'){
+            if (c == '{'){
+                size_t end = string_end(fl, fl->pos);
+                const char *name = fl->json + fl->pos + 1;
+                size_t length = end - fl->pos - 1;
+                fl->pos = end + 2; //skip the closing quote and the colon
+                flatten_child(fl, name, length);
+            }
+            else{
+                char name[16];
+                snprintf(name, sizeof(name), "%d", index++);
+                flatten_child(fl, name, strlen(name));
+            }
+            if (fl->pos < fl->size && fl->json[fl->pos] == ',')
+                fl->pos++;
+        }
+        fl->pos++;
+        return;
+    }
+
+    // A scalar: a string (written without its quotes and escapes kept as they are), a number, true, false or null
+    size_t start = fl->pos, end;
+    if (c == '"'){
+        end = string_end(fl, start);
+        fl->pos = end + 1;
+        start++;
+    }
+    else{
+        for (end=start; end<fl->size && fl->json[end] != ',' && fl->json[end] != '}' && fl->json[end] != ']'; end++);
+        fl->pos = end;
+    }
+    csv_field(fl->rows, fl->id, strlen(fl->id));
+    fputc(',', fl->rows);
+    csv_field(fl->rows, program_name, strlen(program_name));
+    fputc(',', fl->rows);
+    csv_field(fl->rows, fl->metric, strlen(fl->metric));
+    fputc(',', fl->rows);
+    csv_field(fl->rows, fl->json + start, end - start);
+    fputc('\n', fl->rows);
+}
+
+static bool export_csv(const results_record *record, const char *json, size_t size){
+    char *rows = NULL;
+    size_t rows_size = 0;
+    flattener fl = {.json = json, .pos = 0, .size = size, .id = record->id};
+    fl.metric[0] = '\0';
+    fl.rows = open_memstream(&rows, &rows_size);
+    if (!fl.rows)
+        return false;
+    flatten_value(&fl);
+    fclose(fl.rows);
+
+    bool saved = append(csv_file, rows, rows_size, CSV_HEADER);
+    free(rows);
+    return saved;
+}
+
+bool results_end(results_record *record){
+/* Closes the record, appends it to the JSONL file as one line (and to the CSV file as rows) and frees it */
+    fprintf(record->stream, "}\n");
+    fclose(record->stream);
+
+    size_t size = compact_json(record->buffer, record->size);
+    bool saved = true;
+    if (csv_file)
+        saved = export_csv(record, record->buffer, size);
+    record->buffer[size++] = '\n'; //there is room: at least the closing brace's newline was dropped
+    saved = append(record->path, record->buffer, size, NULL) && saved;
+
+    free(record->buffer);
+    record->buffer = NULL;
+    record->stream = NULL;
+    return saved;
+}
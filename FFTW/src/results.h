@@ -0,0 +1,23 @@
+/* Results sink: one JSON record per run, appended atomically to a JSONL file (and optionally to a long-format CSV) */
+#ifndef RESULTS_H
+#define RESULTS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stddef.h>
+
+typedef struct {
+    FILE *stream;      //the caller writes the record's fields here, between results_begin() and results_end()
+    char *buffer;      //what has been written to 'stream' so far
+    size_t size;
+    const char *path;  //JSONL file the record is appended to
+    char id[128];      //identifies the record in the CSV rows: timestamp, host and process id
+} results_record;
+
+void results_init(const char *program, int argc, char **argv, const char *csv_path);
+FILE *results_begin(results_record *record, const char *path);
+bool results_end(results_record *record);
+
+void results_json_string(FILE *f, const char *str);
+
+#endif
@@ -0,0 +1,167 @@
+/* Bounded lock-free ring buffer
+ *
+ * This is the classic bounded MPMC queue: every cell carries a sequence number that tells producers and consumers
+ * whether the cell is free for the current lap of the ring, so pushing and popping only take one compare-and-swap
+ * on the enqueue/dequeue position. When the ring is full, ring_buffer_push() waits for a consumer to catch up,
+ * which is what gives the pipeline its backpressure: a fast stage can never run more than 'capacity' items ahead
+ * of the stage after it.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include "ring_buffer.h"
+
+static void backoff(unsigned *spins){
+/* Spins a little, then yields, then sleeps, so that waiting threads don't steal cores from the busy stages */
+    if (*spins < 64)
+        ;
+    else if (*spins < 128)
+        sched_yield();
+    else{
+        struct timespec pause = {0, 50000}; //50 us
+        nanosleep(&pause, NULL);
+    }
+    (*spins)++;
+}
+
+bool ring_buffer_init(ring_buffer *ring, size_t capacity){
+/* Creates an empty ring with room for at least 'capacity' items (rounded up to a power of two) */
+    size_t i, size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    ring->cells = malloc(size * sizeof(ring_cell));
+    if (!ring->cells)
+        return false;
+    for (i=0; i<size; i++){
+        atomic_init(&ring->cells[i].sequence, i);
+        ring->cells[i].item = NULL;
+    }
+
+    ring->capacity = size;
+    ring->mask = size - 1;
+    atomic_init(&ring->enqueue_pos, 0);
+    atomic_init(&ring->dequeue_pos, 0);
+    atomic_init(&ring->closed, false);
+    atomic_init(&ring->pushes, 0);
+    atomic_init(&ring->occupancy_sum, 0);
+    atomic_init(&ring->max_occupancy, 0);
+    atomic_init(&ring->full_stalls, 0);
+    atomic_init(&ring->empty_stalls, 0);
+
+    return true;
+}
+
+void ring_buffer_destroy(ring_buffer *ring){
+    free(ring->cells);
+    ring->cells = NULL;
+}
+
+size_t ring_buffer_size(ring_buffer *ring){
+/* Number of queued items (approximate while other threads are pushing or popping) */
+    size_t enqueued = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    size_t dequeued = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    return (enqueued > dequeued) ? enqueued - dequeued : 0;
+}
+
+static void record_occupancy(ring_buffer *ring){
+    size_t occupancy = ring_buffer_size(ring);
+    size_t max = atomic_load_explicit(&ring->max_occupancy, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&ring->pushes, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ring->occupancy_sum, occupancy, memory_order_relaxed);
+    while (occupancy > max && !atomic_compare_exchange_weak_explicit(&ring->max_occupancy, &max, occupancy, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+bool ring_buffer_try_push(ring_buffer *ring, void *item){
+/* Adds an item without waiting. Returns false if the ring is full */
+    size_t pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    ring_cell *cell;
+
+    for (;;){
+        cell = &ring->cells[pos & ring->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        if (sequence == pos){
+            // The cell is free for this lap: claim it
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (sequence < pos)
+            return false; //the cell still holds last lap's item, so the ring is full
+        else
+            pos = atomic_load_explicit(&ring->enqueue_pos, memory_order_relaxed);
+    }
+
+    cell->item = item;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    record_occupancy(ring);
+    return true;
+}
+
+bool ring_buffer_try_pop(ring_buffer *ring, void **item){
+/* Removes the oldest item without waiting. Returns false if the ring is empty */
+    size_t pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    ring_cell *cell;
+
+    for (;;){
+        cell = &ring->cells[pos & ring->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        if (sequence == pos + 1){
+            // The cell holds an item for this lap: claim it
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (sequence < pos + 1)
+            return false; //nothing has been pushed into this cell yet, so the ring is empty
+        else
+            pos = atomic_load_explicit(&ring->dequeue_pos, memory_order_relaxed);
+    }
+
+    *item = cell->item;
+    atomic_store_explicit(&cell->sequence, pos + ring->mask + 1, memory_order_release);
+    return true;
+}
+
+void ring_buffer_push(ring_buffer *ring, void *item){
+/* Adds an item, waiting for room if the ring is full */
+    unsigned spins = 0;
+    if (ring_buffer_try_push(ring, item))
+        return;
+
+    atomic_fetch_add_explicit(&ring->full_stalls, 1, memory_order_relaxed);
+    while (!ring_buffer_try_push(ring, item))
+        backoff(&spins);
+}
+
+bool ring_buffer_pop(ring_buffer *ring, void **item){
+/* Removes the oldest item, waiting for one if the ring is empty. Returns false once the ring is closed and empty */
+    unsigned spins = 0;
+    bool stalled = false;
+
+    for (;;){
+        if (ring_buffer_try_pop(ring, item))
+            return true;
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire)){
+            // Items pushed before the ring was closed are still delivered
+            return ring_buffer_try_pop(ring, item);
+        }
+        if (!stalled){
+            atomic_fetch_add_explicit(&ring->empty_stalls, 1, memory_order_relaxed);
+            stalled = true;
+        }
+        backoff(&spins);
+    }
+}
+
+void ring_buffer_close(ring_buffer *ring){
+/* Tells the consumers that no more items are coming */
+    atomic_store_explicit(&ring->closed, true, memory_order_release);
+}
+
+double ring_buffer_average_occupancy(ring_buffer *ring){
+/* Average number of queued items right after a push */
+    unsigned long pushes = atomic_load(&ring->pushes);
+    return (pushes > 0) ? (double)atomic_load(&ring->occupancy_sum) / pushes : 0.0;
+}
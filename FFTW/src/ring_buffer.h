@@ -0,0 +1,42 @@
+/* Bounded lock-free multi-producer/multi-consumer ring buffer of pointers, used between pipeline stages */
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+typedef struct {
+    atomic_size_t sequence; //which lap of the ring this cell is ready for
+    void *item;
+} ring_cell;
+
+typedef struct {
+    ring_cell *cells;
+    size_t capacity;  //power of two
+    size_t mask;      //capacity - 1
+    atomic_size_t enqueue_pos;
+    atomic_size_t dequeue_pos;
+    atomic_bool closed; //no more items will be pushed
+
+    // Statistics
+    atomic_ulong pushes;
+    atomic_ulong occupancy_sum;  //sum of the number of queued items seen after each push
+    atomic_size_t max_occupancy;
+    atomic_ulong full_stalls;    //times a producer had to wait because the ring was full (backpressure)
+    atomic_ulong empty_stalls;   //times a consumer had to wait because the ring was empty
+} ring_buffer;
+
+bool ring_buffer_init(ring_buffer *ring, size_t capacity);
+void ring_buffer_destroy(ring_buffer *ring);
+
+bool ring_buffer_try_push(ring_buffer *ring, void *item);
+bool ring_buffer_try_pop(ring_buffer *ring, void **item);
+void ring_buffer_push(ring_buffer *ring, void *item);
+bool ring_buffer_pop(ring_buffer *ring, void **item);
+void ring_buffer_close(ring_buffer *ring);
+
+size_t ring_buffer_size(ring_buffer *ring);
+double ring_buffer_average_occupancy(ring_buffer *ring);
+
+#endif
@@ -0,0 +1,281 @@
+/* Input signals for the ND benchmarks
+ *
+ * The array is cut into blocks of SIGNAL_BLOCK samples, which are spread over OpenMP threads. Every sample depends
+ * only on its index (and the seed), never on which thread or block produced it, so an input is the same for any
+ * thread count and can be regenerated from its kind, fs and seed alone.
+ *
+ *   - cosine: calling cos() for every sample costs more than the transforms of a large array, so each block only
+ *     calls cos() and sin() for its first SIGNAL_LANES samples (the lanes). Every lane then steps SIGNAL_LANES samples
+ *     at a time by rotating its phasor (cos, sin) with a complex multiply:
+ *
+ *         (cos, sin)(x + L d) = (cos(x) cos(L d) - sin(x) sin(L d), sin(x) cos(L d) + cos(x) sin(L d))
+ *
+ *   - chirp: the same, with a phase that grows quadratically, so that the phase increment per sample sweeps from 0 to
+ *     fs pi over the whole array. The rotation of each lane is itself rotated after every step.
+ *   - noise: splitmix64 of the seed and the sample's index, scaled to [-1, 1).
+ *
+ * The lanes are independent, so the rotations are vectorized with AVX2 or AVX-512 (see simd.c). The kernels don't use
+ * FMA, so every level rounds exactly like the portable one. Restarting from cos() every block keeps the rotations'
+ * error within a few hundred ulps.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "signal_gen.h"
+
+#define PI 3.14159265358979323846
+#define SIGNAL_BLOCK 4096 //samples per block (restarts the rotation, and is the unit of work of the threads)
+#define SIGNAL_LANES 8    //samples rotated side by side
+
+/*
+ * Rotation kernels: writes 'count' rounded down to SIGNAL_LANES samples, the real parts of the lanes' phasors (pc, ps).
+ * After every SIGNAL_LANES samples, each phasor is rotated by its lane's rotor (qc, qs), and each rotor by (wc, ws).
+ * Leaves the next phasors and rotors in the lane arrays and returns the number of samples written
+ */
+
+static size_t rotate_generic(double *out, size_t count, double *pc, double *ps, double *qc, double *qs, double wc, double ws){
+    size_t i;
+    int l;
+    double next;
+    for (i=0; i+SIGNAL_LANES<=count; i+=SIGNAL_LANES){
+        for (l=0; l<SIGNAL_LANES; l++){
+            out[i+l] = pc[l];
+            next = pc[l]*qc[l] - ps[l]*qs[l];
+            ps[l] = ps[l]*qc[l] + pc[l]*qs[l];
+            pc[l] = next;
+            next = qc[l]*wc - qs[l]*ws;
+            qs[l] = qs[l]*wc + qc[l]*ws;
+            qc[l] = next;
+        }
+    }
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static inline void rotate_pair_avx2(__m256d *c, __m256d *s, __m256d rc, __m256d rs){
+    __m256d next = _mm256_sub_pd(_mm256_mul_pd(*c, rc), _mm256_mul_pd(*s, rs));
+    *s = _mm256_add_pd(_mm256_mul_pd(*s, rc), _mm256_mul_pd(*c, rs));
+    *c = next;
+}
+
+__attribute__((target("avx2")))
+static size_t rotate_avx2(double *out, size_t count, double *pc, double *ps, double *qc, double *qs, double wc, double ws){
+    size_t i;
+    __m256d vwc = _mm256_set1_pd(wc), vws = _mm256_set1_pd(ws);
+    __m256d pc0 = _mm256_loadu_pd(pc), pc1 = _mm256_loadu_pd(pc + 4), ps0 = _mm256_loadu_pd(ps), ps1 = _mm256_loadu_pd(ps + 4);
+    __m256d qc0 = _mm256_loadu_pd(qc), qc1 = _mm256_loadu_pd(qc + 4), qs0 = _mm256_loadu_pd(qs), qs1 = _mm256_loadu_pd(qs + 4);
+    for (i=0; i+SIGNAL_LANES<=count; i+=SIGNAL_LANES){
+        _mm256_storeu_pd(out + i, pc0);
+        _mm256_storeu_pd(out + i + 4, pc1);
+        rotate_pair_avx2(&pc0, &ps0, qc0, qs0);
+        rotate_pair_avx2(&pc1, &ps1, qc1, qs1);
+        rotate_pair_avx2(&qc0, &qs0, vwc, vws);
+        rotate_pair_avx2(&qc1, &qs1, vwc, vws);
+    }
+    _mm256_storeu_pd(pc, pc0);
+    _mm256_storeu_pd(pc + 4, pc1);
+    _mm256_storeu_pd(ps, ps0);
+    _mm256_storeu_pd(ps + 4, ps1);
+    _mm256_storeu_pd(qc, qc0);
+    _mm256_storeu_pd(qc + 4, qc1);
+    _mm256_storeu_pd(qs, qs0);
+    _mm256_storeu_pd(qs + 4, qs1);
+    _mm256_zeroupper(); //-O doesn't emit it, and the cos() calls that follow are SSE
+    return i;
+}
+
+__attribute__((target("avx512f")))
+static inline void rotate_pair_avx512(__m512d *c, __m512d *s, __m512d rc, __m512d rs){
+    __m512d next = _mm512_sub_pd(_mm512_mul_pd(*c, rc), _mm512_mul_pd(*s, rs));
+    *s = _mm512_add_pd(_mm512_mul_pd(*s, rc), _mm512_mul_pd(*c, rs));
+    *c = next;
+}
+
+__attribute__((target("avx512f")))
+static size_t rotate_avx512(double *out, size_t count, double *pc, double *ps, double *qc, double *qs, double wc, double ws){
+    size_t i;
+    __m512d vwc = _mm512_set1_pd(wc), vws = _mm512_set1_pd(ws);
+    __m512d vpc = _mm512_loadu_pd(pc), vps = _mm512_loadu_pd(ps), vqc = _mm512_loadu_pd(qc), vqs = _mm512_loadu_pd(qs);
+    for (i=0; i+SIGNAL_LANES<=count; i+=SIGNAL_LANES){
+        _mm512_storeu_pd(out + i, vpc);
+        rotate_pair_avx512(&vpc, &vps, vqc, vqs);
+        rotate_pair_avx512(&vqc, &vqs, vwc, vws);
+    }
+    _mm512_storeu_pd(pc, vpc);
+    _mm512_storeu_pd(ps, vps);
+    _mm512_storeu_pd(qc, vqc);
+    _mm512_storeu_pd(qs, vqs);
+    _mm256_zeroupper();
+    return i;
+}
+#endif
+
+static inline uint64_t splitmix64(uint64_t z){
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+typedef struct {
+    size_t (*rotate)(double*, size_t, double*, double*, double*, double*, double, double);
+    const signal_spec *spec;
+    double *out;         //samples [first, first + count) of a signal of 'total' samples
+    size_t first, count, total;
+    uint64_t seed;       //noise: the seed, mixed
+    double chirp_rate;   //chirp: phase of sample i is chirp_rate i^2
+} signal_job;
+
+static void generate_block(const signal_job *job, size_t block, double *out){
+/* Writes the samples of 'block' (of the whole signal) to 'out' */
+    size_t start = block * SIGNAL_BLOCK, i, done;
+    size_t count = (job->total - start < SIGNAL_BLOCK) ? job->total - start : SIGNAL_BLOCK;
+    double pc[SIGNAL_LANES], ps[SIGNAL_LANES], qc[SIGNAL_LANES], qs[SIGNAL_LANES], wc = 1.0, ws = 0.0, t, phase;
+    int l;
+
+    // Phasors of the block's first SIGNAL_LANES samples, and what rotates them to the next SIGNAL_LANES
+    switch (job->spec->kind){
+        case SIGNAL_COSINE:
+            // A constant rotation by SIGNAL_LANES * fs pi (the rotors are rotated by (1, 0), which is exact)
+            for (l=0; l<SIGNAL_LANES; l++){
+                phase = (double)(start + l) * job->spec->fs * PI; //as the benchmark always computed it
+                pc[l] = cos(phase);
+                ps[l] = sin(phase);
+                qc[l] = cos(SIGNAL_LANES * job->spec->fs * PI);
+                qs[l] = sin(SIGNAL_LANES * job->spec->fs * PI);
+            }
+            break;
+        case SIGNAL_CHIRP:
+            // With phase a t^2, sample t + L is rotated by a (2 t L + L^2) from sample t, and that grows by 2 a L^2
+            for (l=0; l<SIGNAL_LANES; l++){
+                t = (double)(start + l);
+                pc[l] = cos(job->chirp_rate * t * t);
+                ps[l] = sin(job->chirp_rate * t * t);
+                qc[l] = cos(job->chirp_rate * (2.0 * t * SIGNAL_LANES + SIGNAL_LANES * SIGNAL_LANES));
+                qs[l] = sin(job->chirp_rate * (2.0 * t * SIGNAL_LANES + SIGNAL_LANES * SIGNAL_LANES));
+            }
+            wc = cos(2.0 * job->chirp_rate * SIGNAL_LANES * SIGNAL_LANES);
+            ws = sin(2.0 * job->chirp_rate * SIGNAL_LANES * SIGNAL_LANES);
+            break;
+        case SIGNAL_NOISE:
+            for (i=0; i<count; i++)
+                out[i] = (double)(splitmix64(job->seed ^ (start + i)) >> 11) * 0x1.0p-52 - 1.0;
+            return;
+    }
+    done = job->rotate(out, count, pc, ps, qc, qs, wc, ws);
+    for (l=0; done+l<count; l++)
+        out[done+l] = pc[l];
+}
+
+static void generate_range_block(const signal_job *job, size_t block){
+/* Writes the part of 'block' that is in the job's range. A block cut by the range is generated whole and copied, so
+ * that its samples are the same as when the whole signal is generated */
+    size_t start = block * SIGNAL_BLOCK;
+    size_t end = (job->total - start < SIGNAL_BLOCK) ? job->total : start + SIGNAL_BLOCK;
+    size_t from = (start > job->first) ? start : job->first;
+    size_t to = (end < job->first + job->count) ? end : job->first + job->count;
+    double whole[SIGNAL_BLOCK];
+    if (from == start && to == end){
+        generate_block(job, block, job->out + (start - job->first));
+        return;
+    }
+    generate_block(job, block, whole);
+    memcpy(job->out + (from - job->first), whole + (from - start), (to - from) * sizeof(double));
+}
+
+bool parse_signal_kind(const char *name, signal_kind *kind){
+/* Converts "cosine", "noise" or "chirp" into a signal_kind. Returns false if the name is not recognized */
+    if (strcmp(name, "cosine") == 0)
+        *kind = SIGNAL_COSINE;
+    else if (strcmp(name, "noise") == 0)
+        *kind = SIGNAL_NOISE;
+    else if (strcmp(name, "chirp") == 0)
+        *kind = SIGNAL_CHIRP;
+    else
+        return false;
+
+    return true;
+}
+
+const char *signal_kind_name(signal_kind kind){
+    switch (kind){
+        case SIGNAL_NOISE:
+            return "noise";
+        case SIGNAL_CHIRP:
+            return "chirp";
+        default:
+            return "cosine";
+    }
+}
+
+void signal_generate(double *out, size_t count, const signal_spec *spec){
+/* Fills 'out' with 'count' samples of the signal
+ *
+ * Inputs
+ * ======
+ *   double *out
+ *       The array to fill. An ND array is filled in its row-major order, as one long signal
+ *
+ *   size_t count
+ *       Number of samples (i.e., n0*n1*n2*...*nK)
+ *
+ *   const signal_spec *spec
+ *       Kind of signal, its fs (and seed), the vector extension to rotate the cosine with and the number of threads
+ *       to split the blocks across (ignored if built without OpenMP)
+ */
+    signal_generate_range(out, 0, count, count, spec);
+}
+
+void signal_generate_range(double *out, size_t first, size_t count, size_t total, const signal_spec *spec){
+/* Fills 'out' with samples [first, first + count) of a signal of 'total' samples, e.g. one process's slab of a
+ * distributed array. They are the same as the samples signal_generate() gives for the whole signal */
+    signal_job job;
+    memset(&job, 0, sizeof(signal_job));
+    job.spec = spec;
+    job.out = out;
+    job.first = first;
+    job.count = count;
+    job.total = total;
+    job.seed = splitmix64(spec->seed);
+    job.chirp_rate = (total > 1) ? spec->fs * PI / (2.0 * (double)(total - 1)) : 0.0;
+    job.rotate = rotate_generic;
+#if defined(__x86_64__) || defined(__i386__)
+    if (spec->level == SIMD_AVX512)
+        job.rotate = rotate_avx512;
+    else if (spec->level == SIMD_AVX2)
+        job.rotate = rotate_avx2;
+#endif
+    if (count == 0)
+        return;
+
+    size_t block, first_block = first / SIGNAL_BLOCK, end_block = (first + count + SIGNAL_BLOCK - 1) / SIGNAL_BLOCK;
+#pragma omp parallel for num_threads(spec->nthreads) schedule(static)
+    for (block=first_block; block<end_block; block++)
+        generate_range_block(&job, block);
+}
+
+void signal_json(FILE *f, const char *indent, const signal_spec *spec, size_t count, double seconds){
+/* Writes a "signal" object (followed by a comma) for 'count' samples generated in 'seconds' */
+    fprintf(f, "%s\"signal\": {\n", indent);
+    fprintf(f, "%s    \"kind\": \"%s\",\n", indent, signal_kind_name(spec->kind));
+    fprintf(f, "%s    \"seed\": %lu,\n", indent, (unsigned long)spec->seed);
+    fprintf(f, "%s    \"samples\": %zu,\n", indent, count);
+    fprintf(f, "%s    \"bytes\": %zu,\n", indent, count * sizeof(double));
+    fprintf(f, "%s    \"threads\": %d,\n", indent, spec->nthreads);
+    fprintf(f, "%s    \"simd\": \"%s\",\n", indent, simd_level_name(spec->level));
+    fprintf(f, "%s    \"generation_time_seconds\": %0.6f,\n", indent, seconds);
+    fprintf(f, "%s    \"generation_gb_per_second\": %0.3f\n", indent, (seconds > 0.0) ? count * sizeof(double) / seconds * 1e-9 : 0.0);
+    fprintf(f, "%s},\n", indent);
+}
+
+void signal_print(const signal_spec *spec, size_t count, double seconds){
+    printf("    Input: %s", signal_kind_name(spec->kind));
+    if (spec->kind == SIGNAL_NOISE)
+        printf(" (seed %lu)", (unsigned long)spec->seed);
+    printf(", %zu samples (%0.1f MB) generated in %0.3f sec (%0.2f GB/s) on %d thread(s), %s\n", count, count * sizeof(double) / (1024.0 * 1024.0), seconds, (seconds > 0.0) ? count * sizeof(double) / seconds * 1e-9 : 0.0, spec->nthreads, simd_level_name(spec->level));
+}
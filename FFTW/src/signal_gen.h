@@ -0,0 +1,33 @@
+/* Input signals for the ND benchmarks: cosine, noise and chirp, generated in parallel and reproducibly */
+#ifndef SIGNAL_GEN_H
+#define SIGNAL_GEN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "simd.h"
+
+typedef enum {
+    SIGNAL_COSINE, //x[i] = cos(i fs pi), the benchmark's historical input
+    SIGNAL_NOISE,  //uniform in [-1, 1), from a counter-based generator seeded with 'seed'
+    SIGNAL_CHIRP   //phase increment sweeping linearly from 0 to fs pi per sample over the array
+} signal_kind;
+
+typedef struct {
+    signal_kind kind;
+    double fs;
+    uint64_t seed;    //noise only
+    simd_level level; //cosine only
+    int nthreads;
+} signal_spec;
+
+bool parse_signal_kind(const char *name, signal_kind *kind);
+const char *signal_kind_name(signal_kind kind);
+
+void signal_generate(double *out, size_t count, const signal_spec *spec);
+void signal_generate_range(double *out, size_t first, size_t count, size_t total, const signal_spec *spec);
+void signal_json(FILE *f, const char *indent, const signal_spec *spec, size_t count, double seconds);
+void signal_print(const signal_spec *spec, size_t count, double seconds);
+
+#endif
@@ -0,0 +1,46 @@
+/* Runtime detection of the vector extensions used by the hand-vectorized kernels
+ *
+ * The kernels are compiled with target attributes rather than -mavx2/-mavx512f, so one executable runs on every
+ * x86-64 CPU and picks the widest kernel the CPU supports at runtime.
+ */
+#include <string.h>
+#include "simd.h"
+
+simd_level detect_simd_level(void){
+/* Returns the widest vector extension this CPU supports */
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SIMD_AVX2;
+#endif
+    return SIMD_GENERIC;
+}
+
+bool parse_simd_level(const char *name, simd_level *level){
+/* Converts "auto", "avx512", "avx2" or "generic" into a simd_level. Returns false if the name is not recognized */
+    if (strcmp(name, "auto") == 0)
+        *level = detect_simd_level();
+    else if (strcmp(name, "avx512") == 0)
+        *level = SIMD_AVX512;
+    else if (strcmp(name, "avx2") == 0)
+        *level = SIMD_AVX2;
+    else if (strcmp(name, "generic") == 0)
+        *level = SIMD_GENERIC;
+    else
+        return false;
+
+    return true;
+}
+
+const char *simd_level_name(simd_level level){
+    switch (level){
+        case SIMD_AVX512:
+            return "avx512";
+        case SIMD_AVX2:
+            return "avx2";
+        default:
+            return "generic";
+    }
+}
@@ -0,0 +1,17 @@
+/* Runtime detection of the vector extensions used by the hand-vectorized kernels */
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+
+typedef enum {
+    SIMD_GENERIC, //portable C
+    SIMD_AVX2,    //AVX2 + FMA, 4 doubles per instruction
+    SIMD_AVX512   //AVX-512F, 8 doubles per instruction
+} simd_level;
+
+simd_level detect_simd_level(void);
+bool parse_simd_level(const char *name, simd_level *level);
+const char *simd_level_name(simd_level level);
+
+#endif
@@ -0,0 +1,229 @@
+/* Spectral multiply for the image blurring benchmark
+ *
+ * Blurring in the frequency domain is a pointwise complex multiply of every channel's spectrum by the filter's
+ * spectrum. All of the channels are handled in one pass over the filter: each row of the filter is loaded once and
+ * applied to the same row of every channel while it is still in cache. Rows are split across OpenMP threads (or a
+ * thread backend's, see thread_backend.c), and the inner loop is vectorized with AVX2 or AVX-512, whichever the CPU
+ * supports (see simd.c).
+ *
+ * Spectra are stored as FFTW's interleaved (real, imaginary) pairs, so with a = (ar, ai) and f = (fr, fi):
+ *
+ *     a * f = (ar*fr - ai*fi, ai*fr + ar*fi) = fmaddsub((ar, ai), (fr, fr), (ai, ar) * (fi, fi))
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "spectral_multiply.h"
+
+/*
+ * Row kernels: out[i] = in[i] * filter[i] for i in [0, n)
+ * Interleaved kernels: out[i*nplanes + p] = in[i*nplanes + p] * filter[i] for i in [0, n) and p in [0, nplanes)
+ */
+
+static void multiply_row_generic(const double *filter, const double *in, double *out, int n){
+    int i;
+    double ar, ai, fr, fi;
+    for (i=0; i<n; i++){
+        ar = in[2*i]; ai = in[2*i+1];
+        fr = filter[2*i]; fi = filter[2*i+1];
+        out[2*i]   = ar*fr - ai*fi;
+        out[2*i+1] = ai*fr + ar*fi;
+    }
+}
+
+static void multiply_interleaved_generic(const double *filter, const double *in, double *out, int n, int nplanes){
+    int i, p;
+    double ar, ai, fr, fi;
+    for (i=0; i<n; i++){
+        fr = filter[2*i]; fi = filter[2*i+1];
+        for (p=0; p<nplanes; p++){
+            ar = in[2*p]; ai = in[2*p+1];
+            out[2*p]   = ar*fr - ai*fi;
+            out[2*p+1] = ai*fr + ar*fi;
+        }
+        in += 2*nplanes;
+        out += 2*nplanes;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static inline __m256d complex_multiply_avx2(__m256d a, __m256d f){
+    __m256d f_real = _mm256_movedup_pd(f);         //(fr0, fr0, fr1, fr1)
+    __m256d f_imaginary = _mm256_permute_pd(f, 0xF); //(fi0, fi0, fi1, fi1)
+    __m256d a_swapped = _mm256_permute_pd(a, 0x5);   //(ai0, ar0, ai1, ar1)
+    return _mm256_fmaddsub_pd(a, f_real, _mm256_mul_pd(a_swapped, f_imaginary));
+}
+
+__attribute__((target("avx2,fma")))
+static void multiply_row_avx2(const double *filter, const double *in, double *out, int n){
+    int i;
+    for (i=0; i+2<=n; i+=2)
+        _mm256_storeu_pd(out + 2*i, complex_multiply_avx2(_mm256_loadu_pd(in + 2*i), _mm256_loadu_pd(filter + 2*i)));
+    multiply_row_generic(filter + 2*i, in + 2*i, out + 2*i, n - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void multiply_interleaved_avx2(const double *filter, const double *in, double *out, int n, int nplanes){
+    int i, p;
+    double ar, ai;
+    for (i=0; i<n; i++){
+        // Broadcast one filter value across all of the planes
+        __m256d vf = _mm256_broadcast_pd((const __m128d*)(filter + 2*i));
+        for (p=0; p+2<=nplanes; p+=2)
+            _mm256_storeu_pd(out + 2*p, complex_multiply_avx2(_mm256_loadu_pd(in + 2*p), vf));
+        for (; p<nplanes; p++){
+            ar = in[2*p]; ai = in[2*p+1];
+            out[2*p]   = ar*filter[2*i] - ai*filter[2*i+1];
+            out[2*p+1] = ai*filter[2*i] + ar*filter[2*i+1];
+        }
+        in += 2*nplanes;
+        out += 2*nplanes;
+    }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d complex_multiply_avx512(__m512d a, __m512d f){
+    __m512d f_real = _mm512_movedup_pd(f);
+    __m512d f_imaginary = _mm512_permute_pd(f, 0xFF);
+    __m512d a_swapped = _mm512_permute_pd(a, 0x55);
+    return _mm512_fmaddsub_pd(a, f_real, _mm512_mul_pd(a_swapped, f_imaginary));
+}
+
+__attribute__((target("avx512f")))
+static void multiply_row_avx512(const double *filter, const double *in, double *out, int n){
+    int i;
+    for (i=0; i+4<=n; i+=4)
+        _mm512_storeu_pd(out + 2*i, complex_multiply_avx512(_mm512_loadu_pd(in + 2*i), _mm512_loadu_pd(filter + 2*i)));
+    multiply_row_generic(filter + 2*i, in + 2*i, out + 2*i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void multiply_interleaved_avx512(const double *filter, const double *in, double *out, int n, int nplanes){
+    int i, p;
+    double ar, ai;
+    for (i=0; i<n; i++){
+        // Broadcast one filter value across all of the planes (4 at a time, the rest one by one)
+        __m512d vf = _mm512_setr_pd(filter[2*i], filter[2*i+1], filter[2*i], filter[2*i+1], filter[2*i], filter[2*i+1], filter[2*i], filter[2*i+1]);
+        for (p=0; p+4<=nplanes; p+=4)
+            _mm512_storeu_pd(out + 2*p, complex_multiply_avx512(_mm512_loadu_pd(in + 2*p), vf));
+        for (; p<nplanes; p++){
+            ar = in[2*p]; ai = in[2*p+1];
+            out[2*p]   = ar*filter[2*i] - ai*filter[2*i+1];
+            out[2*p+1] = ai*filter[2*i] + ar*filter[2*i+1];
+        }
+        in += 2*nplanes;
+        out += 2*nplanes;
+    }
+}
+#endif
+
+typedef struct {
+    void (*multiply_row)(const double*, const double*, double*, int);
+    void (*multiply_interleaved)(const double*, const double*, double*, int, int);
+    const fftw_complex *filter;
+    int cols;
+    fftw_complex **in, **out;
+    int nplanes;
+    bool interleaved;
+} multiply_job;
+
+static void multiply_rows(void *arg, int first_row, int last_row){
+/* Multiplies rows [first_row, last_row) of every plane */
+    multiply_job *job = (multiply_job*)arg;
+    int row;
+    for (row=first_row; row<last_row; row++){
+        size_t offset = (size_t)row * job->cols;
+        const double *filter_row = (const double*)(job->filter + offset);
+
+        if (job->interleaved){
+            // All of the planes' values for one entry are contiguous, so each filter value is broadcast across them
+            job->multiply_interleaved(filter_row, (const double*)(job->in[0] + offset*job->nplanes), (double*)(job->out[0] + offset*job->nplanes), job->cols, job->nplanes);
+        }
+        else{
+            // The filter row stays in cache while it is applied to every plane
+            int plane;
+            for (plane=0; plane<job->nplanes; plane++)
+                job->multiply_row(filter_row, (const double*)(job->in[plane] + offset), (double*)(job->out[plane] + offset), job->cols);
+        }
+    }
+}
+
+static void setup_multiply(multiply_job *job, simd_level level, const fftw_complex *filter, int cols, fftw_complex **in, fftw_complex **out, int nplanes, int stride){
+    job->multiply_row = multiply_row_generic;
+    job->multiply_interleaved = multiply_interleaved_generic;
+#if defined(__x86_64__) || defined(__i386__)
+    if (level == SIMD_AVX512){
+        job->multiply_row = multiply_row_avx512;
+        job->multiply_interleaved = multiply_interleaved_avx512;
+    }
+    else if (level == SIMD_AVX2){
+        job->multiply_row = multiply_row_avx2;
+        job->multiply_interleaved = multiply_interleaved_avx2;
+    }
+#endif
+    job->filter = filter;
+    job->cols = cols;
+    job->in = in;
+    job->out = out;
+    job->nplanes = nplanes;
+
+    int p;
+    job->interleaved = (stride == nplanes && nplanes > 1);
+    for (p=1; job->interleaved && p<nplanes; p++){
+        if (in[p] != in[0] + p || out[p] != out[0] + p)
+            job->interleaved = false;
+    }
+    if (stride != 1 && !job->interleaved){
+        printf("spectral_multiply: planes with stride %d must be interleaved. Exiting now.\n", stride);
+        exit(EXIT_FAILURE);
+    }
+}
+
+void spectral_multiply(simd_level level, const fftw_complex *filter, int rows, int cols, fftw_complex **in, fftw_complex **out, int nplanes, int stride, int nthreads){
+/* Multiplies every plane's spectrum by the filter's spectrum
+ *
+ * Inputs
+ * ======
+ *   simd_level level
+ *       Which kernel to use (see detect_simd_level)
+ *
+ *   const fftw_complex *filter
+ *       rows x cols filter spectrum (cols = width/2+1 for an r2c transform)
+ *
+ *   int rows, cols
+ *       Shape of each spectrum
+ *
+ *   fftw_complex **in, **out
+ *       nplanes pointers. Entry (row, col) of plane p is in[p][(row*cols + col)*stride]. 'out' can be the same as
+ *       'in' to multiply in place
+ *
+ *   int nplanes
+ *       Number of spectra to multiply (e.g., 3 for R, G and B)
+ *
+ *   int stride
+ *       Distance (in complex numbers) between consecutive entries of one plane. With stride 1, each plane is
+ *       contiguous. With stride == nplanes, the planes have to be interleaved (in[p] == in[0] + p), so all the
+ *       planes' values for one entry sit next to each other
+ *
+ *   int nthreads
+ *       Number of threads to split the rows across (ignored if built without OpenMP)
+ */
+    multiply_job job;
+    setup_multiply(&job, level, filter, cols, in, out, nplanes, stride);
+
+    int row;
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+    for (row=0; row<rows; row++)
+        multiply_rows(&job, row, row+1);
+}
+
+void spectral_multiply_on(thread_backend *threads, simd_level level, const fftw_complex *filter, int rows, int cols, fftw_complex **in, fftw_complex **out, int nplanes, int stride){
+/* Same as spectral_multiply(), with the rows split across the threads of a thread backend */
+    multiply_job job;
+    setup_multiply(&job, level, filter, cols, in, out, nplanes, stride);
+    thread_backend_parallel_for(threads, rows, multiply_rows, &job);
+}
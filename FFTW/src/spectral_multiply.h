@@ -0,0 +1,12 @@
+/* Pointwise multiply of r2c spectra by a filter spectrum, vectorized for AVX2/AVX-512 and chosen at runtime */
+#ifndef SPECTRAL_MULTIPLY_H
+#define SPECTRAL_MULTIPLY_H
+
+#include <fftw3.h>
+#include "simd.h"
+#include "thread_backend.h"
+
+void spectral_multiply(simd_level level, const fftw_complex *filter, int rows, int cols, fftw_complex **in, fftw_complex **out, int nplanes, int stride, int nthreads);
+void spectral_multiply_on(thread_backend *threads, simd_level level, const fftw_complex *filter, int rows, int cols, fftw_complex **in, fftw_complex **out, int nplanes, int stride);
+
+#endif
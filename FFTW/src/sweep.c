@@ -0,0 +1,616 @@
+/* In-process benchmark sweep
+ *
+ * run_benchmarks.sh used to start a new process for every configuration, and every process paid the start-up costs
+ * again: loading and saving wisdom, fftw_init_threads(), generating the input and planning. A sweep runs the whole
+ * matrix of sizes x ranks x thread counts x plan efforts x precisions x batch sizes x layouts in one process instead:
+ *
+ *   - FFTW's threads are started once, and wisdom is loaded once and saved once, at the end. Wisdom gathered for one
+ *     configuration also serves the later ones
+ *   - the input of a shape is generated once and reused by every configuration of that shape (the shapes are the
+ *     outermost loop, so only one shape's buffers are allocated at a time). It comes from signal_generate(), like the
+ *     input of a single nd_cosine_ffts run, so a swept configuration and the same run by hand transform the same data
+ *
+ * Each configuration plans a batched r2c/c2r pair with fftw_plan_many_dft_r2c/c2r (a batch of 1 is a plain
+ * transform), runs 'warmup' untimed forward + backward executions, then times 'iterations' of them into latency
+ * histograms. The batch's transforms are stored one after another (contiguous: stride 1, dist = one transform) or
+ * with sample i of every transform next to each other (interleaved: stride = batch, dist 1). Every configuration is
+ * appended to the results file as a record of its own, with its transforms per second and time per transform, so the
+ * batch size where the per-execution overhead stops dominating small transforms can be read off the records.
+ *
+ * Precisions other than double run on the fftwf_/fftwl_/fftwq_ engines of precision_engine.c, which allocate their
+ * own buffers and don't use the wisdom. Their records also carry the accuracy: the first transform's spectrum against
+ * the double spectrum of the same input, and the round trip against the input itself.
+ *
+ * The config file has one "key = value value ..." per line, and '#' starts a comment:
+ *
+ *     sizes = 256x256 1024x1024 64x64x64 4096  # a shape per value; a plain number is expanded with 'ranks'
+ *     ranks = 1 2 3                            # rank(s) plain numbers in 'sizes' are expanded to (default 1)
+ *     threads = 1 2 4 8                        # default 1
+ *     plan_efforts = estimate measure          # default estimate
+ *     precisions = single double               # any built into the executable, default double
+ *     batch = 1 8                              # transforms per execution, default 1
+ *     layouts = contiguous interleaved         # of the batch, default contiguous
+ *     iterations = 100                         # default 10
+ *     warmup = 1                               # default 1
+ *     signal = cosine                          # cosine, noise or chirp (see signal_gen.c), default cosine
+ *     fs = 0.001                               # sampling frequency of the signal, default 0.001
+ *     seed = 1                                 # of the noise, default 1
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fftw3.h>
+#include "sweep.h"
+#include "wisdom.h"
+#include "timing.h"
+#include "flops.h"
+#include "results.h"
+
+#define TIMELIMIT 2
+#define SWEEP_PHASES 3
+
+enum {SWEEP_FORWARD, SWEEP_BACKWARD, SWEEP_ITERATION};
+
+static int parse_list(char *values, char **tokens, const char *key, const char *path){
+/* Splits a value list on whitespace. Returns the number of values */
+    int count = 0;
+    char *save, *token;
+    for (token = strtok_r(values, " \t", &save); token; token = strtok_r(NULL, " \t", &save)){
+        if (count == SWEEP_MAX_VALUES){
+            printf("Too many values for '%s' in %s (at most %d).\n", key, path, SWEEP_MAX_VALUES);
+            exit(0);
+        }
+        tokens[count++] = token;
+    }
+    if (count == 0){
+        printf("No values given for '%s' in %s.\n", key, path);
+        exit(0);
+    }
+    return count;
+}
+
+static int parse_positive(const char *token, const char *key, const char *path){
+    char *end;
+    long value = strtol(token, &end, 10);
+    if (*end != '\0' || value < 1 || value > 1L << 30){
+        printf("Invalid value '%s' for '%s' in %s. Please use a positive integer.\n", token, key, path);
+        exit(0);
+    }
+    return (int)value;
+}
+
+static void parse_shape(const char *token, sweep_shape *shape, const char *path){
+/* "NxMx..." */
+    char copy[256], *save, *dim;
+    snprintf(copy, sizeof(copy), "%s", token);
+    shape->rank = 0;
+    for (dim = strtok_r(copy, "x", &save); dim; dim = strtok_r(NULL, "x", &save)){
+        if (shape->rank == SWEEP_MAX_RANK){
+            printf("Size '%s' in %s has more than %d dimensions.\n", token, path, SWEEP_MAX_RANK);
+            exit(0);
+        }
+        shape->n[shape->rank++] = parse_positive(dim, "sizes", path);
+    }
+}
+
+void sweep_config_load(sweep_config *config, const char *path){
+/* Reads a sweep config file (see the top of this file). Unknown keys and bad values are reported and exit */
+    char *sizes[SWEEP_MAX_VALUES], *ranks[SWEEP_MAX_VALUES], *tokens[SWEEP_MAX_VALUES];
+    int num_sizes = 0, num_ranks = 0;
+    int i, j, k;
+
+    memset(config, 0, sizeof(sweep_config));
+    config->iterations = 10;
+    config->warmup = 1;
+    config->signal.kind = SIGNAL_COSINE;
+    config->signal.fs = 0.001;
+    config->signal.seed = 1;
+    config->signal.level = detect_simd_level();
+    config->signal.nthreads = 1;
+
+    FILE *f = fopen(path, "r");
+    if (!f){
+        printf("Could not open sweep config %s.\n", path);
+        exit(0);
+    }
+
+    // The lines are kept until the end, since 'sizes' and 'ranks' point into them
+    char **lines = NULL;
+    int num_lines = 0;
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, f) != -1){
+        lines = realloc(lines, (num_lines + 1) * sizeof(char*));
+        lines[num_lines++] = line;
+        line[strcspn(line, "#\r\n")] = '\0';
+        line = NULL;
+        capacity = 0;
+
+        char *text = lines[num_lines-1];
+        char *equals = strchr(text, '=');
+        if (!equals){
+            if (strspn(text, " \t") != strlen(text)){
+                printf("Invalid line '%s' in %s. Please use \"key = value value ...\".\n", text, path);
+                exit(0);
+            }
+            continue;
+        }
+        *equals = '\0';
+        char *key = text + strspn(text, " \t");
+        key[strcspn(key, " \t")] = '\0';
+        char *values = equals + 1;
+
+        if (strcmp(key, "sizes") == 0)
+            num_sizes = parse_list(values, sizes, key, path);
+        else if (strcmp(key, "ranks") == 0)
+            num_ranks = parse_list(values, ranks, key, path);
+        else if (strcmp(key, "threads") == 0){
+            config->num_threads = parse_list(values, tokens, key, path);
+            for (i=0; i<config->num_threads; i++)
+                config->threads[i] = parse_positive(tokens[i], key, path);
+        }
+        else if (strcmp(key, "plan_efforts") == 0){
+            config->num_plan_efforts = parse_list(values, tokens, key, path);
+            for (i=0; i<config->num_plan_efforts; i++){
+                if (!parse_plan_effort(tokens[i], &config->plan_efforts[i])){
+                    printf("Invalid plan effort '%s' in %s. Please use \"estimate\", \"measure\", \"patient\" or \"exhaustive\".\n", tokens[i], path);
+                    exit(0);
+                }
+            }
+        }
+        else if (strcmp(key, "precisions") == 0){
+            config->num_precisions = parse_list(values, tokens, key, path);
+            for (i=0; i<config->num_precisions; i++){
+                config->precisions[i] = find_precision_engine(tokens[i]);
+                if (!config->precisions[i]){
+                    printf("Precision '%s' in %s is not built into this executable. Please use one of: %s.\n", tokens[i], path, precision_engine_names());
+                    exit(0);
+                }
+            }
+        }
+        else if (strcmp(key, "batch") == 0){
+            config->num_batches = parse_list(values, tokens, key, path);
+            for (i=0; i<config->num_batches; i++)
+                config->batches[i] = parse_positive(tokens[i], key, path);
+        }
+        else if (strcmp(key, "layouts") == 0){
+            config->num_layouts = parse_list(values, tokens, key, path);
+            for (i=0; i<config->num_layouts; i++){
+                if (strcmp(tokens[i], "contiguous") == 0)
+                    config->interleaved[i] = false;
+                else if (strcmp(tokens[i], "interleaved") == 0)
+                    config->interleaved[i] = true;
+                else{
+                    printf("Invalid layout '%s' in %s. Please use \"contiguous\" or \"interleaved\".\n", tokens[i], path);
+                    exit(0);
+                }
+            }
+        }
+        else if (strcmp(key, "iterations") == 0){
+            parse_list(values, tokens, key, path);
+            config->iterations = parse_positive(tokens[0], key, path);
+        }
+        else if (strcmp(key, "warmup") == 0){
+            parse_list(values, tokens, key, path);
+            config->warmup = (strcmp(tokens[0], "0") == 0) ? 0 : parse_positive(tokens[0], key, path);
+        }
+        else if (strcmp(key, "signal") == 0){
+            parse_list(values, tokens, key, path);
+            if (!parse_signal_kind(tokens[0], &config->signal.kind)){
+                printf("Invalid signal '%s' in %s. Please use \"cosine\", \"noise\" or \"chirp\".\n", tokens[0], path);
+                exit(0);
+            }
+        }
+        else if (strcmp(key, "fs") == 0){
+            char *end;
+            parse_list(values, tokens, key, path);
+            config->signal.fs = strtod(tokens[0], &end);
+            if (*end != '\0' || config->signal.fs <= 0.0){
+                printf("Invalid value '%s' for 'fs' in %s. Please use a number greater than 0.\n", tokens[0], path);
+                exit(0);
+            }
+        }
+        else if (strcmp(key, "seed") == 0){
+            char *end;
+            parse_list(values, tokens, key, path);
+            config->signal.seed = strtoull(tokens[0], &end, 10);
+            if (*end != '\0' || tokens[0][0] == '-'){
+                printf("Invalid value '%s' for 'seed' in %s. Please use a non-negative integer.\n", tokens[0], path);
+                exit(0);
+            }
+        }
+        else{
+            printf("Unknown key '%s' in %s.\n", key, path);
+            exit(0);
+        }
+    }
+    free(line);
+    fclose(f);
+
+    // Defaults for the lists that weren't given
+    if (num_sizes == 0){
+        printf("No 'sizes' given in %s.\n", path);
+        exit(0);
+    }
+    if (config->num_threads == 0)
+        config->threads[config->num_threads++] = 1;
+    if (config->num_plan_efforts == 0)
+        config->plan_efforts[config->num_plan_efforts++] = FFTW_ESTIMATE;
+    if (config->num_precisions == 0)
+        config->precisions[config->num_precisions++] = find_precision_engine("double");
+    if (config->num_batches == 0)
+        config->batches[config->num_batches++] = 1;
+    if (config->num_layouts == 0)
+        config->interleaved[config->num_layouts++] = false;
+
+    // Expand the sizes: "NxM" is a shape as it is, a plain N is an N x N x ... cube of every rank in 'ranks'
+    int rank_values[SWEEP_MAX_VALUES] = {1};
+    if (num_ranks == 0)
+        num_ranks = 1;
+    else{
+        for (i=0; i<num_ranks; i++){
+            rank_values[i] = parse_positive(ranks[i], "ranks", path);
+            if (rank_values[i] > SWEEP_MAX_RANK){
+                printf("Rank %d in %s is more than %d.\n", rank_values[i], path, SWEEP_MAX_RANK);
+                exit(0);
+            }
+        }
+    }
+    for (i=0; i<num_sizes; i++){
+        if (strchr(sizes[i], 'x')){
+            parse_shape(sizes[i], &config->shapes[config->num_shapes++], path);
+            continue;
+        }
+        int side = parse_positive(sizes[i], "sizes", path);
+        for (j=0; j<num_ranks; j++){
+            sweep_shape *shape = &config->shapes[config->num_shapes++];
+            shape->rank = rank_values[j];
+            for (k=0; k<shape->rank; k++)
+                shape->n[k] = side;
+        }
+    }
+
+    for (i=0; i<num_lines; i++)
+        free(lines[i]);
+    free(lines);
+}
+
+int sweep_config_size(const sweep_config *config){
+/* Number of configurations the sweep runs */
+    return config->num_shapes * config->num_threads * config->num_plan_efforts * config->num_precisions * config->num_batches * config->num_layouts;
+}
+
+static void shape_name(const sweep_shape *shape, char *name, size_t size){
+    int d, used = 0;
+    name[0] = '\0';
+    for (d=0; d<shape->rank && used < (int)size; d++)
+        used += snprintf(name + used, size - used, "%s%d", d ? "x" : "", shape->n[d]);
+}
+
+static void save_record(const char *results_path, const char *config_path, const sweep_shape *shape, const char *precision, unsigned flags, int nthreads, int batch, bool interleaved, const sweep_config *config, const thread_backend *threads, const numa_allocator *buffers,
+                        const signal_spec *signal, size_t real_size, double generation_time, double planning_time, double forward_time, double backward_time, const flop_count *forward_count, const flop_count *backward_count, latency_histogram *latency,
+                        const precision_error *spectrum_error, const precision_error *round_trip_error){
+    const char *phase_names[SWEEP_PHASES] = {"forward", "backward", "iteration"};
+    latency_summary summary;
+    flop_rates forward_rates, backward_rates;
+    int d, i;
+
+    flop_count_rates(forward_count, forward_time, &forward_rates);
+    flop_count_rates(backward_count, backward_time, &backward_rates);
+    double transforms = (double)batch * config->iterations;
+    double forward_transforms_per_sec = (forward_time > 0.0) ? transforms / forward_time : 0.0;
+    double backward_transforms_per_sec = (backward_time > 0.0) ? transforms / backward_time : 0.0;
+    latency_histogram_summarize(&latency[SWEEP_ITERATION], &summary);
+    double p50_per_transform = summary.p50 / batch;
+
+    results_record record;
+    FILE *results_file = results_begin(&record, results_path);
+    fprintf(results_file, "        \"performance_results\": {\n");
+    fprintf(results_file, "            \"inputs\": {\n");
+    fprintf(results_file, "                \"mode\": \"sweep\",\n");
+    fprintf(results_file, "                \"config\": ");
+    results_json_string(results_file, config_path);
+    fprintf(results_file, ",\n");
+    fprintf(results_file, "                \"dims\": [");
+    for (d=0; d<shape->rank; d++)
+        fprintf(results_file, "%s%d", d ? ", " : "", shape->n[d]);
+    fprintf(results_file, "],\n");
+    fprintf(results_file, "                \"rank\": %d,\n", shape->rank);
+    fprintf(results_file, "                \"batch\": %d,\n", batch);
+    fprintf(results_file, "                \"layout\": \"%s\",\n", interleaved ? "interleaved" : "contiguous");
+    fprintf(results_file, "                \"threads\": %d,\n", nthreads);
+    fprintf(results_file, "                \"plan_effort\": \"%s\",\n", plan_effort_name(flags));
+    fprintf(results_file, "                \"precision\": \"%s\",\n", precision);
+    fprintf(results_file, "                \"fs_Hz\": %0.2e,\n", signal->fs);
+    fprintf(results_file, "                \"iterations\": %d\n", config->iterations);
+    fprintf(results_file, "            },\n");
+    signal_json(results_file, "            ", signal, real_size, generation_time);
+    thread_backend_json(results_file, "            ", threads);
+    numa_allocator_json(results_file, "            ", buffers);
+    fprintf(results_file, "            \"planning_time_seconds\": %0.5f,\n", planning_time);
+    fprintf(results_file, "            \"batch_results\": {\n");
+    fprintf(results_file, "                \"transforms_per_execution\": %d,\n", batch);
+    fprintf(results_file, "                \"forward_transforms_per_second\": %0.3f,\n", forward_transforms_per_sec);
+    fprintf(results_file, "                \"backward_transforms_per_second\": %0.3f,\n", backward_transforms_per_sec);
+    fprintf(results_file, "                \"forward_seconds_per_transform\": %0.9f,\n", (transforms > 0.0) ? forward_time / transforms : 0.0);
+    fprintf(results_file, "                \"backward_seconds_per_transform\": %0.9f,\n", (transforms > 0.0) ? backward_time / transforms : 0.0);
+    fprintf(results_file, "                \"p50_iteration_seconds_per_transform\": %0.9f,\n", p50_per_transform);
+    fprintf(results_file, "                \"p99_iteration_seconds_per_transform\": %0.9f\n", summary.p99 / batch);
+    fprintf(results_file, "            },\n");
+    if (spectrum_error){
+        fprintf(results_file, "            \"accuracy\": {\n");
+        fprintf(results_file, "                \"reference\": \"double\",\n");
+        precision_error_json(results_file, "                ", "spectrum", spectrum_error, false);
+        precision_error_json(results_file, "                ", "round_trip", round_trip_error, true);
+        fprintf(results_file, "            },\n");
+    }
+    fprintf(results_file, "            \"forward_dft_results\": {\n");
+    fprintf(results_file, "                \"total_execution_time_seconds\": %0.5f,\n", forward_time);
+    flop_rates_json(results_file, "                ", forward_count, &forward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"backward_dft_results\": {\n");
+    fprintf(results_file, "                \"total_execution_time_seconds\": %0.5f,\n", backward_time);
+    flop_rates_json(results_file, "                ", backward_count, &backward_rates, true);
+    fprintf(results_file, "            },\n");
+    fprintf(results_file, "            \"latency\": {\n");
+    fprintf(results_file, "                \"warmup_iterations\": %d,\n", config->warmup);
+    fprintf(results_file, "                \"phases\": {\n");
+    for (i=0; i<SWEEP_PHASES; i++){
+        latency_histogram_summarize(&latency[i], &summary);
+        latency_summary_json(results_file, "                    ", phase_names[i], &summary, i == SWEEP_PHASES-1);
+    }
+    fprintf(results_file, "                }\n");
+    fprintf(results_file, "            }\n");
+    fprintf(results_file, "        }\n");
+    results_end(&record);
+
+    char name[256];
+    shape_name(shape, name, sizeof(name));
+    printf("%-20s %6d %-11s %8d %-10s %-11s %10.4f %11.3f %11.3f %12.1f %12.3f\n", name, batch, interleaved ? "interleaved" : "contiguous", nthreads, plan_effort_name(flags), precision, planning_time, forward_rates.gflops, backward_rates.gflops, forward_transforms_per_sec, 1e6 * p50_per_transform);
+}
+
+static void run_configuration(const sweep_config *config, const char *config_path, const char *results_path, const sweep_shape *shape, const char *precision, unsigned flags, int nthreads, int batch, bool interleaved,
+                              const thread_backend *threads, const numa_allocator *buffers, const signal_spec *signal, double generation_time, const double *input, double *in, fftw_complex *out, double *back, size_t real_size, size_t complex_size){
+/* Plans, warms up and times one configuration, and saves its record */
+    latency_histogram latency[SWEEP_PHASES];
+    flop_count forward_count, backward_count;
+    double forward_time = 0.0, backward_time = 0.0;
+    int i, b;
+    size_t j;
+    int stride = interleaved ? batch : 1;
+    int real_dist = interleaved ? 1 : (int)real_size, complex_dist = interleaved ? 1 : (int)complex_size;
+
+    fftw_plan_with_nthreads(nthreads);
+    uint64_t plan_start = timing_now();
+    fftw_plan forward = fftw_plan_many_dft_r2c(shape->rank, shape->n, batch, in, NULL, stride, real_dist, out, NULL, stride, complex_dist, flags);
+    fftw_plan backward = fftw_plan_many_dft_c2r(shape->rank, shape->n, batch, out, NULL, stride, complex_dist, back, NULL, stride, real_dist, flags);
+    double planning_time = timing_elapsed(plan_start, timing_now());
+    if (!forward || !backward){
+        printf("  WARNING: FFTW could not plan this configuration, skipping it.\n");
+        if (forward)
+            fftw_destroy_plan(forward);
+        if (backward)
+            fftw_destroy_plan(backward);
+        return;
+    }
+
+    // Planning may have overwritten the arrays, so every transform of the batch gets the shape's input now
+    for (b=0; b<batch; b++){
+        if (!interleaved)
+            memcpy(in + (size_t)b*real_size, input, real_size * sizeof(double));
+        else
+            for (j=0; j<real_size; j++)
+                in[j*batch + b] = input[j];
+    }
+
+    memset(&forward_count, 0, sizeof(flop_count));
+    memset(&backward_count, 0, sizeof(flop_count));
+    for (i=0; i<SWEEP_PHASES; i++){
+        if (!latency_histogram_init(&latency[i], config->warmup)){
+            printf("Could not allocate the latency histograms. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Warm-up executions go into the histograms too, which leave them out themselves
+    for (i=0; i<config->warmup + config->iterations; i++){
+        uint64_t forward_start = timing_now();
+        fftw_execute(forward);
+        uint64_t forward_stop = timing_now();
+        fftw_execute(backward);
+        uint64_t backward_stop = timing_now();
+
+        latency_histogram_record(&latency[SWEEP_FORWARD], timing_elapsed(forward_start, forward_stop));
+        latency_histogram_record(&latency[SWEEP_BACKWARD], timing_elapsed(forward_stop, backward_stop));
+        latency_histogram_record(&latency[SWEEP_ITERATION], timing_elapsed(forward_start, backward_stop));
+        if (i < config->warmup)
+            continue;
+        forward_time += timing_elapsed(forward_start, forward_stop);
+        backward_time += timing_elapsed(forward_stop, backward_stop);
+        flop_count_real_plan(&forward_count, forward, shape->rank, shape->n, batch, 1);
+        flop_count_real_plan(&backward_count, backward, shape->rank, shape->n, batch, 1);
+    }
+
+    save_record(results_path, config_path, shape, precision, flags, nthreads, batch, interleaved, config, threads, buffers, signal, real_size, generation_time, planning_time, forward_time, backward_time, &forward_count, &backward_count, latency, NULL, NULL);
+
+    for (i=0; i<SWEEP_PHASES; i++)
+        latency_histogram_destroy(&latency[i]);
+    fftw_destroy_plan(forward);
+    fftw_destroy_plan(backward);
+}
+
+static void run_precision_configuration(const sweep_config *config, const char *config_path, const char *results_path, const sweep_shape *shape, const precision_engine *engine, unsigned flags, int nthreads, int batch, bool interleaved,
+                                        const thread_backend *threads, const numa_allocator *buffers, const signal_spec *signal, double generation_time, const double *input, const fftw_complex *reference, size_t real_size, size_t complex_size){
+/* Runs one configuration on another precision's engine, compares it with double, and saves its record */
+    latency_histogram latency[SWEEP_PHASES];
+    precision_timings timings;
+    precision_error spectrum_error, round_trip_error;
+    int i;
+
+    fftw_complex *spectrum = malloc(complex_size * sizeof(fftw_complex));
+    double *back = malloc(real_size * sizeof(double));
+    if (!spectrum || !back){
+        printf("  WARNING: Not enough memory to check the %s results, skipping them.\n", engine->name);
+        free(spectrum);
+        free(back);
+        return;
+    }
+    for (i=0; i<SWEEP_PHASES; i++){
+        if (!latency_histogram_init(&latency[i], config->warmup)){
+            printf("Could not allocate the latency histograms. Exiting.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    precision_cosine_job job = {
+        .rank = shape->rank,
+        .n = shape->n,
+        .howmany = batch,
+        .interleaved = interleaved,
+        .input = input,
+        .warmup = config->warmup,
+        .iterations = config->iterations,
+        .nthreads = nthreads,
+        .flags = flags,
+        .spectrum = spectrum,
+        .back = back,
+        .latency = latency
+    };
+    if (engine->cosine(&job, &timings)){
+        precision_error_init(&spectrum_error);
+        precision_error_add(&spectrum_error, (const double*)reference, (const double*)spectrum, 2 * complex_size);
+        precision_error_finish(&spectrum_error);
+        precision_error_init(&round_trip_error);
+        precision_error_add(&round_trip_error, input, back, real_size);
+        precision_error_finish(&round_trip_error);
+        save_record(results_path, config_path, shape, engine->name, flags, nthreads, batch, interleaved, config, threads, buffers, signal, real_size, generation_time, timings.plan_time, timings.forward_time, timings.backward_time, &timings.forward_count, &timings.backward_count, latency, &spectrum_error, &round_trip_error);
+    }
+    else
+        printf("  WARNING: FFTW (%s) could not plan this configuration, skipping it.\n", engine->prefix);
+
+    for (i=0; i<SWEEP_PHASES; i++)
+        latency_histogram_destroy(&latency[i]);
+    free(spectrum);
+    free(back);
+}
+
+void sweep_run(const sweep_config *config, const char *config_path, const char *results_path, bool use_wisdom, const char *wisdom_dir, thread_backend *threads, numa_allocator *buffers){
+/* Runs every configuration of the sweep in this process, appending a record per configuration to 'results_path'
+ *
+ * Inputs
+ * ======
+ *   bool use_wisdom, const char *wisdom_dir
+ *       Wisdom is loaded before the first configuration and saved after the last one, as in a normal run
+ *
+ *   thread_backend *threads
+ *       Threads the transforms run on (see thread_backend.c), with as many threads as the biggest configuration
+ *
+ *   numa_allocator *buffers
+ *       Allocates the transform buffers of every shape (see numa_alloc.c)
+ */
+    int s, p, e, t, b, l, d;
+    int max_batch = 1;
+    bool other_precisions = false;
+    for (b=0; b<config->num_batches; b++)
+        if (config->batches[b] > max_batch)
+            max_batch = config->batches[b];
+
+    // The dTLB probe walks about as much memory as the biggest shape's buffers take
+    size_t working_set = 0;
+    for (s=0; s<config->num_shapes; s++){
+        size_t real_size = 1;
+        for (d=0; d<config->shapes[s].rank; d++)
+            real_size *= config->shapes[s].n[d];
+        size_t complex_size = real_size / config->shapes[s].n[config->shapes[s].rank-1] * (config->shapes[s].n[config->shapes[s].rank-1]/2 + 1);
+        size_t bytes = (2 * real_size * sizeof(double) + complex_size * sizeof(fftw_complex)) * max_batch;
+        if (bytes > working_set)
+            working_set = bytes;
+    }
+    numa_measure_tlb(buffers, working_set);
+    const precision_engine *reference_engine = find_precision_engine("double");
+    for (p=0; p<config->num_precisions; p++){
+        if (config->precisions[p] != reference_engine){
+            config->precisions[p]->init_threads();
+            other_precisions = true;
+        }
+    }
+
+    // Started once for the whole sweep
+    fftw_init_threads();
+    if (threads->kind != THREAD_BACKEND_FFTW && !thread_backend_install_fftw(threads))
+        printf("  NOTE: This FFTW has no fftw_threads_set_callback() (FFTW 3.3.9+), so its transforms run on its own threads.\n");
+    fftw_set_timelimit(TIMELIMIT);
+    wisdom_store wisdom;
+    wisdom_init(&wisdom, wisdom_dir);
+    wisdom.enabled = use_wisdom;
+    wisdom_load(&wisdom);
+
+    // Every shape's input is generated on the backend's threads
+    signal_spec signal = config->signal;
+    signal.nthreads = threads->nthreads;
+
+    printf("Sweep %s: %d configurations, %d iterations each (after %d warm-up)\n", config_path, sweep_config_size(config), config->iterations, config->warmup);
+    printf("%-20s %6s %-11s %8s %-10s %-11s %10s %11s %11s %12s %12s\n", "dims", "batch", "layout", "threads", "effort", "precision", "plan (s)", "fwd GFLOP/s", "bwd GFLOP/s", "fwd xforms/s", "p50 us/xform");
+
+    for (s=0; s<config->num_shapes; s++){
+        const sweep_shape *shape = &config->shapes[s];
+        size_t real_size = 1;
+        for (d=0; d<shape->rank; d++)
+            real_size *= shape->n[d];
+        size_t complex_size = real_size / shape->n[shape->rank-1] * (shape->n[shape->rank-1]/2 + 1);
+
+        // The shape's input is generated once, and its buffers are sized for the biggest batch
+        double *input = malloc(real_size * sizeof(double));
+        double *in = numa_alloc(buffers, real_size * max_batch * sizeof(double));
+        fftw_complex *out = numa_alloc(buffers, complex_size * max_batch * sizeof(fftw_complex));
+        double *back = numa_alloc(buffers, real_size * max_batch * sizeof(double));
+        fftw_complex *reference = other_precisions ? malloc(complex_size * sizeof(fftw_complex)) : NULL;
+        if (!input || !in || !out || !back || (other_precisions && !reference) || real_size > INT_MAX){
+            char name[256];
+            shape_name(shape, name, sizeof(name));
+            printf("  WARNING: Not enough memory for %s with a batch of %d, skipping it.\n", name, max_batch);
+        }
+        else{
+            uint64_t generation_start = timing_now();
+            signal_generate(input, real_size, &signal);
+            double generation_time = timing_elapsed(generation_start, timing_now());
+
+            // The other precisions are checked against the double spectrum of the same input
+            if (other_precisions){
+                precision_timings timings;
+                precision_cosine_job job = {.rank = shape->rank, .n = shape->n, .howmany = 1, .input = input, .iterations = 1, .nthreads = 1, .flags = FFTW_ESTIMATE, .spectrum = reference};
+                if (!reference_engine->cosine(&job, &timings)){
+                    printf("Could not compute the double reference spectrum. Exiting.\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            for (p=0; p<config->num_precisions; p++)
+                for (e=0; e<config->num_plan_efforts; e++)
+                    for (t=0; t<config->num_threads; t++)
+                        for (b=0; b<config->num_batches; b++)
+                            for (l=0; l<config->num_layouts; l++){
+                                if (config->precisions[p] == reference_engine)
+                                    run_configuration(config, config_path, results_path, shape, reference_engine->name, config->plan_efforts[e], config->threads[t], config->batches[b], config->interleaved[l], threads, buffers, &signal, generation_time, input, in, out, back, real_size, complex_size);
+                                else
+                                    run_precision_configuration(config, config_path, results_path, shape, config->precisions[p], config->plan_efforts[e], config->threads[t], config->batches[b], config->interleaved[l], threads, buffers, &signal, generation_time, input, reference, real_size, complex_size);
+                            }
+        }
+        free(input);
+        free(reference);
+        numa_free(buffers, in);
+        numa_free(buffers, out);
+        numa_free(buffers, back);
+    }
+
+    // Save wisdom (cleaning up the threads makes FFTW forget it)
+    wisdom_save(&wisdom);
+    for (p=0; p<config->num_precisions; p++)
+        if (config->precisions[p] != reference_engine)
+            config->precisions[p]->cleanup_threads();
+    fftw_cleanup_threads();
+    if (use_wisdom)
+        printf("%s %s\n", wisdom.imported ? "Imported wisdom from" : "No wisdom found, saved new wisdom to", wisdom.path);
+}
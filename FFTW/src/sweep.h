@@ -0,0 +1,41 @@
+/* In-process sweep: runs a whole matrix of transform configurations (read from a config file) in one process */
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdbool.h>
+#include "thread_backend.h"
+#include "numa_alloc.h"
+#include "precision.h"
+#include "signal_gen.h"
+
+#define SWEEP_MAX_RANK 16
+#define SWEEP_MAX_VALUES 64
+
+typedef struct {
+    int rank;
+    int n[SWEEP_MAX_RANK];
+} sweep_shape;
+
+typedef struct {
+    sweep_shape shapes[SWEEP_MAX_VALUES * SWEEP_MAX_VALUES];
+    int num_shapes;
+    int threads[SWEEP_MAX_VALUES];
+    int num_threads;
+    unsigned plan_efforts[SWEEP_MAX_VALUES]; //FFTW planner flags
+    int num_plan_efforts;
+    const precision_engine *precisions[SWEEP_MAX_VALUES]; //engines of precision.c
+    int num_precisions;
+    int batches[SWEEP_MAX_VALUES];           //transforms per execution
+    int num_batches;
+    bool interleaved[SWEEP_MAX_VALUES];      //layouts of the batch: contiguous (false) or interleaved (true)
+    int num_layouts;
+    int iterations;                          //timed executions per configuration
+    int warmup;                              //untimed executions before them
+    signal_spec signal;                      //input of every shape, generated as nd_cosine_ffts generates its own
+} sweep_config;
+
+void sweep_config_load(sweep_config *config, const char *path);
+int sweep_config_size(const sweep_config *config);
+void sweep_run(const sweep_config *config, const char *config_path, const char *results_path, bool use_wisdom, const char *wisdom_dir, thread_backend *threads, numa_allocator *buffers);
+
+#endif
@@ -0,0 +1,560 @@
+/* Thread backends for the benchmarks
+ *
+ * By default FFTW runs its transforms on its own threads, our loops (the blur multiply) run on OpenMP's, and neither
+ * is pinned: core affinity could only be set from outside, with numactl, and the OS is free to migrate any thread
+ * between the executions being timed. Two other backends are available:
+ *
+ *   - pool: a persistent pool of threads, created once and spinning briefly between loops before going to sleep.
+ *     Every loop is split into one contiguous range per thread, and a thread that finishes its range early steals
+ *     chunks from the others' ranges, so a thread that was descheduled or is running on a busier core doesn't hold
+ *     the whole loop up
+ *   - openmp: OpenMP's threads for everything
+ *
+ * FFTW 3.3.9 and later hand their parallel loops to the application through fftw_threads_set_callback(), so FFTW's
+ * transforms run on the selected backend too. Older FFTWs (e.g. the 3.3.5 in the Dockerfiles) don't have it, and
+ * keep running their transforms on their own threads; compile_benchmark_code.sh defines HAVE_FFTW_THREADS_CALLBACK
+ * when fftw3.h declares it.
+ *
+ * Threads can be pinned, one CPU each, out of the CPUs the process is allowed on:
+ *
+ *   - compact: CPUs ordered by socket, then core, so that hyperthread siblings get consecutive threads
+ *   - scatter: round-robin over the sockets, every physical core once before any of their hyperthread siblings
+ *   - a list of CPUs, e.g. "0,2,4-7", used in that order
+ *
+ * The caller is always thread 0. Threads the backend doesn't create itself (FFTW's own, when it has no callback) are
+ * confined to the pinned set, the way numactl -C would, but not to one CPU each.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <fftw3.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "thread_backend.h"
+
+#define SPIN_ITERATIONS 2000 //times an idle thread polls for the next loop (or the end of this one) before it sleeps
+#define CHUNKS_PER_THREAD 4   //chunks every thread's range is split into, for stealing
+
+static __thread bool inside_loop = false; //loops started from a loop body (or a pool worker) run serially
+
+static inline void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+bool parse_thread_backend(const char *name, thread_backend_kind *kind){
+    if (strcmp(name, "fftw") == 0)
+        *kind = THREAD_BACKEND_FFTW;
+    else if (strcmp(name, "pool") == 0)
+        *kind = THREAD_BACKEND_POOL;
+    else if (strcmp(name, "openmp") == 0)
+        *kind = THREAD_BACKEND_OPENMP;
+    else
+        return false;
+    return true;
+}
+
+const char *thread_backend_name(thread_backend_kind kind){
+    switch (kind){
+        case THREAD_BACKEND_POOL:
+            return "pool";
+        case THREAD_BACKEND_OPENMP:
+            return "openmp";
+        default:
+            return "fftw";
+    }
+}
+
+bool parse_cpu_list(const char *spec, int *values, int *count, int max_values){
+/* Parses a list of CPUs (or NUMA nodes) such as "0,2,4-7", the format of the kernel's cpulist files. Returns false
+ * if it isn't one, is empty or has more than max_values entries */
+    const char *p = spec;
+    char *end;
+    *count = 0;
+    while (*p && *p != '\n'){
+        long first = strtol(p, &end, 10), last;
+        if (end == p || first < 0)
+            return false;
+        last = first;
+        p = end;
+        if (*p == '-'){
+            last = strtol(p+1, &end, 10);
+            if (end == p+1 || last < first)
+                return false;
+            p = end;
+        }
+        for (; first <= last; first++){
+            if (*count == max_values || first >= CPU_SETSIZE)
+                return false;
+            values[(*count)++] = (int)first;
+        }
+        if (*p == ',')
+            p++;
+        else if (*p && *p != '\n')
+            return false;
+    }
+    return *count > 0;
+}
+
+bool parse_pin_policy(const char *spec, pin_policy *pin, int *cpus, int *num_cpus){
+/* Parses "none", "compact", "scatter" or a list of CPUs ("0,2,4-7"). A list is stored in 'cpus' (room for
+ * THREAD_BACKEND_MAX_CPUS entries) */
+    *num_cpus = 0;
+    if (strcmp(spec, "none") == 0)
+        *pin = PIN_NONE;
+    else if (strcmp(spec, "compact") == 0)
+        *pin = PIN_COMPACT;
+    else if (strcmp(spec, "scatter") == 0)
+        *pin = PIN_SCATTER;
+    else{
+        *pin = PIN_LIST;
+        return parse_cpu_list(spec, cpus, num_cpus, THREAD_BACKEND_MAX_CPUS);
+    }
+    return true;
+}
+
+const char *pin_policy_name(pin_policy pin){
+    switch (pin){
+        case PIN_COMPACT:
+            return "compact";
+        case PIN_SCATTER:
+            return "scatter";
+        case PIN_LIST:
+            return "list";
+        default:
+            return "none";
+    }
+}
+
+/*
+ * CPU topology
+ */
+
+typedef struct {
+    int cpu;
+    int package;
+    int core;
+    int sibling;   //how many hyperthreads of the same core come before this one
+    int core_rank; //position of the core among its package's cores
+} cpu_info;
+
+static int read_topology(int cpu, const char *name, int fallback){
+    char path[128];
+    int value;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return fallback;
+    if (fscanf(f, "%d", &value) != 1)
+        value = fallback;
+    fclose(f);
+    return value;
+}
+
+static int compare_compact(const void *a, const void *b){
+    const cpu_info *x = a, *y = b;
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+static int compare_scatter(const void *a, const void *b){
+    const cpu_info *x = a, *y = b;
+    if (x->sibling != y->sibling)
+        return x->sibling - y->sibling;
+    if (x->core_rank != y->core_rank)
+        return x->core_rank - y->core_rank;
+    if (x->package != y->package)
+        return x->package - y->package;
+    return x->cpu - y->cpu;
+}
+
+static int order_cpus(pin_policy pin, int *cpus){
+/* Fills 'cpus' with the CPUs this process may run on, in the order 'pin' hands them out. Returns how many */
+    cpu_set_t allowed;
+    int cpu, i, j, count = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return 0;
+    cpu_info *info = malloc(CPU_COUNT(&allowed) * sizeof(cpu_info));
+    if (!info)
+        return 0;
+    for (cpu=0; cpu<CPU_SETSIZE; cpu++){
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        info[count].cpu = cpu;
+        info[count].package = read_topology(cpu, "physical_package_id", 0);
+        info[count].core = read_topology(cpu, "core_id", cpu);
+        info[count].sibling = 0;
+        info[count].core_rank = 0;
+        for (j=0; j<count; j++){
+            if (info[j].package != info[count].package)
+                continue;
+            if (info[j].core == info[count].core)
+                info[count].sibling++;
+            else if (info[j].sibling == 0)
+                info[count].core_rank++;
+        }
+        // A sibling's core was already ranked by its first hyperthread
+        for (j=0; j<count && info[count].sibling > 0; j++){
+            if (info[j].package == info[count].package && info[j].core == info[count].core && info[j].sibling == 0){
+                info[count].core_rank = info[j].core_rank;
+                break;
+            }
+        }
+        count++;
+    }
+
+    qsort(info, count, sizeof(cpu_info), (pin == PIN_SCATTER) ? compare_scatter : compare_compact);
+    for (i=0; i<count; i++)
+        cpus[i] = info[i].cpu;
+    free(info);
+    return count;
+}
+
+static bool pin_thread(pthread_t thread, const int *cpus, int num_cpus){
+/* Restricts 'thread' to the given CPUs */
+    cpu_set_t set;
+    int i;
+    CPU_ZERO(&set);
+    for (i=0; i<num_cpus; i++)
+        CPU_SET(cpus[i], &set);
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+/*
+ * Pool
+ */
+
+static void run_chunks(thread_backend *backend, int self){
+/* Runs chunks of this thread's range, then steals chunks from the other threads' ranges until none are left */
+    int threads = backend->loop_threads, grain = backend->grain;
+    int k, begin, end;
+    unsigned long chunks = 0, stolen = 0;
+
+    for (k=0; k<threads; k++){
+        thread_range *range = &backend->ranges[(self + k) % threads];
+        end = atomic_load_explicit(&range->end, memory_order_relaxed);
+        while ((begin = atomic_fetch_add_explicit(&range->next, grain, memory_order_relaxed)) < end){
+            backend->fn(backend->arg, begin, (end - begin < grain) ? end : begin + grain);
+            chunks++;
+            if (k > 0)
+                stolen++;
+        }
+    }
+    atomic_fetch_add_explicit(&backend->chunks, chunks, memory_order_relaxed);
+    atomic_fetch_add_explicit(&backend->stolen_chunks, stolen, memory_order_relaxed);
+}
+
+static void *pool_worker(void *arg){
+    thread_backend *backend = (thread_backend*)arg;
+    int self = atomic_fetch_add(&backend->next_worker, 1);
+    unsigned long seen = 0, generation;
+    int spins;
+
+    if (backend->cpus)
+        pin_thread(pthread_self(), &backend->cpus[self], 1);
+    inside_loop = true;
+
+    for (;;){
+        // Poll for a while, so that back-to-back loops (e.g. the passes of a transform) don't pay for a wake-up
+        spins = 0;
+        while ((generation = atomic_load_explicit(&backend->generation, memory_order_acquire)) == seen && !atomic_load(&backend->shutdown)){
+            if (++spins < backend->spin){
+                cpu_relax();
+                continue;
+            }
+            pthread_mutex_lock(&backend->lock);
+            while (atomic_load(&backend->generation) == seen && !atomic_load(&backend->shutdown))
+                pthread_cond_wait(&backend->wake, &backend->lock);
+            pthread_mutex_unlock(&backend->lock);
+            spins = 0;
+        }
+        if (atomic_load(&backend->shutdown))
+            break;
+        seen = generation;
+
+        // Every worker checks in for every loop, even if the loop has fewer iterations than there are threads
+        if (self < backend->loop_threads)
+            run_chunks(backend, self);
+        atomic_fetch_sub_explicit(&backend->active, 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+static void pool_parallel_for(thread_backend *backend, int n, thread_loop_fn fn, void *arg){
+    int threads = (n < backend->nthreads) ? n : backend->nthreads;
+    int t, spins = 0;
+
+    // Nested loops (FFTW's sub-plans, or a loop body that starts a loop) and loops started while another thread
+    // has the pool run in the calling thread
+    if (threads <= 1 || inside_loop || pthread_mutex_trylock(&backend->busy) != 0){
+        if (threads > 1)
+            atomic_fetch_add_explicit(&backend->serial_loops, 1, memory_order_relaxed);
+        fn(arg, 0, n);
+        return;
+    }
+
+    backend->fn = fn;
+    backend->arg = arg;
+    backend->loop_threads = threads;
+    backend->grain = n / (threads * CHUNKS_PER_THREAD);
+    if (backend->grain < 1)
+        backend->grain = 1;
+    for (t=0; t<threads; t++){
+        atomic_store_explicit(&backend->ranges[t].next, (int)((long)n * t / threads), memory_order_relaxed);
+        atomic_store_explicit(&backend->ranges[t].end, (int)((long)n * (t+1) / threads), memory_order_relaxed);
+    }
+    atomic_store_explicit(&backend->active, backend->num_started, memory_order_relaxed);
+
+    pthread_mutex_lock(&backend->lock);
+    atomic_fetch_add_explicit(&backend->generation, 1, memory_order_release);
+    pthread_cond_broadcast(&backend->wake);
+    pthread_mutex_unlock(&backend->lock);
+
+    inside_loop = true;
+    run_chunks(backend, 0);
+    inside_loop = false;
+
+    while (atomic_load_explicit(&backend->active, memory_order_acquire) > 0){
+        if (++spins < backend->spin)
+            cpu_relax();
+        else
+            sched_yield();
+    }
+    atomic_fetch_add_explicit(&backend->loops, 1, memory_order_relaxed);
+    pthread_mutex_unlock(&backend->busy);
+}
+
+void thread_backend_parallel_for(thread_backend *backend, int n, thread_loop_fn fn, void *arg){
+/* Runs fn over iterations [0, n), split across the backend's threads. Returns when every iteration has run */
+    if (n <= 0)
+        return;
+    if (backend->kind == THREAD_BACKEND_POOL){
+        pool_parallel_for(backend, n, fn, arg);
+        return;
+    }
+
+#ifdef _OPENMP
+    // Static split, one contiguous range per thread, as the loops' own "omp parallel for schedule(static)" did
+    int threads = (n < backend->nthreads) ? n : backend->nthreads;
+    if (threads > 1){
+#pragma omp parallel num_threads(threads)
+        {
+            int t = omp_get_thread_num(), nt = omp_get_num_threads();
+            int begin = (int)((long)n * t / nt), end = (int)((long)n * (t+1) / nt);
+            if (begin < end)
+                fn(arg, begin, end);
+        }
+        return;
+    }
+#endif
+    fn(arg, 0, n);
+}
+
+#ifdef HAVE_FFTW_THREADS_CALLBACK
+typedef struct {
+    void *(*work)(char *);
+    char *jobdata;
+    size_t elsize;
+} fftw_jobs;
+
+static void run_fftw_jobs(void *arg, int begin, int end){
+    fftw_jobs *jobs = (fftw_jobs*)arg;
+    int i;
+    for (i=begin; i<end; i++)
+        jobs->work(jobs->jobdata + jobs->elsize * i);
+}
+
+static void fftw_parallel_loop(void *(*work)(char *), char *jobdata, size_t elsize, int njobs, void *data){
+/* fftw_threads_set_callback() hook: FFTW's njobs jobs (one per thread it planned for) as one loop */
+    fftw_jobs jobs = {work, jobdata, elsize};
+    thread_backend_parallel_for((thread_backend*)data, njobs, run_fftw_jobs, &jobs);
+}
+#endif
+
+bool thread_backend_init(thread_backend *backend, thread_backend_kind kind, pin_policy pin, const int *cpu_list, int num_cpus, int nthreads){
+/* Sets up a backend of 'nthreads' threads, counting the caller. Call it before fftw_init_threads() and before
+ * anything else starts threads, so that they inherit the pinned set
+ *
+ * Inputs
+ * ======
+ *   thread_backend_kind kind
+ *       Which threads run FFTW's transforms (with thread_backend_install_fftw) and thread_backend_parallel_for()
+ *
+ *   pin_policy pin, const int *cpu_list, int num_cpus
+ *       How the threads are pinned. cpu_list (num_cpus entries) is only used with PIN_LIST
+ *
+ *   int nthreads
+ *       Number of threads, at least 1
+ */
+    int ordered[THREAD_BACKEND_MAX_CPUS];
+    int i;
+
+    memset(backend, 0, sizeof(thread_backend));
+    backend->kind = kind;
+    backend->pin = pin;
+    backend->nthreads = nthreads;
+
+#ifndef _OPENMP
+    if (kind == THREAD_BACKEND_OPENMP){
+        printf("  WARNING: Built without OpenMP, so the openmp thread backend is not available.\n");
+        return false;
+    }
+#endif
+
+    // Pick a CPU for every thread, and confine the process's threads to those CPUs
+    if (pin != PIN_NONE){
+        if (pin == PIN_LIST){
+            memcpy(ordered, cpu_list, num_cpus * sizeof(int));
+        }
+        else
+            num_cpus = order_cpus(pin, ordered);
+        if (num_cpus == 0){
+            printf("  WARNING: Could not read which CPUs this process may run on, so the threads are not pinned.\n");
+            backend->pin = PIN_NONE;
+        }
+        else{
+            if (nthreads > num_cpus)
+                printf("  WARNING: %d threads pinned to %d CPUs, so some CPUs run more than one thread.\n", nthreads, num_cpus);
+            backend->cpus = malloc(nthreads * sizeof(int));
+            if (!backend->cpus)
+                return false;
+            for (i=0; i<nthreads; i++)
+                backend->cpus[i] = ordered[i % num_cpus];
+            if (!pin_thread(pthread_self(), backend->cpus, (nthreads < num_cpus) ? nthreads : num_cpus)){
+                printf("  WARNING: Could not pin to the CPUs asked for (are they online and allowed?), so the threads are not pinned.\n");
+                free(backend->cpus);
+                backend->cpus = NULL;
+                backend->pin = PIN_NONE;
+            }
+        }
+    }
+
+#ifdef _OPENMP
+    // OpenMP keeps its threads between parallel regions, so pinning them once holds for every later loop. The
+    // calling thread (OpenMP's thread 0) is only pinned once FFTW's threads can no longer inherit its one CPU
+    if (kind != THREAD_BACKEND_POOL && backend->cpus && nthreads > 1){
+#pragma omp parallel num_threads(nthreads)
+        {
+            int t = omp_get_thread_num();
+            if (t > 0)
+                pin_thread(pthread_self(), &backend->cpus[t], 1);
+        }
+    }
+#endif
+
+    if (kind != THREAD_BACKEND_POOL)
+        return true;
+
+    // Polling only pays off if every thread has a CPU of its own; otherwise it takes CPU time from the threads
+    // that still have work to do
+    cpu_set_t allowed;
+    int num_allowed = (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) ? CPU_COUNT(&allowed) : 1;
+    backend->spin = (nthreads <= num_allowed) ? SPIN_ITERATIONS : 0;
+
+    pthread_mutex_init(&backend->lock, NULL);
+    pthread_mutex_init(&backend->busy, NULL);
+    pthread_cond_init(&backend->wake, NULL);
+    backend->ranges = aligned_alloc(sizeof(thread_range), nthreads * sizeof(thread_range));
+    backend->threads = malloc(nthreads * sizeof(pthread_t));
+    if (!backend->ranges || !backend->threads){
+        thread_backend_destroy(backend);
+        return false;
+    }
+    memset(backend->ranges, 0, nthreads * sizeof(thread_range));
+    atomic_store(&backend->next_worker, 1);
+    for (i=1; i<nthreads; i++){
+        if (pthread_create(&backend->threads[backend->num_started], NULL, pool_worker, backend) != 0){
+            thread_backend_destroy(backend);
+            return false;
+        }
+        backend->num_started++;
+    }
+    return true;
+}
+
+bool thread_backend_install_fftw(thread_backend *backend){
+/* Runs FFTW's transforms on the backend. Call it after fftw_init_threads() and before planning. Returns false if
+ * FFTW keeps running them on its own threads (the fftw backend, or an FFTW older than 3.3.9) */
+#ifdef HAVE_FFTW_THREADS_CALLBACK
+    if (backend->kind == THREAD_BACKEND_FFTW)
+        return false;
+    fftw_threads_set_callback(fftw_parallel_loop, backend);
+    backend->fftw_callback = true;
+
+    // No FFTW thread will inherit the caller's affinity any more, so the caller can have its own CPU
+    if (backend->cpus)
+        pin_thread(pthread_self(), &backend->cpus[0], 1);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void thread_backend_destroy(thread_backend *backend){
+    int i;
+
+    if (backend->kind == THREAD_BACKEND_POOL){
+        pthread_mutex_lock(&backend->lock);
+        atomic_store(&backend->shutdown, true);
+        pthread_cond_broadcast(&backend->wake);
+        pthread_mutex_unlock(&backend->lock);
+        for (i=0; i<backend->num_started; i++)
+            pthread_join(backend->threads[i], NULL);
+        pthread_mutex_destroy(&backend->lock);
+        pthread_mutex_destroy(&backend->busy);
+        pthread_cond_destroy(&backend->wake);
+    }
+    free(backend->threads);
+    free(backend->ranges);
+    free(backend->cpus);
+    backend->threads = NULL;
+    backend->ranges = NULL;
+    backend->cpus = NULL;
+    backend->num_started = 0;
+}
+
+static double stolen_fraction(const thread_backend *backend){
+    unsigned long chunks = atomic_load((atomic_ulong*)&backend->chunks);
+    return chunks ? (double)atomic_load((atomic_ulong*)&backend->stolen_chunks) / chunks : 0.0;
+}
+
+void thread_backend_json(FILE *f, const char *indent, const thread_backend *backend){
+/* Writes a "thread_backend" object (followed by a comma) */
+    int i;
+    fprintf(f, "%s\"thread_backend\": {\n", indent);
+    fprintf(f, "%s    \"backend\": \"%s\",\n", indent, thread_backend_name(backend->kind));
+    fprintf(f, "%s    \"fftw_on_backend\": %s,\n", indent, backend->fftw_callback ? "true" : "false");
+    fprintf(f, "%s    \"pinning\": \"%s\",\n", indent, pin_policy_name(backend->pin));
+    fprintf(f, "%s    \"cpus\": [", indent);
+    for (i=0; backend->cpus && i<backend->nthreads; i++)
+        fprintf(f, "%s%d", (i == 0) ? "" : ", ", backend->cpus[i]);
+    fprintf(f, "],\n");
+    fprintf(f, "%s    \"pool_loops\": %lu,\n", indent, atomic_load((atomic_ulong*)&backend->loops));
+    fprintf(f, "%s    \"serial_loops\": %lu,\n", indent, atomic_load((atomic_ulong*)&backend->serial_loops));
+    fprintf(f, "%s    \"stolen_chunk_fraction\": %0.5f\n", indent, stolen_fraction(backend));
+    fprintf(f, "%s},\n", indent);
+}
+
+void thread_backend_print(const thread_backend *backend){
+    int i;
+    printf("    Thread backend: %s, FFTW on %s, ", thread_backend_name(backend->kind), backend->fftw_callback ? "the backend" : "its own threads");
+    if (backend->cpus){
+        printf("pinned (%s) to CPUs ", pin_policy_name(backend->pin));
+        for (i=0; i<backend->nthreads; i++)
+            printf("%s%d", (i == 0) ? "" : ",", backend->cpus[i]);
+        printf("\n");
+    }
+    else
+        printf("not pinned\n");
+    if (backend->kind == THREAD_BACKEND_POOL)
+        printf("    Pool: %lu parallel loops, %0.1f%% of chunks stolen, %lu nested loops run serially\n", atomic_load((atomic_ulong*)&backend->loops), 100.0 * stolen_fraction(backend), atomic_load((atomic_ulong*)&backend->serial_loops));
+}
@@ -0,0 +1,78 @@
+/* Threads that FFTW's transforms and the benchmarks' own loops (blur multiply, copy-in) run on, optionally pinned */
+#ifndef THREAD_BACKEND_H
+#define THREAD_BACKEND_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define THREAD_BACKEND_MAX_CPUS 4096
+
+typedef enum {
+    THREAD_BACKEND_FFTW,   //FFTW's own threads, OpenMP for our loops (what the benchmarks always did)
+    THREAD_BACKEND_POOL,   //persistent work-stealing pool for both
+    THREAD_BACKEND_OPENMP  //OpenMP for both
+} thread_backend_kind;
+
+typedef enum {
+    PIN_NONE,     //let the OS place (and migrate) the threads
+    PIN_COMPACT,  //fill a core's hyperthreads, then the next core, then the next socket
+    PIN_SCATTER,  //round-robin over the sockets, one thread per physical core before any hyperthread sibling
+    PIN_LIST      //an explicit list of CPUs, e.g. "0,2,4-7"
+} pin_policy;
+
+typedef void (*thread_loop_fn)(void *arg, int begin, int end); //runs iterations [begin, end) of a loop
+
+typedef struct {
+    _Alignas(64) atomic_int next; //next iteration to hand out, owner and thieves both take chunks from here
+    atomic_int end;
+} thread_range;
+
+typedef struct {
+    thread_backend_kind kind;
+    pin_policy pin;
+    int nthreads;
+    int *cpus;             //CPU of every thread (thread 0 is the caller), NULL if not pinned
+    bool fftw_callback;    //FFTW's transforms run on this backend (fftw_threads_set_callback)
+
+    // Pool
+    pthread_t *threads;    //workers 1 .. nthreads-1
+    int num_started;
+    atomic_int next_worker;  //index the next worker to start takes
+    thread_range *ranges;  //one per thread
+    pthread_mutex_t lock;  //guards sleeping on 'wake'
+    pthread_cond_t wake;
+    pthread_mutex_t busy;  //held by the thread running a loop on the pool
+    atomic_ulong generation; //bumped for every loop
+    atomic_int active;       //workers still running the current loop
+    atomic_bool shutdown;
+    thread_loop_fn fn;       //current loop
+    void *arg;
+    int grain;
+    int loop_threads;
+    int spin;                //polls before sleeping (none when there are more threads than CPUs to spin on)
+
+    // Statistics
+    atomic_ulong loops;
+    atomic_ulong chunks;
+    atomic_ulong stolen_chunks;
+    atomic_ulong serial_loops; //nested or concurrent loops, run in the calling thread
+} thread_backend;
+
+bool parse_thread_backend(const char *name, thread_backend_kind *kind);
+const char *thread_backend_name(thread_backend_kind kind);
+bool parse_cpu_list(const char *spec, int *values, int *count, int max_values);
+bool parse_pin_policy(const char *spec, pin_policy *pin, int *cpus, int *num_cpus);
+const char *pin_policy_name(pin_policy pin);
+
+bool thread_backend_init(thread_backend *backend, thread_backend_kind kind, pin_policy pin, const int *cpu_list, int num_cpus, int nthreads);
+bool thread_backend_install_fftw(thread_backend *backend);
+void thread_backend_destroy(thread_backend *backend);
+
+void thread_backend_parallel_for(thread_backend *backend, int n, thread_loop_fn fn, void *arg);
+
+void thread_backend_json(FILE *f, const char *indent, const thread_backend *backend);
+void thread_backend_print(const thread_backend *backend);
+
+#endif
@@ -0,0 +1,341 @@
+/* Tiled blur engine
+ *
+ * Transforming a whole image at once needs several image-sized buffers, and once those outgrow the caches every
+ * pass of the FFT streams through main memory. The tiled engine instead cuts the output into tiles and blurs each
+ * one with a small transform using overlap-save: a tile's transform covers the tile plus the filter_size - 1 pixels
+ * above and to the left of it (zero outside the image), so after the backward transform the part of the result
+ * that did not wrap around is exactly the tile's linear convolution. The first filter_size - 1 rows and columns are
+ * thrown away, the rest is the tile.
+ *
+ * Every tile has the same shape, so all tiles share one forward plan, one backward plan and one filter spectrum.
+ * The tiles are spread over the threads, each with its own tile buffer, so the memory used is a few tiles per
+ * thread no matter how large the image is. The tile size is picked so that a tile's working set fits in the L2
+ * cache (or in each thread's share of the last level cache).
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "tiled.h"
+#include "fft_size.h"
+#include "spectral_multiply.h"
+#include "timing.h"
+
+#define DEFAULT_L2_BYTES (1024 * 1024)        //used if the cache size can't be detected
+#define DEFAULT_LLC_BYTES (8 * 1024 * 1024)
+#define MIN_TILE_EFFICIENCY 2                 //a tile must be at least this many times the overlap
+
+bool parse_tile_cache_level(const char *name, tile_cache_level *level){
+    if (strcmp(name, "l2") == 0)
+        *level = TILE_CACHE_L2;
+    else if (strcmp(name, "llc") == 0)
+        *level = TILE_CACHE_LLC;
+    else
+        return false;
+    return true;
+}
+
+const char *tile_cache_level_name(tile_cache_level level){
+    return (level == TILE_CACHE_LLC) ? "llc" : "l2";
+}
+
+static size_t sysfs_cache_size(int wanted_level){
+/* Size of the largest data/unified cache of the given level (0 = the last level) from sysfs, or 0 if unknown */
+    char path[256], type[32];
+    size_t best = 0;
+    int index, level, best_level = 0;
+
+    for (index=0; index<16; index++){
+        FILE *f;
+        unsigned long size;
+        char unit = 'B';
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/level", index);
+        if (!(f = fopen(path, "r")))
+            break;
+        if (fscanf(f, "%d", &level) != 1)
+            level = 0;
+        fclose(f);
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/type", index);
+        if (!(f = fopen(path, "r")))
+            continue;
+        if (fscanf(f, "%31s", type) != 1)
+            type[0] = '\0';
+        fclose(f);
+        if (strcmp(type, "Instruction") == 0)
+            continue;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+        if (!(f = fopen(path, "r")))
+            continue;
+        if (fscanf(f, "%lu%c", &size, &unit) < 1)
+            size = 0;
+        fclose(f);
+        if (unit == 'K')
+            size *= 1024;
+        else if (unit == 'M')
+            size *= 1024 * 1024;
+
+        if ((wanted_level > 0 && level == wanted_level) || (wanted_level == 0 && level >= best_level)){
+            best_level = level;
+            best = size;
+        }
+    }
+
+    return best;
+}
+
+size_t detect_cache_size(tile_cache_level level){
+/* L2 size of one core, or the size of the last level cache */
+    long size = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    if (level == TILE_CACHE_L2)
+        size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    else{
+        size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        if (size <= 0)
+            size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+#endif
+    if (size <= 0)
+        size = (long)sysfs_cache_size(level == TILE_CACHE_L2 ? 2 : 0);
+    if (size <= 0)
+        size = (level == TILE_CACHE_L2) ? DEFAULT_L2_BYTES : DEFAULT_LLC_BYTES;
+    return (size_t)size;
+}
+
+static size_t tile_working_set(int transform){
+/* R, G and B planes of an in-place tile, plus the filter spectrum */
+    size_t plane = (size_t)transform * 2*(transform/2+1) * sizeof(double);
+    size_t filter = (size_t)transform * (transform/2+1) * sizeof(fftw_complex);
+    return 3 * plane + filter;
+}
+
+int min_tile_transform(int filter_size){
+/* Smallest transform size per tile side: below it, the overlap makes up too much of every tile */
+    return MIN_TILE_EFFICIENCY * (filter_size - 1) + 1;
+}
+
+void choose_tile_geometry(int height, int width, int filter_size, int nthreads, tile_cache_level level, int transform, tile_geometry *geometry){
+/* Picks the tile size
+ *
+ * Inputs
+ * ======
+ *   int height, width, filter_size
+ *       Image and filter sizes
+ *
+ *   int nthreads
+ *       Threads sharing the last level cache (for TILE_CACHE_LLC)
+ *
+ *   tile_cache_level level
+ *       Cache a tile's working set should fit in
+ *
+ *   int transform
+ *       If at least min_tile_transform(filter_size), the transform size to use instead of sizing the tiles from
+ *       the cache
+ *
+ * Of the FFT-friendly (2^a 3^b 5^c 7^d) transform sizes whose working set fits the cache, the one with the lowest
+ * model cost per output pixel wins: bigger tiles waste less on the overlap, but cost more per pixel to transform.
+ */
+    int overlap = filter_size - 1;
+    int smallest = min_tile_transform(filter_size);
+    int largest = ((height > width) ? height : width) + overlap; //no point in a tile bigger than the padded image
+    int n;
+
+    geometry->overlap = overlap;
+    geometry->cache_bytes = 0;
+    if (smallest < 8)
+        smallest = 8;
+    if (largest < smallest)
+        largest = smallest;
+
+    if (transform >= min_tile_transform(filter_size))
+        geometry->transform = transform;
+    else{
+        size_t budget = detect_cache_size(level);
+        if (level == TILE_CACHE_LLC)
+            budget /= nthreads;
+        geometry->cache_bytes = budget;
+
+        double best_cost = -1.0;
+        geometry->transform = 0;
+        for (n=smallest; n<=largest; n++){
+            if (!is_smooth_size(n) || tile_working_set(n) > budget)
+                continue;
+            double tile = n - overlap;
+            double cost = fft_cost_model(n, n) / (tile * tile);
+            if (best_cost < 0.0 || cost < best_cost){
+                best_cost = cost;
+                geometry->transform = n;
+            }
+        }
+
+        // Nothing fits (tiny cache or huge filter): use the smallest sensible tile anyway
+        if (geometry->transform == 0){
+            n = smallest;
+            while (!is_smooth_size(n))
+                n++;
+            geometry->transform = n;
+        }
+    }
+
+    geometry->tile = geometry->transform - overlap;
+    geometry->tiles_y = (height + geometry->tile - 1) / geometry->tile;
+    geometry->tiles_x = (width + geometry->tile - 1) / geometry->tile;
+    geometry->working_set_bytes = tile_working_set(geometry->transform);
+}
+
+bool tiled_engine_init(tiled_engine *engine, plan_cache *plans, kernel_cache *kernels, int height, int width, double sigma, int filter_size, bool analytic_filter, const tile_geometry *geometry, int nthreads, unsigned flags, simd_level simd){
+/* Creates the tile plans, the filter spectrum and one tile buffer per thread
+ *
+ * The plans are single-threaded (the threads work on different tiles instead), and come from the plan cache like
+ * every other plan. FFTW's execute functions are thread-safe, so all threads share them.
+ */
+    int n = geometry->transform;
+    int dims[2] = {n, n};
+    size_t plane = (size_t)n * 2*(n/2+1);
+    int t;
+
+    memset(engine, 0, sizeof(tiled_engine));
+    engine->geometry = *geometry;
+    engine->height = height;
+    engine->width = width;
+    engine->nthreads = nthreads;
+    engine->simd = simd;
+    engine->buffer_bytes = 3 * plane * sizeof(double);
+
+    engine->buffers = calloc(nthreads, sizeof(double*));
+    if (!engine->buffers)
+        return false;
+    for (t=0; t<nthreads; t++){
+        engine->buffers[t] = (double*)fftw_malloc(engine->buffer_bytes);
+        if (!engine->buffers[t]){
+            tiled_engine_destroy(engine);
+            return false;
+        }
+    }
+
+    double *buffer = engine->buffers[0];
+    engine->forward = plan_cache_r2c(plans, 2, dims, 3, buffer, 1, (int)plane, (fftw_complex*)buffer, 1, (int)(plane/2), 1, flags);
+    engine->backward = plan_cache_c2r(plans, 2, dims, 3, (fftw_complex*)buffer, 1, (int)(plane/2), buffer, 1, (int)plane, 1, flags);
+    engine->filter = kernel_cache_gaussian(kernels, plans, n, n, sigma, filter_size, analytic_filter, nthreads, flags);
+
+    return engine->forward && engine->backward && engine->filter;
+}
+
+void tiled_blur(tiled_engine *engine, double **in, double **out){
+/* Blurs an image's R, G and B channels (in[c] -> out[c], height x width each, on the same scale as the input) */
+    const tile_geometry *g = &engine->geometry;
+    int n = g->transform;
+    size_t row_width = 2*(n/2+1);
+    size_t plane = (size_t)n * row_width;
+    double scale = 1.0 / ((double)n * n); //undo FFTW's scaling
+    int num_tiles = g->tiles_y * g->tiles_x;
+    int tile;
+
+    double *copy_time = calloc(engine->nthreads, sizeof(double));
+    double *fft_time = calloc(engine->nthreads, sizeof(double));
+    double *multiply_time = calloc(engine->nthreads, sizeof(double));
+    double *ifft_time = calloc(engine->nthreads, sizeof(double));
+
+#pragma omp parallel for num_threads(engine->nthreads) schedule(dynamic)
+    for (tile=0; tile<num_tiles; tile++){
+#ifdef _OPENMP
+        int thread = omp_get_thread_num();
+#else
+        int thread = 0;
+#endif
+        double *buffer = engine->buffers[thread];
+        fftw_complex *spectrum = (fftw_complex*)buffer;
+        fftw_complex *planes[3] = {spectrum, spectrum + plane/2, spectrum + plane};
+        uint64_t start, stop;
+        int c, u;
+
+        // The tile's output starts at (y0, x0); its input starts filter_size - 1 pixels earlier in both directions
+        int y0 = (tile / g->tiles_x) * g->tile;
+        int x0 = (tile % g->tiles_x) * g->tile;
+        int in_y0 = y0 - g->overlap, in_x0 = x0 - g->overlap;
+
+        // Copy the tile plus its overlap, zero outside the image
+        start = timing_now(); //start clock
+        int first_x = (in_x0 < 0) ? -in_x0 : 0;
+        int last_x = (in_x0 + n > engine->width) ? engine->width - in_x0 : n;
+        for (c=0; c<3; c++){
+            for (u=0; u<n; u++){
+                double *row = buffer + c*plane + u*row_width;
+                int y = in_y0 + u;
+                if (y < 0 || y >= engine->height || last_x <= first_x){
+                    memset(row, 0, n * sizeof(double));
+                    continue;
+                }
+                memset(row, 0, first_x * sizeof(double));
+                memcpy(row + first_x, in[c] + (size_t)y*engine->width + in_x0 + first_x, (last_x - first_x) * sizeof(double));
+                memset(row + last_x, 0, (n - last_x) * sizeof(double));
+            }
+        }
+        stop = timing_now(); //stop clock
+        copy_time[thread] += timing_elapsed(start, stop);
+
+        // Forward DFT, blur, backward DFT
+        start = timing_now(); //start clock
+        fftw_execute_dft_r2c(engine->forward, buffer, spectrum);
+        stop = timing_now(); //stop clock
+        fft_time[thread] += timing_elapsed(start, stop);
+
+        start = timing_now(); //start clock
+        spectral_multiply(engine->simd, engine->filter, n, n/2+1, planes, planes, 3, 1, 1);
+        stop = timing_now(); //stop clock
+        multiply_time[thread] += timing_elapsed(start, stop);
+
+        start = timing_now(); //start clock
+        fftw_execute_dft_c2r(engine->backward, spectrum, buffer);
+        stop = timing_now(); //stop clock
+        ifft_time[thread] += timing_elapsed(start, stop);
+
+        // Keep the part of the result that didn't wrap around
+        start = timing_now(); //start clock
+        int rows = (y0 + g->tile > engine->height) ? engine->height - y0 : g->tile;
+        int cols = (x0 + g->tile > engine->width) ? engine->width - x0 : g->tile;
+        for (c=0; c<3; c++){
+            for (u=0; u<rows; u++){
+                const double *result = buffer + c*plane + (u + g->overlap)*row_width + g->overlap;
+                double *dest = out[c] + (size_t)(y0 + u)*engine->width + x0;
+                int v;
+                for (v=0; v<cols; v++)
+                    dest[v] = result[v] * scale;
+            }
+        }
+        stop = timing_now(); //stop clock
+        copy_time[thread] += timing_elapsed(start, stop);
+    }
+
+    int t;
+    for (t=0; t<engine->nthreads; t++){
+        engine->copy_time += copy_time[t];
+        engine->fft_time += fft_time[t];
+        engine->multiply_time += multiply_time[t];
+        engine->ifft_time += ifft_time[t];
+    }
+    engine->tiles += num_tiles;
+
+    free(copy_time);
+    free(fft_time);
+    free(multiply_time);
+    free(ifft_time);
+}
+
+void tiled_engine_destroy(tiled_engine *engine){
+/* Frees the tile buffers (the plans and the filter spectrum belong to the caches) */
+    int t;
+    if (engine->buffers){
+        for (t=0; t<engine->nthreads; t++)
+            fftw_free(engine->buffers[t]);
+        free(engine->buffers);
+        engine->buffers = NULL;
+    }
+}
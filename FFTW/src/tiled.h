@@ -0,0 +1,52 @@
+/* Tiled (overlap-save) blur: convolves cache-sized tiles with small FFTs, spread across threads */
+#ifndef TILED_H
+#define TILED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <fftw3.h>
+#include "plan_cache.h"
+#include "kernel_cache.h"
+#include "simd.h"
+
+typedef enum {
+    TILE_CACHE_L2,  //size tiles so that one tile's working set fits in a core's L2
+    TILE_CACHE_LLC  //size tiles so that every thread's working set fits in the last level cache together
+} tile_cache_level;
+
+typedef struct {
+    int transform;            //transform size per side (FFT-friendly)
+    int tile;                 //output pixels per tile side (transform - (filter_size - 1))
+    int overlap;              //filter_size - 1 pixels of input shared with the neighbouring tiles
+    int tiles_y, tiles_x;
+    size_t cache_bytes;       //cache budget per thread the tile was sized for (0 if the size was given)
+    size_t working_set_bytes; //tile buffers + filter spectrum touched per tile
+} tile_geometry;
+
+typedef struct {
+    tile_geometry geometry;
+    int height, width;
+    int nthreads;
+    simd_level simd;
+    fftw_complex *filter;     //transform x (transform/2+1) filter spectrum (owned by the kernel cache)
+    fftw_plan forward, backward;
+    double **buffers;         //one in-place tile buffer (R, G and B planes) per thread
+    size_t buffer_bytes;
+
+    // Seconds per phase, summed over all threads and images
+    double copy_time, fft_time, multiply_time, ifft_time;
+    unsigned long tiles;      //tiles transformed
+} tiled_engine;
+
+bool parse_tile_cache_level(const char *name, tile_cache_level *level);
+const char *tile_cache_level_name(tile_cache_level level);
+size_t detect_cache_size(tile_cache_level level);
+
+int min_tile_transform(int filter_size);
+void choose_tile_geometry(int height, int width, int filter_size, int nthreads, tile_cache_level level, int transform, tile_geometry *geometry);
+
+bool tiled_engine_init(tiled_engine *engine, plan_cache *plans, kernel_cache *kernels, int height, int width, double sigma, int filter_size, bool analytic_filter, const tile_geometry *geometry, int nthreads, unsigned flags, simd_level simd);
+void tiled_blur(tiled_engine *engine, double **in, double **out);
+void tiled_engine_destroy(tiled_engine *engine);
+
+#endif
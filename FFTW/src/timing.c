@@ -0,0 +1,213 @@
+/* Timing for the benchmarks
+ *
+ * gettimeofday() has microsecond resolution and follows the wall clock, which NTP may slew or step in the middle of a
+ * run. Timestamps here come from CLOCK_MONOTONIC_RAW (nanoseconds, never adjusted) or, if asked for, straight from
+ * the TSC, which is cheaper to read and is converted to seconds with a frequency calibrated against
+ * CLOCK_MONOTONIC_RAW at startup.
+ *
+ * Averages hide the jitter that matters for tail latency (e.g. FFTW's threads waking up late), so every iteration of
+ * a phase is recorded into a latency histogram. The histogram is HDR-style: values below 128 ns get a bucket each,
+ * and above that every power of two is split into 64 linear sub-buckets, so any value is known to within 1/64
+ * (~1.6%) over the whole range from nanoseconds to hours, with a fixed ~30 KB of counts. The first 'warmup'
+ * iterations (planning, cold caches, page faults) are left out.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#include "timing.h"
+
+#define LINEAR_BUCKETS 128    //values below this (in ns) have a bucket each
+#define SUB_BUCKET_BITS 6     //64 sub-buckets per power of two above that
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define NUM_BUCKETS (LINEAR_BUCKETS + (64 - SUB_BUCKET_BITS) * SUB_BUCKETS)
+#define TSC_CALIBRATION_NS 20000000 //calibrate the TSC over 20 ms
+
+static clock_source source_in_use = CLOCK_SOURCE_MONOTONIC_RAW;
+static double seconds_per_tick = 1.0e-9;
+
+bool parse_clock_source(const char *name, clock_source *source){
+    if (strcmp(name, "monotonic") == 0)
+        *source = CLOCK_SOURCE_MONOTONIC_RAW;
+    else if (strcmp(name, "tsc") == 0)
+        *source = CLOCK_SOURCE_TSC;
+    else
+        return false;
+    return true;
+}
+
+const char *clock_source_name(clock_source source){
+    return (source == CLOCK_SOURCE_TSC) ? "tsc" : "monotonic_raw";
+}
+
+static uint64_t monotonic_ns(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static bool invariant_tsc(void){
+/* The TSC only measures time if it ticks at a constant rate through frequency and power state changes */
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000007)
+        return false;
+    __cpuid(0x80000007, eax, ebx, ecx, edx);
+    return (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+clock_source timing_init(clock_source source){
+/* Picks the clock for timing_now(), and returns the one actually used (the TSC falls back on CLOCK_MONOTONIC_RAW
+ * if it isn't invariant) */
+    source_in_use = CLOCK_SOURCE_MONOTONIC_RAW;
+    seconds_per_tick = 1.0e-9;
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (source == CLOCK_SOURCE_TSC && invariant_tsc()){
+        uint64_t ns_start = monotonic_ns();
+        uint64_t tsc_start = __rdtsc();
+        uint64_t ns_stop;
+        do
+            ns_stop = monotonic_ns();
+        while (ns_stop - ns_start < TSC_CALIBRATION_NS);
+        uint64_t tsc_stop = __rdtsc();
+
+        seconds_per_tick = (ns_stop - ns_start) * 1.0e-9 / (double)(tsc_stop - tsc_start);
+        source_in_use = CLOCK_SOURCE_TSC;
+    }
+#endif
+    if (source == CLOCK_SOURCE_TSC && source_in_use != CLOCK_SOURCE_TSC)
+        printf("  WARNING: No invariant TSC on this CPU, timing with CLOCK_MONOTONIC_RAW instead.\n");
+
+    return source_in_use;
+}
+
+uint64_t timing_now(void){
+#if defined(__x86_64__) || defined(__i386__)
+    if (source_in_use == CLOCK_SOURCE_TSC)
+        return __rdtsc();
+#endif
+    return monotonic_ns();
+}
+
+double timing_elapsed(uint64_t start, uint64_t stop){
+/* Seconds between two timing_now() timestamps */
+    return (double)(stop - start) * seconds_per_tick;
+}
+
+/*
+ * Latency histogram
+ */
+
+static int bucket_index(uint64_t ns){
+    if (ns < LINEAR_BUCKETS)
+        return (int)ns;
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - SUB_BUCKET_BITS; //ns >> shift is in [SUB_BUCKETS, 2 * SUB_BUCKETS)
+    return LINEAR_BUCKETS + (shift - 1) * SUB_BUCKETS + (int)((ns >> shift) - SUB_BUCKETS);
+}
+
+static double bucket_midpoint(int index){
+/* Middle of the range of nanoseconds that falls into a bucket */
+    if (index < LINEAR_BUCKETS)
+        return (double)index;
+    int shift = (index - LINEAR_BUCKETS) / SUB_BUCKETS + 1;
+    int sub_bucket = (index - LINEAR_BUCKETS) % SUB_BUCKETS + SUB_BUCKETS;
+    return ((double)sub_bucket + 0.5) * (double)(1ull << shift);
+}
+
+bool latency_histogram_init(latency_histogram *histogram, int warmup){
+    memset(histogram, 0, sizeof(latency_histogram));
+    histogram->num_buckets = NUM_BUCKETS;
+    histogram->warmup = warmup;
+    histogram->counts = calloc(NUM_BUCKETS, sizeof(uint64_t));
+    return histogram->counts != NULL;
+}
+
+void latency_histogram_destroy(latency_histogram *histogram){
+    free(histogram->counts);
+    histogram->counts = NULL;
+}
+
+void latency_histogram_record(latency_histogram *histogram, double seconds){
+/* Adds one iteration's time (the first 'warmup' calls are only counted) */
+    if (histogram->skipped < (unsigned long)histogram->warmup){
+        histogram->skipped++;
+        return;
+    }
+
+    uint64_t ns = (seconds > 0.0) ? (uint64_t)(seconds * 1.0e9 + 0.5) : 0;
+    histogram->counts[bucket_index(ns)]++;
+    if (histogram->count == 0 || ns < histogram->min_ns)
+        histogram->min_ns = ns;
+    if (histogram->count == 0 || ns > histogram->max_ns)
+        histogram->max_ns = ns;
+    histogram->count++;
+    histogram->sum += seconds;
+    histogram->sum_squares += seconds * seconds;
+}
+
+double latency_histogram_percentile(const latency_histogram *histogram, double percentile){
+/* Time (in seconds) that 'percentile' percent of the recorded iterations took at most */
+    if (histogram->count == 0)
+        return 0.0;
+
+    uint64_t rank = (uint64_t)ceil(percentile / 100.0 * histogram->count);
+    uint64_t seen = 0;
+    int i;
+    if (rank < 1)
+        rank = 1;
+    for (i=0; i<histogram->num_buckets; i++){
+        seen += histogram->counts[i];
+        if (seen >= rank)
+            break;
+    }
+
+    // The exact extremes are known, so don't report a bucket midpoint beyond them
+    double ns = bucket_midpoint(i);
+    if (ns < histogram->min_ns)
+        ns = histogram->min_ns;
+    if (ns > histogram->max_ns)
+        ns = histogram->max_ns;
+    return ns * 1.0e-9;
+}
+
+void latency_histogram_summarize(const latency_histogram *histogram, latency_summary *summary){
+    memset(summary, 0, sizeof(latency_summary));
+    summary->count = histogram->count;
+    if (histogram->count == 0)
+        return;
+
+    summary->min = histogram->min_ns * 1.0e-9;
+    summary->max = histogram->max_ns * 1.0e-9;
+    summary->p50 = latency_histogram_percentile(histogram, 50.0);
+    summary->p90 = latency_histogram_percentile(histogram, 90.0);
+    summary->p99 = latency_histogram_percentile(histogram, 99.0);
+    summary->p999 = latency_histogram_percentile(histogram, 99.9);
+    summary->mean = histogram->sum / histogram->count;
+    double variance = histogram->sum_squares / histogram->count - summary->mean * summary->mean;
+    summary->stddev = (variance > 0.0) ? sqrt(variance) : 0.0;
+}
+
+void latency_summary_json(FILE *f, const char *indent, const char *name, const latency_summary *summary, bool last){
+/* Writes '"name": {...}' on one line, in seconds */
+    fprintf(f, "%s\"%s\": {\"count\": %lu, \"min_seconds\": %0.9f, \"p50_seconds\": %0.9f, \"p90_seconds\": %0.9f, \"p99_seconds\": %0.9f, \"p999_seconds\": %0.9f, \"max_seconds\": %0.9f, \"mean_seconds\": %0.9f, \"stddev_seconds\": %0.9f}%s\n", indent, name, summary->count, summary->min, summary->p50, summary->p90, summary->p99, summary->p999, summary->max, summary->mean, summary->stddev, last ? "" : ",");
+}
+
+void latency_summary_print(const char *name, const latency_summary *summary){
+/* One line, in milliseconds */
+    if (summary->count == 0){
+        printf("    %-9s no iterations recorded\n", name);
+        return;
+    }
+    printf("    %-9s min %0.3f  p50 %0.3f  p90 %0.3f  p99 %0.3f  p99.9 %0.3f  max %0.3f  sd %0.3f ms\n", name, 1e3 * summary->min, 1e3 * summary->p50, 1e3 * summary->p90, 1e3 * summary->p99, 1e3 * summary->p999, 1e3 * summary->max, 1e3 * summary->stddev);
+}
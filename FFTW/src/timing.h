@@ -0,0 +1,46 @@
+/* High-resolution timing and per-iteration latency histograms (min, percentiles, max, stddev) */
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    CLOCK_SOURCE_MONOTONIC_RAW, //clock_gettime(CLOCK_MONOTONIC_RAW): nanoseconds, not slewed by NTP
+    CLOCK_SOURCE_TSC            //rdtsc, calibrated against CLOCK_MONOTONIC_RAW (needs an invariant TSC)
+} clock_source;
+
+typedef struct {
+    uint64_t *counts;         //log-linear buckets of nanoseconds
+    int num_buckets;
+    int warmup;               //iterations to leave out before recording
+    unsigned long skipped;    //warm-up iterations seen so far
+    unsigned long count;      //iterations recorded
+    uint64_t min_ns, max_ns;
+    double sum, sum_squares;  //seconds, for the mean and standard deviation
+} latency_histogram;
+
+typedef struct {
+    unsigned long count;
+    double min, p50, p90, p99, p999, max; //seconds
+    double mean, stddev;
+} latency_summary;
+
+bool parse_clock_source(const char *name, clock_source *source);
+const char *clock_source_name(clock_source source);
+
+clock_source timing_init(clock_source source);
+uint64_t timing_now(void);
+double timing_elapsed(uint64_t start, uint64_t stop);
+
+bool latency_histogram_init(latency_histogram *histogram, int warmup);
+void latency_histogram_destroy(latency_histogram *histogram);
+void latency_histogram_record(latency_histogram *histogram, double seconds);
+double latency_histogram_percentile(const latency_histogram *histogram, double percentile);
+void latency_histogram_summarize(const latency_histogram *histogram, latency_summary *summary);
+
+void latency_summary_json(FILE *f, const char *indent, const char *name, const latency_summary *summary, bool last);
+void latency_summary_print(const char *name, const latency_summary *summary);
+
+#endif
@@ -0,0 +1,235 @@
+/* Persistent FFTW wisdom store
+ *
+ * Wisdom is only valid for the machine (and the FFTW build) that produced it, so every wisdom file is keyed by the
+ * CPU model, the ISA extensions the CPU supports, the FFTW version and the FFTW build flags. The key is hashed into
+ * the file name, which lets several hosts (or containers built with different flags) share one wisdom directory.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fftw3.h>
+#include "wisdom.h"
+
+// Configure flags FFTW was built with. compile_benchmark_code.sh passes these in from $FFTW_BUILD_FLAGS
+#ifndef FFTW_BUILD_FLAGS
+#define FFTW_BUILD_FLAGS "unknown"
+#endif
+
+#define DEFAULT_WISDOM_DIR "wisdom"
+
+static double elapsed_seconds(struct timeval *start, struct timeval *stop){
+    return (stop->tv_sec - start->tv_sec) + (stop->tv_usec - start->tv_usec) * (1.0e-6);
+}
+
+bool parse_plan_effort(const char *effort, unsigned *flags){
+/* Converts a plan effort name into FFTW planner flags
+ *
+ * Inputs
+ * ======
+ *   const char *effort
+ *       One of "estimate", "measure", "patient" or "exhaustive"
+ *
+ *   unsigned *flags
+ *       Set to the matching FFTW_* planner flag
+ *
+ * Returns false if the name is not recognized
+ */
+    if (strcmp(effort, "estimate") == 0)
+        *flags = FFTW_ESTIMATE;
+    else if (strcmp(effort, "measure") == 0)
+        *flags = FFTW_MEASURE;
+    else if (strcmp(effort, "patient") == 0)
+        *flags = FFTW_PATIENT;
+    else if (strcmp(effort, "exhaustive") == 0)
+        *flags = FFTW_EXHAUSTIVE;
+    else
+        return false;
+
+    return true;
+}
+
+const char *plan_effort_name(unsigned flags){
+    if (flags & FFTW_ESTIMATE)
+        return "estimate";
+    if (flags & FFTW_EXHAUSTIVE)
+        return "exhaustive";
+    if (flags & FFTW_PATIENT)
+        return "patient";
+    return "measure";
+}
+
+void get_cpu_model(char *model, size_t size){
+/* Reads the CPU model name from /proc/cpuinfo (or "unknown" if it can't be found) */
+    snprintf(model, size, "unknown");
+
+    FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+    if (!cpuinfo)
+        return;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), cpuinfo)){
+        if (strncmp(line, "model name", 10) == 0){
+            char *value = strchr(line, ':');
+            if (value){
+                value++;
+                while (*value == ' ' || *value == '\t')
+                    value++;
+                value[strcspn(value, "\n")] = '\0';
+                snprintf(model, size, "%s", value);
+            }
+            break;
+        }
+    }
+    fclose(cpuinfo);
+}
+
+void get_isa_flags(char *isa, size_t size){
+/* Lists the SIMD extensions FFTW can make use of on this CPU */
+    isa[0] = '\0';
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        strncat(isa, "sse2 ", size - strlen(isa) - 1);
+    if (__builtin_cpu_supports("avx"))
+        strncat(isa, "avx ", size - strlen(isa) - 1);
+    if (__builtin_cpu_supports("avx2"))
+        strncat(isa, "avx2 ", size - strlen(isa) - 1);
+    if (__builtin_cpu_supports("fma"))
+        strncat(isa, "fma ", size - strlen(isa) - 1);
+    if (__builtin_cpu_supports("avx512f"))
+        strncat(isa, "avx512f ", size - strlen(isa) - 1);
+#endif
+    if (isa[0] == '\0')
+        snprintf(isa, size, "generic");
+    else
+        isa[strlen(isa) - 1] = '\0'; //drop the trailing space
+}
+
+static uint64_t fnv1a_hash(const char *str){
+    uint64_t hash = 14695981039346656037ULL;
+    while (*str){
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool make_directory(const char *directory){
+/* Creates a directory and any missing parents (i.e., "mkdir -p") */
+    char path[WISDOM_PATH_SIZE];
+    char *p;
+
+    snprintf(path, sizeof(path), "%s", directory);
+    for (p = path + 1; *p; p++){
+        if (*p == '/'){
+            *p = '\0';
+            if (mkdir(path, 0755) != 0 && errno != EEXIST)
+                return false;
+            *p = '/';
+        }
+    }
+    if (mkdir(path, 0755) != 0 && errno != EEXIST)
+        return false;
+
+    return true;
+}
+
+void wisdom_init(wisdom_store *store, const char *directory){
+/* Works out which wisdom file belongs to this host and FFTW build
+ *
+ * Inputs
+ * ======
+ *   wisdom_store *store
+ *       The store to initialize
+ *
+ *   const char *directory
+ *       Directory that holds the wisdom files. If NULL, $FFTW_WISDOM_DIR is used, and if that isn't set either,
+ *       "./wisdom" is used
+ */
+    char cpu_model[256], isa[128];
+
+    if (directory == NULL)
+        directory = getenv("FFTW_WISDOM_DIR");
+    if (directory == NULL || directory[0] == '\0')
+        directory = DEFAULT_WISDOM_DIR;
+
+    get_cpu_model(cpu_model, sizeof(cpu_model));
+    get_isa_flags(isa, sizeof(isa));
+    snprintf(store->key, sizeof(store->key), "cpu=%s; isa=%s; fftw=%s; build_flags=%s", cpu_model, isa, fftw_version, FFTW_BUILD_FLAGS);
+    snprintf(store->path, sizeof(store->path), "%s/fftw_wisdom_%016llx.dat", directory, (unsigned long long)fnv1a_hash(store->key));
+
+    store->enabled = true;
+    store->imported = false;
+    store->import_time = 0.0;
+    store->export_time = 0.0;
+}
+
+bool wisdom_load(wisdom_store *store){
+/* Imports this host's wisdom, if there is any. Call this after fftw_init_threads() and before creating any plans */
+    struct timeval import_start, import_stop;
+
+    if (!store->enabled || access(store->path, R_OK) != 0)
+        return false;
+
+    gettimeofday(&import_start, NULL); //start clock
+    store->imported = (fftw_import_wisdom_from_filename(store->path) != 0);
+    gettimeofday(&import_stop, NULL); //stop clock
+    store->import_time = elapsed_seconds(&import_start, &import_stop);
+
+    if (!store->imported)
+        printf("  WARNING: Could not import FFTW wisdom from %s. Plans will be created from scratch.\n", store->path);
+
+    return store->imported;
+}
+
+bool wisdom_save(wisdom_store *store){
+/* Exports all of the wisdom accumulated so far (imported + newly planned)
+ *
+ * The wisdom is written to a temporary file first and then renamed, so concurrent runs sharing a wisdom directory
+ * never see a half-written file.
+ */
+    struct timeval export_start, export_stop;
+    char tmp_path[WISDOM_PATH_SIZE + 32];
+    char key_path[WISDOM_PATH_SIZE + 32];
+
+    if (!store->enabled)
+        return false;
+
+    // Make sure the wisdom directory exists
+    char directory[WISDOM_PATH_SIZE];
+    snprintf(directory, sizeof(directory), "%s", store->path);
+    char *slash = strrchr(directory, '/');
+    if (slash){
+        *slash = '\0';
+        if (!make_directory(directory)){
+            printf("  WARNING: Could not create wisdom directory %s. Wisdom will not be saved.\n", directory);
+            return false;
+        }
+    }
+
+    gettimeofday(&export_start, NULL); //start clock
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", store->path, (int)getpid());
+    if (!fftw_export_wisdom_to_filename(tmp_path) || rename(tmp_path, store->path) != 0){
+        printf("  WARNING: Could not export FFTW wisdom to %s.\n", store->path);
+        unlink(tmp_path);
+        return false;
+    }
+    gettimeofday(&export_stop, NULL); //stop clock
+    store->export_time = elapsed_seconds(&export_start, &export_stop);
+
+    // Save the key next to the wisdom so that people can tell which host/build a file belongs to
+    snprintf(key_path, sizeof(key_path), "%.*s.key", (int)(strlen(store->path) - 4), store->path);
+    FILE *key_file = fopen(key_path, "w");
+    if (key_file){
+        fprintf(key_file, "%s\n", store->key);
+        fclose(key_file);
+    }
+
+    return true;
+}
@@ -0,0 +1,30 @@
+/* Persistent FFTW wisdom, keyed by host CPU and FFTW build so that it can be shared across runs and containers */
+#ifndef WISDOM_H
+#define WISDOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WISDOM_PATH_SIZE 4096
+#define WISDOM_KEY_SIZE 1024
+
+typedef struct {
+    bool enabled;
+    char path[WISDOM_PATH_SIZE]; //wisdom file for this host + FFTW build
+    char key[WISDOM_KEY_SIZE];   //human-readable description of what the file is keyed by
+    bool imported;               //true if wisdom was found and imported at startup
+    double import_time;          //seconds spent importing
+    double export_time;          //seconds spent exporting
+} wisdom_store;
+
+bool parse_plan_effort(const char *effort, unsigned *flags);
+const char *plan_effort_name(unsigned flags);
+
+void get_cpu_model(char *model, size_t size);
+void get_isa_flags(char *isa, size_t size);
+
+void wisdom_init(wisdom_store *store, const char *directory);
+bool wisdom_load(wisdom_store *store);
+bool wisdom_save(wisdom_store *store);
+
+#endif
@@ -0,0 +1,117 @@
+/* Worker pool
+ *
+ * A fixed number of threads pull tasks from a FIFO queue. Tasks are owned by the caller (no allocation per task),
+ * and worker_pool_wait() blocks until a given task has finished, which is all the double-buffered staging in
+ * 2d_fft needs: submit the next image's staging, run the transforms, then wait for the staging before swapping.
+ */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <sys/time.h>
+#include "worker_pool.h"
+
+static void *worker_main(void *arg){
+    worker_pool *pool = (worker_pool*)arg;
+    struct timeval start, stop;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;){
+        while (!pool->head && !pool->shutdown)
+            pthread_cond_wait(&pool->task_ready, &pool->lock);
+        if (!pool->head)
+            break; //shut down, and nothing left to run
+
+        worker_task *task = pool->head;
+        pool->head = task->next;
+        if (!pool->head)
+            pool->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        gettimeofday(&start, NULL); //start clock
+        task->fn(task->arg);
+        gettimeofday(&stop, NULL); //stop clock
+
+        pthread_mutex_lock(&pool->lock);
+        pool->busy_time += (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) * (1.0e-6);
+        task->done = true;
+        pthread_cond_broadcast(&pool->task_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+bool worker_pool_init(worker_pool *pool, int nthreads){
+/* Starts 'nthreads' workers. Returns false if no worker could be started */
+    int i;
+
+    pool->threads = malloc(nthreads * sizeof(pthread_t));
+    pool->nthreads = 0;
+    pool->head = pool->tail = NULL;
+    pool->shutdown = false;
+    pool->busy_time = 0.0;
+    if (!pool->threads)
+        return false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->task_ready, NULL);
+    pthread_cond_init(&pool->task_done, NULL);
+
+    for (i=0; i<nthreads; i++){
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0)
+            break;
+        pool->nthreads++;
+    }
+    if (pool->nthreads == 0){
+        worker_pool_destroy(pool);
+        return false;
+    }
+
+    return true;
+}
+
+void worker_pool_destroy(worker_pool *pool){
+/* Runs whatever is still queued, then stops the workers */
+    int i;
+
+    if (!pool->threads)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i=0; i<pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->task_ready);
+    pthread_cond_destroy(&pool->task_done);
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->nthreads = 0;
+}
+
+void worker_pool_submit(worker_pool *pool, worker_task *task, worker_task_fn fn, void *arg){
+/* Queues fn(arg) to run on the next free worker */
+    task->fn = fn;
+    task->arg = arg;
+    task->done = false;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail)
+        pool->tail->next = task;
+    else
+        pool->head = task;
+    pool->tail = task;
+    pthread_cond_signal(&pool->task_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void worker_pool_wait(worker_pool *pool, worker_task *task){
+/* Blocks until 'task' has finished */
+    pthread_mutex_lock(&pool->lock);
+    while (!task->done)
+        pthread_cond_wait(&pool->task_done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,34 @@
+/* Small pool of worker threads that run submitted tasks in the background */
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+typedef void (*worker_task_fn)(void *arg);
+
+typedef struct worker_task {
+    worker_task_fn fn;
+    void *arg;
+    bool done;
+    struct worker_task *next;
+} worker_task; //owned by the caller, must stay alive until worker_pool_wait() returns
+
+typedef struct {
+    pthread_t *threads;
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t task_ready;
+    pthread_cond_t task_done;
+    worker_task *head, *tail; //queued tasks
+    bool shutdown;
+    double busy_time;         //seconds spent running tasks, summed over the workers
+} worker_pool;
+
+bool worker_pool_init(worker_pool *pool, int nthreads);
+void worker_pool_destroy(worker_pool *pool);
+
+void worker_pool_submit(worker_pool *pool, worker_task *task, worker_task_fn fn, void *arg);
+void worker_pool_wait(worker_pool *pool, worker_task *task);
+
+#endif